@@ -0,0 +1,122 @@
+/**
+ * @file      bench_large.c
+ * @brief     Large input benchmark of multiple key-value replacement.
+ * @author    MMaster <mmaster@bitbix.com>
+ * @version   0.1
+ * @date      2013
+ * @copyright Apache License v2
+ *
+ * Runs the search over inputs larger than 4 GB with more than 2^31 matches
+ * (3 matches per 8 bytes, so anything above 5.4 GiB) to validate 64-bit
+ * counts and measure throughput.
+ *
+ * Compile with:
+ *    $ gcc -O2 -o bench_large bench_large.c str_multireplace.c
+ *
+ * Run with:
+ *    $ ./bench_large [size in GiB (default 6)] [full]
+ *
+ * "full" also runs str_multireplace64(), which needs about 8 times the input
+ * size of additional memory for matched pairs and result.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "str_multireplace.h"
+
+/**
+ * @brief Sink counting result length only
+ */
+static int
+count_sink (void *ctx, const char *ptr, size_t len)
+{
+    (void)ptr;
+
+    *(size_t *)ctx += len;
+    return 0;
+}
+
+static double
+now (void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+check (const char *what, int64_t rc, int64_t expected_rc,
+       size_t len, size_t expected_len, double secs, size_t str_len)
+{
+    printf("%-20s %12lld matches %8.2f s %8.2f GiB/s\n", what, (long long)rc,
+           secs, str_len / secs / (1024.0 * 1024.0 * 1024.0));
+
+    if ((rc != expected_rc) || (len != expected_len)) {
+        printf("  FAILED: expected %lld matches and %zu bytes, got %zu bytes\n",
+               (long long)expected_rc, expected_len, len);
+        return 1;
+    }
+
+    return 0;
+}
+
+int
+main (int argc, char *argv[])
+{
+    str_mr_match_pair mps[] = {
+        {"a", 1, "xy", 2}, {"abab", 4, "Q", 1},
+    };
+    size_t mp_cnt  = sizeof(mps) / sizeof(str_mr_match_pair);
+    double gib     = (argc > 1 ? strtod(argv[1], NULL) : 6.0);
+    bool   full    = (argc > 2 && strcmp(argv[2], "full") == 0);
+    size_t str_len = (size_t)(gib * 1024 * 1024 * 1024) & ~(size_t)7;
+    char  *str     = NULL;
+    char  *result  = NULL;
+    size_t result_len = 0;
+    size_t counts[2];
+    size_t i = 0;
+    int64_t rc = 0;
+    int64_t expected_rc = 0;
+    int failed = 0;
+    double t = 0;
+
+    str = (char *)malloc(str_len);
+    if (str == NULL) {
+        printf("cannot allocate %zu bytes\n", str_len);
+        return 1;
+    }
+
+    /* "ababacac" repeated: one "abab" and two "a" matches per 8 bytes */
+    for (i = 0; i < str_len; i += 8) {
+        memcpy(str + i, "ababacac", 8);
+    }
+
+    expected_rc = (str_len / 8) * 3;
+    printf("input: %zu bytes, expecting %lld matches\n", str_len,
+           (long long)expected_rc);
+
+    t  = now();
+    rc = str_mr_count(str, str_len, mps, mp_cnt, false, counts);
+    failed |= check("str_mr_count", rc, expected_rc,
+                    counts[0] + counts[1], expected_rc, now() - t, str_len);
+
+    result_len = 0;
+    t  = now();
+    rc = str_multireplace_sink(str, str_len, mps, mp_cnt,
+                               count_sink, &result_len);
+    failed |= check("str_multireplace_sink", rc, expected_rc, result_len,
+                    (str_len / 8) * 7, now() - t, str_len);
+
+    if (full) {
+        t  = now();
+        rc = str_multireplace64(str, str_len, mps, mp_cnt,
+                                &result, &result_len, false);
+        failed |= check("str_multireplace64", rc, expected_rc, result_len,
+                        (str_len / 8) * 7, now() - t, str_len);
+        free(result);
+    }
+
+    free(str);
+    return failed;
+}
@@ -0,0 +1,219 @@
+/**
+ * @file      bench_set.c
+ * @brief     Benchmark of incremental changes of compiled set.
+ * @author    MMaster <mmaster@bitbix.com>
+ * @version   0.1
+ * @date      2013
+ * @copyright Apache License v2
+ *
+ * Compares compiling the whole set with adding and removing single keys by
+ * str_mr_set_add() and str_mr_set_remove() (including rebuilds triggered by
+ * removals) and checks the modified set gives the same result as compiling
+ * the remaining pairs.
+ *
+ * Compile with:
+ *    $ gcc -O2 -o bench_set bench_set.c str_multireplace.c
+ *
+ * Run with:
+ *    $ ./bench_set [number of keys (default 200000)]
+ */
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "str_multireplace.h"
+
+/**
+ * Length of generated keys and values
+ */
+#define KEY_LEN     (12)
+
+static double
+now (void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Generate key number i
+ */
+static void
+gen_key (char *key, size_t i)
+{
+    size_t j = 0;
+
+    for (j = 0; j < KEY_LEN; j++) {
+        key[j] = 'a' + (char)(i % 26);
+        i /= 26;
+    }
+}
+
+/**
+ * @brief Result digest (length and FNV-1a hash)
+ */
+typedef struct digest {
+    size_t   len;
+    uint64_t hash;
+} digest;
+
+/**
+ * @brief Sink computing result digest
+ */
+static int
+digest_sink (void *ctx, const char *ptr, size_t len)
+{
+    digest *d = (digest *)ctx;
+    size_t  i = 0;
+
+    for (i = 0; i < len; i++) {
+        d->hash = (d->hash ^ (unsigned char)ptr[i]) * UINT64_C(0x100000001b3);
+    }
+
+    d->len += len;
+    return 0;
+}
+
+/**
+ * @brief Replace str by set, computing digest of result
+ *
+ * @return number of replacements or negative number on error
+ */
+static int64_t
+run (const str_mr_set *set, const char *str, size_t str_len, digest *d)
+{
+    str_mr_stream *stream = NULL;
+    int64_t rc = 0;
+
+    d->len  = 0;
+    d->hash = UINT64_C(0xcbf29ce484222325);
+
+    rc = str_mr_stream_init(set, digest_sink, d, &stream);
+    if (rc == STR_MR_ERROR_SUCCESS) {
+        rc = str_mr_stream_feed(stream, str, str_len);
+    }
+
+    if (rc >= 0) {
+        rc = str_mr_stream_finish(stream);
+    }
+
+    str_mr_stream_free(stream);
+    return rc;
+}
+
+int
+main (int argc, char *argv[])
+{
+    size_t key_cnt = (argc > 1 ? strtoul(argv[1], NULL, 10) : 200000);
+    str_mr_match_pair *mps = NULL;
+    char  *keys = NULL;
+    char  *str  = NULL;
+    size_t str_len = 0;
+    str_mr_set *set = NULL, *ref = NULL;
+    digest d1, d2;
+    int64_t rc1 = 0, rc2 = 0;
+    size_t i = 0, half = 0;
+    double t = 0, compile = 0, add = 0, remove = 0;
+    int    ret = 1;
+
+    if (key_cnt < 2) {
+        fprintf(stderr, "usage: %s [number of keys (at least 2)]\n", argv[0]);
+        return 2;
+    }
+
+    half    = key_cnt / 2;
+    mps     = (str_mr_match_pair *)malloc(key_cnt * sizeof(str_mr_match_pair));
+    keys    = (char *)malloc(key_cnt * KEY_LEN);
+    str_len = key_cnt * KEY_LEN;
+    str     = (char *)malloc(str_len);
+    if ((mps == NULL) || (keys == NULL) || (str == NULL)) {
+        fprintf(stderr, "out of memory\n");
+        goto cleanup;
+    }
+
+    for (i = 0; i < key_cnt; i++) {
+        gen_key(keys + i * KEY_LEN, i);
+        mps[i].key          = keys + i * KEY_LEN;
+        mps[i].key_length   = KEY_LEN;
+        mps[i].value        = keys + (key_cnt - 1 - i) * KEY_LEN;
+        mps[i].value_length = KEY_LEN;
+    }
+
+    /* every key once, in reverse order */
+    for (i = 0; i < key_cnt; i++) {
+        memcpy(str + i * KEY_LEN, keys + (key_cnt - 1 - i) * KEY_LEN,
+               KEY_LEN);
+    }
+
+    /* compile whole set */
+    t = now();
+    if (str_mr_set_compile(mps, key_cnt, &ref) != STR_MR_ERROR_SUCCESS) {
+        fprintf(stderr, "compile failed\n");
+        goto cleanup;
+    }
+
+    compile = now() - t;
+    str_mr_set_free(ref);
+    ref = NULL;
+
+    /* first half compiled, second half added one by one */
+    if (str_mr_set_compile(mps, half, &set) != STR_MR_ERROR_SUCCESS) {
+        fprintf(stderr, "compile failed\n");
+        goto cleanup;
+    }
+
+    t = now();
+    for (i = half; i < key_cnt; i++) {
+        if (str_mr_set_add(set, &mps[i]) != STR_MR_ERROR_SUCCESS) {
+            fprintf(stderr, "add failed\n");
+            goto cleanup;
+        }
+    }
+
+    add = now() - t;
+
+    /* remove first half one by one */
+    t = now();
+    for (i = 0; i < half; i++) {
+        if (str_mr_set_remove(set, mps[i].key, mps[i].key_length) != 1) {
+            fprintf(stderr, "remove failed\n");
+            goto cleanup;
+        }
+    }
+
+    remove = now() - t;
+
+    printf("%zu keys\n", key_cnt);
+    printf("%-20s %10.2f ms\n", "compile", compile * 1e3);
+    printf("%-20s %10.3f us/key\n", "add",
+           add * 1e6 / (key_cnt - half));
+    printf("%-20s %10.3f us/key\n", "remove", remove * 1e6 / half);
+
+    /* modified set has to behave as compiled remaining pairs */
+    if (str_mr_set_compile(mps + half, key_cnt - half, &ref) !=
+        STR_MR_ERROR_SUCCESS) {
+        fprintf(stderr, "compile failed\n");
+        goto cleanup;
+    }
+
+    rc1 = run(set, str, str_len, &d1);
+    rc2 = run(ref, str, str_len, &d2);
+    if ((rc1 < 0) || (rc1 != rc2) || (d1.len != d2.len) ||
+        (d1.hash != d2.hash)) {
+        printf("FAILED: modified set differs from compiled set\n");
+        goto cleanup;
+    }
+
+    printf("%-20s %10lld matches\n", "check", (long long)rc1);
+    ret = 0;
+
+cleanup:
+    str_mr_set_free(set);
+    str_mr_set_free(ref);
+    free(str);
+    free(keys);
+    free(mps);
+
+    return ret;
+}
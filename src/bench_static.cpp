@@ -0,0 +1,133 @@
+/**
+ * @file      bench_static.cpp
+ * @brief     Benchmark of compile-time sets against runtime-compiled sets.
+ * @author    MMaster <mmaster@bitbix.com>
+ * @version   0.1
+ * @date      2013
+ * @copyright Apache License v2
+ *
+ * Replaces with an HTML escape table and a keyword token map using
+ * str_mr::static_set, str_mr::multireplacer (compiled set) and
+ * str_multireplace64() (pairs compiled on every call) and checks all give
+ * the same result.
+ *
+ * Compile with:
+ *    $ gcc -O2 -c str_multireplace.c
+ *    $ g++ -std=c++20 -O2 -o bench_static bench_static.cpp str_multireplace.o
+ *
+ * Run with:
+ *    $ ./bench_static [size in MiB (default 64)]
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <string>
+#include <vector>
+#include "str_mr_static.hpp"
+#include "str_multireplace.hpp"
+
+static constexpr str_mr::static_pair html_pairs[] = {
+    {"&", "&amp;"}, {"<", "&lt;"}, {">", "&gt;"}, {"\"", "&quot;"},
+    {"'", "&#39;"},
+};
+
+static constexpr str_mr::static_pair token_pairs[] = {
+    {"if", "IF"}, {"else", "ELSE"}, {"while", "WHILE"}, {"for", "FOR"},
+    {"return", "RETURN"}, {"int", "INT"}, {"char", "CHAR"},
+    {"void", "VOID"}, {"struct", "STRUCT"}, {"static", "STATIC"},
+    {"const", "CONST"}, {"switch", "SWITCH"}, {"case", "CASE"},
+    {"break", "BREAK"}, {"continue", "CONTINUE"}, {"sizeof", "SIZEOF"},
+};
+
+static constexpr auto html_set  = str_mr::make_static_set<html_pairs>();
+static constexpr auto token_set = str_mr::make_static_set<token_pairs>();
+
+static double
+now (void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+report (const char *what, double secs, size_t len)
+{
+    printf("%-28s %8.3f s %8.1f MiB/s\n", what, secs,
+           len / secs / (1024.0 * 1024.0));
+}
+
+/**
+ * @brief Run all three paths over str
+ *
+ * @return 0 when all results are the same
+ */
+template <size_t P, size_t N>
+static int
+bench (const char *name, const str_mr::static_set<P, N> &static_set,
+       const str_mr::static_pair (&pairs)[P], const std::string &str)
+{
+    std::vector<str_mr_match_pair> mps;
+    std::string out_static, out_set;
+    char   *out_c = nullptr;
+    size_t  out_c_len = 0;
+    int64_t rc = 0;
+    double  t = 0;
+
+    for (const auto &p : pairs) {
+        mps.push_back(str_mr::make_pair(p.key, p.value));
+    }
+
+    printf("%s (%zu pairs, %zu trie nodes)\n", name, P, N);
+
+    t = now();
+    static_set.replace(str, out_static);
+    report("  static_set", now() - t, str.size());
+
+    t = now();
+    str_mr::multireplacer mr(mps);
+    mr.replace(str, out_set);
+    report("  multireplacer (+compile)", now() - t, str.size());
+
+    t  = now();
+    rc = str_multireplace64(str.data(), str.size(), mps.data(), mps.size(),
+                            &out_c, &out_c_len, false);
+    report("  str_multireplace64", now() - t, str.size());
+
+    if ((rc < 0) || (out_static != out_set) ||
+        (std::string_view(out_c, out_c_len) != out_static)) {
+        printf("  FAILED: results differ\n");
+        free(out_c);
+        return 1;
+    }
+
+    free(out_c);
+    return 0;
+}
+
+int
+main (int argc, char *argv[])
+{
+    static const char *words[] = {
+        "if", "else", "while", "for", "return", "int", "char", "value",
+        "count", "buffer", "<p>", "a & b", "\"x\"", "it's", "struct", "x",
+    };
+    double mib = (argc > 1 ? strtod(argv[1], nullptr) : 64.0);
+    size_t len = (size_t)(mib * 1024 * 1024);
+    std::string str;
+    unsigned seed = 1;
+    int ret = 0;
+
+    str.reserve(len + 16);
+    while (str.size() < len) {
+        seed = seed * 1103515245 + 12345;
+        str += words[(seed >> 16) % (sizeof(words) / sizeof(words[0]))];
+        str += ' ';
+    }
+
+    ret |= bench("html escape", html_set, html_pairs, str);
+    ret |= bench("token map", token_set, token_pairs, str);
+
+    return ret;
+}
@@ -0,0 +1,353 @@
+/**
+ * @file      str_mr_dict.c
+ * @brief     Zero-copy dictionary loading.
+ * @author    MMaster <mmaster@bitbix.com>
+ * @version   0.1
+ * @date      2013
+ * @copyright Apache License v2
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "str_mr_dict.h"
+
+/**
+ * Minimal size of arena chunk for unescaped fields
+ */
+#define STR_MR_DICT_CHUNK_SIZE  (64 * 1024)
+
+/**
+ * @brief Arena chunk for unescaped fields
+ */
+typedef struct str_mr_dict_chunk {
+    struct str_mr_dict_chunk *next; /* previously allocated chunk */
+    size_t used;                /* used bytes of data */
+    size_t size;                /* size of data */
+    char data[];                /* unescaped fields */
+} str_mr_dict_chunk;
+
+/**
+ * @brief Loaded dictionary
+ */
+struct str_mr_dict {
+    str_mr_match_pair *mps;     /* match pairs */
+    size_t mp_cnt;              /* number of match pairs */
+    char *map;                  /* mapped dictionary file */
+    size_t map_len;             /* length of mapping */
+    str_mr_dict_chunk *arena;   /* unescaped fields (newest chunk first) */
+};
+
+/**
+ * @brief Allocate len bytes in arena
+ *
+ * @return allocated memory or NULL when out of memory
+ */
+static char *
+str_mr_dict_alloc (str_mr_dict *dict, size_t len)
+{
+    str_mr_dict_chunk *chunk = dict->arena;
+    size_t size = STR_MR_DICT_CHUNK_SIZE;
+
+    if ((chunk == NULL) || (chunk->size - chunk->used < len)) {
+        if (len > size) {
+            size = len;
+        }
+
+        chunk = (str_mr_dict_chunk *)malloc(sizeof(str_mr_dict_chunk) + size);
+        if (chunk == NULL) {
+            return NULL;
+        }
+
+        chunk->next = dict->arena;
+        chunk->used = 0;
+        chunk->size = size;
+        dict->arena = chunk;
+    }
+
+    chunk->used += len;
+    return chunk->data + chunk->used - len;
+}
+
+/**
+ * @brief Set up TSV field, unescaping it into arena only when needed
+ *
+ * @return 0 on success, -1 when out of memory
+ */
+static int
+str_mr_dict_field (str_mr_dict *dict, const char *field, size_t len,
+                   const char **out, size_t *out_len)
+{
+    char  *dst = NULL;
+    size_t i = 0, o = 0;
+
+    if (memchr(field, '\\', len) == NULL) {
+        *out     = field;       /* points into mapping */
+        *out_len = len;
+        return 0;
+    }
+
+    dst = str_mr_dict_alloc(dict, len);
+    if (dst == NULL) {
+        return -1;
+    }
+
+    for (i = 0; i < len; i++, o++) {
+        if ((field[i] != '\\') || (i + 1 >= len)) {
+            dst[o] = field[i];
+            continue;
+        }
+
+        switch (field[++i]) {
+        case 't':  dst[o] = '\t'; break;
+        case 'n':  dst[o] = '\n'; break;
+        case 'r':  dst[o] = '\r'; break;
+        case '0':  dst[o] = '\0'; break;
+        default:   dst[o] = field[i]; break;
+        }
+    }
+
+    *out     = dst;
+    *out_len = o;
+    return 0;
+}
+
+/**
+ * @brief Parse TSV dictionary
+ *
+ * @return status code
+ */
+static int32_t
+str_mr_dict_parse_tsv (str_mr_dict *dict, size_t *err_line)
+{
+    const char *p = dict->map, *end = dict->map + dict->map_len;
+    const char *eol = NULL, *tab = NULL, *vend = NULL;
+    str_mr_match_pair *mp = NULL;
+    size_t line = 0, line_cnt = 1;
+
+    /* one pair per line at most */
+    for (eol = p; (eol = (const char *)memchr(eol, '\n', end - eol)) != NULL;
+         eol++) {
+        line_cnt++;
+    }
+
+    dict->mps = (str_mr_match_pair *)malloc(line_cnt *
+                                            sizeof(str_mr_match_pair));
+    if (dict->mps == NULL) {
+        return STR_MR_ERROR_OOM;
+    }
+
+    for (; p < end; p = eol + 1) {
+        line++;
+        eol = (const char *)memchr(p, '\n', end - p);
+        if (eol == NULL) {
+            eol = end;
+        }
+
+        /* CRLF line ending */
+        vend = ((eol > p) && (eol[-1] == '\r') ? eol - 1 : eol);
+        if (vend == p) {
+            continue;           /* empty line */
+        }
+
+        tab = (const char *)memchr(p, '\t', vend - p);
+        if ((tab == NULL) || (tab == p)) {
+            if (err_line != NULL) {
+                *err_line = line;
+            }
+
+            return STR_MR_ERROR_FORMAT;
+        }
+
+        mp = &dict->mps[dict->mp_cnt];
+        if ((str_mr_dict_field(dict, p, tab - p, &mp->key,
+                               &mp->key_length) != 0) ||
+            (str_mr_dict_field(dict, tab + 1, vend - tab - 1, &mp->value,
+                               &mp->value_length) != 0)) {
+            return STR_MR_ERROR_OOM;
+        }
+
+        dict->mp_cnt++;
+    }
+
+    return STR_MR_ERROR_SUCCESS;
+}
+
+/**
+ * @brief Read 32-bit little-endian length
+ */
+static size_t
+str_mr_dict_len32 (const char *p)
+{
+    const unsigned char *u = (const unsigned char *)p;
+
+    return ((size_t)u[0] | ((size_t)u[1] << 8) | ((size_t)u[2] << 16) |
+            ((size_t)u[3] << 24));
+}
+
+/**
+ * @brief Parse length-prefixed dictionary
+ *
+ * First pass validates and counts records, second sets up pairs.
+ *
+ * @return status code
+ */
+static int32_t
+str_mr_dict_parse_lp (str_mr_dict *dict, size_t *err_line)
+{
+    size_t start = sizeof(STR_MR_DICT_LP_MAGIC) - 1;
+    size_t pos = 0, cnt = 0, klen = 0, vlen = 0;
+    str_mr_match_pair *mp = NULL;
+    const char *map = dict->map;
+    size_t len = dict->map_len;
+
+    for (pos = start; pos < len; cnt++) {
+        if ((len - pos < 4) ||
+            ((klen = str_mr_dict_len32(map + pos)) == 0) ||
+            (len - pos - 4 < klen) ||
+            (len - pos - 4 - klen < 4) ||
+            ((vlen = str_mr_dict_len32(map + pos + 4 + klen)) >
+             len - pos - 8 - klen)) {
+            if (err_line != NULL) {
+                *err_line = cnt + 1;
+            }
+
+            return STR_MR_ERROR_FORMAT;
+        }
+
+        pos += 8 + klen + vlen;
+    }
+
+    dict->mps = (str_mr_match_pair *)malloc((cnt > 0 ? cnt : 1) *
+                                            sizeof(str_mr_match_pair));
+    if (dict->mps == NULL) {
+        return STR_MR_ERROR_OOM;
+    }
+
+    for (pos = start; pos < len; pos += 8 + klen + vlen) {
+        mp   = &dict->mps[dict->mp_cnt++];
+        klen = str_mr_dict_len32(map + pos);
+        vlen = str_mr_dict_len32(map + pos + 4 + klen);
+
+        mp->key          = map + pos + 4;
+        mp->key_length   = klen;
+        mp->value        = map + pos + 8 + klen;
+        mp->value_length = vlen;
+    }
+
+    return STR_MR_ERROR_SUCCESS;
+}
+
+/**
+ * @brief Function to map and parse dictionary file.
+ *
+ * @see str_mr_dict.h
+ */
+int32_t
+str_mr_dict_map (const char *path, str_mr_dict **dict, size_t *err_line)
+{
+    int32_t rc = STR_MR_ERROR_SUCCESS;
+    str_mr_dict *d = NULL;
+    struct stat st;
+    int fd = -1, err_no = 0;
+
+    if ((path == NULL) || (dict == NULL)) {
+        return STR_MR_ERROR_INVALID_ARG;
+    }
+
+    fd = open(path, O_RDONLY);
+    if ((fd < 0) || (fstat(fd, &st) != 0)) {
+        if (fd >= 0) {
+            err_no = errno;
+            close(fd);
+            errno = err_no;
+        }
+
+        return STR_MR_ERROR_IO;
+    }
+
+    d = (str_mr_dict *)calloc(1, sizeof(str_mr_dict));
+    if (d == NULL) {
+        close(fd);
+        return STR_MR_ERROR_OOM;
+    }
+
+    if (st.st_size > 0) {
+        d->map = (char *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (d->map == MAP_FAILED) {
+            err_no = errno;
+            close(fd);
+            free(d);
+            errno = err_no;
+            return STR_MR_ERROR_IO;
+        }
+
+        d->map_len = st.st_size;
+    }
+
+    close(fd);
+
+    if (d->map_len == 0) {
+        rc = STR_MR_ERROR_SUCCESS;  /* empty dictionary */
+    } else if ((d->map_len >= sizeof(STR_MR_DICT_LP_MAGIC) - 1) &&
+        (memcmp(d->map, STR_MR_DICT_LP_MAGIC,
+                sizeof(STR_MR_DICT_LP_MAGIC) - 1) == 0)) {
+        rc = str_mr_dict_parse_lp(d, err_line);
+    } else {
+        rc = str_mr_dict_parse_tsv(d, err_line);
+    }
+
+    if (rc != STR_MR_ERROR_SUCCESS) {
+        str_mr_dict_free(d);
+        return rc;
+    }
+
+    *dict = d;
+    return STR_MR_ERROR_SUCCESS;
+}
+
+/**
+ * @brief Function to get match pairs of dictionary.
+ *
+ * @see str_mr_dict.h
+ */
+const str_mr_match_pair *
+str_mr_dict_pairs (const str_mr_dict *dict, size_t *pair_cnt)
+{
+    if (pair_cnt != NULL) {
+        *pair_cnt = (dict != NULL ? dict->mp_cnt : 0);
+    }
+
+    return (dict != NULL ? dict->mps : NULL);
+}
+
+/**
+ * @brief Function to free dictionary.
+ *
+ * @see str_mr_dict.h
+ */
+void
+str_mr_dict_free (str_mr_dict *dict)
+{
+    str_mr_dict_chunk *chunk = NULL;
+
+    if (dict == NULL) {
+        return;
+    }
+
+    while (dict->arena != NULL) {
+        chunk = dict->arena;
+        dict->arena = chunk->next;
+        free(chunk);
+    }
+
+    if (dict->map != NULL) {
+        munmap(dict->map, dict->map_len);
+    }
+
+    free(dict->mps);
+    free(dict);
+}
@@ -0,0 +1,90 @@
+/**
+ * @file      str_mr_dict.h
+ * @brief     Header for zero-copy dictionary loading.
+ * @author    MMaster
+ * @version   0.1
+ * @date      2013
+ * @copyright Apache License v2
+ *
+ * Dictionary file is mapped and match pairs point directly into the
+ * mapping. Only fields with escapes are unescaped into a side arena.
+ *
+ * Two formats are supported:
+ * - TSV: one "key<TAB>value" pair per line (LF or CRLF), backslash escapes
+ *   \t, \n, \r, \0 and \\ can be used in both key and value. Empty lines
+ *   are skipped.
+ * - length-prefixed: STR_MR_DICT_LP_MAGIC followed by records of 32-bit
+ *   little-endian key length, key, 32-bit little-endian value length and
+ *   value. No escaping at all.
+ */
+
+#ifndef __STR_MR_DICT_H__
+#define __STR_MR_DICT_H__
+
+#include "str_multireplace.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Magic at start of length-prefixed dictionary
+ */
+#define STR_MR_DICT_LP_MAGIC    "STRMRKV1"
+
+/**
+ * @brief Loaded dictionary
+ *
+ * Created by str_mr_dict_map().
+ */
+typedef struct str_mr_dict str_mr_dict;
+
+/**
+ * @brief Function to map and parse dictionary file.
+ *
+ * Format is detected by STR_MR_DICT_LP_MAGIC, anything else is TSV.
+ *
+ * Note: Caller is responsible for freeing the dictionary
+ * (str_mr_dict_free()).
+ *
+ * @param[in] path path to dictionary file
+ * @param[out] dict newly allocated dictionary
+ * @param[out] err_line line (or record) number of invalid entry, set only
+ *             when STR_MR_ERROR_FORMAT is returned (can be NULL)
+ *
+ * @return status code
+ * @retval STR_MR_ERROR_SUCCESS success
+ * @retval STR_MR_ERROR_OOM out of memory
+ * @retval STR_MR_ERROR_INVALID_ARG invalid argument provided
+ * @retval STR_MR_ERROR_IO opening or mapping failed (errno is set)
+ * @retval STR_MR_ERROR_FORMAT invalid entry in dictionary
+ */
+int32_t
+str_mr_dict_map(const char *path, str_mr_dict **dict, size_t *err_line);
+
+/**
+ * @brief Function to get match pairs of dictionary.
+ *
+ * Pairs (in order of the file) stay valid until the dictionary is freed.
+ *
+ * @param[in] dict dictionary
+ * @param[out] pair_cnt number of match pairs (can be 0)
+ *
+ * @return match pairs array
+ */
+const str_mr_match_pair *
+str_mr_dict_pairs(const str_mr_dict *dict, size_t *pair_cnt);
+
+/**
+ * @brief Function to free dictionary.
+ *
+ * @param[in] dict dictionary to be freed (can be NULL)
+ */
+void
+str_mr_dict_free(str_mr_dict *dict);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
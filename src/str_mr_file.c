@@ -0,0 +1,336 @@
+/**
+ * @file      str_mr_file.c
+ * @brief     File to file multiple key-value replacement tool.
+ * @author    MMaster <mmaster@bitbix.com>
+ * @version   0.1
+ * @date      2013
+ * @copyright Apache License v2
+ *
+ * Maps the input file, replaces all keys from dictionary and writes
+ * untouched slices of the mapping together with values using writev().
+ * Input that can't be mapped (stdin, pipes) goes through str_mr_pipe().
+ * With -u regular files are processed by str_mr_uring_file() instead.
+ * Standard output is never written by str_mr_uring_file() (it goes through
+ * str_mr_pipe() instead), it can be shared with other writers or be in
+ * append mode.
+ *
+ * Dictionary can be compiled once into set image by -c. Image is mapped
+ * instead of parsed and always processed by str_mr_uring_file() or
+ * str_mr_pipe().
+ *
+ * Dictionary is loaded by str_mr_dict_map(), see str_mr_dict.h for
+ * supported formats.
+ *
+ * Compile with:
+ *    $ gcc -O2 -pthread -o str_mr_file str_mr_file.c str_mr_dict.c \
+ *          str_mr_pipe.c str_mr_uring.c str_multireplace.c
+ *
+ * Add -DSTR_MR_WITH_IO_URING to use io_uring for -u.
+ *
+ * Run with:
+ *    $ ./str_mr_file [-u] dict.tsv input output
+ *    $ ./str_mr_file -c dict.tsv dict.img
+ *    $ ./str_mr_file dict.img input output
+ *
+ * Use "-" as input to read stdin and as output to write to stdout.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "str_mr_dict.h"
+#include "str_mr_pipe.h"
+#include "str_mr_uring.h"
+
+#ifndef IOV_MAX
+#define IOV_MAX     (1024)
+#endif
+
+/**
+ * @brief Load dictionary
+ *
+ * @return 0 on success, -1 on error (reported to stderr)
+ */
+static int
+dict_load (const char *path, str_mr_dict **d)
+{
+    size_t  line = 0, cnt = 0;
+    int32_t rc = str_mr_dict_map(path, d, &line);
+
+    if (rc == STR_MR_ERROR_IO) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    if (rc == STR_MR_ERROR_FORMAT) {
+        fprintf(stderr, "%s:%zu: invalid entry\n", path, line);
+        return -1;
+    }
+
+    if (rc != STR_MR_ERROR_SUCCESS) {
+        fprintf(stderr, "%s: cannot load dictionary\n", path);
+        return -1;
+    }
+
+    str_mr_dict_pairs(*d, &cnt);
+    if (cnt == 0) {
+        fprintf(stderr, "%s: empty dictionary\n", path);
+        str_mr_dict_free(*d);
+        *d = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Report replacement error
+ *
+ * @return 0 on success, -1 on error (reported to stderr)
+ */
+static int
+report (int64_t rc)
+{
+    if (rc == STR_MR_ERROR_IO) {
+        fprintf(stderr, "%s\n", strerror(errno));
+        return -1;
+    }
+
+    if (rc < 0) {
+        fprintf(stderr, "replacement failed (%lld)\n", (long long)rc);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Replace stream that can't be mapped or files with io_uring
+ *
+ * @return 0 on success, -1 on error (reported to stderr)
+ */
+static int
+replace_stream (const str_mr_set *set, int in_fd, int out_fd, bool use_uring)
+{
+    if (use_uring) {
+        return report(str_mr_uring_file(set, in_fd, out_fd, 0, 0));
+    }
+
+    return report(str_mr_pipe(set, in_fd, out_fd, 0));
+}
+
+/**
+ * @brief Compile dictionary into set image file
+ *
+ * @return 0 on success, -1 on error (reported to stderr)
+ */
+static int
+compile_image (const char *dict_path, const char *image_path)
+{
+    str_mr_dict *d = NULL;
+    const str_mr_match_pair *mps = NULL;
+    size_t mp_cnt = 0;
+    str_mr_set *set = NULL;
+    int32_t rc = 0;
+
+    if (dict_load(dict_path, &d) != 0) {
+        return -1;
+    }
+
+    mps = str_mr_dict_pairs(d, &mp_cnt);
+    rc  = str_mr_set_compile(mps, mp_cnt, &set);
+    if (rc == STR_MR_ERROR_SUCCESS) {
+        rc = str_mr_set_save(set, image_path);
+    }
+
+    str_mr_set_free(set);
+    str_mr_dict_free(d);
+
+    if (rc == STR_MR_ERROR_IO) {
+        fprintf(stderr, "%s: %s\n", image_path, strerror(errno));
+        return -1;
+    }
+
+    return report(rc);
+}
+
+/**
+ * @brief Write whole iovec array, continuing after partial writes
+ *
+ * @return 0 on success, -1 on error (errno set)
+ */
+static int
+write_all (int fd, struct iovec *iov, size_t iov_cnt)
+{
+    ssize_t written = 0;
+    int     batch   = 0;
+
+    while (iov_cnt > 0) {
+        batch   = (iov_cnt > IOV_MAX ? IOV_MAX : (int)iov_cnt);
+        written = writev(fd, iov, batch);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            return -1;
+        }
+
+        /* skip what was written */
+        while ((iov_cnt > 0) && ((size_t)written >= iov->iov_len)) {
+            written -= iov->iov_len;
+            iov++;
+            iov_cnt--;
+        }
+
+        if (written > 0) {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+
+    return 0;
+}
+
+int
+main (int argc, char *argv[])
+{
+    str_mr_dict *d = NULL;
+    const str_mr_match_pair *mps = NULL;
+    size_t mp_cnt = 0;
+    int    in_fd = -1, out_fd = -1;
+    struct stat st;
+    char  *in = NULL;
+    struct iovec *iov = NULL;
+    size_t iov_cnt = 0;
+    int64_t rc = 0;
+    int    ret = 1;
+    bool   use_uring = false;
+    str_mr_set *set = NULL;
+    struct stat out_st;
+
+    if ((argc == 4) && (strcmp(argv[1], "-c") == 0)) {
+        return (compile_image(argv[2], argv[3]) == 0 ? 0 : 1);
+    }
+
+    if ((argc == 5) && (strcmp(argv[1], "-u") == 0)) {
+        use_uring = true;
+        argc--;
+        argv++;
+    }
+
+    if (argc != 4) {
+        fprintf(stderr, "usage: %s [-u] dict.tsv|set.img input|- output|-\n"
+                        "       %s -c dict.tsv set.img\n", argv[0], argv[0]);
+        return 2;
+    }
+
+    /* compiled image or dictionary */
+    rc = str_mr_set_map(argv[1], &set);
+    if (rc == STR_MR_ERROR_FORMAT) {
+        if (dict_load(argv[1], &d) != 0) {
+            return 1;
+        }
+
+        mps = str_mr_dict_pairs(d, &mp_cnt);
+    }
+
+    if ((rc != STR_MR_ERROR_SUCCESS) && (rc != STR_MR_ERROR_FORMAT)) {
+        fprintf(stderr, "%s: %s\n", argv[1],
+                (rc == STR_MR_ERROR_IO ? strerror(errno) : "cannot load"));
+        return 1;
+    }
+
+    if (strcmp(argv[2], "-") == 0) {
+        in_fd = dup(STDIN_FILENO);
+    } else {
+        in_fd = open(argv[2], O_RDONLY);
+    }
+
+    if ((in_fd < 0) || (fstat(in_fd, &st) != 0)) {
+        fprintf(stderr, "%s: %s\n", argv[2], strerror(errno));
+        goto cleanup;
+    }
+
+    if (strcmp(argv[3], "-") == 0) {
+        out_fd = STDOUT_FILENO;
+    } else {
+        out_fd = open(argv[3], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (out_fd < 0) {
+            fprintf(stderr, "%s: %s\n", argv[3], strerror(errno));
+            goto cleanup;
+        }
+    }
+
+    /* image is already compiled, so it always goes through the set */
+    use_uring = ((use_uring || (set != NULL)) && S_ISREG(st.st_mode) &&
+                 (out_fd != STDOUT_FILENO) &&
+                 (fstat(out_fd, &out_st) == 0) && S_ISREG(out_st.st_mode));
+
+    if (!S_ISREG(st.st_mode) || use_uring || (set != NULL)) {
+        rc = STR_MR_ERROR_SUCCESS;
+        if (set == NULL) {
+            rc = str_mr_set_compile(mps, mp_cnt, &set);
+        }
+
+        if (rc == STR_MR_ERROR_SUCCESS) {
+            ret = (replace_stream(set, in_fd, out_fd, use_uring) == 0 ? 0 : 1);
+        } else {
+            report(rc);
+        }
+
+        goto cleanup;
+    }
+
+    if (st.st_size == 0) {
+        ret = 0;                /* empty in, empty out */
+        goto cleanup;
+    }
+
+    in = (char *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, in_fd, 0);
+    if (in == MAP_FAILED) {
+        in = NULL;
+        fprintf(stderr, "%s: %s\n", argv[2], strerror(errno));
+        goto cleanup;
+    }
+
+    madvise(in, st.st_size, MADV_SEQUENTIAL);
+
+    rc = str_multireplace_iov(in, st.st_size, mps, mp_cnt,
+                              &iov, &iov_cnt);
+    if (rc < 0) {
+        fprintf(stderr, "replacement failed (%lld)\n", (long long)rc);
+        goto cleanup;
+    }
+
+    if (write_all(out_fd, iov, iov_cnt) != 0) {
+        fprintf(stderr, "%s: %s\n", argv[3], strerror(errno));
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    free(iov);
+    if (in != NULL) {
+        munmap(in, st.st_size);
+    }
+
+    if (in_fd >= 0) {
+        close(in_fd);
+    }
+
+    if ((out_fd >= 0) && (out_fd != STDOUT_FILENO) && (close(out_fd) != 0)) {
+        fprintf(stderr, "%s: %s\n", argv[3], strerror(errno));
+        ret = 1;
+    }
+
+    str_mr_set_free(set);
+    str_mr_dict_free(d);
+
+    return ret;
+}
@@ -0,0 +1,468 @@
+/**
+ * @file      str_mr_gen.c
+ * @brief     Generator of specialised matchers for fixed dictionaries.
+ * @author    MMaster <mmaster@bitbix.com>
+ * @version   0.1
+ * @date      2013
+ * @copyright Apache License v2
+ *
+ * Reads dictionary (see str_mr_dict.h for formats) and writes C source with
+ * the whole key trie unrolled into goto-connected switch statements (split
+ * into functions of at most GEN_FN_NODES nodes) and a replacement function
+ * with the same result as str_multireplace64() of the dictionary:
+ *
+ *    int64_t
+ *    name(const char *str, size_t str_len,
+ *         char **result, size_t *result_len, bool terminate);
+ *
+ * Generated source includes str_multireplace.h for error codes only, it
+ * doesn't need the library.
+ *
+ * Compile with:
+ *    $ gcc -O2 -o str_mr_gen str_mr_gen.c str_mr_dict.c
+ *
+ * Run with:
+ *    $ ./str_mr_gen dict.tsv name name.c
+ *
+ * Use "-" as output to write to stdout.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include "str_mr_dict.h"
+
+/**
+ * Trie nodes one generated function can hold, subtrees that don't fit are
+ * emitted as separate functions so none gets too big for the compiler
+ */
+#define GEN_FN_NODES    (512)
+
+/**
+ * @brief Subtree waiting to be emitted as function
+ */
+typedef struct {
+    size_t lo;                  /* first key in order */
+    size_t hi;                  /* end of keys in order */
+    size_t depth;               /* length of shared prefix */
+} gen_fn;
+
+/**
+ * @brief Generator state
+ */
+typedef struct {
+    FILE *out;                  /* generated source */
+    FILE *body;                 /* function bodies (after prototypes) */
+    const char *name;           /* name of generated function */
+    const str_mr_match_pair *mps; /* dictionary pairs */
+    size_t *order;              /* pair indexes sorted by key, then index */
+    size_t node_cnt;            /* trie nodes numbered so far */
+    size_t fn_nodes;            /* nodes left to current function */
+    gen_fn *fns;                /* subtree functions (0 is root) */
+    size_t fn_cnt;              /* number of subtree functions */
+    size_t fn_alloc;            /* allocated subtree functions */
+} gen_state;
+
+/** Pairs for key_cmp() (qsort() has no context argument) */
+static const str_mr_match_pair *sort_mps = NULL;
+
+/**
+ * @brief Order pair indexes by key bytes, duplicates by index
+ */
+static int
+key_cmp (const void *a, const void *b)
+{
+    const str_mr_match_pair *pa = &sort_mps[*(const size_t *)a];
+    const str_mr_match_pair *pb = &sort_mps[*(const size_t *)b];
+    size_t len = (pa->key_length < pb->key_length ? pa->key_length :
+                  pb->key_length);
+    int    rc  = memcmp(pa->key, pb->key, len);
+
+    if (rc != 0) {
+        return rc;
+    }
+
+    if (pa->key_length != pb->key_length) {
+        return (pa->key_length < pb->key_length ? -1 : 1);
+    }
+
+    return (*(const size_t *)a < *(const size_t *)b ? -1 : 1);
+}
+
+/**
+ * @brief Write bytes as C string literal (octal escapes only, so the next
+ *        character can never extend an escape)
+ */
+static void
+put_literal (FILE *out, const char *s, size_t len)
+{
+    size_t i = 0;
+    unsigned char c = 0;
+
+    fputc('"', out);
+    for (i = 0; i < len; i++) {
+        c = (unsigned char)s[i];
+        if ((c >= 0x20) && (c < 0x7f) && (c != '"') && (c != '\\') &&
+            (c != '?')) {
+            fputc(c, out);
+        } else {
+            fprintf(out, "\\%03o", c);
+        }
+    }
+
+    fputc('"', out);
+}
+
+/**
+ * @brief Add subtree function
+ *
+ * @return function number or (size_t)-1 when out of memory
+ */
+static size_t
+add_fn (gen_state *g, size_t lo, size_t hi, size_t depth)
+{
+    gen_fn *fns = NULL;
+
+    if (g->fn_cnt == g->fn_alloc) {
+        g->fn_alloc = g->fn_alloc * 2 + 16;
+        fns = (gen_fn *)realloc(g->fns, g->fn_alloc * sizeof(gen_fn));
+        if (fns == NULL) {
+            return (size_t)-1;
+        }
+
+        g->fns = fns;
+    }
+
+    g->fns[g->fn_cnt].lo    = lo;
+    g->fns[g->fn_cnt].hi    = hi;
+    g->fns[g->fn_cnt].depth = depth;
+    return g->fn_cnt++;
+}
+
+/**
+ * @brief Emit trie node of keys order[lo..hi) sharing prefix of length depth
+ *
+ * Keys equal to the prefix come first in the range, the first of them is
+ * the pair whose key ends in this node. Children are numbered before they
+ * are emitted, so the switch can jump to them. Children that don't fit
+ * into the current function become their own functions called in tail
+ * position.
+ *
+ * @return 0 on success, -1 when out of memory
+ */
+static int
+emit_node (gen_state *g, size_t id, size_t lo, size_t hi, size_t depth)
+{
+    const str_mr_match_pair *mps = g->mps;
+    FILE  *out = g->body;
+    size_t i = lo, k = 0, end = 0, first_child = 0, fn = 0;
+    unsigned char c = 0;
+    bool   inline_child[256];
+
+    if (id != 0) {
+        fprintf(out, "n%zu:\n", id);
+    }
+
+    if ((i < hi) && (mps[g->order[i]].key_length == depth)) {
+        fprintf(out, "    best = %zu;\n    *pair = %zu;\n", depth,
+                g->order[i]);
+        while ((i < hi) && (mps[g->order[i]].key_length == depth)) {
+            i++;                /* later duplicates never win */
+        }
+    }
+
+    if (i == hi) {
+        fprintf(out, "    return best;\n");
+        return 0;
+    }
+
+    fprintf(out, "    if (n <= %zu) {\n        return best;\n    }\n\n",
+            depth);
+    fprintf(out, "    switch (p[%zu]) {\n", depth);
+
+    first_child = g->node_cnt;
+    for (k = i; k < hi; k = end) {
+        c = (unsigned char)mps[g->order[k]].key[depth];
+        for (end = k; (end < hi) &&
+             ((unsigned char)mps[g->order[end]].key[depth] == c); end++) {
+        }
+
+        inline_child[c] = (g->fn_nodes > 0);
+        if (inline_child[c]) {
+            g->fn_nodes--;
+            fprintf(out, "    case %u: goto n%zu;\n", c, g->node_cnt++);
+        } else {
+            fn = add_fn(g, k, end, depth + 1);
+            if (fn == (size_t)-1) {
+                return -1;
+            }
+
+            fprintf(out, "    case %u: return %s_f%zu(p, n, pair, best);\n",
+                    c, g->name, fn);
+        }
+    }
+
+    fprintf(out, "    default: return best;\n    }\n\n");
+
+    /* children in the same order as numbered above */
+    for (k = i; k < hi; k = end) {
+        c = (unsigned char)mps[g->order[k]].key[depth];
+        for (end = k; (end < hi) &&
+             ((unsigned char)mps[g->order[end]].key[depth] == c); end++) {
+        }
+
+        if (inline_child[c] &&
+            (emit_node(g, first_child++, k, end, depth + 1) != 0)) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Emit the whole generated source
+ *
+ * @return 0 on success, -1 when out of memory or temporary file failed
+ */
+static int
+emit (gen_state *g, size_t mp_cnt, const char *dict_path)
+{
+    FILE  *out  = g->out;
+    const char *name = g->name;
+    size_t i = 0, len = 0;
+    char   buf[4096];
+
+    fprintf(out,
+"/*\n"
+" * Generated by str_mr_gen from %s, do not edit.\n"
+" *\n"
+" * int64_t\n"
+" * %s(const char *str, size_t str_len,\n"
+" *     char **result, size_t *result_len, bool terminate);\n"
+" */\n"
+"#include <string.h>\n"
+"#include \"str_multireplace.h\"\n\n", dict_path, name);
+
+    fprintf(out, "static const char *const %s_values[%zu] = {\n", name,
+            mp_cnt);
+    for (i = 0; i < mp_cnt; i++) {
+        fprintf(out, "    ");
+        put_literal(out, g->mps[i].value, g->mps[i].value_length);
+        fprintf(out, ",\n");
+    }
+
+    fprintf(out, "};\n\nstatic const size_t %s_value_lens[%zu] = {\n", name,
+            mp_cnt);
+    for (i = 0; i < mp_cnt; i++) {
+        fprintf(out, "    %zu,\n", g->mps[i].value_length);
+    }
+
+    fprintf(out, "};\n\n");
+
+    /* longest key at p, split into functions of subtrees */
+    if (add_fn(g, 0, mp_cnt, 0) != 0) {
+        return -1;
+    }
+
+    g->node_cnt = 1;
+    for (i = 0; i < g->fn_cnt; i++) {
+        fprintf(out,
+"static size_t %s_f%zu(const unsigned char *p, size_t n, size_t *pair,\n"
+"              size_t best);\n", name, i);
+        fprintf(g->body,
+"static size_t\n"
+"%s_f%zu (const unsigned char *p, size_t n, size_t *pair, size_t best)\n"
+"{\n", name, i);
+
+        g->fn_nodes = GEN_FN_NODES;
+        if (emit_node(g, 0, g->fns[i].lo, g->fns[i].hi,
+                      g->fns[i].depth) != 0) {
+            return -1;
+        }
+
+        fprintf(g->body, "}\n\n");
+    }
+
+    fprintf(out, "\n");
+    rewind(g->body);
+    while ((len = fread(buf, 1, sizeof(buf), g->body)) > 0) {
+        fwrite(buf, 1, len, out);
+    }
+
+    if (ferror(g->body)) {
+        return -1;
+    }
+
+    fprintf(out,
+"static int\n"
+"%s_put (char **r, size_t *r_len, size_t *r_alloc, const char *s,\n"
+"        size_t len)\n"
+"{\n"
+"    size_t alloc = *r_alloc;\n"
+"    char  *nr = NULL;\n\n"
+"    if (alloc - *r_len < len) {\n"
+"        while (alloc - *r_len < len) {\n"
+"            alloc = alloc * 2 + 64;\n"
+"        }\n\n"
+"        nr = (char *)realloc(*r, alloc);\n"
+"        if (nr == NULL) {\n"
+"            return -1;\n"
+"        }\n\n"
+"        *r = nr;\n"
+"        *r_alloc = alloc;\n"
+"    }\n\n"
+"    memcpy(*r + *r_len, s, len);\n"
+"    *r_len += len;\n"
+"    return 0;\n"
+"}\n\n", name);
+
+    fprintf(out,
+"int64_t\n"
+"%s (const char *str, size_t str_len,\n"
+"    char **result, size_t *result_len, bool terminate)\n"
+"{\n"
+"    char  *r = NULL;\n"
+"    size_t r_len = 0, r_alloc = 0;\n"
+"    size_t i = 0, lit = 0, len = 0, pair = 0;\n"
+"    int64_t cnt = 0;\n\n"
+"    if ((str == NULL) || (str_len == 0) || (result == NULL) ||\n"
+"        (result_len == NULL)) {\n"
+"        return STR_MR_ERROR_INVALID_ARG;\n"
+"    }\n\n"
+"    r_alloc = str_len + str_len / 8 + 1;\n"
+"    r = (char *)malloc(r_alloc);\n"
+"    if (r == NULL) {\n"
+"        return STR_MR_ERROR_OOM;\n"
+"    }\n\n"
+"    while (i < str_len) {\n"
+"        len = %s_f0((const unsigned char *)str + i, str_len - i, &pair,\n"
+"                    0);\n"
+"        if (len == 0) {\n"
+"            i++;\n"
+"            continue;\n"
+"        }\n\n"
+"        if ((%s_put(&r, &r_len, &r_alloc, str + lit, i - lit) != 0) ||\n"
+"            (%s_put(&r, &r_len, &r_alloc, %s_values[pair],\n"
+"                    %s_value_lens[pair]) != 0)) {\n"
+"            free(r);\n"
+"            return STR_MR_ERROR_OOM;\n"
+"        }\n\n"
+"        i  += len;\n"
+"        lit = i;\n"
+"        cnt++;\n"
+"    }\n\n"
+"    if ((%s_put(&r, &r_len, &r_alloc, str + lit, str_len - lit) != 0) ||\n"
+"        (terminate && (%s_put(&r, &r_len, &r_alloc, \"\", 1) != 0))) {\n"
+"        free(r);\n"
+"        return STR_MR_ERROR_OOM;\n"
+"    }\n\n"
+"    *result     = r;\n"
+"    *result_len = r_len - (terminate ? 1 : 0);\n"
+"    return cnt;\n"
+"}\n", name, name, name, name, name, name, name, name);
+
+    return 0;
+}
+
+/**
+ * @brief Check name is a C identifier
+ */
+static bool
+valid_name (const char *name)
+{
+    size_t i = 0;
+
+    if (!isalpha((unsigned char)name[0]) && (name[0] != '_')) {
+        return false;
+    }
+
+    for (i = 1; name[i] != '\0'; i++) {
+        if (!isalnum((unsigned char)name[i]) && (name[i] != '_')) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+int
+main (int argc, char *argv[])
+{
+    str_mr_dict *d = NULL;
+    size_t  mp_cnt = 0, line = 0, i = 0;
+    int32_t rc = 0;
+    int     ret = 1;
+    gen_state g;
+
+    if ((argc != 4) || !valid_name(argv[2])) {
+        fprintf(stderr, "usage: %s dict.tsv name output.c|-\n"
+                        "       (name has to be a C identifier)\n", argv[0]);
+        return 2;
+    }
+
+    memset(&g, 0, sizeof(g));
+    g.name = argv[2];
+
+    rc = str_mr_dict_map(argv[1], &d, &line);
+    if (rc != STR_MR_ERROR_SUCCESS) {
+        if (rc == STR_MR_ERROR_FORMAT) {
+            fprintf(stderr, "%s:%zu: invalid entry\n", argv[1], line);
+        } else {
+            fprintf(stderr, "%s: %s\n", argv[1], (rc == STR_MR_ERROR_IO ?
+                    strerror(errno) : "cannot load dictionary"));
+        }
+
+        return 1;
+    }
+
+    g.mps = str_mr_dict_pairs(d, &mp_cnt);
+    if (mp_cnt == 0) {
+        fprintf(stderr, "%s: empty dictionary\n", argv[1]);
+        goto cleanup;
+    }
+
+    g.order = (size_t *)malloc(mp_cnt * sizeof(size_t));
+    if (g.order == NULL) {
+        fprintf(stderr, "out of memory\n");
+        goto cleanup;
+    }
+
+    for (i = 0; i < mp_cnt; i++) {
+        g.order[i] = i;
+    }
+
+    sort_mps = g.mps;
+    qsort(g.order, mp_cnt, sizeof(size_t), key_cmp);
+
+    g.out = (strcmp(argv[3], "-") == 0 ? stdout : fopen(argv[3], "w"));
+    if (g.out == NULL) {
+        fprintf(stderr, "%s: %s\n", argv[3], strerror(errno));
+        goto cleanup;
+    }
+
+    g.body = tmpfile();
+    if ((g.body == NULL) || (emit(&g, mp_cnt, argv[1]) != 0)) {
+        fprintf(stderr, "cannot generate: %s\n", strerror(errno));
+    } else if ((fflush(g.out) != 0) || ferror(g.out)) {
+        fprintf(stderr, "%s: %s\n", argv[3], strerror(errno));
+    } else {
+        ret = 0;
+    }
+
+    if ((g.out != stdout) && (fclose(g.out) != 0)) {
+        fprintf(stderr, "%s: %s\n", argv[3], strerror(errno));
+        ret = 1;
+    }
+
+cleanup:
+    if (g.body != NULL) {
+        fclose(g.body);
+    }
+
+    free(g.fns);
+    free(g.order);
+    str_mr_dict_free(d);
+
+    return ret;
+}
@@ -0,0 +1,178 @@
+/**
+ * @file      str_mr_handle.c
+ * @brief     Atomically swappable compiled set handle.
+ * @author    MMaster <mmaster@bitbix.com>
+ * @version   0.1
+ * @date      2013
+ * @copyright Apache License v2
+ *
+ * Reclamation uses two reader counters selected by epoch parity. Reader
+ * increments the counter of the epoch it read and checks the epoch didn't
+ * change meanwhile (retrying otherwise), so after the writer published the
+ * new set and advanced the epoch, only readers counted in the old counter
+ * can still see the old set. Once it drops to zero the old set is freed.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <time.h>
+#include "str_mr_handle.h"
+
+/**
+ * Size of cache line (reader counters are kept apart to avoid false
+ * sharing)
+ */
+#define STR_MR_HANDLE_CACHE_LINE    (64)
+
+/**
+ * Waiting rounds spent in sched_yield() before sleeping
+ */
+#define STR_MR_HANDLE_SPIN_CNT      (128)
+
+/**
+ * @brief Reader counter of one epoch parity
+ */
+typedef struct {
+    _Atomic size_t cnt;         /* readers inside */
+    char pad[STR_MR_HANDLE_CACHE_LINE - sizeof(size_t)];
+} str_mr_handle_readers;
+
+/**
+ * @brief Swappable compiled set handle
+ */
+struct str_mr_handle {
+    str_mr_handle_readers readers[2];   /* readers by epoch parity */
+    _Atomic uint32_t epoch;     /* incremented by every swap */
+    _Atomic(str_mr_set *) set;  /* current set */
+    pthread_mutex_t swap_lock;  /* serializes swaps */
+};
+
+/**
+ * @brief Function to create handle.
+ *
+ * @see str_mr_handle.h
+ */
+int32_t
+str_mr_handle_init (str_mr_set *set, str_mr_handle **handle)
+{
+    str_mr_handle *h = NULL;
+
+    if ((set == NULL) || (handle == NULL)) {
+        return STR_MR_ERROR_INVALID_ARG;
+    }
+
+    h = (str_mr_handle *)calloc(1, sizeof(str_mr_handle));
+    if (h == NULL) {
+        return STR_MR_ERROR_OOM;
+    }
+
+    if (pthread_mutex_init(&h->swap_lock, NULL) != 0) {
+        free(h);
+        return STR_MR_ERROR_OOM;
+    }
+
+    atomic_init(&h->readers[0].cnt, 0);
+    atomic_init(&h->readers[1].cnt, 0);
+    atomic_init(&h->epoch, 0);
+    atomic_init(&h->set, set);
+
+    *handle = h;
+    return STR_MR_ERROR_SUCCESS;
+}
+
+/**
+ * @brief Function to get current set for reading.
+ *
+ * @see str_mr_handle.h
+ */
+const str_mr_set *
+str_mr_handle_acquire (str_mr_handle *handle, uint32_t *ticket)
+{
+    uint32_t epoch = 0;
+
+    for (;;) {
+        epoch = atomic_load(&handle->epoch);
+        atomic_fetch_add(&handle->readers[epoch & 1].cnt, 1);
+
+        /* swap in between could have missed this reader */
+        if (atomic_load(&handle->epoch) == epoch) {
+            break;
+        }
+
+        atomic_fetch_sub(&handle->readers[epoch & 1].cnt, 1);
+    }
+
+    *ticket = epoch & 1;
+    return atomic_load(&handle->set);
+}
+
+/**
+ * @brief Function to stop reading set got by str_mr_handle_acquire().
+ *
+ * @see str_mr_handle.h
+ */
+void
+str_mr_handle_release (str_mr_handle *handle, uint32_t ticket)
+{
+    atomic_fetch_sub_explicit(&handle->readers[ticket & 1].cnt, 1,
+                              memory_order_release);
+}
+
+/**
+ * @brief Function to replace current set.
+ *
+ * @see str_mr_handle.h
+ */
+int32_t
+str_mr_handle_swap (str_mr_handle *handle, str_mr_set *set)
+{
+    struct timespec ts = {0, 50 * 1000};
+    str_mr_set *old = NULL;
+    uint32_t epoch = 0;
+    unsigned round = 0;
+
+    if ((handle == NULL) || (set == NULL)) {
+        return STR_MR_ERROR_INVALID_ARG;
+    }
+
+    pthread_mutex_lock(&handle->swap_lock);
+
+    old   = atomic_exchange(&handle->set, set);
+    epoch = atomic_load(&handle->epoch);
+    atomic_store(&handle->epoch, epoch + 1);
+
+    /* readers of previous epoch are the only ones who can see old set */
+    while (atomic_load(&handle->readers[epoch & 1].cnt) != 0) {
+        if (++round < STR_MR_HANDLE_SPIN_CNT) {
+            sched_yield();
+        } else {
+            nanosleep(&ts, NULL);
+        }
+    }
+
+    pthread_mutex_unlock(&handle->swap_lock);
+
+    if (old != set) {
+        str_mr_set_free(old);
+    }
+
+    return STR_MR_ERROR_SUCCESS;
+}
+
+/**
+ * @brief Function to free handle together with current set.
+ *
+ * @see str_mr_handle.h
+ */
+void
+str_mr_handle_free (str_mr_handle *handle)
+{
+    if (handle == NULL) {
+        return;
+    }
+
+    pthread_mutex_destroy(&handle->swap_lock);
+    str_mr_set_free(atomic_load(&handle->set));
+    free(handle);
+}
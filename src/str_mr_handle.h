@@ -0,0 +1,118 @@
+/**
+ * @file      str_mr_handle.h
+ * @brief     Header for atomically swappable compiled set handle.
+ * @author    MMaster
+ * @version   0.1
+ * @date      2013
+ * @copyright Apache License v2
+ *
+ * Lets the active set be replaced while other threads are searching with
+ * it. Readers never lock: str_mr_handle_acquire() registers the reader in
+ * the current epoch and returns the current set, str_mr_handle_release()
+ * leaves the epoch. str_mr_handle_swap() publishes a new set, advances the
+ * epoch and frees the old set once every reader that could have seen it
+ * has released it. Needs to be linked with -pthread.
+ *
+ * Usage:
+ *    uint32_t ticket;
+ *    const str_mr_set *set = str_mr_handle_acquire(handle, &ticket);
+ *    ... str_mr_stream_init(set, ...), str_mr_pipe(set, ...) ...
+ *    str_mr_handle_release(handle, ticket);
+ */
+
+#ifndef __STR_MR_HANDLE_H__
+#define __STR_MR_HANDLE_H__
+
+#include "str_multireplace.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Swappable compiled set handle
+ *
+ * Created by str_mr_handle_init().
+ */
+typedef struct str_mr_handle str_mr_handle;
+
+/**
+ * @brief Function to create handle.
+ *
+ * Handle takes ownership of the set.
+ *
+ * Note: Caller is responsible for freeing the handle (str_mr_handle_free()).
+ *
+ * @param[in] set initial compiled set
+ * @param[out] handle newly allocated handle
+ *
+ * @return status code
+ * @retval STR_MR_ERROR_SUCCESS success
+ * @retval STR_MR_ERROR_OOM out of memory
+ * @retval STR_MR_ERROR_INVALID_ARG invalid argument provided
+ */
+int32_t
+str_mr_handle_init(str_mr_set *set, str_mr_handle **handle);
+
+/**
+ * @brief Function to get current set for reading.
+ *
+ * Lock-free, can be called from any number of threads. Returned set stays
+ * valid (and unchanged) until str_mr_handle_release() is called with the
+ * ticket, even if the handle is swapped meanwhile.
+ *
+ * Note: Set must not be modified (str_mr_set_add(), str_mr_set_remove())
+ * through the handle.
+ *
+ * @param[in] handle handle
+ * @param[out] ticket ticket to be passed to str_mr_handle_release()
+ *
+ * @return current set
+ */
+const str_mr_set *
+str_mr_handle_acquire(str_mr_handle *handle, uint32_t *ticket);
+
+/**
+ * @brief Function to stop reading set got by str_mr_handle_acquire().
+ *
+ * @param[in] handle handle
+ * @param[in] ticket ticket returned by str_mr_handle_acquire()
+ */
+void
+str_mr_handle_release(str_mr_handle *handle, uint32_t ticket);
+
+/**
+ * @brief Function to replace current set.
+ *
+ * New set is visible to every following str_mr_handle_acquire(). Call
+ * waits until all readers of the old set release it and then frees it.
+ * Concurrent swaps are serialized.
+ *
+ * Note: Must not be called by a thread holding a ticket of the same handle
+ * (it would wait for itself).
+ *
+ * @param[in] handle handle
+ * @param[in] set new compiled set (handle takes ownership)
+ *
+ * @return status code
+ * @retval STR_MR_ERROR_SUCCESS success
+ * @retval STR_MR_ERROR_INVALID_ARG invalid argument provided
+ */
+int32_t
+str_mr_handle_swap(str_mr_handle *handle, str_mr_set *set);
+
+/**
+ * @brief Function to free handle together with current set.
+ *
+ * Note: No reader can hold a ticket anymore.
+ *
+ * @param[in] handle handle to be freed (can be NULL)
+ */
+void
+str_mr_handle_free(str_mr_handle *handle);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
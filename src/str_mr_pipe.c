@@ -0,0 +1,466 @@
+/**
+ * @file      str_mr_pipe.c
+ * @brief     Pipelined multiple key-value replacement of streams.
+ * @author    MMaster <mmaster@bitbix.com>
+ * @version   0.1
+ * @date      2013
+ * @copyright Apache License v2
+ *
+ * Reader thread -> in_full queue -> matcher (calling thread) -> out_full
+ * queue -> writer thread. Buffers go back through in_free and out_free
+ * queues, so every queue has a single producer and a single consumer and
+ * there is a fixed number of buffers in flight.
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include "str_mr_pipe.h"
+
+/**
+ * Number of buffers in each direction (power of 2)
+ */
+#define STR_MR_PIPE_BUF_CNT     (4)
+
+/**
+ * Alignment of I/O buffers
+ */
+#define STR_MR_PIPE_BUF_ALIGN   (4096)
+
+/**
+ * Size of cache line (queue ends are kept apart to avoid false sharing)
+ */
+#define STR_MR_PIPE_CACHE_LINE  (64)
+
+/**
+ * Waiting rounds spent in sched_yield() before sleeping
+ */
+#define STR_MR_PIPE_SPIN_CNT    (128)
+
+/**
+ * @brief I/O buffer
+ */
+typedef struct {
+    char *data;                 /* buffer data (aligned) */
+    size_t len;                 /* length of valid data, 0 means end */
+} str_mr_pipe_buf;
+
+/**
+ * @brief Bounded lock-free single producer single consumer queue
+ */
+typedef struct {
+    _Atomic size_t head;        /* next slot to pop (owned by consumer) */
+    char pad0[STR_MR_PIPE_CACHE_LINE - sizeof(size_t)];
+    _Atomic size_t tail;        /* next slot to push (owned by producer) */
+    char pad1[STR_MR_PIPE_CACHE_LINE - sizeof(size_t)];
+    str_mr_pipe_buf *slots[STR_MR_PIPE_BUF_CNT];
+} str_mr_spsc;
+
+/**
+ * @brief Pipeline state shared by all threads
+ */
+typedef struct {
+    int in_fd;                  /* input file descriptor */
+    int out_fd;                 /* output file descriptor */
+    size_t buf_size;            /* size of one buffer */
+    str_mr_spsc in_full;        /* reader -> matcher */
+    str_mr_spsc in_free;        /* matcher -> reader */
+    str_mr_spsc out_full;       /* matcher -> writer */
+    str_mr_spsc out_free;       /* writer -> matcher */
+    str_mr_pipe_buf in_bufs[STR_MR_PIPE_BUF_CNT];
+    str_mr_pipe_buf out_bufs[STR_MR_PIPE_BUF_CNT];
+    str_mr_pipe_buf *out_cur;   /* output buffer being filled by matcher */
+    _Atomic int32_t status;     /* first error, stops all threads */
+    int err_no;                 /* errno of first I/O error */
+} str_mr_pipe_ctx;
+
+/**
+ * @brief Push buffer to queue
+ *
+ * @return false when queue is full
+ */
+static bool
+str_mr_spsc_push (str_mr_spsc *q, str_mr_pipe_buf *buf)
+{
+    size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&q->head, memory_order_acquire);
+
+    if (tail - head >= STR_MR_PIPE_BUF_CNT) {
+        return false;
+    }
+
+    q->slots[tail & (STR_MR_PIPE_BUF_CNT - 1)] = buf;
+    atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+
+    return true;
+}
+
+/**
+ * @brief Pop buffer from queue
+ *
+ * @return buffer or NULL when queue is empty
+ */
+static str_mr_pipe_buf *
+str_mr_spsc_pop (str_mr_spsc *q)
+{
+    size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+    str_mr_pipe_buf *buf = NULL;
+
+    if (head == tail) {
+        return NULL;
+    }
+
+    buf = q->slots[head & (STR_MR_PIPE_BUF_CNT - 1)];
+    atomic_store_explicit(&q->head, head + 1, memory_order_release);
+
+    return buf;
+}
+
+/**
+ * @brief Wait a bit for the other side of a queue
+ */
+static void
+str_mr_pipe_backoff (unsigned *round)
+{
+    struct timespec ts = {0, 50 * 1000};
+
+    if (++(*round) < STR_MR_PIPE_SPIN_CNT) {
+        sched_yield();
+    } else {
+        nanosleep(&ts, NULL);
+    }
+}
+
+/**
+ * @brief Record first error (stops all threads)
+ */
+static void
+str_mr_pipe_fail (str_mr_pipe_ctx *ctx, int32_t status, int err_no)
+{
+    int32_t expected = STR_MR_ERROR_SUCCESS;
+
+    if (atomic_compare_exchange_strong(&ctx->status, &expected, status)) {
+        ctx->err_no = err_no;
+    }
+}
+
+/**
+ * @brief Push buffer to queue, waiting while it is full
+ *
+ * @return false when pipeline failed meanwhile
+ */
+static bool
+str_mr_pipe_push (str_mr_pipe_ctx *ctx, str_mr_spsc *q, str_mr_pipe_buf *buf)
+{
+    unsigned round = 0;
+
+    while (!str_mr_spsc_push(q, buf)) {
+        if (atomic_load(&ctx->status) != STR_MR_ERROR_SUCCESS) {
+            return false;
+        }
+
+        str_mr_pipe_backoff(&round);
+    }
+
+    return true;
+}
+
+/**
+ * @brief Pop buffer from queue, waiting while it is empty
+ *
+ * @return buffer or NULL when pipeline failed meanwhile
+ */
+static str_mr_pipe_buf *
+str_mr_pipe_pop (str_mr_pipe_ctx *ctx, str_mr_spsc *q)
+{
+    unsigned round = 0;
+    str_mr_pipe_buf *buf = NULL;
+
+    while ((buf = str_mr_spsc_pop(q)) == NULL) {
+        if (atomic_load(&ctx->status) != STR_MR_ERROR_SUCCESS) {
+            return NULL;
+        }
+
+        str_mr_pipe_backoff(&round);
+    }
+
+    return buf;
+}
+
+/**
+ * @brief Reader thread
+ */
+static void *
+str_mr_pipe_reader (void *arg)
+{
+    str_mr_pipe_ctx *ctx = (str_mr_pipe_ctx *)arg;
+    str_mr_pipe_buf *buf = NULL;
+    ssize_t rd = 0;
+
+    for (;;) {
+        buf = str_mr_pipe_pop(ctx, &ctx->in_free);
+        if (buf == NULL) {
+            break;
+        }
+
+        do {
+            rd = read(ctx->in_fd, buf->data, ctx->buf_size);
+        } while ((rd < 0) && (errno == EINTR));
+
+        if (rd < 0) {
+            str_mr_pipe_fail(ctx, STR_MR_ERROR_IO, errno);
+            break;
+        }
+
+        buf->len = rd;
+        if (!str_mr_pipe_push(ctx, &ctx->in_full, buf) || (rd == 0)) {
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Writer thread
+ */
+static void *
+str_mr_pipe_writer (void *arg)
+{
+    str_mr_pipe_ctx *ctx = (str_mr_pipe_ctx *)arg;
+    str_mr_pipe_buf *buf = NULL;
+    ssize_t wr = 0;
+    size_t  pos = 0;
+
+    for (;;) {
+        buf = str_mr_pipe_pop(ctx, &ctx->out_full);
+        if ((buf == NULL) || (buf->len == 0)) {
+            break;
+        }
+
+        for (pos = 0; pos < buf->len; pos += wr) {
+            wr = write(ctx->out_fd, buf->data + pos, buf->len - pos);
+            if (wr < 0) {
+                if (errno == EINTR) {
+                    wr = 0;
+                    continue;
+                }
+
+                str_mr_pipe_fail(ctx, STR_MR_ERROR_IO, errno);
+                return NULL;
+            }
+        }
+
+        buf->len = 0;
+        if (!str_mr_pipe_push(ctx, &ctx->out_free, buf)) {
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Sink copying result into output buffers for writer thread
+ *
+ * @return 0 on success, 1 when pipeline failed
+ */
+static int
+str_mr_pipe_sink (void *arg, const char *ptr, size_t len)
+{
+    str_mr_pipe_ctx *ctx = (str_mr_pipe_ctx *)arg;
+    str_mr_pipe_buf *buf = NULL;
+    size_t n = 0;
+
+    while (len > 0) {
+        if (ctx->out_cur == NULL) {
+            ctx->out_cur = str_mr_pipe_pop(ctx, &ctx->out_free);
+            if (ctx->out_cur == NULL) {
+                return 1;
+            }
+        }
+
+        buf = ctx->out_cur;
+        n   = ctx->buf_size - buf->len;
+        if (n > len) {
+            n = len;
+        }
+
+        memcpy(buf->data + buf->len, ptr, n);
+        buf->len += n;
+        ptr += n;
+        len -= n;
+
+        if (buf->len == ctx->buf_size) {
+            ctx->out_cur = NULL;
+            if (!str_mr_pipe_push(ctx, &ctx->out_full, buf)) {
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Matcher, runs in calling thread
+ *
+ * @return number of replacements made or negative number on error
+ */
+static int64_t
+str_mr_pipe_match (str_mr_pipe_ctx *ctx, str_mr_stream *stream)
+{
+    str_mr_pipe_buf *buf = NULL;
+    bool    last = false;
+    int64_t rc = 0;
+
+    for (;;) {
+        buf = str_mr_pipe_pop(ctx, &ctx->in_full);
+        if (buf == NULL) {
+            return STR_MR_ERROR_IO;
+        }
+
+        if (buf->len == 0) {
+            break;
+        }
+
+        rc = str_mr_stream_feed(stream, buf->data, buf->len);
+        if ((rc < 0) || !str_mr_pipe_push(ctx, &ctx->in_free, buf)) {
+            return (rc < 0 ? rc : STR_MR_ERROR_IO);
+        }
+    }
+
+    rc = str_mr_stream_finish(stream);
+    if (rc < 0) {
+        return rc;
+    }
+
+    /* pass last partial buffer and end marker to writer */
+    if (ctx->out_cur == NULL) {
+        ctx->out_cur = str_mr_pipe_pop(ctx, &ctx->out_free);
+        if (ctx->out_cur == NULL) {
+            return STR_MR_ERROR_IO;
+        }
+    }
+
+    /* buffer belongs to writer once pushed, so its length is read before */
+    buf = ctx->out_cur;
+    ctx->out_cur = NULL;
+    last = (buf->len == 0);
+    if (!str_mr_pipe_push(ctx, &ctx->out_full, buf)) {
+        return STR_MR_ERROR_IO;
+    }
+
+    if (!last) {
+        buf = str_mr_pipe_pop(ctx, &ctx->out_free);
+        if (buf == NULL) {
+            return STR_MR_ERROR_IO;
+        }
+
+        if (!str_mr_pipe_push(ctx, &ctx->out_full, buf)) {
+            return STR_MR_ERROR_IO;
+        }
+    }
+
+    return rc;
+}
+
+/**
+ * @brief Function to replace all occurrences of match pairs from in_fd to
+ *        out_fd.
+ *
+ * @see str_mr_pipe.h
+ */
+int64_t
+str_mr_pipe (const str_mr_set *set, int in_fd, int out_fd, size_t buf_size)
+{
+    str_mr_pipe_ctx *ctx = NULL;
+    str_mr_stream *stream = NULL;
+    pthread_t reader, writer;
+    bool reader_started = false, writer_started = false;
+    int64_t rc = 0;
+    size_t i = 0;
+
+    if ((set == NULL) || (in_fd < 0) || (out_fd < 0)) {
+        return STR_MR_ERROR_INVALID_ARG;
+    }
+
+    if (buf_size == 0) {
+        buf_size = STR_MR_PIPE_DEFAULT_BUF_SIZE;
+    }
+
+    ctx = (str_mr_pipe_ctx *)calloc(1, sizeof(str_mr_pipe_ctx));
+    if (ctx == NULL) {
+        return STR_MR_ERROR_OOM;
+    }
+
+    ctx->in_fd    = in_fd;
+    ctx->out_fd   = out_fd;
+    ctx->buf_size = buf_size;
+    atomic_init(&ctx->status, STR_MR_ERROR_SUCCESS);
+
+    rc = str_mr_stream_init(set, str_mr_pipe_sink, ctx, &stream);
+    if (rc != STR_MR_ERROR_SUCCESS) {
+        free(ctx);
+        return rc;
+    }
+
+    for (i = 0; i < STR_MR_PIPE_BUF_CNT; i++) {
+        if ((posix_memalign((void **)&ctx->in_bufs[i].data,
+                            STR_MR_PIPE_BUF_ALIGN, buf_size) != 0) ||
+            (posix_memalign((void **)&ctx->out_bufs[i].data,
+                            STR_MR_PIPE_BUF_ALIGN, buf_size) != 0)) {
+            rc = STR_MR_ERROR_OOM;
+            goto cleanup;
+        }
+
+        str_mr_spsc_push(&ctx->in_free, &ctx->in_bufs[i]);
+        str_mr_spsc_push(&ctx->out_free, &ctx->out_bufs[i]);
+    }
+
+    reader_started = (pthread_create(&reader, NULL, str_mr_pipe_reader,
+                                     ctx) == 0);
+    writer_started = reader_started &&
+                     (pthread_create(&writer, NULL, str_mr_pipe_writer,
+                                     ctx) == 0);
+    if (!writer_started) {
+        str_mr_pipe_fail(ctx, STR_MR_ERROR_OOM, 0);
+        rc = STR_MR_ERROR_OOM;
+        goto cleanup;
+    }
+
+    rc = str_mr_pipe_match(ctx, stream);
+    if (rc < 0) {
+        str_mr_pipe_fail(ctx, (int32_t)rc, 0);
+    }
+
+cleanup:
+    if (reader_started) {
+        pthread_join(reader, NULL);
+    }
+
+    if (writer_started) {
+        pthread_join(writer, NULL);
+    }
+
+    /* I/O error of other thread is the reason matcher failed */
+    if (atomic_load(&ctx->status) == STR_MR_ERROR_IO) {
+        rc = STR_MR_ERROR_IO;
+        errno = ctx->err_no;
+    }
+
+    for (i = 0; i < STR_MR_PIPE_BUF_CNT; i++) {
+        free(ctx->in_bufs[i].data);
+        free(ctx->out_bufs[i].data);
+    }
+
+    str_mr_stream_free(stream);
+    free(ctx);
+
+    return rc;
+}
@@ -0,0 +1,57 @@
+/**
+ * @file      str_mr_pipe.h
+ * @brief     Header for pipelined multiple key-value replacement of streams.
+ * @author    MMaster
+ * @version   0.1
+ * @date      2013
+ * @copyright Apache License v2
+ *
+ * Reads, replaces and writes in three threads connected by bounded
+ * lock-free single producer single consumer queues, so matching overlaps
+ * with I/O. Needs to be linked with -pthread.
+ */
+
+#ifndef __STR_MR_PIPE_H__
+#define __STR_MR_PIPE_H__
+
+#include "str_multireplace.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Default size of one I/O buffer
+ */
+#define STR_MR_PIPE_DEFAULT_BUF_SIZE    (1024 * 1024)
+
+/**
+ * @brief Function to replace all occurrences of match pairs from in_fd to
+ *        out_fd.
+ *
+ * Reader thread fills page aligned buffers from in_fd, calling thread feeds
+ * them into str_mr_stream_feed() and writer thread writes the result to
+ * out_fd. Works with any file descriptors (files, pipes, sockets).
+ *
+ * Note: when writing fails, reader thread is only stopped after its current
+ * read() returns.
+ *
+ * @param[in] set compiled match pairs set (all pairs need values)
+ * @param[in] in_fd file descriptor to read input from
+ * @param[in] out_fd file descriptor to write result to
+ * @param[in] buf_size size of one I/O buffer (0 for default)
+ *
+ * @return number of replacements made or negative number on error
+ * @retval STR_MR_ERROR_OOM out of memory (or cannot start threads)
+ * @retval STR_MR_ERROR_INVALID_ARG invalid argument provided
+ * @retval STR_MR_ERROR_INVALID_MATCH some pair in set has no value
+ * @retval STR_MR_ERROR_IO reading or writing failed (errno is set)
+ */
+int64_t
+str_mr_pipe(const str_mr_set *set, int in_fd, int out_fd, size_t buf_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
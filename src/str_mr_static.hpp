@@ -0,0 +1,275 @@
+/**
+ * @file      str_mr_static.hpp
+ * @brief     Compile-time match pairs sets for fixed dictionaries.
+ * @author    MMaster
+ * @version   0.1
+ * @date      2013
+ * @copyright Apache License v2
+ *
+ * Dictionaries fixed in source (escape tables, token maps) are turned into
+ * a trie automaton by constexpr construction, so there is no runtime setup
+ * and the scan loop works on constant tables the compiler can see.
+ * Transitions are a dense table of 256 entries per trie node, so this is
+ * meant for small dictionaries (hundreds of key bytes at most), use
+ * str_mr_set_compile() for anything bigger.
+ *
+ * The trie has no failure links, the walk starts again from the root at
+ * every position, so the scan is O(n * longest key). That is cheap for
+ * the short keys of such tables, but long keys sharing long prefixes with
+ * the input are better served by the hashing search of str_mr_set.
+ *
+ * Matches are the same as of str_multireplace(): leftmost, longest,
+ * non-overlapping, the first of duplicate keys wins.
+ *
+ * Usage:
+ *    constexpr str_mr::static_pair html_pairs[] = {
+ *        {"&", "&amp;"}, {"<", "&lt;"}, {">", "&gt;"},
+ *    };
+ *    constexpr auto html = str_mr::make_static_set<html_pairs>();
+ *    std::string out;
+ *    html.replace(in, out);
+ *
+ * Header-only, needs C++20.
+ */
+
+#ifndef __STR_MR_STATIC_HPP__
+#define __STR_MR_STATIC_HPP__
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+namespace str_mr {
+
+/**
+ * @brief Key-value pair of compile-time set
+ */
+struct static_pair {
+    std::string_view key;       /**< key that should be replaced */
+    std::string_view value;     /**< value put in place of key */
+};
+
+/**
+ * @brief Count trie nodes needed for keys (root included)
+ *
+ * Every distinct non-empty key prefix is one node.
+ */
+template <size_t N>
+constexpr size_t
+static_node_cnt (const static_pair (&pairs)[N])
+{
+    size_t cnt = 1;
+
+    for (size_t i = 0; i < N; i++) {
+        for (size_t len = 1; len <= pairs[i].key.size(); len++) {
+            bool seen = false;
+
+            for (size_t k = 0; (k < i) && !seen; k++) {
+                seen = (pairs[k].key.size() >= len) &&
+                       (pairs[k].key.substr(0, len) ==
+                        pairs[i].key.substr(0, len));
+            }
+
+            cnt += (seen ? 0 : 1);
+        }
+    }
+
+    return cnt;
+}
+
+/**
+ * @brief Compile-time match pairs set
+ *
+ * Built by make_static_set(). All members are constexpr, so sets and
+ * results can also be used in constant expressions.
+ */
+template <size_t PairCnt, size_t NodeCnt>
+class static_set {
+public:
+    /** Smallest type able to index all nodes */
+    using node_t = std::conditional_t<(NodeCnt <= UINT8_MAX), uint8_t,
+                   std::conditional_t<(NodeCnt <= UINT16_MAX), uint16_t,
+                                      uint32_t>>;
+
+    /**
+     * @brief Build trie of pairs (throws on empty key)
+     */
+    constexpr explicit
+    static_set (const static_pair (&pairs)[PairCnt])
+    {
+        node_t used = 0;
+
+        for (size_t i = 0; i < PairCnt; i++) {
+            node_t node = 0;
+
+            if (pairs[i].key.empty()) {
+                throw std::invalid_argument("empty key");
+            }
+
+            for (char c : pairs[i].key) {
+                node_t &to = next_[node * 256 + (unsigned char)c];
+
+                if (to == 0) {
+                    to = ++used;
+                }
+
+                node = to;
+            }
+
+            /* the first of duplicate keys wins */
+            if (pair_[node] == 0) {
+                pair_[node] = i + 1;
+            }
+
+            pairs_[i] = pairs[i];
+        }
+    }
+
+    /**
+     * @brief Call sink with every piece of the result
+     *
+     * Pieces are untouched slices of str and values, in order and never
+     * empty. Every position of str may walk up to the longest key.
+     *
+     * @return number of replacements made
+     */
+    template <typename Sink>
+    constexpr size_t
+    for_each_piece (std::string_view str, Sink &&sink) const
+    {
+        const size_t len = str.size();
+        size_t i = 0, lit = 0, cnt = 0;
+
+        while (i < len) {
+            size_t node = next_[(unsigned char)str[i]];
+            size_t best = 0, best_len = 0;
+
+            if (node == 0) {
+                i++;            /* no key starts with this byte */
+                continue;
+            }
+
+            /* walk the trie as far as input follows, remember longest key */
+            for (size_t j = i + 1; ; j++) {
+                if (pair_[node] != 0) {
+                    best     = pair_[node];
+                    best_len = j - i;
+                }
+
+                if (j == len) {
+                    break;
+                }
+
+                node = next_[node * 256 + (unsigned char)str[j]];
+                if (node == 0) {
+                    break;
+                }
+            }
+
+            if (best == 0) {
+                i++;
+                continue;
+            }
+
+            if (lit < i) {
+                sink(str.substr(lit, i - lit));
+            }
+
+            if (!pairs_[best - 1].value.empty()) {
+                sink(pairs_[best - 1].value);
+            }
+
+            i  += best_len;
+            lit = i;
+            cnt++;
+        }
+
+        if (lit < len) {
+            sink(str.substr(lit));
+        }
+
+        return cnt;
+    }
+
+    /**
+     * @brief Replace into out (overwritten, capacity is reused)
+     *
+     * @return number of replacements made
+     */
+    constexpr size_t
+    replace (std::string_view str, std::string &out) const
+    {
+        out.clear();
+        out.reserve(str.size());
+        return for_each_piece(str, [&out] (std::string_view piece) {
+            out.append(piece);
+        });
+    }
+
+    /**
+     * @brief Replace into output iterator
+     *
+     * @return iterator past the last written character
+     */
+    template <std::output_iterator<char> It>
+    constexpr It
+    replace (std::string_view str, It out) const
+    {
+        for_each_piece(str, [&out] (std::string_view piece) {
+            for (char c : piece) {
+                *out++ = c;
+            }
+        });
+
+        return out;
+    }
+
+    /**
+     * @brief Count matches that would be replaced
+     */
+    constexpr size_t
+    count (std::string_view str) const
+    {
+        return for_each_piece(str, [] (std::string_view) {});
+    }
+
+    static constexpr size_t
+    pair_cnt () noexcept
+    {
+        return PairCnt;
+    }
+
+    static constexpr size_t
+    node_cnt () noexcept
+    {
+        return NodeCnt;
+    }
+
+private:
+    std::array<node_t, NodeCnt * 256> next_{};  /* 0 means no transition */
+    std::array<size_t, NodeCnt> pair_{};        /* pair index + 1 of key
+                                                   ending in node, or 0 */
+    std::array<static_pair, PairCnt> pairs_{};
+};
+
+/**
+ * @brief Build compile-time set of pairs array with static storage
+ */
+template <const auto &Pairs>
+consteval auto
+make_static_set ()
+{
+    constexpr size_t pair_cnt = std::extent_v<
+        std::remove_reference_t<decltype(Pairs)>>;
+
+    return static_set<pair_cnt, static_node_cnt(Pairs)>(Pairs);
+}
+
+} /* namespace str_mr */
+
+#endif
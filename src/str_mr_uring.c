@@ -0,0 +1,702 @@
+/**
+ * @file      str_mr_uring.c
+ * @brief     Asynchronous file to file key-value replacement.
+ * @author    MMaster <mmaster@bitbix.com>
+ * @version   0.1
+ * @date      2013
+ * @copyright Apache License v2
+ *
+ * Input is split into chunks of buf_size, up to depth of them are read
+ * ahead. Chunks are fed into the matcher in order as their reads complete
+ * and the result fills output buffers that are written at increasing
+ * offsets, again with up to depth writes in flight.
+ *
+ * io_uring is driven by raw system calls (no liburing needed), so only
+ * <linux/io_uring.h> is required to build it.
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "str_mr_uring.h"
+
+#ifdef STR_MR_WITH_IO_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+/**
+ * Alignment of I/O buffers
+ */
+#define STR_MR_URING_BUF_ALIGN  (4096)
+
+/**
+ * Buffer states
+ */
+#define STR_MR_URING_FREE       (0)
+#define STR_MR_URING_INFLIGHT   (1)
+#define STR_MR_URING_DONE       (2)
+
+/**
+ * @brief I/O buffer
+ */
+typedef struct {
+    char *data;                 /* buffer data (aligned) */
+    size_t len;                 /* length to be read / written */
+    size_t done;                /* length already read / written */
+    uint64_t off;               /* file offset of the buffer */
+    int state;                  /* STR_MR_URING_FREE/INFLIGHT/DONE */
+} str_mr_uring_buf;
+
+#ifdef STR_MR_WITH_IO_URING
+/**
+ * @brief Mapped io_uring
+ */
+typedef struct {
+    int fd;                     /* ring file descriptor */
+    unsigned *sq_head;          /* submission queue head (kernel owned) */
+    unsigned *sq_tail;          /* submission queue tail */
+    unsigned *sq_mask;          /* submission queue index mask */
+    unsigned *sq_entries;       /* submission queue size */
+    unsigned *sq_array;         /* submission queue index array */
+    unsigned *cq_head;          /* completion queue head */
+    unsigned *cq_tail;          /* completion queue tail (kernel owned) */
+    unsigned *cq_mask;          /* completion queue index mask */
+    struct io_uring_sqe *sqes;  /* submission queue entries */
+    struct io_uring_cqe *cqes;  /* completion queue entries */
+    void *sq_ptr;               /* mapped submission ring */
+    void *cq_ptr;               /* mapped completion ring */
+    size_t sq_sz;               /* size of mapped submission ring */
+    size_t cq_sz;               /* size of mapped completion ring */
+    size_t sqes_sz;             /* size of mapped submission entries */
+    unsigned to_submit;         /* entries queued but not submitted */
+    bool fixed;                 /* buffers are registered */
+} str_mr_ring;
+#endif
+
+/**
+ * @brief Replacement state
+ */
+typedef struct {
+    int in_fd;                  /* input file descriptor */
+    int out_fd;                 /* output file descriptor */
+    size_t buf_size;            /* size of one buffer */
+    unsigned depth;             /* number of buffers in each direction */
+    uint64_t in_off;            /* input offset to start at */
+    uint64_t in_size;           /* input length from in_off */
+    uint64_t out_off;           /* next output offset */
+    char *mem;                  /* memory of all buffers */
+    str_mr_uring_buf *in_bufs;  /* read buffers (depth) */
+    str_mr_uring_buf *out_bufs; /* write buffers (depth) */
+    str_mr_uring_buf *out_cur;  /* write buffer being filled by matcher */
+    unsigned writes;            /* writes in flight */
+    unsigned inflight;          /* operations queued in ring */
+    int32_t status;             /* first error */
+    int err_no;                 /* errno of first I/O error */
+#ifdef STR_MR_WITH_IO_URING
+    bool use_ring;              /* io_uring is used */
+    str_mr_ring ring;           /* io_uring */
+#endif
+} str_mr_uring_ctx;
+
+/**
+ * @brief Record first I/O error
+ */
+static void
+str_mr_uring_fail (str_mr_uring_ctx *ctx, int err_no)
+{
+    if (ctx->status == STR_MR_ERROR_SUCCESS) {
+        ctx->status = STR_MR_ERROR_IO;
+        ctx->err_no = err_no;
+    }
+}
+
+#ifdef STR_MR_WITH_IO_URING
+
+/**
+ * @brief Map new io_uring
+ *
+ * @return 0 on success, -1 on error (errno set)
+ */
+static int
+str_mr_ring_init (str_mr_ring *ring, unsigned entries)
+{
+    struct io_uring_params p;
+
+    memset(ring, 0, sizeof(*ring));
+    memset(&p, 0, sizeof(p));
+
+    ring->fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (ring->fd < 0) {
+        return -1;
+    }
+
+    ring->sq_sz   = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cq_sz   = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_sz > ring->sq_sz) {
+            ring->sq_sz = ring->cq_sz;
+        }
+        ring->cq_sz = 0;
+    }
+
+    ring->sq_ptr = mmap(NULL, ring->sq_sz, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring->fd,
+                        IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED) {
+        close(ring->fd);
+        return -1;
+    }
+
+    ring->cq_ptr = ring->sq_ptr;
+    if (ring->cq_sz > 0) {
+        ring->cq_ptr = mmap(NULL, ring->cq_sz, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, ring->fd,
+                            IORING_OFF_CQ_RING);
+        if (ring->cq_ptr == MAP_FAILED) {
+            munmap(ring->sq_ptr, ring->sq_sz);
+            close(ring->fd);
+            return -1;
+        }
+    }
+
+    ring->sqes = (struct io_uring_sqe *)mmap(NULL, ring->sqes_sz,
+                                             PROT_READ | PROT_WRITE,
+                                             MAP_SHARED | MAP_POPULATE,
+                                             ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        if (ring->cq_sz > 0) {
+            munmap(ring->cq_ptr, ring->cq_sz);
+        }
+        munmap(ring->sq_ptr, ring->sq_sz);
+        close(ring->fd);
+        return -1;
+    }
+
+    ring->sq_head    = (unsigned *)((char *)ring->sq_ptr + p.sq_off.head);
+    ring->sq_tail    = (unsigned *)((char *)ring->sq_ptr + p.sq_off.tail);
+    ring->sq_mask    = (unsigned *)((char *)ring->sq_ptr + p.sq_off.ring_mask);
+    ring->sq_entries = (unsigned *)((char *)ring->sq_ptr +
+                                    p.sq_off.ring_entries);
+    ring->sq_array   = (unsigned *)((char *)ring->sq_ptr + p.sq_off.array);
+    ring->cq_head    = (unsigned *)((char *)ring->cq_ptr + p.cq_off.head);
+    ring->cq_tail    = (unsigned *)((char *)ring->cq_ptr + p.cq_off.tail);
+    ring->cq_mask    = (unsigned *)((char *)ring->cq_ptr + p.cq_off.ring_mask);
+    ring->cqes       = (struct io_uring_cqe *)((char *)ring->cq_ptr +
+                                               p.cq_off.cqes);
+
+    return 0;
+}
+
+/**
+ * @brief Unmap io_uring
+ */
+static void
+str_mr_ring_fini (str_mr_ring *ring)
+{
+    munmap(ring->sqes, ring->sqes_sz);
+    if (ring->cq_sz > 0) {
+        munmap(ring->cq_ptr, ring->cq_sz);
+    }
+    munmap(ring->sq_ptr, ring->sq_sz);
+    close(ring->fd);
+}
+
+/**
+ * @brief Submit queued entries and optionally wait for completions
+ *
+ * @return 0 on success, -1 on error (errno set)
+ */
+static int
+str_mr_ring_enter (str_mr_ring *ring, unsigned min_complete)
+{
+    int ret = 0;
+
+    do {
+        ret = syscall(__NR_io_uring_enter, ring->fd, ring->to_submit,
+                      min_complete,
+                      (min_complete > 0 ? IORING_ENTER_GETEVENTS : 0),
+                      NULL, 0);
+        if (ret >= 0) {
+            ring->to_submit -= ret;
+        }
+    } while ((ret < 0) && (errno == EINTR));
+
+    return (ret < 0 ? -1 : 0);
+}
+
+/**
+ * @brief Queue read or write of the rest of the buffer
+ *
+ * @return 0 on success, -1 on error (errno set)
+ */
+static int
+str_mr_ring_queue (str_mr_uring_ctx *ctx, str_mr_uring_buf *buf,
+                   bool write)
+{
+    str_mr_ring *ring = &ctx->ring;
+    struct io_uring_sqe *sqe = NULL;
+    unsigned tail = *ring->sq_tail;
+    unsigned idx  = 0;
+
+    /* at most 2 * depth entries are ever queued, but be safe */
+    if (tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >=
+        *ring->sq_entries) {
+        if (str_mr_ring_enter(ring, 0) != 0) {
+            return -1;
+        }
+    }
+
+    idx = tail & *ring->sq_mask;
+    sqe = &ring->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+
+    sqe->fd   = (write ? ctx->out_fd : ctx->in_fd);
+    sqe->addr = (uint64_t)(uintptr_t)(buf->data + buf->done);
+    sqe->len  = buf->len - buf->done;
+    sqe->off  = buf->off + buf->done;
+    sqe->user_data = (uint64_t)(uintptr_t)buf;
+
+    if (ring->fixed) {
+        sqe->opcode    = (write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED);
+        sqe->buf_index = (buf - ctx->in_bufs);
+    } else {
+        sqe->opcode    = (write ? IORING_OP_WRITE : IORING_OP_READ);
+    }
+
+    ring->sq_array[idx] = idx;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->to_submit++;
+    ctx->inflight++;
+
+    return 0;
+}
+
+/**
+ * @brief Process one completion
+ */
+static void
+str_mr_ring_complete (str_mr_uring_ctx *ctx, struct io_uring_cqe *cqe)
+{
+    str_mr_uring_buf *buf = (str_mr_uring_buf *)(uintptr_t)cqe->user_data;
+    bool write = (buf >= ctx->out_bufs);
+
+    ctx->inflight--;
+    if (ctx->status != STR_MR_ERROR_SUCCESS) {
+        return;                 /* draining after error */
+    }
+
+    if ((cqe->res == -EINTR) || (cqe->res == -EAGAIN)) {
+        cqe->res = 0;           /* just try again */
+    } else if (cqe->res < 0) {
+        str_mr_uring_fail(ctx, -cqe->res);
+        return;
+    } else if ((cqe->res == 0) && !write) {
+        str_mr_uring_fail(ctx, EIO); /* input shrank */
+        return;
+    }
+
+    buf->done += cqe->res;
+    if (buf->done < buf->len) {
+        if (str_mr_ring_queue(ctx, buf, write) != 0) {
+            str_mr_uring_fail(ctx, errno);
+        }
+        return;
+    }
+
+    if (write) {
+        buf->state = STR_MR_URING_FREE;
+        ctx->writes--;
+    } else {
+        buf->state = STR_MR_URING_DONE;
+    }
+}
+
+/**
+ * @brief Process all available completions
+ */
+static void
+str_mr_ring_reap (str_mr_uring_ctx *ctx)
+{
+    str_mr_ring *ring = &ctx->ring;
+    unsigned head = *ring->cq_head;
+
+    while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        str_mr_ring_complete(ctx, &ring->cqes[head & *ring->cq_mask]);
+        head++;
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    }
+}
+
+#endif /* STR_MR_WITH_IO_URING */
+
+/**
+ * @brief Start reading or writing whole buffer
+ *
+ * Without io_uring the buffer is read or written right away.
+ */
+static void
+str_mr_uring_start (str_mr_uring_ctx *ctx, str_mr_uring_buf *buf,
+                    bool write)
+{
+    ssize_t n = 0;
+
+    buf->done  = 0;
+    buf->state = STR_MR_URING_INFLIGHT;
+    if (write) {
+        ctx->writes++;
+    }
+
+#ifdef STR_MR_WITH_IO_URING
+    if (ctx->use_ring) {
+        if (str_mr_ring_queue(ctx, buf, write) != 0) {
+            str_mr_uring_fail(ctx, errno);
+        }
+        return;
+    }
+#endif
+
+    while (buf->done < buf->len) {
+        if (write) {
+            n = pwrite(ctx->out_fd, buf->data + buf->done,
+                       buf->len - buf->done, buf->off + buf->done);
+        } else {
+            n = pread(ctx->in_fd, buf->data + buf->done,
+                      buf->len - buf->done, buf->off + buf->done);
+        }
+
+        if ((n < 0) && (errno == EINTR)) {
+            continue;
+        }
+
+        if (n <= 0) {
+            str_mr_uring_fail(ctx, (n < 0 ? errno : EIO));
+            return;
+        }
+
+        buf->done += n;
+    }
+
+    if (write) {
+        buf->state = STR_MR_URING_FREE;
+        ctx->writes--;
+    } else {
+        buf->state = STR_MR_URING_DONE;
+    }
+}
+
+/**
+ * @brief Submit started I/O and wait for at least one completion
+ *
+ * @param[in] wait false to only submit
+ */
+static void
+str_mr_uring_poll (str_mr_uring_ctx *ctx, bool wait)
+{
+#ifdef STR_MR_WITH_IO_URING
+    if (!ctx->use_ring || (ctx->status != STR_MR_ERROR_SUCCESS)) {
+        return;
+    }
+
+    if (((ctx->ring.to_submit > 0) || wait) &&
+        (str_mr_ring_enter(&ctx->ring, (wait ? 1 : 0)) != 0)) {
+        str_mr_uring_fail(ctx, errno);
+        return;
+    }
+
+    str_mr_ring_reap(ctx);
+#else
+    (void)ctx;
+    (void)wait;
+#endif
+}
+
+/**
+ * @brief Sink copying result into write buffers
+ *
+ * @return 0 on success, 1 on I/O error
+ */
+static int
+str_mr_uring_sink (void *arg, const char *ptr, size_t len)
+{
+    str_mr_uring_ctx *ctx = (str_mr_uring_ctx *)arg;
+    str_mr_uring_buf *buf = NULL;
+    size_t n = 0;
+    unsigned i = 0;
+
+    while (len > 0) {
+        while (ctx->out_cur == NULL) {
+            for (i = 0; i < ctx->depth; i++) {
+                if (ctx->out_bufs[i].state == STR_MR_URING_FREE) {
+                    ctx->out_cur = &ctx->out_bufs[i];
+                    ctx->out_cur->len = 0;
+                    break;
+                }
+            }
+
+            if (ctx->out_cur == NULL) {
+                str_mr_uring_poll(ctx, true);
+            }
+
+            if (ctx->status != STR_MR_ERROR_SUCCESS) {
+                return 1;
+            }
+        }
+
+        buf = ctx->out_cur;
+        n   = ctx->buf_size - buf->len;
+        if (n > len) {
+            n = len;
+        }
+
+        memcpy(buf->data + buf->len, ptr, n);
+        buf->len += n;
+        ptr += n;
+        len -= n;
+
+        if (buf->len == ctx->buf_size) {
+            buf->off = ctx->out_off;
+            ctx->out_off += buf->len;
+            ctx->out_cur  = NULL;
+            str_mr_uring_start(ctx, buf, true);
+        }
+    }
+
+    return (ctx->status != STR_MR_ERROR_SUCCESS ? 1 : 0);
+}
+
+/**
+ * @brief Start reading chunk into buffer
+ */
+static void
+str_mr_uring_read_chunk (str_mr_uring_ctx *ctx, str_mr_uring_buf *buf,
+                         uint64_t chunk)
+{
+    buf->off = chunk * ctx->buf_size;
+    buf->len = ctx->buf_size;
+    if (ctx->in_size - buf->off < buf->len) {
+        buf->len = ctx->in_size - buf->off;
+    }
+
+    buf->off += ctx->in_off;
+
+    str_mr_uring_start(ctx, buf, false);
+}
+
+/**
+ * @brief Read, replace and write all chunks
+ *
+ * @return number of replacements made or negative number on error
+ */
+static int64_t
+str_mr_uring_run (str_mr_uring_ctx *ctx, str_mr_stream *stream)
+{
+    uint64_t chunks = (ctx->in_size + ctx->buf_size - 1) / ctx->buf_size;
+    uint64_t c = 0;
+    str_mr_uring_buf *buf = NULL;
+    int64_t rc = 0;
+
+    for (c = 0; (c < chunks) && (c < ctx->depth); c++) {
+        str_mr_uring_read_chunk(ctx, &ctx->in_bufs[c], c);
+    }
+
+    for (c = 0; c < chunks; c++) {
+        buf = &ctx->in_bufs[c % ctx->depth];
+        str_mr_uring_poll(ctx, false);
+        while ((buf->state != STR_MR_URING_DONE) &&
+               (ctx->status == STR_MR_ERROR_SUCCESS)) {
+            str_mr_uring_poll(ctx, true);
+        }
+
+        if (ctx->status != STR_MR_ERROR_SUCCESS) {
+            return ctx->status;
+        }
+
+        rc = str_mr_stream_feed(stream, buf->data, buf->len);
+        if (rc < 0) {
+            return (ctx->status != STR_MR_ERROR_SUCCESS ? ctx->status : rc);
+        }
+
+        /* reuse buffer for read ahead */
+        buf->state = STR_MR_URING_FREE;
+        if (c + ctx->depth < chunks) {
+            str_mr_uring_read_chunk(ctx, buf, c + ctx->depth);
+        }
+    }
+
+    rc = str_mr_stream_finish(stream);
+    if (rc < 0) {
+        return (ctx->status != STR_MR_ERROR_SUCCESS ? ctx->status : rc);
+    }
+
+    if ((ctx->out_cur != NULL) && (ctx->out_cur->len > 0)) {
+        ctx->out_cur->off = ctx->out_off;
+        ctx->out_off += ctx->out_cur->len;
+        str_mr_uring_start(ctx, ctx->out_cur, true);
+        ctx->out_cur = NULL;
+    }
+
+    while ((ctx->writes > 0) && (ctx->status == STR_MR_ERROR_SUCCESS)) {
+        str_mr_uring_poll(ctx, true);
+    }
+
+    if (ctx->status != STR_MR_ERROR_SUCCESS) {
+        return ctx->status;
+    }
+
+    /* leave offsets at the ends, as read() and write() would */
+    if ((ftruncate(ctx->out_fd, ctx->out_off) != 0) ||
+        (lseek(ctx->out_fd, ctx->out_off, SEEK_SET) < 0) ||
+        (lseek(ctx->in_fd, ctx->in_off + ctx->in_size, SEEK_SET) < 0)) {
+        str_mr_uring_fail(ctx, errno);
+        return ctx->status;
+    }
+
+    return rc;
+}
+
+/**
+ * @brief Function to tell whether io_uring can be used.
+ *
+ * @see str_mr_uring.h
+ */
+bool
+str_mr_uring_available (void)
+{
+#ifdef STR_MR_WITH_IO_URING
+    str_mr_ring ring;
+
+    if (str_mr_ring_init(&ring, 1) != 0) {
+        return false;
+    }
+
+    str_mr_ring_fini(&ring);
+    return true;
+#else
+    return false;
+#endif
+}
+
+/**
+ * @brief Function to replace all occurrences of match pairs from file to
+ *        file.
+ *
+ * @see str_mr_uring.h
+ */
+int64_t
+str_mr_uring_file (const str_mr_set *set, int in_fd, int out_fd,
+                   size_t buf_size, unsigned depth)
+{
+    str_mr_uring_ctx ctx;
+    str_mr_stream *stream = NULL;
+    struct stat st;
+    off_t   in_off = 0, out_off = 0;
+    int64_t rc = 0;
+    unsigned i = 0;
+    int     flags = 0;
+
+    if ((set == NULL) || (in_fd < 0) || (out_fd < 0)) {
+        return STR_MR_ERROR_INVALID_ARG;
+    }
+
+    /* writes at offsets would all go to the end of append mode file */
+    flags = fcntl(out_fd, F_GETFL);
+    if ((flags >= 0) && ((flags & O_APPEND) != 0)) {
+        return STR_MR_ERROR_INVALID_ARG;
+    }
+
+    if ((flags < 0) || (fstat(in_fd, &st) != 0)) {
+        return STR_MR_ERROR_IO;
+    }
+
+    in_off  = lseek(in_fd, 0, SEEK_CUR);
+    out_off = lseek(out_fd, 0, SEEK_CUR);
+    if ((in_off < 0) || (out_off < 0)) {
+        return STR_MR_ERROR_IO;
+    }
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.in_fd    = in_fd;
+    ctx.out_fd   = out_fd;
+    ctx.in_off   = in_off;
+    ctx.in_size  = (st.st_size > in_off ? st.st_size - in_off : 0);
+    ctx.out_off  = out_off;
+    ctx.buf_size = (buf_size > 0 ? buf_size : STR_MR_URING_DEFAULT_BUF_SIZE);
+    ctx.depth    = (depth > 0 ? depth : STR_MR_URING_DEFAULT_DEPTH);
+
+    rc = str_mr_stream_init(set, str_mr_uring_sink, &ctx, &stream);
+    if (rc != STR_MR_ERROR_SUCCESS) {
+        return rc;
+    }
+
+    /* in_bufs and out_bufs are adjacent, buffer index is offset in both */
+    ctx.in_bufs = (str_mr_uring_buf *)calloc(2 * ctx.depth,
+                                             sizeof(str_mr_uring_buf));
+    if ((ctx.in_bufs == NULL) ||
+        (posix_memalign((void **)&ctx.mem, STR_MR_URING_BUF_ALIGN,
+                        2 * ctx.depth * ctx.buf_size) != 0)) {
+        free(ctx.in_bufs);
+        str_mr_stream_free(stream);
+        return STR_MR_ERROR_OOM;
+    }
+
+    ctx.out_bufs = ctx.in_bufs + ctx.depth;
+    for (i = 0; i < 2 * ctx.depth; i++) {
+        ctx.in_bufs[i].data = ctx.mem + (size_t)i * ctx.buf_size;
+    }
+
+#ifdef STR_MR_WITH_IO_URING
+    ctx.use_ring = (str_mr_ring_init(&ctx.ring, 2 * ctx.depth) == 0);
+    if (ctx.use_ring) {
+        struct iovec *iov = (struct iovec *)calloc(2 * ctx.depth,
+                                                   sizeof(struct iovec));
+
+        /* registering can fail on low RLIMIT_MEMLOCK, plain ops work too */
+        if (iov != NULL) {
+            for (i = 0; i < 2 * ctx.depth; i++) {
+                iov[i].iov_base = ctx.in_bufs[i].data;
+                iov[i].iov_len  = ctx.buf_size;
+            }
+
+            ctx.ring.fixed = (syscall(__NR_io_uring_register, ctx.ring.fd,
+                                      IORING_REGISTER_BUFFERS, iov,
+                                      2 * ctx.depth) == 0);
+            free(iov);
+        }
+    }
+#endif
+
+    rc = str_mr_uring_run(&ctx, stream);
+
+#ifdef STR_MR_WITH_IO_URING
+    if (ctx.use_ring) {
+        /* kernel may still use buffers after an error, drain the ring */
+        while (ctx.inflight > 0) {
+            if (str_mr_ring_enter(&ctx.ring, 1) != 0) {
+                break;
+            }
+            str_mr_ring_reap(&ctx);
+        }
+
+        str_mr_ring_fini(&ctx.ring);
+        if (ctx.inflight > 0) {
+            ctx.mem = NULL;     /* leak rather than free buffers in use */
+        }
+    }
+#endif
+
+    if (rc == STR_MR_ERROR_IO) {
+        errno = ctx.err_no;
+    }
+
+    free(ctx.mem);
+    free(ctx.in_bufs);
+    str_mr_stream_free(stream);
+
+    return rc;
+}
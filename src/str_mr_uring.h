@@ -0,0 +1,74 @@
+/**
+ * @file      str_mr_uring.h
+ * @brief     Header for asynchronous file to file key-value replacement.
+ * @author    MMaster
+ * @version   0.1
+ * @date      2013
+ * @copyright Apache License v2
+ *
+ * Keeps N reads and writes in flight using io_uring with registered buffers
+ * while a single thread runs the chunked matcher.
+ * io_uring is only used when compiled with -DSTR_MR_WITH_IO_URING (Linux
+ * 5.6+), otherwise (or when the kernel refuses it) plain pread()/pwrite()
+ * are used.
+ */
+
+#ifndef __STR_MR_URING_H__
+#define __STR_MR_URING_H__
+
+#include "str_multireplace.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Default size of one I/O buffer
+ */
+#define STR_MR_URING_DEFAULT_BUF_SIZE   (1024 * 1024)
+
+/**
+ * Default number of reads (and writes) in flight
+ */
+#define STR_MR_URING_DEFAULT_DEPTH      (8)
+
+/**
+ * @brief Function to tell whether io_uring can be used.
+ *
+ * @return true when compiled in and supported by the kernel
+ */
+bool
+str_mr_uring_available(void);
+
+/**
+ * @brief Function to replace all occurrences of match pairs from file to
+ *        file.
+ *
+ * Reads in_fd from its current offset to its end, replaces and writes
+ * result to out_fd from its current offset, truncating it at the end of
+ * the result. Both offsets are left at the end, as read() and write() would
+ * leave them. Both have to be regular files and out_fd must not be in
+ * append mode (O_APPEND), offsets of its writes would be ignored.
+ *
+ * @param[in] set compiled match pairs set (all pairs need values)
+ * @param[in] in_fd input file descriptor
+ * @param[in] out_fd output file descriptor
+ * @param[in] buf_size size of one I/O buffer (0 for default)
+ * @param[in] depth number of reads and writes in flight (0 for default)
+ *
+ * @return number of replacements made or negative number on error
+ * @retval STR_MR_ERROR_OOM out of memory
+ * @retval STR_MR_ERROR_INVALID_ARG invalid argument provided (or out_fd
+ *         is in append mode)
+ * @retval STR_MR_ERROR_INVALID_MATCH some pair in set has no value
+ * @retval STR_MR_ERROR_IO reading or writing failed (errno is set)
+ */
+int64_t
+str_mr_uring_file(const str_mr_set *set, int in_fd, int out_fd,
+                  size_t buf_size, unsigned depth);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
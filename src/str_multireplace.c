@@ -12,9 +12,40 @@
  * large number of replacements. (don't have exact numbers - not tested yet)
  */
 
+/* POSIX declarations for STR_MR_WITH_POSIX parts also with strict -std=c11 */
+#if !defined(_POSIX_C_SOURCE) && !defined(_GNU_SOURCE)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <stdio.h>
 #include <string.h>
+#include <errno.h>
 #include "str_multireplace.h"
 
+#ifdef STR_MR_WITH_POSIX
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+/*
+ * Rolling hashes of several key lengths are updated and probed with
+ * AVX-512 (8 lengths per instruction) or AVX2 (4 lengths) when compiled for
+ * them (e.g. -mavx2, -march=native). Define STR_MR_NO_SIMD to always use
+ * scalar code, STR_MR_SIMD_MIN_LENS to change how many key lengths are
+ * needed for them.
+ */
+#if !defined(STR_MR_NO_SIMD) && defined(__AVX512F__) && defined(__AVX512DQ__)
+#define STR_MR_SIMD_LANES       (8)
+#elif !defined(STR_MR_NO_SIMD) && defined(__AVX2__)
+#define STR_MR_SIMD_LANES       (4)
+#endif
+
+#ifdef STR_MR_SIMD_LANES
+#include <immintrin.h>
+#endif
+
 /**
  * @name String searching
  *
@@ -24,18 +55,96 @@
 
 /** @{ */
 
-#define STR_MR_MATCH_CONTINUE   (0)
-#define STR_MR_MATCH_STOP       (1)
+/**
+ * Match refused by non-overlapping match callback
+ */
+#define STR_MR_MATCH_SKIP       (2)
+
+/**
+ * End of hash chain
+ */
+#define STR_MR_NO_PAIR          ((size_t)-1)
+
+/**
+ * Keys and values in arena start at cache line boundary
+ */
+#define STR_MR_ARENA_ALIGN      (64)
+
+/**
+ * @brief Round length up to multiple of STR_MR_ARENA_ALIGN
+ */
+#define STR_MR_ARENA_ROUND(len) \
+    (((len) + STR_MR_ARENA_ALIGN - 1) & ~(size_t)(STR_MR_ARENA_ALIGN - 1))
+
+/**
+ * Minimal hash table has 2^STR_MR_BUCKET_MIN_BITS chains
+ */
+#define STR_MR_BUCKET_MIN_BITS  (4)
+
+/**
+ * Hash table has at least STR_MR_BUCKET_LOAD times more chains than keys
+ *
+ * Most positions then hit an empty chain, which is well predicted.
+ */
+#define STR_MR_BUCKET_LOAD      (4)
 
 /**
- * @brief Match pair internal wrapper structure
+ * @brief Keys of the same length
+ *
+ * Keys are found by hash of the substring in chained hash table. Chains
+ * are ordered by pair index, so the first of duplicate keys wins. Key
+ * length and removal coefficient of bucket b are kept in key_lens[b] and
+ * rem_coefs[b] of the set.
  */
 typedef struct {
-    const str_mr_match_pair *pair; /**< wrapped match pair */
-    uint64_t key_hash;             /**< hash of the key */
-    uint64_t str_hash;             /**< hash of substring of str */
-    uint64_t rem_coef;             /**< char removal coeficient for UNHASH() */
-} str_mr_match_pair_wrap;
+    size_t *heads;                 /**< hash table of pair chains */
+    unsigned bits;                 /**< hash table has 2^bits chains */
+    size_t cnt;                    /**< number of keys in bucket */
+} str_mr_bucket;
+
+/**
+ * @brief Compiled match pairs set
+ *
+ * Never changed by searching, so it can be shared by concurrent searches.
+ *
+ * Data is kept as arrays of single fields, so the search loop walks dense
+ * arrays: per bucket key lengths and removal coefficients to roll all
+ * hashes, per pair key hashes and chain links to probe.
+ */
+struct str_mr_set {
+    str_mr_bucket *buckets;        /**< hash tables of buckets */
+    size_t *key_lens;              /**< key length of each bucket, SORTED
+                                        (descending) */
+    uint64_t *rem_coefs;           /**< UNHASH() coefficient of each bucket */
+    size_t bucket_cnt;             /**< number of buckets */
+    size_t bucket_alloc;           /**< number of allocated buckets */
+    uint64_t *key_hashes;          /**< key hash of each pair */
+    size_t *chain_next;            /**< next pair in hash chain of each pair
+                                        (STR_MR_NO_PAIR ends the chain) */
+    bool *removed;                 /**< pair was removed from set */
+    size_t pair_cnt;               /**< number of pairs (including removed) */
+    size_t pair_alloc;             /**< number of allocated own pairs */
+    size_t removed_cnt;            /**< number of removed pairs */
+    const str_mr_match_pair *match_pairs; /**< pairs array (for pair index) */
+    size_t max_key_len;            /**< length of the longest key */
+    size_t no_value_cnt;           /**< number of pairs without value */
+    uint8_t *filter;               /**< key length bits of key prefixes
+                                        (NULL when not used) */
+    unsigned filter_bits;          /**< filter has 2^filter_bits entries */
+    size_t filter_q;               /**< length of hashed prefix */
+    size_t unit_mask;              /**< matches start only at multiples of
+                                        code unit size (size - 1, 0 for
+                                        bytes) */
+    str_mr_match_pair *own_pairs;  /**< pairs owned by set (after compile,
+                                        load or modification) */
+    char *arena;                   /**< keys and values copied by set */
+    size_t arena_len;              /**< used length of arena */
+    size_t arena_alloc;            /**< allocated length of arena */
+    void *map;                     /**< image mapped by str_mr_set_map() */
+    size_t map_len;                /**< length of mapped image */
+    bool in_image;                 /**< hash tables, key hashes, chain links
+                                        and filter are in loaded image */
+};
 
 /**
  * @brief Match callback fuction called when match is found
@@ -46,23 +155,47 @@ typedef struct {
  * @return callback returns whether the searching should continue or not
  * @retval STR_MR_MATCH_CONTINUE continue with searching for rest of matches
  * @retval STR_MR_MATCH_STOP stop searching
+ * @retval STR_MR_MATCH_SKIP match refused, shorter matches at the same
+ *         position are tried (only for non-overlapping matches)
  */
 typedef int (*str_mr_match_cb)(const char *str, const char *where,
                                const str_mr_match_pair *pair, void *cb_ctx);
 
+/**
+ * Rolling hash base
+ *
+ * Odd, so no character is ever shifted out of the hash and all bits of the
+ * hash depend on all characters (keys are looked up in hash tables by it).
+ */
+#define STR_MR_HASH_BASE        UINT64_C(0x9E3779B97F4A7C15)
+
 /**
  * @brief Compute hash character removal coefficient.
  *
  * Used for first hashed substring character removal in UNHASH() and REHASH()
  *
- * Computes (2^(match_len-1)). Only when match_len < 64 because hash has only
- * 64 bits, anything beyond 64 bits is thrown away automatically.
+ * Computes (STR_MR_HASH_BASE^(match_len-1)) modulo 2^64.
  *
  * @param[in] match_len length of match string
  * @return removal coefficient used in UNHASH() and REHASH()
  */
-#define COMPUTE_REM_COEF(match_len) \
-    (match_len < 64 ? (1 << (match_len - 1)) : 0)
+static
+uint64_t
+str_mr_rem_coef (size_t match_len)
+{
+    uint64_t coef = 1, base = STR_MR_HASH_BASE;
+    size_t   exp  = match_len - 1;
+
+    for (; exp > 0; exp >>= 1) {
+        if (exp & 1) {
+            coef *= base;
+        }
+
+        base *= base;
+    }
+
+    return coef;
+}
 
 /**
  * @brief Hash new character into current hash.
@@ -75,7 +208,7 @@ typedef int (*str_mr_match_cb)(const char *str, const char *where,
  * @return hash of substring (str[0..pos])
  */
 #define HASH(add_c, cur_hash) \
-    (((cur_hash) << 1) + (add_c))
+    ((cur_hash) * STR_MR_HASH_BASE + (add_c))
 
 /**
  * @brief Remove first character from hashed substring.
@@ -87,7 +220,7 @@ typedef int (*str_mr_match_cb)(const char *str, const char *where,
  * @param[in] cur_hash hash of current hashed substring
  *            (str[pos..pos+match_len-1])
  * @param[in] rem_coef preprocessed coefficient used in removal of first
- *            character from hash (2^(match_len-1))
+ *            character from hash (STR_MR_HASH_BASE^(match_len-1))
  * @return hash of substring with first character removed
  *         (str[pos+1..pos+match_len-1])
  */
@@ -107,305 +240,826 @@ typedef int (*str_mr_match_cb)(const char *str, const char *where,
  * @param[in] cur_hash hash of current hashed substring
  *            (str[pos..pos+match_len-1])
  * @param[in] rem_coef preprocessed coefficient used in removal of first
- *            character from hash (2^(match_len-1))
+ *            character from hash (STR_MR_HASH_BASE^(match_len-1))
  * @return hash of substring offsetted by 1 (str[pos+1..pos+match_len])
  */
 #define REHASH(rem_c, add_c, cur_hash, rem_coef) \
     HASH(add_c, UNHASH(rem_c, cur_hash, rem_coef))
 
 /**
- * @brief String searching using Karp-Rabin algorithm
- *
- * Searches for match in str. Doesn't care about NULL terminators.
+ * @brief Hash table chain of hash.
  *
- * Note: there are no checks, but function has following assumptions:
- * - str != NULL
- * - matches != NULL
+ * Hash is mixed by multiplication (it is poorly distributed in low bits)
+ * and top bits are taken, so doubling the table splits chain c into chains
+ * 2c and 2c+1.
  *
- * @param[in] str source string
- * @param[in] str_len source string length
- * @param[in] matches wrapped matches array SORTED by length (descending)
- * @param[in] match_cnt count of matches
- * @param[in/out] all_match_cb callback function called for all matches (even
- *                overlapping)
- * @param[in/out] no_overlap_cb callback function called only for
- *                non-overlapping matches
+ * @param[in] hash key or substring hash
+ * @param[in] bits hash table has 2^bits chains (1-63)
+ * @return chain index
  */
-static void
-str_mr_kr_search (const char *str, size_t str_len,
-                  str_mr_match_pair_wrap *matches, size_t match_cnt,
-                  str_mr_match_cb all_match_cb, str_mr_match_cb no_overlap_cb,
-                  void *cb_ctx)
+#define STR_MR_CHAIN(hash, bits) \
+    ((size_t)(((hash) * UINT64_C(0x9E3779B97F4A7C15)) >> (64 - (bits))))
+
+/**
+ * Key prefix filter is built for sets with at least this many keys, small
+ * sets have their hash tables in cache anyway
+ */
+#define STR_MR_FILTER_MIN_PAIRS (1024)
+
+/**
+ * Filter hashes key prefixes up to this length
+ */
+#define STR_MR_FILTER_Q         (4)
+
+/**
+ * Filter has at least this many entries per key
+ */
+#define STR_MR_FILTER_LOAD      (4)
+
+/**
+ * @return filter bit of keys of key_len length
+ */
+#define STR_MR_FILTER_BIT(key_len) (1u << ((key_len) & 7))
+
+/**
+ * @brief Pack first q characters of str into one number
+ */
+static inline
+uint64_t
+str_mr_filter_window (const char *str, size_t q)
 {
-    size_t      i = 1, j = 0;
-    size_t      m = 0, first_valid_m = 0;
-    uint64_t    str_hash   = 0, last_str_hash = 0;
-    size_t      match_len  = 0, last_key_len = 0;
-    uint64_t    match_hash = 0, match_hash_start = 0;
-    size_t      shortest_match_len = matches[match_cnt - 1].pair->key_length;
-    size_t      next_novp_pos = 0; /* next non-overlapping position in string */
-    const char *match = NULL;
-    int status = STR_MR_MATCH_CONTINUE;
+    uint64_t window = 0;
+    size_t   i = 0;
 
-    if (all_match_cb == NULL && no_overlap_cb == NULL) {
-        return;                 /* no reason to live */
+    for (i = 0; i < q; i++) {
+        window = (window << 8) | (unsigned char)str[i];
     }
 
-    /* count rem_coef for character removal from hash (UNHASH()/REHASH()) */
-    for (m = 0; m < match_cnt; m++) {
-        matches[m].rem_coef = COMPUTE_REM_COEF(matches[m].pair->key_length);
-    }
+    return window;
+}
 
-    /* count hash of first match_len characters of both match and str
-     * strings for each match */
-    for (m = 0; m < match_cnt; m++) {
-        matches[m].key_hash = matches[m].str_hash = 0;
-        match_len = matches[m].pair->key_length;
-        if (match_len > str_len) {
-            first_valid_m = m + 1;
-            continue;
-        }
+#ifdef STR_MR_SIMD_LANES
+/**
+ * Vector kernels read 8 bytes at str[pos + key length], so positions
+ * closer to the end of source string are done by scalar code
+ */
+#define STR_MR_SIMD_READ        (8)
 
-        /* check if we didn't already count str_hash for this */
-        if (match_len == last_key_len) {
-            matches[m].str_hash = last_str_hash;
+/**
+ * Vector kernels are used for at least this many key lengths, with fewer
+ * lengths scalar code is as fast or faster (AVX-512 breaks even around 16
+ * lengths, AVX2 is no faster up to 48). Tests define it as 1, so every
+ * search of a build with vector flags goes through the kernels.
+ */
+#ifndef STR_MR_SIMD_MIN_LENS
+#define STR_MR_SIMD_MIN_LENS    (16)
+#endif
 
-            /* hash only last 64 characters */
-            match_hash_start = (match_len > 64 ? match_len - 64 : 0);
+/**
+ * Hash table of padding lanes (always empty, chain is 0 or 1)
+ */
+static const size_t str_mr_simd_no_chain[2] = {
+    STR_MR_NO_PAIR, STR_MR_NO_PAIR
+};
 
-            /* cool now we only need to copute key hash */
-            for (i = match_hash_start; i < match_len; i++) {
-                matches[m].key_hash = HASH(matches[m].pair->key[i],
-                                           matches[m].key_hash);
-            }
+/**
+ * @brief Per bucket data of one search laid out for vector kernels
+ *
+ * All arrays have STR_MR_SIMD_LANES padding lanes behind the buckets, so
+ * kernels can start at any bucket and always process whole vectors.
+ * Padding lanes have zero key length and empty hash table.
+ */
+typedef struct {
+    uint64_t *hashes;           /* substring hash for each key length */
+    uint64_t *rem_coefs;        /* UNHASH() coefficient */
+    uint64_t *key_lens;         /* key length */
+    uint64_t *heads;            /* address of hash table */
+    uint64_t *shifts;           /* 64 - bits of hash table */
+    uint64_t *firsts;           /* first pair of chain probed last */
+} str_mr_lanes;
 
-            continue;
-        }
+/**
+ * @brief Lay out buckets of set for vector kernels
+ *
+ * Note: Caller is responsible for freeing lanes->hashes (only allocation).
+ *
+ * @return status code
+ */
+static
+int32_t
+str_mr_lanes_init (str_mr_lanes *lanes, const str_mr_set *set)
+{
+    size_t cnt = set->bucket_cnt + STR_MR_SIMD_LANES;
+    size_t b = 0;
 
-        for (i = 0; i < match_len; i++) {
-            matches[m].key_hash = HASH(matches[m].pair->key[i],
-                                       matches[m].key_hash);
-            matches[m].str_hash = HASH(str[i], matches[m].str_hash);
-        }
+    lanes->hashes = (uint64_t *)malloc(6 * cnt * sizeof(uint64_t));
+    if (lanes->hashes == NULL) {
+        return STR_MR_ERROR_OOM;
+    }
+
+    lanes->rem_coefs = lanes->hashes + cnt;
+    lanes->key_lens  = lanes->rem_coefs + cnt;
+    lanes->heads     = lanes->key_lens + cnt;
+    lanes->shifts    = lanes->heads + cnt;
+    lanes->firsts    = lanes->shifts + cnt;
 
-        /* remember last match key length and str_hash */
-        last_key_len  = match_len;
-        last_str_hash = matches[m].str_hash;
+    for (b = 0; b < cnt; b++) {
+        lanes->hashes[b] = 0;
+        if (b < set->bucket_cnt) {
+            lanes->rem_coefs[b] = set->rem_coefs[b];
+            lanes->key_lens[b]  = set->key_lens[b];
+            lanes->heads[b]     = (uintptr_t)set->buckets[b].heads;
+            lanes->shifts[b]    = 64 - set->buckets[b].bits;
+        } else {
+            lanes->rem_coefs[b] = 0;
+            lanes->key_lens[b]  = 0;
+            lanes->heads[b]     = (uintptr_t)str_mr_simd_no_chain;
+            lanes->shifts[b]    = 63;
+        }
     }
 
-    /* walk through the source string and try to find a match */
-    while (j < str_len - shortest_match_len) {
-        /* reset stored variables */
-        last_key_len  = 0;
-        last_str_hash = 0;
-
-        /* walk all matches that can fit into the source string at j */
-        for (m = first_valid_m; m < match_cnt; m++) {
-            match_len = matches[m].pair->key_length;
-            /* if a match cannot fit, skip it next time */
-            if (j >= str_len - match_len) {
-                first_valid_m = m + 1;
-                continue;
-            }
+    return STR_MR_ERROR_SUCCESS;
+}
 
-            str_hash   = matches[m].str_hash;
-            match      = matches[m].pair->key;
-            match_hash = matches[m].key_hash;
-
-            /* if it's the same match_len as last key */
-            if (match_len == last_key_len) {
-                /* use the last computed hash */
-                matches[m].str_hash = last_str_hash;
-                /* str_hash stays the same as last time */
-            } else {
-                /* compute hash of next substring */
-                matches[m].str_hash =
-                    REHASH(str[j], str[j + match_len], str_hash,
-                           matches[m].rem_coef);
-            }
+#if STR_MR_SIMD_LANES == 8
+typedef __m512i str_mr_vec;
 
-            /*
-             * compare hashes and memory (if hashes are equal)
-             * go in only if all match callback is set or j is behind
-             * end of last match
-             */
-            if (((all_match_cb != NULL) || (j >= next_novp_pos)) &&
-                (match_hash == str_hash) &&
-                (memcmp(match, str + j, match_len) == 0)) {
-                /*
-                 * match found starting at str[j] (including)
-                 */
-                if (all_match_cb != NULL) {
-                    status =
-                        all_match_cb(str, str + j, matches[m].pair, cb_ctx);
-                }
+#define STR_MR_VEC_LOAD(ptr)    _mm512_loadu_si512((const void *)(ptr))
+#define STR_MR_VEC_STORE(ptr, v) _mm512_storeu_si512((void *)(ptr), (v))
+#define STR_MR_VEC_SET1(x)      _mm512_set1_epi64((long long)(x))
+#define STR_MR_VEC_ADD(a, b)    _mm512_add_epi64((a), (b))
+#define STR_MR_VEC_SUB(a, b)    _mm512_sub_epi64((a), (b))
+#define STR_MR_VEC_MUL(a, b)    _mm512_mullo_epi64((a), (b))
+#define STR_MR_VEC_SRLV(a, b)   _mm512_srlv_epi64((a), (b))
+#define STR_MR_VEC_SLLI(a, n)   _mm512_slli_epi64((a), (n))
+#define STR_MR_VEC_GATHER(base, idx) \
+    _mm512_i64gather_epi64((idx), (const void *)(base), 1)
 
-                if (j >= next_novp_pos) {
-                    if (no_overlap_cb != NULL) {
-                        status = no_overlap_cb(str, str + j, matches[m].pair,
-                                               cb_ctx);
-                    }
+/**
+ * @brief Take sign extended lowest byte of each lane (as char is in HASH())
+ */
+static inline str_mr_vec
+str_mr_vec_char (str_mr_vec v)
+{
+    return _mm512_srai_epi64(_mm512_slli_epi64(v, 56), 56);
+}
 
-                    next_novp_pos = j + match_len;
-                }
+/**
+ * @brief Check which lanes are not STR_MR_NO_PAIR
+ */
+static inline unsigned
+str_mr_vec_found (str_mr_vec v)
+{
+    return _mm512_cmpneq_epi64_mask(v, STR_MR_VEC_SET1(STR_MR_NO_PAIR));
+}
+#else
+typedef __m256i str_mr_vec;
 
-                if (status == STR_MR_MATCH_STOP) {
-                    break;
-                }
-            }
+#define STR_MR_VEC_LOAD(ptr)    _mm256_loadu_si256((const __m256i *)(ptr))
+#define STR_MR_VEC_STORE(ptr, v) _mm256_storeu_si256((__m256i *)(ptr), (v))
+#define STR_MR_VEC_SET1(x)      _mm256_set1_epi64x((long long)(x))
+#define STR_MR_VEC_ADD(a, b)    _mm256_add_epi64((a), (b))
+#define STR_MR_VEC_SUB(a, b)    _mm256_sub_epi64((a), (b))
+#define STR_MR_VEC_MUL(a, b)    str_mr_vec_mul((a), (b))
+#define STR_MR_VEC_SRLV(a, b)   _mm256_srlv_epi64((a), (b))
+#define STR_MR_VEC_SLLI(a, n)   _mm256_slli_epi64((a), (n))
+#define STR_MR_VEC_GATHER(base, idx) \
+    _mm256_i64gather_epi64((const long long *)(base), (idx), 1)
 
-            /*
-             * store hash for next match (if it has same length)
-             */
-            last_str_hash = matches[m].str_hash;
-            last_key_len  = match_len;
-        }
+/**
+ * @brief Multiply lanes modulo 2^64 (AVX2 has 32x32 bit products only)
+ */
+static inline str_mr_vec
+str_mr_vec_mul (str_mr_vec a, str_mr_vec b)
+{
+    __m256i lo    = _mm256_mul_epu32(a, b);
+    __m256i cross = _mm256_add_epi64(
+                        _mm256_mul_epu32(_mm256_srli_epi64(a, 32), b),
+                        _mm256_mul_epu32(a, _mm256_srli_epi64(b, 32)));
 
-        if (status == STR_MR_MATCH_STOP) {
-            break;
-        }
+    return _mm256_add_epi64(lo, _mm256_slli_epi64(cross, 32));
+}
 
-        j++;
-    }
+/**
+ * @brief Take sign extended lowest byte of each lane (as char is in HASH())
+ */
+static inline str_mr_vec
+str_mr_vec_char (str_mr_vec v)
+{
+    __m256i u = _mm256_and_si256(v, _mm256_set1_epi64x(0xFF));
+
+    return _mm256_sub_epi64(u, _mm256_slli_epi64(
+                                   _mm256_and_si256(u,
+                                       _mm256_set1_epi64x(0x80)), 1));
 }
 
-/** @} */
+/**
+ * @brief Check which lanes are not STR_MR_NO_PAIR
+ */
+static inline unsigned
+str_mr_vec_found (str_mr_vec v)
+{
+    __m256i none = _mm256_cmpeq_epi64(v, STR_MR_VEC_SET1(STR_MR_NO_PAIR));
+
+    return ~(unsigned)_mm256_movemask_pd(_mm256_castsi256_pd(none)) & 0xF;
+}
+#endif
 
 /**
- * @name String replacement
+ * @brief Vector REHASH() of buckets from..to at str (position of search)
  *
- * This section contains string replacement functionality
+ * Note: str[key_len + STR_MR_SIMD_READ - 1] has to be readable for all
+ * buckets.
  */
-/** @{ */
-
-#define STR_MR_PREALLOC_OCCURENCES      (32)
-#define STR_MR_MAX_QUEUE_GROW           (1024)
+static inline void
+str_mr_lanes_roll (str_mr_lanes *lanes, size_t from, size_t to,
+                   const char *str)
+{
+    const str_mr_vec base = STR_MR_VEC_SET1(STR_MR_HASH_BASE);
+    const str_mr_vec rem_c = STR_MR_VEC_SET1((int64_t)str[0]);
+    str_mr_vec h, add_c;
+    size_t b = 0;
 
-#define MIN(x, y) (x > y ? y : x)
+    for (b = from; b < to; b += STR_MR_SIMD_LANES) {
+        h     = STR_MR_VEC_LOAD(&lanes->hashes[b]);
+        add_c = str_mr_vec_char(STR_MR_VEC_GATHER(str,
+                    STR_MR_VEC_LOAD(&lanes->key_lens[b])));
+        h = STR_MR_VEC_SUB(h, STR_MR_VEC_MUL(rem_c,
+                               STR_MR_VEC_LOAD(&lanes->rem_coefs[b])));
+        h = STR_MR_VEC_ADD(STR_MR_VEC_MUL(h, base), add_c);
+        STR_MR_VEC_STORE(&lanes->hashes[b], h);
+    }
+}
 
 /**
- * @brief Matched pair pointer
+ * @brief Vector lookup of chains of current hashes of buckets from..to
+ *
+ * First pair of each chain is stored in lanes->firsts.
+ *
+ * @return true when some chain is not empty
  */
-typedef struct {
-    size_t pos;                    /* position in source buffer */
-    const str_mr_match_pair *pair; /* match pair found */
-} str_mr_matched_pair;
+static inline bool
+str_mr_lanes_probe (str_mr_lanes *lanes, size_t from, size_t to)
+{
+    const str_mr_vec base = STR_MR_VEC_SET1(STR_MR_HASH_BASE);
+    str_mr_vec chain, first;
+    unsigned   found = 0;
+    size_t b = 0;
+
+    for (b = from; b < to; b += STR_MR_SIMD_LANES) {
+        chain = STR_MR_VEC_SRLV(STR_MR_VEC_MUL(
+                                    STR_MR_VEC_LOAD(&lanes->hashes[b]), base),
+                                STR_MR_VEC_LOAD(&lanes->shifts[b]));
+        first = STR_MR_VEC_GATHER(NULL, STR_MR_VEC_ADD(
+                    STR_MR_VEC_LOAD(&lanes->heads[b]),
+                    STR_MR_VEC_SLLI(chain, 3)));
+        STR_MR_VEC_STORE(&lanes->firsts[b], first);
+        found |= str_mr_vec_found(first);
+    }
+
+    return (found != 0);
+}
+#endif
 
 /**
- * @brief Matched pairs queue
+ * @brief Karp-Rabin search state between positions
+ *
+ * Kept by str_mr_kr_search() for one walk and by match cursor between its
+ * calls, both advance it by str_mr_kr_scan().
  */
 typedef struct {
-    str_mr_matched_pair *mps;   /* matched pairs array */
-    size_t mp_cnt;              /* number of matched pairs in array */
-    size_t mp_alloc_cnt;        /* number of matched pairs alloc'ed */
-    size_t offset;              /* offset after last replacement */
-} str_mr_mp_queue;
+    const str_mr_set *set;      /* compiled match pairs */
+    const char *str;            /* source string */
+    size_t str_len;             /* source string length */
+    size_t pos;                 /* next position to be tried */
+    size_t end;                 /* positions below can start a key */
+    size_t next_novp_pos;       /* next non-overlapping position in string */
+    size_t first_valid_b;       /* first bucket whose keys fit at pos */
+    uint64_t *str_hashes;       /* substring hash at pos for each key length */
+#ifdef STR_MR_SIMD_LANES
+    str_mr_lanes lanes;         /* buckets laid out for vector kernels */
+    size_t simd_end;            /* vector kernels are used below */
+#endif
+} str_mr_kr_state;
 
 /**
- * @brief Initialize matched pairs queue
+ * @brief Allocate search state for set
+ *
+ * Note: Caller is responsible for calling str_mr_kr_fini().
+ *
+ * @return status code
  */
 static
-str_mr_mp_queue *
-str_mr_mp_queue_init (size_t prealloc_cnt)
+int32_t
+str_mr_kr_init (str_mr_kr_state *st, const str_mr_set *set)
 {
-    str_mr_mp_queue *mpq = (str_mr_mp_queue *)malloc(sizeof(str_mr_mp_queue));
+    memset(st, 0, sizeof(*st));
+    st->set = set;
 
-    if (mpq == NULL) {
-        return NULL;
+#ifdef STR_MR_SIMD_LANES
+    if (str_mr_lanes_init(&st->lanes, set) != STR_MR_ERROR_SUCCESS) {
+        return STR_MR_ERROR_OOM;
     }
 
-    mpq->mps = (str_mr_matched_pair *)calloc(STR_MR_PREALLOC_OCCURENCES,
-                                             sizeof(str_mr_matched_pair));
-    if (mpq->mps == NULL) {
-        free(mpq);
-        return NULL;
+    st->str_hashes = st->lanes.hashes;
+#else
+    st->str_hashes = (uint64_t *)calloc(set->bucket_cnt + 1,
+                                        sizeof(uint64_t));
+    if (st->str_hashes == NULL) {
+        return STR_MR_ERROR_OOM;
     }
+#endif
 
-    mpq->mp_alloc_cnt = STR_MR_PREALLOC_OCCURENCES;
-
-    return mpq;
+    return STR_MR_ERROR_SUCCESS;
 }
 
 /**
- * @brief Free matched pairs queue
+ * @brief Free search state
  */
 static
 void
-str_mr_mp_queue_free (str_mr_mp_queue *mpq)
+str_mr_kr_fini (str_mr_kr_state *st)
 {
-    free(mpq->mps);
-    free(mpq);
+    free(st->str_hashes);
+    st->str_hashes = NULL;
 }
 
 /**
- * @brief Grow matched pairs queue as needed
- *
- * Grows queue (max. by STR_MR_MAX_QUEUE_GROW)
+ * @brief Duplicate search state with its position
  *
  * @return status code
- * @retval STR_MR_ERROR_SUCCESS successfuly grown
- * @retval STR_MR_ERROR_OOM out of memory
- * @retval STR_MR_ERROR_INVALID_ARG invalid argument provided
  */
 static
 int32_t
-str_mr_mp_queue_grow (str_mr_mp_queue *mpq)
+str_mr_kr_copy (const str_mr_kr_state *st, str_mr_kr_state *copy)
 {
-    str_mr_matched_pair *new_mps = NULL;
-    size_t new_mp_alloc_cnt = 0;
-    size_t grow_by = 0;
-
-    if (mpq == NULL) {
-        return STR_MR_ERROR_INVALID_ARG;
-    }
-
-    grow_by = MIN(mpq->mp_alloc_cnt, STR_MR_MAX_QUEUE_GROW);
-    new_mp_alloc_cnt = mpq->mp_alloc_cnt + grow_by;
+    size_t cnt = st->set->bucket_cnt;
 
-    new_mps = (str_mr_matched_pair *)realloc(mpq->mps,
-                                             new_mp_alloc_cnt *
-                                             sizeof(str_mr_matched_pair));
-    if (new_mps == NULL) {
+    if (str_mr_kr_init(copy, st->set) != STR_MR_ERROR_SUCCESS) {
         return STR_MR_ERROR_OOM;
     }
 
-    mpq->mps = new_mps;
-    mpq->mp_alloc_cnt = new_mp_alloc_cnt;
+#ifdef STR_MR_SIMD_LANES
+    /* only hashes change during the search, the rest is the same */
+    cnt += STR_MR_SIMD_LANES;
+#else
+    cnt += 1;
+#endif
+
+    memcpy(copy->str_hashes, st->str_hashes, cnt * sizeof(uint64_t));
+    copy->str     = st->str;
+    copy->str_len = st->str_len;
+    copy->pos     = st->pos;
+    copy->end     = st->end;
+    copy->next_novp_pos = st->next_novp_pos;
+    copy->first_valid_b = st->first_valid_b;
+#ifdef STR_MR_SIMD_LANES
+    copy->simd_end = st->simd_end;
+#endif
 
     return STR_MR_ERROR_SUCCESS;
 }
 
 /**
- * @brief Add new matched pair to queue
+ * @brief Start search state at the beginning of str
  *
- * @return status code
- * @retval STR_MR_ERROR_SUCCESS successfuly grown
- * @retval STR_MR_ERROR_OOM out of memory
- * @retval STR_MR_ERROR_INVALID_ARG invalid argument provided
+ * Counts hash of the first characters for each key length.
  */
 static
-int32_t
-str_mr_mp_queue_add (str_mr_mp_queue *mpq, size_t pos,
-                     const str_mr_match_pair *pair)
+void
+str_mr_kr_start (str_mr_kr_state *st, const char *str, size_t str_len)
 {
-    int32_t rc = STR_MR_ERROR_SUCCESS;
-    str_mr_matched_pair *mp = NULL;
+    const str_mr_set *set = st->set;
+    const size_t *key_lens = set->key_lens;
+    size_t bucket_cnt = set->bucket_cnt;
+    size_t b = 0, i = 0, match_len = 0;
 
-    if (mpq == NULL || pair == NULL) {
-        return STR_MR_ERROR_INVALID_ARG;
+    st->str           = str;
+    st->str_len       = str_len;
+    st->pos           = 0;
+    st->end           = 0;
+    st->next_novp_pos = 0;
+    st->first_valid_b = 0;
+#ifdef STR_MR_SIMD_LANES
+    st->simd_end      = 0;
+#endif
+
+    /* all keys removed or nothing can fit */
+    if ((bucket_cnt == 0) || (key_lens[bucket_cnt - 1] > str_len)) {
+        return;
     }
 
-    /* grow memory if needed */
-    if (mpq->mp_cnt >= mpq->mp_alloc_cnt) {
-        rc = str_mr_mp_queue_grow(mpq);
-        if (rc != STR_MR_ERROR_SUCCESS) {
-            return rc;
+    st->end = str_len - key_lens[bucket_cnt - 1] + 1;
+
+    for (b = 0; b < bucket_cnt; b++) {
+        match_len = key_lens[b];
+        st->str_hashes[b] = 0;
+        if (match_len > str_len) {
+            st->first_valid_b = b + 1;
+            continue;
+        }
+
+        for (i = 0; i < match_len; i++) {
+            st->str_hashes[b] = HASH(str[i], st->str_hashes[b]);
         }
     }
 
-    /* set new matched pair in queue */
-    mp = &(mpq->mps[mpq->mp_cnt]);
-    mp->pos  = pos;
+#ifdef STR_MR_SIMD_LANES
+    /* all lengths from first_valid_b fit and can be read behind */
+    b = st->first_valid_b;
+    if ((bucket_cnt - b >= STR_MR_SIMD_MIN_LENS) &&
+        (str_len >= key_lens[b] + STR_MR_SIMD_READ)) {
+        st->simd_end = str_len - key_lens[b] - STR_MR_SIMD_READ + 1;
+    }
+#endif
+}
+
+/**
+ * @brief Karp-Rabin walk from current position of search state
+ *
+ * At each position buckets are tried from the longest keys and only keys
+ * in hash chain of the substring hash are compared. Then all hashes are
+ * rolled in one pass over dense per bucket arrays, which is all that is
+ * done at positions covered by previous match or inside of a code unit
+ * (set->unit_mask).
+ *
+ * Walk ends at the end of str or when a callback returns
+ * STR_MR_MATCH_STOP. Then the position of the stopping match is not rolled
+ * over, so the walk can be resumed: with only non-overlapping callback the
+ * position is already taken by the match and only its hashes are rolled.
+ *
+ * @param[in/out] st search state started by str_mr_kr_start()
+ * @param[in/out] all_match_cb callback function called for all matches (even
+ *                overlapping)
+ * @param[in/out] no_overlap_cb callback function called only for
+ *                non-overlapping matches
+ *
+ * @return STR_MR_MATCH_STOP when stopped by callback,
+ *         STR_MR_MATCH_CONTINUE at the end
+ */
+static inline
+int
+str_mr_kr_scan (str_mr_kr_state *st, str_mr_match_cb all_match_cb,
+                str_mr_match_cb no_overlap_cb, void *cb_ctx)
+{
+    const str_mr_set *set = st->set;
+    const char *str = st->str;
+    size_t      str_len = st->str_len;
+    size_t      j = st->pos, end = st->end, w = 0;
+    size_t      b = 0, first_valid_b = st->first_valid_b;
+    uint64_t    str_hash   = 0;
+    size_t      match_len  = 0;
+    const str_mr_bucket *buckets = set->buckets;
+    const size_t   *key_lens   = set->key_lens;
+    const uint64_t *rem_coefs  = set->rem_coefs;
+    const uint64_t *key_hashes = set->key_hashes;
+    const size_t   *chain_next = set->chain_next;
+    const uint8_t  *filter     = set->filter;
+    size_t      unit_mask  = set->unit_mask;
+    unsigned    filter_mask = 0xFF; /* filter bits of substring at j */
+    size_t      bucket_cnt = set->bucket_cnt;
+    size_t      next_novp_pos = st->next_novp_pos;
+    uint64_t   *str_hashes = st->str_hashes;
+    const str_mr_match_pair *pair = NULL;
+    int status = STR_MR_MATCH_CONTINUE;
+#ifdef STR_MR_SIMD_LANES
+    str_mr_lanes lanes = st->lanes; /* pointers only, arrays are shared */
+    size_t      simd_end = st->simd_end;
+    bool        simd = false;   /* vector kernels can be used at j */
+#endif
+
+    /* walk through the source string and try to find a match */
+    while (j < end) {
+        /* lengths that cannot fit into the source string at j are skipped */
+        while (key_lens[first_valid_b] > str_len - j) {
+            first_valid_b++;
+        }
+
+#ifdef STR_MR_SIMD_LANES
+        simd = (j < simd_end);
+#endif
+
+        if ((j & unit_mask) != 0) {
+            filter_mask = 0;    /* inside of code unit, only roll hashes */
+        } else if (filter != NULL) {
+            filter_mask = filter[STR_MR_CHAIN(str_mr_filter_window(str + j,
+                                                  set->filter_q),
+                                              set->filter_bits)];
+        } else {
+            filter_mask = 0xFF;
+        }
+
+        /*
+         * probe from the longest keys, go in only if all match callback is
+         * set or j is behind end of last match
+         */
+        for (b = first_valid_b; b < bucket_cnt; b++) {
+            if ((all_match_cb == NULL) && (j < next_novp_pos)) {
+                break;          /* position already taken by longer match */
+            }
+
+            if (filter_mask == 0) {
+                break;          /* no key starts with prefix at j */
+            }
+
+#ifdef STR_MR_SIMD_LANES
+            /* look up chains of all lengths at once, skip when all empty */
+            if (simd && (b == first_valid_b) &&
+                !str_mr_lanes_probe(&lanes, first_valid_b, bucket_cnt)) {
+                break;
+            }
+#endif
+
+            match_len = key_lens[b];
+            if ((filter_mask & STR_MR_FILTER_BIT(match_len)) == 0) {
+                continue;
+            }
+
+            str_hash = str_hashes[b];
+
+            /* compare hashes and memory (if hashes are equal) */
+#ifdef STR_MR_SIMD_LANES
+            w = (simd ? lanes.firsts[b] :
+                 buckets[b].heads[STR_MR_CHAIN(str_hash, buckets[b].bits)]);
+#else
+            w = buckets[b].heads[STR_MR_CHAIN(str_hash, buckets[b].bits)];
+#endif
+            for (; w != STR_MR_NO_PAIR; w = chain_next[w]) {
+                if ((all_match_cb == NULL) && (j < next_novp_pos)) {
+                    break;      /* position already taken by longer match */
+                }
+
+                pair = &set->match_pairs[w];
+                if ((key_hashes[w] != str_hash) ||
+                    (memcmp(pair->key, str + j, match_len) != 0)) {
+                    continue;
+                }
+
+                /*
+                 * match found starting at str[j] (including)
+                 */
+                if (all_match_cb != NULL) {
+                    status = all_match_cb(str, str + j, pair, cb_ctx);
+                }
+
+                if (j >= next_novp_pos) {
+                    if (no_overlap_cb != NULL) {
+                        status = no_overlap_cb(str, str + j, pair, cb_ctx);
+                    }
+
+                    if (status == STR_MR_MATCH_SKIP) {
+                        /* refused, let shorter matches try this position */
+                        status = STR_MR_MATCH_CONTINUE;
+                    } else {
+                        next_novp_pos = j + match_len;
+                    }
+                }
+
+                if (status == STR_MR_MATCH_STOP) {
+                    break;
+                }
+            }
+
+            if (status == STR_MR_MATCH_STOP) {
+                break;
+            }
+        }
+
+        if (status == STR_MR_MATCH_STOP) {
+            break;
+        }
+
+        /* compute hash of next substring for each length */
+#ifdef STR_MR_SIMD_LANES
+        if (simd) {
+            str_mr_lanes_roll(&lanes, first_valid_b, bucket_cnt, str + j);
+            j++;
+            continue;
+        }
+#endif
+
+        for (b = first_valid_b; b < bucket_cnt; b++) {
+            if (key_lens[b] < str_len - j) {
+                str_hashes[b] = REHASH(str[j], str[j + key_lens[b]],
+                                       str_hashes[b], rem_coefs[b]);
+            }
+        }
+
+        j++;
+    }
+
+    st->pos           = j;
+    st->next_novp_pos = next_novp_pos;
+    st->first_valid_b = first_valid_b;
+
+    return status;
+}
+
+/**
+ * @brief String searching using Karp-Rabin algorithm
+ *
+ * Searches for match in str. Doesn't care about NULL terminators.
+ *
+ * One rolling hash is kept for each key length, see str_mr_kr_scan().
+ *
+ * Note: there are no checks, but function has following assumptions:
+ * - str != NULL
+ * - set != NULL
+ *
+ * @param[in] str source string
+ * @param[in] str_len source string length
+ * @param[in] set compiled match pairs set
+ * @param[in/out] all_match_cb callback function called for all matches (even
+ *                overlapping)
+ * @param[in/out] no_overlap_cb callback function called only for
+ *                non-overlapping matches
+ *
+ * @return status code
+ * @retval STR_MR_ERROR_SUCCESS searched (or stopped by callback)
+ * @retval STR_MR_ERROR_OOM out of memory
+ */
+static int32_t
+str_mr_kr_search (const char *str, size_t str_len, const str_mr_set *set,
+                  str_mr_match_cb all_match_cb, str_mr_match_cb no_overlap_cb,
+                  void *cb_ctx)
+{
+    str_mr_kr_state st;
+
+    if (all_match_cb == NULL && no_overlap_cb == NULL) {
+        return STR_MR_ERROR_SUCCESS; /* no reason to live */
+    }
+
+    if (set->bucket_cnt == 0) {
+        return STR_MR_ERROR_SUCCESS; /* all keys removed */
+    }
+
+    if (set->key_lens[set->bucket_cnt - 1] > str_len) {
+        return STR_MR_ERROR_SUCCESS; /* nothing can fit */
+    }
+
+    if (str_mr_kr_init(&st, set) != STR_MR_ERROR_SUCCESS) {
+        return STR_MR_ERROR_OOM;
+    }
+
+    str_mr_kr_start(&st, str, str_len);
+    str_mr_kr_scan(&st, all_match_cb, no_overlap_cb, cb_ctx);
+    str_mr_kr_fini(&st);
+
+    return STR_MR_ERROR_SUCCESS;
+}
+
+/** @} */
+
+/**
+ * @name String replacement
+ *
+ * This section contains string replacement functionality
+ */
+/** @{ */
+
+#define STR_MR_PREALLOC_OCCURENCES      (32)
+#define STR_MR_MAX_QUEUE_GROW           (1024)
+
+/**
+ * Most replacements str_multireplace() can report (define lower to test
+ * STR_MR_ERROR_OVERFLOW without 2^31 matches)
+ */
+#ifndef STR_MR_INT32_MAX
+#define STR_MR_INT32_MAX                INT32_MAX
+#endif
+
+#define MIN(x, y) (x > y ? y : x)
+
+/**
+ * @brief Matched pair pointer
+ */
+typedef struct {
+    size_t pos;                    /* position in source buffer */
+    const str_mr_match_pair *pair; /* match pair found */
+} str_mr_matched_pair;
+
+/**
+ * @brief Matched pairs queue
+ */
+typedef struct {
+    str_mr_matched_pair *mps;   /* matched pairs array */
+    size_t mp_cnt;              /* number of matched pairs in array */
+    size_t mp_alloc_cnt;        /* number of matched pairs alloc'ed */
+    size_t offset;              /* offset after last replacement */
+    int32_t status;             /* first error hit while adding matches */
+    size_t max_cnt;             /* stop searching after this many matches */
+    const size_t *quotas;       /* max. matches of each pair (can be NULL) */
+    size_t *quota_used;         /* matches of each pair so far */
+    const str_mr_match_pair *match_pairs; /* pairs array (for pair index) */
+} str_mr_mp_queue;
+
+/**
+ * @brief Initialize matched pairs queue
+ */
+static
+str_mr_mp_queue *
+str_mr_mp_queue_init (size_t prealloc_cnt)
+{
+    str_mr_mp_queue *mpq = (str_mr_mp_queue *)calloc(1,
+                                                     sizeof(str_mr_mp_queue));
+
+    if (mpq == NULL) {
+        return NULL;
+    }
+
+    mpq->mps = (str_mr_matched_pair *)calloc(STR_MR_PREALLOC_OCCURENCES,
+                                             sizeof(str_mr_matched_pair));
+    if (mpq->mps == NULL) {
+        free(mpq);
+        return NULL;
+    }
+
+    mpq->mp_alloc_cnt = STR_MR_PREALLOC_OCCURENCES;
+
+    return mpq;
+}
+
+/**
+ * @brief Free matched pairs queue
+ */
+static
+void
+str_mr_mp_queue_free (str_mr_mp_queue *mpq)
+{
+    free(mpq->quota_used);
+    free(mpq->mps);
+    free(mpq);
+}
+
+/**
+ * @brief Grow matched pairs queue as needed
+ *
+ * Grows queue (max. by STR_MR_MAX_QUEUE_GROW)
+ *
+ * @return status code
+ * @retval STR_MR_ERROR_SUCCESS successfuly grown
+ * @retval STR_MR_ERROR_OOM out of memory
+ * @retval STR_MR_ERROR_INVALID_ARG invalid argument provided
+ */
+static
+int32_t
+str_mr_mp_queue_grow (str_mr_mp_queue *mpq)
+{
+    str_mr_matched_pair *new_mps = NULL;
+    size_t new_mp_alloc_cnt = 0;
+    size_t grow_by = 0;
+
+    if (mpq == NULL) {
+        return STR_MR_ERROR_INVALID_ARG;
+    }
+
+    grow_by = MIN(mpq->mp_alloc_cnt, STR_MR_MAX_QUEUE_GROW);
+    new_mp_alloc_cnt = mpq->mp_alloc_cnt + grow_by;
+
+    new_mps = (str_mr_matched_pair *)realloc(mpq->mps,
+                                             new_mp_alloc_cnt *
+                                             sizeof(str_mr_matched_pair));
+    if (new_mps == NULL) {
+        return STR_MR_ERROR_OOM;
+    }
+
+    mpq->mps = new_mps;
+    mpq->mp_alloc_cnt = new_mp_alloc_cnt;
+
+    return STR_MR_ERROR_SUCCESS;
+}
+
+/**
+ * @brief Add new matched pair to queue
+ *
+ * @return status code
+ * @retval STR_MR_ERROR_SUCCESS successfuly grown
+ * @retval STR_MR_ERROR_OOM out of memory
+ * @retval STR_MR_ERROR_INVALID_ARG invalid argument provided
+ */
+static
+int32_t
+str_mr_mp_queue_add (str_mr_mp_queue *mpq, size_t pos,
+                     const str_mr_match_pair *pair)
+{
+    int32_t rc = STR_MR_ERROR_SUCCESS;
+    str_mr_matched_pair *mp = NULL;
+
+    if (mpq == NULL || pair == NULL) {
+        return STR_MR_ERROR_INVALID_ARG;
+    }
+
+    /* grow memory if needed */
+    if (mpq->mp_cnt >= mpq->mp_alloc_cnt) {
+        rc = str_mr_mp_queue_grow(mpq);
+        if (rc != STR_MR_ERROR_SUCCESS) {
+            return rc;
+        }
+    }
+
+    /* set new matched pair in queue */
+    mp = &(mpq->mps[mpq->mp_cnt]);
+    mp->pos  = pos;
     mp->pair = pair;
 
     /* increase queue counter */
@@ -417,148 +1071,3195 @@ str_mr_mp_queue_add (str_mr_mp_queue *mpq, size_t pos,
 }
 
 /**
- * @brief Callback when match is found
+ * @brief Callback when match is found
+ *
+ * @return callback returns whether the searching should continue or not
+ * @retval STR_MR_MATCH_CONTINUE continue with searching for rest of matches
+ * @retval STR_MR_MATCH_STOP stop searching
+ */
+int
+str_mr_match_callback (const char *str, const char *where,
+                       const str_mr_match_pair *pair, void *ctx)
+{
+    str_mr_mp_queue *mpq = (str_mr_mp_queue *)ctx;
+    size_t idx = 0;
+
+    /* pair used up its quota, let others replace it */
+    if (mpq->quotas != NULL) {
+        idx = pair - mpq->match_pairs;
+        if (mpq->quota_used[idx] >= mpq->quotas[idx]) {
+            return STR_MR_MATCH_SKIP;
+        }
+
+        mpq->quota_used[idx]++;
+    }
+
+    /* add to queue */
+    mpq->status = str_mr_mp_queue_add(mpq, (where - str), pair);
+    if (mpq->status != STR_MR_ERROR_SUCCESS) {
+        return STR_MR_MATCH_STOP;
+    }
+
+    if (mpq->mp_cnt >= mpq->max_cnt) {
+        return STR_MR_MATCH_STOP;
+    }
+
+    return STR_MR_MATCH_CONTINUE;
+}
+
+/**
+ * @brief Sink output state
+ */
+typedef struct {
+    str_mr_sink_cb sink;        /* output sink */
+    void *sink_ctx;             /* output sink context */
+    str_mr_value_cb value_cb;   /* value producer (NULL to use pair values) */
+    void *value_ctx;            /* value producer context */
+    const str_mr_match_pair *match_pairs; /* pairs array (for pair index) */
+    size_t str_pos;             /* source position not yet passed to sink */
+    size_t decide_end;          /* matches starting here are not taken yet */
+    size_t mp_cnt;              /* number of replacements made */
+    int32_t status;             /* STR_MR_ERROR_SINK when sink failed */
+} str_mr_sink_state;
+
+/**
+ * @brief Growable result buffer used as sink
+ */
+typedef struct {
+    char *data;                 /* result data */
+    size_t len;                 /* length of result data */
+    size_t alloc_len;           /* allocated length of data */
+    bool oom;                   /* out of memory while growing */
+} str_mr_buf;
+
+/**
+ * @brief Callback when match is found passing result directly to sink
+ *
+ * Non-overlapping matches are reported in order and never taken back, so
+ * everything before the match can go to the sink right away.
+ *
+ * @return callback returns whether the searching should continue or not
+ * @retval STR_MR_MATCH_CONTINUE continue with searching for rest of matches
+ * @retval STR_MR_MATCH_STOP stop searching
+ */
+static
+int
+str_mr_sink_callback (const char *str, const char *where,
+                      const str_mr_match_pair *pair, void *ctx)
+{
+    str_mr_sink_state *ss = (str_mr_sink_state *)ctx;
+    size_t pos = where - str;
+    int rc = 0;
+
+    if (pos >= ss->decide_end) {
+        return STR_MR_MATCH_STOP; /* the rest is decided by next scan */
+    }
+
+    if (pos > ss->str_pos) {
+        rc = ss->sink(ss->sink_ctx, str + ss->str_pos, pos - ss->str_pos);
+    }
+
+    if (rc == 0) {
+        if (ss->value_cb != NULL) {
+            rc = ss->value_cb(ss->value_ctx, pos, pair - ss->match_pairs, pair,
+                              ss->sink, ss->sink_ctx);
+        } else if (pair->value_length > 0) {
+            rc = ss->sink(ss->sink_ctx, pair->value, pair->value_length);
+        }
+    }
+
+    if (rc != 0) {
+        ss->status = STR_MR_ERROR_SINK;
+        return STR_MR_MATCH_STOP;
+    }
+
+    ss->str_pos = pos + pair->key_length;
+    ss->mp_cnt++;
+
+    return STR_MR_MATCH_CONTINUE;
+}
+
+/**
+ * @brief Sink appending result to growable buffer
+ *
+ * @return 0 on success, 1 when out of memory
+ */
+static
+int
+str_mr_buf_sink (void *ctx, const char *ptr, size_t len)
+{
+    str_mr_buf *buf = (str_mr_buf *)ctx;
+    char  *new_data = NULL;
+    size_t new_alloc_len = 0;
+
+    if (buf->len + len > buf->alloc_len) {
+        new_alloc_len = buf->alloc_len * 2;
+        if (new_alloc_len < buf->len + len) {
+            new_alloc_len = buf->len + len;
+        }
+
+        new_data = (char *)realloc(buf->data, new_alloc_len * sizeof(char));
+        if (new_data == NULL) {
+            buf->oom = true;
+            return 1;
+        }
+
+        buf->data      = new_data;
+        buf->alloc_len = new_alloc_len;
+    }
+
+    memcpy(buf->data + buf->len, ptr, len);
+    buf->len += len;
+
+    return 0;
+}
+
+/**
+ * @brief Count hash of the key
+ */
+static
+uint64_t
+str_mr_key_hash (const str_mr_match_pair *pair)
+{
+    uint64_t hash = 0;
+    size_t   c = 0;
+
+    for (c = 0; c < pair->key_length; c++) {
+        hash = HASH(pair->key[c], hash);
+    }
+
+    return hash;
+}
+
+/**
+ * @brief Find bucket of keys of given length
+ *
+ * @param[out] idx index of the bucket or where it would be inserted
+ * @return true when bucket exists
+ */
+static
+bool
+str_mr_bucket_find (const str_mr_set *set, size_t key_len, size_t *idx)
+{
+    size_t lo = 0, hi = set->bucket_cnt, mid = 0;
+
+    /* buckets are sorted by key length (descending) */
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (set->key_lens[mid] == key_len) {
+            *idx = mid;
+            return true;
+        }
+
+        if (set->key_lens[mid] > key_len) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    *idx = lo;
+    return false;
+}
+
+/**
+ * @brief Allocate empty hash table of bucket
+ *
+ * @return status code
+ */
+static
+int32_t
+str_mr_bucket_alloc (str_mr_bucket *bucket, unsigned bits)
+{
+    size_t i = 0;
+
+    bucket->heads = (size_t *)malloc(((size_t)1 << bits) * sizeof(size_t));
+    if (bucket->heads == NULL) {
+        return STR_MR_ERROR_OOM;
+    }
+
+    for (i = 0; i < ((size_t)1 << bits); i++) {
+        bucket->heads[i] = STR_MR_NO_PAIR;
+    }
+
+    bucket->bits = bits;
+    return STR_MR_ERROR_SUCCESS;
+}
+
+/**
+ * @brief Get bucket of keys of given length, create it if needed
+ *
+ * @param[out] idx index of the bucket
+ * @return status code
+ */
+static
+int32_t
+str_mr_bucket_get (str_mr_set *set, size_t key_len, size_t *idx)
+{
+    str_mr_bucket *new_buckets = NULL;
+    size_t        *new_lens    = NULL;
+    uint64_t      *new_coefs   = NULL;
+    str_mr_bucket  bucket;
+    size_t new_alloc = 0, move = 0;
+
+    if (str_mr_bucket_find(set, key_len, idx)) {
+        return STR_MR_ERROR_SUCCESS;
+    }
+
+    memset(&bucket, 0, sizeof(bucket));
+    if (str_mr_bucket_alloc(&bucket, STR_MR_BUCKET_MIN_BITS) !=
+        STR_MR_ERROR_SUCCESS) {
+        return STR_MR_ERROR_OOM;
+    }
+
+    if (set->bucket_cnt >= set->bucket_alloc) {
+        /* arrays that were grown stay valid, alloc is updated last */
+        new_alloc   = (set->bucket_alloc > 0 ? set->bucket_alloc * 2 : 8);
+        new_buckets = (str_mr_bucket *)realloc(set->buckets, new_alloc *
+                                               sizeof(str_mr_bucket));
+        if (new_buckets != NULL) {
+            set->buckets = new_buckets;
+            new_lens = (size_t *)realloc(set->key_lens,
+                                         new_alloc * sizeof(size_t));
+        }
+
+        if (new_lens != NULL) {
+            set->key_lens = new_lens;
+            new_coefs = (uint64_t *)realloc(set->rem_coefs,
+                                            new_alloc * sizeof(uint64_t));
+        }
+
+        if (new_coefs == NULL) {
+            free(bucket.heads);
+            return STR_MR_ERROR_OOM;
+        }
+
+        set->rem_coefs    = new_coefs;
+        set->bucket_alloc = new_alloc;
+    }
+
+    move = set->bucket_cnt - *idx;
+    memmove(&set->buckets[*idx + 1], &set->buckets[*idx],
+            move * sizeof(str_mr_bucket));
+    memmove(&set->key_lens[*idx + 1], &set->key_lens[*idx],
+            move * sizeof(size_t));
+    memmove(&set->rem_coefs[*idx + 1], &set->rem_coefs[*idx],
+            move * sizeof(uint64_t));
+    set->buckets[*idx]   = bucket;
+    set->key_lens[*idx]  = key_len;
+    set->rem_coefs[*idx] = str_mr_rem_coef(key_len);
+    set->bucket_cnt++;
+
+    return STR_MR_ERROR_SUCCESS;
+}
+
+/**
+ * @brief Append pair to the end of its hash chain
+ */
+static
+void
+str_mr_bucket_link (str_mr_set *set, str_mr_bucket *bucket, size_t w)
+{
+    size_t *link = &bucket->heads[STR_MR_CHAIN(set->key_hashes[w],
+                                                bucket->bits)];
+
+    while (*link != STR_MR_NO_PAIR) {
+        link = &set->chain_next[*link];
+    }
+
+    set->chain_next[w] = STR_MR_NO_PAIR;
+    *link = w;
+}
+
+/**
+ * @brief Double hash table of bucket
+ *
+ * Chain c is split into chains 2c and 2c+1 keeping the order.
+ *
+ * @return status code
+ */
+static
+int32_t
+str_mr_bucket_grow (str_mr_set *set, str_mr_bucket *bucket)
+{
+    size_t *old_heads = bucket->heads;
+    size_t  old_size  = (size_t)1 << bucket->bits;
+    size_t  c = 0, w = 0, next = 0;
+
+    if (str_mr_bucket_alloc(bucket, bucket->bits + 1) !=
+        STR_MR_ERROR_SUCCESS) {
+        bucket->heads = old_heads;
+        return STR_MR_ERROR_OOM;
+    }
+
+    for (c = 0; c < old_size; c++) {
+        for (w = old_heads[c]; w != STR_MR_NO_PAIR; w = next) {
+            next = set->chain_next[w];
+            str_mr_bucket_link(set, bucket, w);
+        }
+    }
+
+    free(old_heads);
+    return STR_MR_ERROR_SUCCESS;
+}
+
+/**
+ * @brief Set filter bit of key of pair
+ */
+static
+void
+str_mr_filter_add (str_mr_set *set, const str_mr_match_pair *pair)
+{
+    uint64_t window = str_mr_filter_window(pair->key, set->filter_q);
+
+    set->filter[STR_MR_CHAIN(window, set->filter_bits)] |=
+        STR_MR_FILTER_BIT(pair->key_length);
+}
+
+/**
+ * @brief Build key prefix filter of set (or drop it for small sets)
+ *
+ * Each entry of the filter has one bit for each key length modulo 8, set
+ * when some key of such length starts with prefix hashed to the entry.
+ * Search looks the entry up for substring at each position and probes only
+ * buckets whose bit is set, so most positions need one load. Prefix is
+ * as long as the shortest key, but at most STR_MR_FILTER_Q characters.
+ * Bits of removed keys stay set until next build.
+ *
+ * Set without filter is searched the same way, only slower.
+ *
+ * @return status code
+ */
+static
+int32_t
+str_mr_filter_build (str_mr_set *set)
+{
+    size_t   i = 0, live = set->pair_cnt - set->removed_cnt;
+    unsigned bits = STR_MR_BUCKET_MIN_BITS;
+
+    free(set->filter);
+    set->filter      = NULL;
+    set->filter_bits = 0;
+    set->filter_q    = 0;
+
+    if ((live < STR_MR_FILTER_MIN_PAIRS) || (set->bucket_cnt == 0)) {
+        return STR_MR_ERROR_SUCCESS;
+    }
+
+    while (((size_t)1 << bits) < STR_MR_FILTER_LOAD * live) {
+        bits++;
+    }
+
+    set->filter = (uint8_t *)calloc((size_t)1 << bits, sizeof(uint8_t));
+    if (set->filter == NULL) {
+        return STR_MR_ERROR_OOM;
+    }
+
+    set->filter_bits = bits;
+    set->filter_q    = set->key_lens[set->bucket_cnt - 1];
+    if (set->filter_q > STR_MR_FILTER_Q) {
+        set->filter_q = STR_MR_FILTER_Q;
+    }
+
+    for (i = 0; i < set->pair_cnt; i++) {
+        if (!set->removed[i]) {
+            str_mr_filter_add(set, &set->match_pairs[i]);
+        }
+    }
+
+    return STR_MR_ERROR_SUCCESS;
+}
+
+/**
+ * @brief Build buckets of all pairs that weren't removed
+ *
+ * Key hashes and removed flags of pairs have to be set. Previous buckets are
+ * released.
+ *
+ * @return status code
+ */
+static
+int32_t
+str_mr_set_build (str_mr_set *set)
+{
+    size_t   i = 0, b = 0;
+    size_t  *head = NULL;
+    unsigned bits = 0;
+
+    for (b = 0; b < set->bucket_cnt; b++) {
+        free(set->buckets[b].heads);
+    }
+
+    set->bucket_cnt   = 0;
+    set->no_value_cnt = 0;
+
+    /* create buckets and count keys */
+    for (i = 0; i < set->pair_cnt; i++) {
+        if (set->removed[i]) {
+            continue;
+        }
+
+        if (str_mr_bucket_get(set, set->match_pairs[i].key_length, &b) !=
+            STR_MR_ERROR_SUCCESS) {
+            return STR_MR_ERROR_OOM;
+        }
+
+        set->buckets[b].cnt++;
+        if (set->match_pairs[i].value == NULL) {
+            set->no_value_cnt++;
+        }
+    }
+
+    /* size hash tables by number of keys */
+    for (b = 0; b < set->bucket_cnt; b++) {
+        bits = STR_MR_BUCKET_MIN_BITS;
+        while (((size_t)1 << bits) <
+               STR_MR_BUCKET_LOAD * set->buckets[b].cnt) {
+            bits++;
+        }
+
+        free(set->buckets[b].heads);
+        set->buckets[b].heads = NULL;
+        if (str_mr_bucket_alloc(&set->buckets[b], bits) !=
+            STR_MR_ERROR_SUCCESS) {
+            return STR_MR_ERROR_OOM;
+        }
+    }
+
+    /* prepend in reverse, so chains are ordered by pair index */
+    for (i = set->pair_cnt; i-- > 0; ) {
+        if (!set->removed[i]) {
+            str_mr_bucket_find(set, set->match_pairs[i].key_length, &b);
+            head = &set->buckets[b].heads[STR_MR_CHAIN(set->key_hashes[i],
+                                                       set->buckets[b].bits)];
+            set->chain_next[i] = *head;
+            *head = i;
+        }
+    }
+
+    set->max_key_len = (set->bucket_cnt > 0 ? set->key_lens[0] : 0);
+
+    return str_mr_filter_build(set);
+}
+
+/**
+ * @brief Resize per pair arrays of set to hold alloc pairs
+ *
+ * Arrays that were resized stay valid when out of memory.
+ *
+ * @return status code
+ */
+static
+int32_t
+str_mr_set_resize_pairs (str_mr_set *set, size_t alloc)
+{
+    uint64_t *key_hashes = NULL;
+    size_t   *chain_next = NULL;
+    bool     *removed    = NULL;
+
+    key_hashes = (uint64_t *)realloc(set->key_hashes,
+                                     alloc * sizeof(uint64_t));
+    if (key_hashes == NULL) {
+        return STR_MR_ERROR_OOM;
+    }
+
+    set->key_hashes = key_hashes;
+
+    chain_next = (size_t *)realloc(set->chain_next, alloc * sizeof(size_t));
+    if (chain_next == NULL) {
+        return STR_MR_ERROR_OOM;
+    }
+
+    set->chain_next = chain_next;
+
+    removed = (bool *)realloc(set->removed, alloc * sizeof(bool));
+    if (removed == NULL) {
+        return STR_MR_ERROR_OOM;
+    }
+
+    set->removed = removed;
+
+    return STR_MR_ERROR_SUCCESS;
+}
+
+/**
+ * @brief Release compiled set initialized by str_mr_set_init()
+ */
+static
+void
+str_mr_set_fini (str_mr_set *set)
+{
+    size_t b = 0;
+
+    if (!set->in_image) {
+        for (b = 0; b < set->bucket_cnt; b++) {
+            free(set->buckets[b].heads);
+        }
+
+        free(set->key_hashes);
+        free(set->chain_next);
+        free(set->filter);
+    }
+
+    free(set->buckets);
+    free(set->key_lens);
+    free(set->rem_coefs);
+    free(set->removed);
+    free(set->own_pairs);
+    free(set->arena);
+    set->buckets    = NULL;
+    set->key_lens   = NULL;
+    set->rem_coefs  = NULL;
+    set->bucket_cnt = 0;
+    set->key_hashes = NULL;
+    set->chain_next = NULL;
+    set->removed    = NULL;
+    set->filter     = NULL;
+    set->own_pairs  = NULL;
+    set->arena      = NULL;
+}
+
+/**
+ * @brief Check match pairs and compile them into set
+ *
+ * Note: Caller is responsible for releasing the set (str_mr_set_fini()).
+ *
+ * @param[out] set set to be initialized
+ * @param[in] match_pairs match pairs array
+ * @param[in] match_pair_cnt number of match pairs in match_pair array
+ * @param[in] need_value false when values are produced by callback
+ *
+ * @return status code
+ * @retval STR_MR_ERROR_SUCCESS successfuly compiled
+ * @retval STR_MR_ERROR_OOM out of memory
+ * @retval STR_MR_ERROR_INVALID_MATCH invalid match pair provided
+ */
+static
+int32_t
+str_mr_set_init (str_mr_set *set, const str_mr_match_pair *match_pairs,
+                 size_t match_pair_cnt, bool need_value)
+{
+    size_t i = 0;
+
+    memset(set, 0, sizeof(*set));
+
+    for (i = 0; i < match_pair_cnt; i++) {
+        if ((match_pairs[i].key == NULL) || (match_pairs[i].key_length == 0) ||
+            (need_value && (match_pairs[i].value == NULL))) {
+            return STR_MR_ERROR_INVALID_MATCH;
+        }
+    }
+
+    if (str_mr_set_resize_pairs(set, (match_pair_cnt > 0 ? match_pair_cnt :
+                                      1)) != STR_MR_ERROR_SUCCESS) {
+        str_mr_set_fini(set);
+        return STR_MR_ERROR_OOM;
+    }
+
+    for (i = 0; i < match_pair_cnt; i++) {
+        set->key_hashes[i] = str_mr_key_hash(&match_pairs[i]);
+        set->removed[i]    = false;
+    }
+
+    set->pair_cnt    = match_pair_cnt;
+    set->match_pairs = match_pairs;
+
+    if (str_mr_set_build(set) != STR_MR_ERROR_SUCCESS) {
+        str_mr_set_fini(set);
+        return STR_MR_ERROR_OOM;
+    }
+
+    return STR_MR_ERROR_SUCCESS;
+}
+
+/**
+ * @brief Find all non-overlapping matches in buffer
+ *
+ * Note: Caller is responsible for freeing the queue (str_mr_mp_queue_free()).
+ *
+ * @param[in] str source buffer
+ * @param[in] str_len source buffer length
+ * @param[in] match_pairs match pairs array
+ * @param[in] match_pair_cnt number of match pairs in match_pair array
+ * @param[in] max_cnt max. number of matches to find
+ * @param[in] quotas max. number of matches of each pair (can be NULL)
+ * @param[in] unit code unit size in bytes (power of 2, matches start only
+ *            at its multiples)
+ * @param[out] queue newly allocated queue of matched pairs in order of
+ *             appearance in str
+ *
+ * @return status code
+ * @retval STR_MR_ERROR_SUCCESS successfuly searched
+ * @retval STR_MR_ERROR_OOM out of memory
+ * @retval STR_MR_ERROR_INVALID_MATCH invalid match pair provided
+ */
+static
+int32_t
+str_mr_find_matches (const char *str, size_t str_len,
+                     const str_mr_match_pair *match_pairs,
+                     size_t match_pair_cnt, size_t max_cnt,
+                     const size_t *quotas, size_t unit,
+                     str_mr_mp_queue **queue)
+{
+    int32_t rc = STR_MR_ERROR_SUCCESS;
+    str_mr_mp_queue *mpq = NULL;               /* matched pairs queue */
+    str_mr_set set;                            /* compiled match pairs */
+
+    rc = str_mr_set_init(&set, match_pairs, match_pair_cnt, true);
+    if (rc != STR_MR_ERROR_SUCCESS) {
+        return rc;
+    }
+
+    mpq = str_mr_mp_queue_init(STR_MR_PREALLOC_OCCURENCES);
+    if (mpq == NULL) {
+        str_mr_set_fini(&set);
+        return STR_MR_ERROR_OOM;
+    }
+
+    if (quotas != NULL) {
+        mpq->quota_used = (size_t *)calloc(match_pair_cnt, sizeof(size_t));
+        if (mpq->quota_used == NULL) {
+            str_mr_set_fini(&set);
+            str_mr_mp_queue_free(mpq);
+            return STR_MR_ERROR_OOM;
+        }
+    }
+
+    mpq->max_cnt     = max_cnt;
+    mpq->quotas      = quotas;
+    mpq->match_pairs = match_pairs;
+    set.unit_mask    = unit - 1;
+
+    if (max_cnt > 0) {
+        rc = str_mr_kr_search(str, str_len, &set,
+                              NULL, str_mr_match_callback, mpq);
+    }
+
+    str_mr_set_fini(&set);
+    free(mpq->quota_used);
+    mpq->quota_used = NULL;
+
+    if (rc == STR_MR_ERROR_SUCCESS) {
+        rc = mpq->status;
+    }
+
+    if (rc != STR_MR_ERROR_SUCCESS) {
+        str_mr_mp_queue_free(mpq);
+        return rc;
+    }
+
+    *queue = mpq;
+    return STR_MR_ERROR_SUCCESS;
+}
+
+/**
+ * @brief Replace limited number of occurrences of match pairs in buffer
+ *
+ * Note: there are no checks, but function has following assumptions:
+ * - str != NULL, str_len > 0
+ * - match_pairs != NULL, match_pair_cnt > 0
+ * - result != NULL, result_len != NULL
+ *
+ * @param[in] max_cnt max. number of replacements
+ * @param[in] quotas max. number of replacements of each pair (can be NULL)
+ * @param[in] unit code unit size in bytes (power of 2), terminator is one
+ *            zero code unit
+ *
+ * @return number of replacements made or negative number on error
+ */
+static
+int64_t
+str_mr_replace (const char *str, size_t str_len,
+                const str_mr_match_pair *match_pairs, size_t match_pair_cnt,
+                size_t max_cnt, const size_t *quotas, size_t unit,
+                char **result, size_t *result_len, bool terminate)
+{
+    size_t i = 0;
+    int64_t rc    = 0;
+    char   *r     = NULL;
+    size_t  r_len = 0;
+    size_t  alloc_len = 0;
+    size_t  str_pos   = 0;
+    size_t  offset    = 0;
+
+    str_mr_mp_queue *mpq = NULL;               /* matched pairs queue */
+    str_mr_matched_pair    *mp = NULL;         /* match pair helper pointer */
+
+    rc = str_mr_find_matches(str, str_len, match_pairs, match_pair_cnt,
+                             max_cnt, quotas, unit, &mpq);
+    if (rc != STR_MR_ERROR_SUCCESS) {
+        return rc;
+    }
+
+    if (mpq->mp_cnt <= 0) {
+        alloc_len = str_len;
+        if (terminate == true) {
+            alloc_len += unit;
+        }
+
+        *result = (char *)malloc(alloc_len * sizeof(char));
+        if (*result == NULL) {
+            rc = STR_MR_ERROR_OOM;
+        } else {
+            memcpy(*result, str, str_len * sizeof(char));
+            if (terminate == true) {
+                memset(*result + str_len, '\0', unit);
+            }
+
+            *result_len = str_len;
+        }
+    } else {
+        rc    = mpq->mp_cnt;
+        r_len = str_len + mpq->offset;
+        alloc_len = r_len;
+        if (terminate) {
+            alloc_len += unit;
+        }
+
+        r = (char *)malloc(alloc_len * sizeof(char));
+        if (r == NULL) {
+            str_mr_mp_queue_free(mpq);
+            return STR_MR_ERROR_OOM;
+        }
+
+        for (i = 0; i < mpq->mp_cnt; i++) {
+            mp = &mpq->mps[i];
+
+            memcpy(r + str_pos + offset, str + str_pos, mp->pos - str_pos);
+            str_pos = mp->pos + mp->pair->key_length;
+            memcpy(r + mp->pos + offset, mp->pair->value,
+                   mp->pair->value_length);
+            offset += mp->pair->value_length - mp->pair->key_length;
+        }
+
+        memcpy(r + str_pos + offset, str + str_pos, str_len - str_pos);
+        if (terminate) {
+            memset(r + r_len, '\0', unit);
+        }
+
+        *result = r;
+        *result_len = r_len;
+    }
+
+    /* cleanup */
+    str_mr_mp_queue_free(mpq);
+
+    return rc;
+}
+
+/**
+ * @brief Function to replace all occurrences of match pairs in buffer.
+ *
+ * @see str_multireplace.h
+ */
+int32_t
+str_multireplace (const char *str, size_t str_len,
+                  const str_mr_match_pair *match_pairs, size_t match_pair_cnt,
+                  char **result, size_t *result_len, bool terminate)
+{
+    int64_t rc = 0;
+
+    rc = str_multireplace64(str, str_len, match_pairs, match_pair_cnt,
+                            result, result_len, terminate);
+    if (rc > STR_MR_INT32_MAX) {
+        free(*result);
+        *result = NULL;
+        return STR_MR_ERROR_OVERFLOW;
+    }
+
+    return (int32_t)rc;
+}
+
+/**
+ * @brief Function to replace all occurrences of match pairs in buffer.
+ *
+ * @see str_multireplace.h
+ */
+int64_t
+str_multireplace64 (const char *str, size_t str_len,
+                    const str_mr_match_pair *match_pairs,
+                    size_t match_pair_cnt,
+                    char **result, size_t *result_len, bool terminate)
+{
+    if ((str == NULL) || (str_len <= 0) || (match_pairs == NULL) ||
+        (match_pair_cnt <= 0) || (result == NULL) || (result_len == NULL)) {
+        return STR_MR_ERROR_INVALID_ARG;
+    }
+
+    return str_mr_replace(str, str_len, match_pairs, match_pair_cnt,
+                          STR_MR_UNLIMITED, NULL, 1,
+                          result, result_len, terminate);
+}
+
+/**
+ * @brief Function to replace limited number of occurrences of match pairs.
+ *
+ * @see str_multireplace.h
+ */
+int64_t
+str_multireplace_limit (const char *str, size_t str_len,
+                        const str_mr_match_pair *match_pairs,
+                        size_t match_pair_cnt,
+                        size_t max_replacements, const size_t *pair_quotas,
+                        char **result, size_t *result_len, bool terminate)
+{
+    if ((str == NULL) || (str_len <= 0) || (match_pairs == NULL) ||
+        (match_pair_cnt <= 0) || (result == NULL) || (result_len == NULL)) {
+        return STR_MR_ERROR_INVALID_ARG;
+    }
+
+    return str_mr_replace(str, str_len, match_pairs, match_pair_cnt,
+                          max_replacements, pair_quotas, 1,
+                          result, result_len, terminate);
+}
+
+/**
+ * @brief Define replacement function for buffers of code unit type
+ *
+ * Pairs are turned into byte pairs and the buffer is searched as bytes.
+ * Hashes roll over every byte, but keys are probed only at code unit
+ * boundaries, so bytes straddling two code units never match. Result is
+ * the same as replacing code units directly: code units are compared as
+ * they are, surrogate pairs are not decoded.
+ *
+ * @param[in] name name of the function
+ * @param[in] char_t code unit type (size has to be power of 2)
+ * @param[in] pair_t match pair type of char_t strings
+ */
+#define STR_MR_DEFINE_UNIT_REPLACE(name, char_t, pair_t) \
+int64_t \
+name (const char_t *str, size_t str_len, \
+      const pair_t *match_pairs, size_t match_pair_cnt, \
+      char_t **result, size_t *result_len, bool terminate) \
+{ \
+    str_mr_match_pair *mps = NULL; \
+    size_t  i = 0, len = 0; \
+    int64_t rc = 0; \
+ \
+    if ((str == NULL) || (str_len <= 0) || (match_pairs == NULL) || \
+        (match_pair_cnt <= 0) || (result == NULL) || (result_len == NULL)) { \
+        return STR_MR_ERROR_INVALID_ARG; \
+    } \
+ \
+    mps = (str_mr_match_pair *)malloc(match_pair_cnt * \
+                                      sizeof(str_mr_match_pair)); \
+    if (mps == NULL) { \
+        return STR_MR_ERROR_OOM; \
+    } \
+ \
+    for (i = 0; i < match_pair_cnt; i++) { \
+        mps[i].key          = (const char *)match_pairs[i].key; \
+        mps[i].key_length   = match_pairs[i].key_length * sizeof(char_t); \
+        mps[i].value        = (const char *)match_pairs[i].value; \
+        mps[i].value_length = match_pairs[i].value_length * sizeof(char_t); \
+    } \
+ \
+    rc = str_mr_replace((const char *)str, str_len * sizeof(char_t), mps, \
+                        match_pair_cnt, STR_MR_UNLIMITED, NULL, \
+                        sizeof(char_t), (char **)result, &len, terminate); \
+    free(mps); \
+    if (rc >= 0) { \
+        *result_len = len / sizeof(char_t); \
+    } \
+ \
+    return rc; \
+}
+
+/**
+ * @brief Function to replace match pairs in UTF-16 buffer.
+ *
+ * @see str_multireplace.h
+ */
+STR_MR_DEFINE_UNIT_REPLACE(str_multireplace16, char16_t, str_mr_match_pair16)
+
+/**
+ * @brief Function to replace match pairs in UTF-32 buffer.
+ *
+ * @see str_multireplace.h
+ */
+STR_MR_DEFINE_UNIT_REPLACE(str_multireplace32, char32_t, str_mr_match_pair32)
+
+/**
+ * @brief Function to replace match pairs in wide character buffer.
+ *
+ * @see str_multireplace.h
+ */
+STR_MR_DEFINE_UNIT_REPLACE(str_multireplace_w, wchar_t, str_mr_match_pair_w)
+
+/**
+ * @brief In-place rewrite state
+ */
+typedef struct {
+    char *str;                  /* buffer being rewritten */
+    size_t rd;                  /* source position not yet moved */
+    size_t wr;                  /* write cursor (never ahead of rd) */
+    const str_mr_match_pair *pending; /* last match, value not written yet */
+    size_t mp_cnt;              /* number of replacements made */
+} str_mr_inplace_state;
+
+/**
+ * @brief Write pending value and move untouched source up to end down
+ *
+ * Nothing at or behind end is written, as value is never longer than key.
+ */
+static
+void
+str_mr_inplace_flush (str_mr_inplace_state *is, size_t end)
+{
+    if (is->pending != NULL) {
+        memcpy(is->str + is->wr, is->pending->value,
+               is->pending->value_length);
+        is->wr     += is->pending->value_length;
+        is->pending = NULL;
+    }
+
+    if (is->wr != is->rd) {
+        memmove(is->str + is->wr, is->str + is->rd, end - is->rd);
+    }
+
+    is->wr += end - is->rd;
+    is->rd  = end;
+}
+
+/**
+ * @brief Callback when match is found rewriting the buffer in place
+ *
+ * Search never reads before the position of current match again, but it
+ * still rolls its hashes over characters of the match. So only what lies
+ * before the match is written now and value of the match waits for the
+ * next one (or the end of search).
+ *
+ * @return STR_MR_MATCH_CONTINUE
+ */
+static
+int
+str_mr_inplace_callback (const char *str, const char *where,
+                         const str_mr_match_pair *pair, void *ctx)
+{
+    str_mr_inplace_state *is = (str_mr_inplace_state *)ctx;
+    size_t pos = where - str;
+
+    str_mr_inplace_flush(is, pos);
+
+    is->pending = pair;
+    is->rd      = pos + pair->key_length;
+    is->mp_cnt++;
+
+    return STR_MR_MATCH_CONTINUE;
+}
+
+/**
+ * @brief Function to replace all occurrences of match pairs in place.
+ *
+ * Buffer is rewritten during the search, there is no queue of matches.
+ *
+ * @see str_multireplace.h
+ */
+int64_t
+str_multireplace_inplace (char *str, size_t str_len,
+                          const str_mr_match_pair *match_pairs,
+                          size_t match_pair_cnt, size_t *result_len)
+{
+    size_t i = 0;
+    int64_t rc = 0;
+    str_mr_inplace_state is;
+    str_mr_set set;                            /* compiled match pairs */
+
+    if ((str == NULL) || (str_len <= 0) || (match_pairs == NULL) ||
+        (match_pair_cnt <= 0) || (result_len == NULL)) {
+        return STR_MR_ERROR_INVALID_ARG;
+    }
+
+    /* result has to fit into source buffer */
+    for (i = 0; i < match_pair_cnt; i++) {
+        if (match_pairs[i].value_length > match_pairs[i].key_length) {
+            return STR_MR_ERROR_INVALID_MATCH;
+        }
+    }
+
+    rc = str_mr_set_init(&set, match_pairs, match_pair_cnt, true);
+    if (rc != STR_MR_ERROR_SUCCESS) {
+        return rc;
+    }
+
+    memset(&is, 0, sizeof(is));
+    is.str = str;
+
+    rc = str_mr_kr_search(str, str_len, &set, NULL, str_mr_inplace_callback,
+                          &is);
+    str_mr_set_fini(&set);
+    if (rc != STR_MR_ERROR_SUCCESS) {
+        return rc;
+    }
+
+    str_mr_inplace_flush(&is, str_len);
+
+    *result_len = is.wr;
+    return is.mp_cnt;
+}
+
+#ifdef STR_MR_WITH_POSIX
+/**
+ * @brief Function to describe replaced buffer as scatter/gather list.
+ *
+ * @see str_multireplace.h
+ */
+int64_t
+str_multireplace_iov (const char *str, size_t str_len,
+                      const str_mr_match_pair *match_pairs,
+                      size_t match_pair_cnt,
+                      struct iovec **iov, size_t *iov_cnt)
+{
+    size_t i = 0;
+    int64_t rc      = 0;
+    size_t  str_pos = 0;
+    size_t  v_cnt   = 0;
+    struct iovec *v = NULL;
+
+    str_mr_mp_queue *mpq = NULL;               /* matched pairs queue */
+    str_mr_matched_pair    *mp = NULL;         /* match pair helper pointer */
+
+    if ((str == NULL) || (str_len <= 0) || (match_pairs == NULL) ||
+        (match_pair_cnt <= 0) || (iov == NULL) || (iov_cnt == NULL)) {
+        return STR_MR_ERROR_INVALID_ARG;
+    }
+
+    rc = str_mr_find_matches(str, str_len, match_pairs, match_pair_cnt,
+                             STR_MR_UNLIMITED, NULL, 1, &mpq);
+    if (rc != STR_MR_ERROR_SUCCESS) {
+        return rc;
+    }
+
+    /* untouched slice before each match + value + untouched tail */
+    v = (struct iovec *)malloc((2 * mpq->mp_cnt + 1) * sizeof(struct iovec));
+    if (v == NULL) {
+        str_mr_mp_queue_free(mpq);
+        return STR_MR_ERROR_OOM;
+    }
+
+    for (i = 0; i < mpq->mp_cnt; i++) {
+        mp = &mpq->mps[i];
+
+        if (mp->pos > str_pos) {
+            v[v_cnt].iov_base = (void *)(str + str_pos);
+            v[v_cnt].iov_len  = mp->pos - str_pos;
+            v_cnt++;
+        }
+
+        if (mp->pair->value_length > 0) {
+            v[v_cnt].iov_base = (void *)mp->pair->value;
+            v[v_cnt].iov_len  = mp->pair->value_length;
+            v_cnt++;
+        }
+
+        str_pos = mp->pos + mp->pair->key_length;
+    }
+
+    if (str_len > str_pos) {
+        v[v_cnt].iov_base = (void *)(str + str_pos);
+        v[v_cnt].iov_len  = str_len - str_pos;
+        v_cnt++;
+    }
+
+    *iov     = v;
+    *iov_cnt = v_cnt;
+    rc = mpq->mp_cnt;
+
+    /* cleanup */
+    str_mr_mp_queue_free(mpq);
+
+    return rc;
+}
+#endif
+
+/**
+ * @brief Pass replaced buffer to sink up to given position
+ *
+ * Replaces matches starting before decide_end and passes everything up to
+ * decide_end (or up to the end of last match) to the sink.
+ * Sink state str_pos is set to the end of what was passed to the sink.
+ *
+ * @param[in] set compiled match pairs set
+ * @param[in,out] ss sink state (str_pos should be 0)
+ * @param[in] str source buffer
+ * @param[in] str_len source buffer length
+ * @param[in] decide_end position in str where scanning should stop (all keys
+ *            starting before it have to fit into str)
+ *
+ * @return status code
+ * @retval STR_MR_ERROR_SUCCESS success
+ * @retval STR_MR_ERROR_OOM out of memory
+ * @retval STR_MR_ERROR_SINK sink or value callback failed
+ */
+static
+int32_t
+str_mr_sink_scan (const str_mr_set *set, str_mr_sink_state *ss,
+                  const char *str, size_t str_len, size_t decide_end)
+{
+    int32_t rc = STR_MR_ERROR_SUCCESS;
+
+    if (decide_end == 0) {
+        return STR_MR_ERROR_SUCCESS;
+    }
+
+    ss->decide_end = decide_end;
+    rc = str_mr_kr_search(str, str_len, set, NULL, str_mr_sink_callback, ss);
+    if (rc != STR_MR_ERROR_SUCCESS) {
+        return rc;
+    }
+
+    if (ss->status != STR_MR_ERROR_SUCCESS) {
+        return ss->status;
+    }
+
+    /* untouched tail */
+    if (decide_end > ss->str_pos) {
+        if (ss->sink(ss->sink_ctx, str + ss->str_pos,
+                     decide_end - ss->str_pos) != 0) {
+            return STR_MR_ERROR_SINK;
+        }
+
+        ss->str_pos = decide_end;
+    }
+
+    return STR_MR_ERROR_SUCCESS;
+}
+
+/**
+ * @brief Replace all occurrences of match pairs into a sink
+ *
+ * Note: there are no checks, but function has following assumptions:
+ * - str != NULL, str_len > 0
+ * - match_pairs != NULL, match_pair_cnt > 0
+ * - sink != NULL
+ *
+ * @param[in] value_cb value producer or NULL to use values of match pairs
+ *
+ * @return number of replacements made or negative number on error
+ */
+static
+int64_t
+str_mr_replace_sink (const char *str, size_t str_len,
+                     const str_mr_match_pair *match_pairs,
+                     size_t match_pair_cnt,
+                     str_mr_value_cb value_cb, void *value_ctx,
+                     str_mr_sink_cb sink, void *sink_ctx)
+{
+    int64_t rc = 0;
+    str_mr_sink_state ss;
+    str_mr_set set;                            /* compiled match pairs */
+
+    rc = str_mr_set_init(&set, match_pairs, match_pair_cnt,
+                         (value_cb == NULL));
+    if (rc != STR_MR_ERROR_SUCCESS) {
+        return rc;
+    }
+
+    memset(&ss, 0, sizeof(ss));
+    ss.sink        = sink;
+    ss.sink_ctx    = sink_ctx;
+    ss.value_cb    = value_cb;
+    ss.value_ctx   = value_ctx;
+    ss.match_pairs = match_pairs;
+    ss.status      = STR_MR_ERROR_SUCCESS;
+
+    rc = str_mr_sink_scan(&set, &ss, str, str_len, str_len);
+
+    str_mr_set_fini(&set);
+
+    if (rc != STR_MR_ERROR_SUCCESS) {
+        return rc;
+    }
+
+    return ss.mp_cnt;
+}
+
+/**
+ * @brief Function to replace all occurrences of match pairs into a sink.
+ *
+ * @see str_multireplace.h
+ */
+int64_t
+str_multireplace_sink (const char *str, size_t str_len,
+                       const str_mr_match_pair *match_pairs,
+                       size_t match_pair_cnt,
+                       str_mr_sink_cb sink, void *sink_ctx)
+{
+    if ((str == NULL) || (str_len <= 0) || (match_pairs == NULL) ||
+        (match_pair_cnt <= 0) || (sink == NULL)) {
+        return STR_MR_ERROR_INVALID_ARG;
+    }
+
+    return str_mr_replace_sink(str, str_len, match_pairs, match_pair_cnt,
+                               NULL, NULL, sink, sink_ctx);
+}
+
+/**
+ * @brief Function to replace match pairs with values produced by callback.
+ *
+ * @see str_multireplace.h
+ */
+int64_t
+str_multireplace_dyn_sink (const char *str, size_t str_len,
+                           const str_mr_match_pair *match_pairs,
+                           size_t match_pair_cnt,
+                           str_mr_value_cb value_cb, void *value_ctx,
+                           str_mr_sink_cb sink, void *sink_ctx)
+{
+    if ((str == NULL) || (str_len <= 0) || (match_pairs == NULL) ||
+        (match_pair_cnt <= 0) || (value_cb == NULL) || (sink == NULL)) {
+        return STR_MR_ERROR_INVALID_ARG;
+    }
+
+    return str_mr_replace_sink(str, str_len, match_pairs, match_pair_cnt,
+                               value_cb, value_ctx, sink, sink_ctx);
+}
+
+/**
+ * @brief Function to replace match pairs with values produced by callback.
+ *
+ * @see str_multireplace.h
+ */
+int64_t
+str_multireplace_dyn (const char *str, size_t str_len,
+                      const str_mr_match_pair *match_pairs,
+                      size_t match_pair_cnt,
+                      str_mr_value_cb value_cb, void *value_ctx,
+                      char **result, size_t *result_len, bool terminate)
+{
+    int64_t rc = 0;
+    str_mr_buf buf;
+
+    if ((str == NULL) || (str_len <= 0) || (match_pairs == NULL) ||
+        (match_pair_cnt <= 0) || (value_cb == NULL) ||
+        (result == NULL) || (result_len == NULL)) {
+        return STR_MR_ERROR_INVALID_ARG;
+    }
+
+    /* good guess for the result length, grows as needed */
+    memset(&buf, 0, sizeof(buf));
+    buf.alloc_len = str_len + 1;
+    buf.data = (char *)malloc(buf.alloc_len * sizeof(char));
+    if (buf.data == NULL) {
+        return STR_MR_ERROR_OOM;
+    }
+
+    rc = str_mr_replace_sink(str, str_len, match_pairs, match_pair_cnt,
+                             value_cb, value_ctx, str_mr_buf_sink, &buf);
+    if ((rc >= 0) && terminate &&
+        (str_mr_buf_sink(&buf, "", 1) == 0)) {
+        buf.len--;
+    }
+
+    if (buf.oom) {
+        rc = STR_MR_ERROR_OOM;
+    }
+
+    if (rc < 0) {
+        free(buf.data);
+        return rc;
+    }
+
+    *result     = buf.data;
+    *result_len = buf.len;
+
+    return rc;
+}
+
+/** @} */
+
+/**
+ * @name String searching API
+ *
+ * This section exposes the search without doing any replacement
+ */
+/** @{ */
+
+#define STR_MR_PREALLOC_MATCHES         (32)
+
+/**
+ * @brief Find callback adapter state
+ */
+typedef struct {
+    str_mr_find_cb cb;          /* user callback */
+    void *cb_ctx;               /* user callback context */
+    const str_mr_match_pair *match_pairs; /* pairs array (for pair index) */
+    size_t match_cnt;           /* number of matches reported */
+} str_mr_find_state;
+
+/**
+ * @brief Growable matches array
+ */
+typedef struct {
+    str_mr_match *matches;      /* matches array */
+    size_t match_cnt;           /* number of matches in array */
+    size_t match_alloc_cnt;     /* number of matches alloc'ed */
+    bool oom;                   /* out of memory while growing */
+} str_mr_match_list;
+
+/**
+ * @brief Callback when match is found passing it to user callback
+ *
+ * Anything else than STR_MR_MATCH_CONTINUE from user callback stops the
+ * search, so it never gets mistaken for internal STR_MR_MATCH_SKIP.
+ *
+ * @return callback returns whether the searching should continue or not
+ * @retval STR_MR_MATCH_CONTINUE continue with searching for rest of matches
+ * @retval STR_MR_MATCH_STOP stop searching
+ */
+static
+int
+str_mr_find_callback (const char *str, const char *where,
+                      const str_mr_match_pair *pair, void *ctx)
+{
+    str_mr_find_state *fs = (str_mr_find_state *)ctx;
+
+    fs->match_cnt++;
+    if (fs->cb(fs->cb_ctx, where - str, pair - fs->match_pairs) !=
+        STR_MR_MATCH_CONTINUE) {
+        return STR_MR_MATCH_STOP;
+    }
+
+    return STR_MR_MATCH_CONTINUE;
+}
+
+/**
+ * @brief Find callback appending match to matches array
+ *
+ * @return callback returns whether the searching should continue or not
+ * @retval STR_MR_MATCH_CONTINUE continue with searching for rest of matches
+ * @retval STR_MR_MATCH_STOP stop searching (out of memory)
+ */
+static
+int
+str_mr_match_list_callback (void *ctx, size_t pos, size_t pair_idx)
+{
+    str_mr_match_list *ml = (str_mr_match_list *)ctx;
+    str_mr_match *new_matches = NULL;
+    size_t new_alloc_cnt = 0;
+
+    if (ml->match_cnt >= ml->match_alloc_cnt) {
+        new_alloc_cnt = ml->match_alloc_cnt * 2;
+        new_matches = (str_mr_match *)realloc(ml->matches, new_alloc_cnt *
+                                              sizeof(str_mr_match));
+        if (new_matches == NULL) {
+            ml->oom = true;
+            return STR_MR_MATCH_STOP;
+        }
+
+        ml->matches = new_matches;
+        ml->match_alloc_cnt = new_alloc_cnt;
+    }
+
+    ml->matches[ml->match_cnt].pos      = pos;
+    ml->matches[ml->match_cnt].pair_idx = pair_idx;
+    ml->match_cnt++;
+
+    return STR_MR_MATCH_CONTINUE;
+}
+
+/**
+ * @brief Function to find occurrences of match pairs calling callback.
+ *
+ * @see str_multireplace.h
+ */
+int64_t
+str_mr_find_each (const char *str, size_t str_len,
+                  const str_mr_match_pair *match_pairs, size_t match_pair_cnt,
+                  bool overlapping, str_mr_find_cb cb, void *cb_ctx)
+{
+    int64_t rc = 0;
+    str_mr_find_state fs;
+    str_mr_set set;                            /* compiled match pairs */
+
+    if ((str == NULL) || (str_len <= 0) || (match_pairs == NULL) ||
+        (match_pair_cnt <= 0) || (cb == NULL)) {
+        return STR_MR_ERROR_INVALID_ARG;
+    }
+
+    rc = str_mr_set_init(&set, match_pairs, match_pair_cnt, false);
+    if (rc != STR_MR_ERROR_SUCCESS) {
+        return rc;
+    }
+
+    memset(&fs, 0, sizeof(fs));
+    fs.cb          = cb;
+    fs.cb_ctx      = cb_ctx;
+    fs.match_pairs = match_pairs;
+
+    if (overlapping) {
+        rc = str_mr_kr_search(str, str_len, &set,
+                              str_mr_find_callback, NULL, &fs);
+    } else {
+        rc = str_mr_kr_search(str, str_len, &set,
+                              NULL, str_mr_find_callback, &fs);
+    }
+
+    str_mr_set_fini(&set);
+
+    if (rc != STR_MR_ERROR_SUCCESS) {
+        return rc;
+    }
+
+    return fs.match_cnt;
+}
+
+/**
+ * @brief Function to find occurrences of match pairs.
+ *
+ * @see str_multireplace.h
+ */
+int64_t
+str_mr_find (const char *str, size_t str_len,
+             const str_mr_match_pair *match_pairs, size_t match_pair_cnt,
+             bool overlapping, str_mr_match **matches, size_t *match_cnt)
+{
+    int64_t rc = 0;
+    str_mr_match_list ml;
+
+    if ((matches == NULL) || (match_cnt == NULL)) {
+        return STR_MR_ERROR_INVALID_ARG;
+    }
+
+    memset(&ml, 0, sizeof(ml));
+    ml.match_alloc_cnt = STR_MR_PREALLOC_MATCHES;
+    ml.matches = (str_mr_match *)malloc(ml.match_alloc_cnt *
+                                        sizeof(str_mr_match));
+    if (ml.matches == NULL) {
+        return STR_MR_ERROR_OOM;
+    }
+
+    rc = str_mr_find_each(str, str_len, match_pairs, match_pair_cnt,
+                          overlapping, str_mr_match_list_callback, &ml);
+    if (ml.oom) {
+        rc = STR_MR_ERROR_OOM;
+    }
+
+    if (rc < 0) {
+        free(ml.matches);
+        return rc;
+    }
+
+    *matches   = ml.matches;
+    *match_cnt = ml.match_cnt;
+
+    return rc;
+}
+
+/**
+ * @brief Count callback state
+ */
+typedef struct {
+    const str_mr_match_pair *match_pairs; /* pairs array (for pair index) */
+    size_t *counts;             /* per pair counts (can be NULL) */
+    size_t match_cnt;           /* total number of matches */
+} str_mr_count_state;
+
+/**
+ * @brief Callback stopping the search on first match
+ *
+ * @return always STR_MR_MATCH_STOP
+ */
+static
+int
+str_mr_contains_callback (const char *str, const char *where,
+                          const str_mr_match_pair *pair, void *ctx)
+{
+    (void)str;
+    (void)where;
+    (void)pair;
+
+    *(bool *)ctx = true;
+    return STR_MR_MATCH_STOP;
+}
+
+/**
+ * @brief Callback counting matches
+ *
+ * @return always STR_MR_MATCH_CONTINUE
+ */
+static
+int
+str_mr_count_callback (const char *str, const char *where,
+                       const str_mr_match_pair *pair, void *ctx)
+{
+    str_mr_count_state *cs = (str_mr_count_state *)ctx;
+
+    (void)str;
+    (void)where;
+
+    if (cs->counts != NULL) {
+        cs->counts[pair - cs->match_pairs]++;
+    }
+
+    cs->match_cnt++;
+    return STR_MR_MATCH_CONTINUE;
+}
+
+/**
+ * @brief Function to check whether any key occurs in buffer.
+ *
+ * @see str_multireplace.h
+ */
+int32_t
+str_mr_contains_any (const char *str, size_t str_len,
+                     const str_mr_match_pair *match_pairs,
+                     size_t match_pair_cnt)
+{
+    int32_t rc = 0;
+    bool found = false;
+    str_mr_set set;                            /* compiled match pairs */
+
+    if ((str == NULL) || (str_len <= 0) || (match_pairs == NULL) ||
+        (match_pair_cnt <= 0)) {
+        return STR_MR_ERROR_INVALID_ARG;
+    }
+
+    rc = str_mr_set_init(&set, match_pairs, match_pair_cnt, false);
+    if (rc != STR_MR_ERROR_SUCCESS) {
+        return rc;
+    }
+
+    /* any occurrence will do, so don't bother with overlaps */
+    rc = str_mr_kr_search(str, str_len, &set,
+                          str_mr_contains_callback, NULL, &found);
+
+    str_mr_set_fini(&set);
+
+    if (rc != STR_MR_ERROR_SUCCESS) {
+        return rc;
+    }
+
+    return (found ? 1 : 0);
+}
+
+/**
+ * @brief Function to count occurrences of keys in buffer.
+ *
+ * @see str_multireplace.h
+ */
+int64_t
+str_mr_count (const char *str, size_t str_len,
+              const str_mr_match_pair *match_pairs, size_t match_pair_cnt,
+              bool overlapping, size_t *counts)
+{
+    int64_t rc = 0;
+    str_mr_count_state cs;
+    str_mr_set set;                            /* compiled match pairs */
+
+    if ((str == NULL) || (str_len <= 0) || (match_pairs == NULL) ||
+        (match_pair_cnt <= 0)) {
+        return STR_MR_ERROR_INVALID_ARG;
+    }
+
+    rc = str_mr_set_init(&set, match_pairs, match_pair_cnt, false);
+    if (rc != STR_MR_ERROR_SUCCESS) {
+        return rc;
+    }
+
+    if (counts != NULL) {
+        memset(counts, 0, match_pair_cnt * sizeof(size_t));
+    }
+
+    memset(&cs, 0, sizeof(cs));
+    cs.match_pairs = match_pairs;
+    cs.counts      = counts;
+
+    if (overlapping) {
+        rc = str_mr_kr_search(str, str_len, &set,
+                              str_mr_count_callback, NULL, &cs);
+    } else {
+        rc = str_mr_kr_search(str, str_len, &set,
+                              NULL, str_mr_count_callback, &cs);
+    }
+
+    str_mr_set_fini(&set);
+
+    if (rc != STR_MR_ERROR_SUCCESS) {
+        return rc;
+    }
+
+    return cs.match_cnt;
+}
+
+/** @} */
+
+/**
+ * @name Compiled set and streaming
+ *
+ * This section contains reusable compiled set and chunked replacement
+ */
+/** @{ */
+
+/**
+ * @brief Streaming replacement state
+ */
+struct str_mr_stream {
+    const str_mr_set *set;      /* compiled match pairs */
+    str_mr_sink_state ss;       /* sink state of last scan */
+    char *carry;                /* undecided input from previous chunks */
+    size_t carry_len;           /* length of undecided input */
+    size_t lookahead;           /* bytes needed behind decided position */
+    int64_t mp_cnt;             /* number of replacements made so far */
+    int32_t status;             /* sticky error */
+};
+
+/**
+ * @brief Check pointer points into used part of arena
+ */
+#define STR_MR_IN_ARENA(set, ptr) \
+    (((set)->arena != NULL) && ((ptr) != NULL) && \
+     ((uintptr_t)(ptr) >= (uintptr_t)(set)->arena) && \
+     ((uintptr_t)(ptr) < (uintptr_t)(set)->arena + (set)->arena_len))
+
+/**
+ * @brief Allocate arena of len bytes
+ *
+ * Arena is aligned to STR_MR_ARENA_ALIGN on POSIX systems, elsewhere it has
+ * alignment of malloc() (which only makes searching slightly slower).
+ *
+ * @return arena to be released by free() or NULL when out of memory
+ */
+static
+char *
+str_mr_arena_alloc (size_t len)
+{
+#ifdef STR_MR_WITH_POSIX
+    void *arena = NULL;
+
+    if (posix_memalign(&arena, STR_MR_ARENA_ALIGN, len) != 0) {
+        return NULL;
+    }
+
+    return (char *)arena;
+#else
+    return (char *)malloc(len);
+#endif
+}
+
+/**
+ * @brief Copy keys and values of all pairs of set into new arena
+ *
+ * Keys come first, in order of hash chains of buckets, so keys compared
+ * one after another while searching are next to each other. Values follow
+ * in the same order. Set gets its own pairs array if it doesn't have one.
+ * Set is left untouched when out of memory.
+ *
+ * @return status code
+ */
+static
+int32_t
+str_mr_set_intern (str_mr_set *set)
+{
+    str_mr_match_pair *pairs = set->own_pairs;
+    char  *arena = NULL, *key_pos = NULL, *value_pos = NULL;
+    size_t keys_len = 0, values_len = 0, alloc = 0;
+    size_t i = 0, b = 0, c = 0, w = 0;
+
+    for (i = 0; i < set->pair_cnt; i++) {
+        if (!set->removed[i]) {
+            keys_len   += set->match_pairs[i].key_length;
+            values_len += (set->match_pairs[i].value != NULL ?
+                           set->match_pairs[i].value_length : 0);
+        }
+    }
+
+    alloc = STR_MR_ARENA_ROUND(keys_len) + STR_MR_ARENA_ROUND(values_len);
+    arena = str_mr_arena_alloc(alloc > 0 ? alloc : STR_MR_ARENA_ALIGN);
+    if (arena == NULL) {
+        return STR_MR_ERROR_OOM;
+    }
+
+    if (pairs == NULL) {
+        pairs = (str_mr_match_pair *)malloc((set->pair_cnt > 0 ?
+                                             set->pair_cnt : 1) *
+                                            sizeof(str_mr_match_pair));
+        if (pairs == NULL) {
+            free(arena);
+            return STR_MR_ERROR_OOM;
+        }
+
+        memcpy(pairs, set->match_pairs,
+               set->pair_cnt * sizeof(str_mr_match_pair));
+        set->pair_alloc = set->pair_cnt;
+    }
+
+    key_pos   = arena;
+    value_pos = arena + STR_MR_ARENA_ROUND(keys_len);
+    for (b = 0; b < set->bucket_cnt; b++) {
+        for (c = 0; c < ((size_t)1 << set->buckets[b].bits); c++) {
+            for (w = set->buckets[b].heads[c]; w != STR_MR_NO_PAIR;
+                 w = set->chain_next[w]) {
+                memcpy(key_pos, pairs[w].key, pairs[w].key_length);
+                pairs[w].key = key_pos;
+                key_pos += pairs[w].key_length;
+
+                if (pairs[w].value != NULL) {
+                    memcpy(value_pos, pairs[w].value, pairs[w].value_length);
+                    pairs[w].value = value_pos;
+                    value_pos += pairs[w].value_length;
+                }
+            }
+        }
+    }
+
+    free(set->arena);
+    set->arena       = arena;
+    set->arena_len   = (size_t)(value_pos - arena);
+    set->arena_alloc = alloc;
+    set->own_pairs   = pairs;
+    set->match_pairs = pairs;
+
+    return STR_MR_ERROR_SUCCESS;
+}
+
+/**
+ * @brief Make room for len more bytes at the end of arena
+ *
+ * Arena is moved, so keys and values of own pairs in it (and of extra pair,
+ * which can be NULL) are moved too. Set is left untouched when out of
+ * memory.
+ *
+ * @return status code
+ */
+static
+int32_t
+str_mr_arena_reserve (str_mr_set *set, size_t len, str_mr_match_pair *extra)
+{
+    char  *arena = NULL;
+    size_t alloc = 0, i = 0;
+
+    if (set->arena_alloc - set->arena_len >= len) {
+        return STR_MR_ERROR_SUCCESS;
+    }
+
+    alloc = STR_MR_ARENA_ROUND(set->arena_len + len);
+    if (alloc < set->arena_alloc * 2) {
+        alloc = set->arena_alloc * 2;
+    }
+
+    arena = str_mr_arena_alloc(alloc);
+    if (arena == NULL) {
+        return STR_MR_ERROR_OOM;
+    }
+
+    if (set->arena_len > 0) {
+        memcpy(arena, set->arena, set->arena_len);
+    }
+
+    for (i = 0; i < set->pair_cnt; i++) {
+        if (STR_MR_IN_ARENA(set, set->own_pairs[i].key)) {
+            set->own_pairs[i].key = arena + (set->own_pairs[i].key -
+                                             set->arena);
+        }
+
+        if (STR_MR_IN_ARENA(set, set->own_pairs[i].value)) {
+            set->own_pairs[i].value = arena + (set->own_pairs[i].value -
+                                               set->arena);
+        }
+    }
+
+    if ((extra != NULL) && STR_MR_IN_ARENA(set, extra->key)) {
+        extra->key = arena + (extra->key - set->arena);
+    }
+
+    if ((extra != NULL) && STR_MR_IN_ARENA(set, extra->value)) {
+        extra->value = arena + (extra->value - set->arena);
+    }
+
+    free(set->arena);
+    set->arena       = arena;
+    set->arena_alloc = alloc;
+
+    return STR_MR_ERROR_SUCCESS;
+}
+
+/**
+ * @brief Copy bytes to the end of arena (room has to be reserved)
+ *
+ * @return copy in arena
+ */
+static
+const char *
+str_mr_arena_put (str_mr_set *set, const char *str, size_t len)
+{
+    char *pos = set->arena + set->arena_len;
+
+    memcpy(pos, str, len);
+    set->arena_len += len;
+
+    return pos;
+}
+
+/**
+ * @brief Function to compile match pairs into reusable set.
+ *
+ * @see str_multireplace.h
+ */
+int32_t
+str_mr_set_compile (const str_mr_match_pair *match_pairs,
+                    size_t match_pair_cnt, str_mr_set **set)
+{
+    int32_t rc = STR_MR_ERROR_SUCCESS;
+    str_mr_set *s = NULL;
+
+    if ((match_pairs == NULL) || (match_pair_cnt <= 0) || (set == NULL)) {
+        return STR_MR_ERROR_INVALID_ARG;
+    }
+
+    s = (str_mr_set *)malloc(sizeof(str_mr_set));
+    if (s == NULL) {
+        return STR_MR_ERROR_OOM;
+    }
+
+    rc = str_mr_set_init(s, match_pairs, match_pair_cnt, false);
+    if (rc != STR_MR_ERROR_SUCCESS) {
+        free(s);
+        return rc;
+    }
+
+    rc = str_mr_set_intern(s);
+    if (rc != STR_MR_ERROR_SUCCESS) {
+        str_mr_set_free(s);
+        return rc;
+    }
+
+    *set = s;
+    return STR_MR_ERROR_SUCCESS;
+}
+
+/**
+ * @brief Function to free compiled set.
+ *
+ * @see str_multireplace.h
+ */
+void
+str_mr_set_free (str_mr_set *set)
+{
+    if (set == NULL) {
+        return;
+    }
+
+    str_mr_set_fini(set);
+#ifdef STR_MR_WITH_POSIX
+    if (set->map != NULL) {
+        munmap(set->map, set->map_len);
+    }
+#endif
+
+    free(set);
+}
+
+/**
+ * Removed pairs are dropped by rebuild when there are at least this many
+ * and they are more than half of all pairs
+ */
+#define STR_MR_SET_REBUILD_MIN          (64)
+
+/**
+ * @brief Copy data of loaded set that point into image to the heap
+ *
+ * Image can be mapped read-only, so loaded set is copied on first
+ * modification. Set is left untouched when out of memory.
+ *
+ * @return status code
+ */
+static
+int32_t
+str_mr_set_detach (str_mr_set *set)
+{
+    uint64_t *key_hashes = NULL;
+    size_t   *chain_next = NULL;
+    size_t  **heads = NULL;
+    uint8_t  *filter = NULL;
+    size_t    b = 0, cnt = (set->pair_cnt > 0 ? set->pair_cnt : 1);
+    size_t    filter_len = (size_t)1 << set->filter_bits;
+    bool      oom = false;
+
+    if (!set->in_image) {
+        return STR_MR_ERROR_SUCCESS;
+    }
+
+    key_hashes = (uint64_t *)malloc(cnt * sizeof(uint64_t));
+    chain_next = (size_t *)malloc(cnt * sizeof(size_t));
+    heads      = (size_t **)calloc(set->bucket_cnt + 1, sizeof(size_t *));
+    if (set->filter != NULL) {
+        filter = (uint8_t *)malloc(filter_len);
+        oom    = (filter == NULL);
+    }
+
+    oom = oom || (key_hashes == NULL) || (chain_next == NULL) ||
+          (heads == NULL);
+    for (b = 0; !oom && (b < set->bucket_cnt); b++) {
+        heads[b] = (size_t *)malloc(((size_t)1 << set->buckets[b].bits) *
+                                    sizeof(size_t));
+        oom = (heads[b] == NULL);
+    }
+
+    if (oom) {
+        for (b = 0; (heads != NULL) && (b < set->bucket_cnt); b++) {
+            free(heads[b]);
+        }
+
+        free(heads);
+        free(filter);
+        free(chain_next);
+        free(key_hashes);
+        return STR_MR_ERROR_OOM;
+    }
+
+    memcpy(key_hashes, set->key_hashes, set->pair_cnt * sizeof(uint64_t));
+    memcpy(chain_next, set->chain_next, set->pair_cnt * sizeof(size_t));
+    set->key_hashes = key_hashes;
+    set->chain_next = chain_next;
+
+    for (b = 0; b < set->bucket_cnt; b++) {
+        memcpy(heads[b], set->buckets[b].heads,
+               ((size_t)1 << set->buckets[b].bits) * sizeof(size_t));
+        set->buckets[b].heads = heads[b];
+    }
+
+    if (filter != NULL) {
+        memcpy(filter, set->filter, filter_len);
+        set->filter = filter;
+    }
+
+    free(heads);
+    set->in_image = false;
+
+    return STR_MR_ERROR_SUCCESS;
+}
+
+/**
+ * @brief Make sure set owns its pairs and has room for one more pair
+ *
+ * @return status code
+ */
+static
+int32_t
+str_mr_set_reserve (str_mr_set *set)
+{
+    str_mr_match_pair *pairs = NULL;
+    size_t alloc = 0;
+
+    if ((set->own_pairs != NULL) && (set->pair_cnt < set->pair_alloc)) {
+        return STR_MR_ERROR_SUCCESS;
+    }
+
+    alloc = (set->pair_cnt >= 8 ? set->pair_cnt * 2 : 16);
+    if (str_mr_set_resize_pairs(set, alloc) != STR_MR_ERROR_SUCCESS) {
+        return STR_MR_ERROR_OOM;
+    }
+
+    if (set->own_pairs != NULL) {
+        pairs = (str_mr_match_pair *)realloc(set->own_pairs, alloc *
+                                             sizeof(str_mr_match_pair));
+    } else {
+        /* first change of compiled set, stop using caller's array */
+        pairs = (str_mr_match_pair *)malloc(alloc * sizeof(str_mr_match_pair));
+        if ((pairs != NULL) && (set->pair_cnt > 0)) {
+            memcpy(pairs, set->match_pairs,
+                   set->pair_cnt * sizeof(str_mr_match_pair));
+        }
+    }
+
+    if (pairs == NULL) {
+        return STR_MR_ERROR_OOM;
+    }
+
+    set->own_pairs   = pairs;
+    set->match_pairs = pairs;
+    set->pair_alloc  = alloc;
+
+    return STR_MR_ERROR_SUCCESS;
+}
+
+/**
+ * @brief Drop removed pairs and rebuild all buckets and arena
+ *
+ * Set is left untouched when out of memory.
+ *
+ * @return status code
+ */
+static
+int32_t
+str_mr_set_compact (str_mr_set *set)
+{
+    str_mr_set tmp;
+    size_t i = 0, live = set->pair_cnt - set->removed_cnt;
+
+    memset(&tmp, 0, sizeof(tmp));
+    tmp.pair_alloc = (live >= 8 ? live * 2 : 16);
+    tmp.own_pairs = (str_mr_match_pair *)malloc(tmp.pair_alloc *
+                                                sizeof(str_mr_match_pair));
+    if ((tmp.own_pairs == NULL) ||
+        (str_mr_set_resize_pairs(&tmp, tmp.pair_alloc) !=
+         STR_MR_ERROR_SUCCESS)) {
+        str_mr_set_fini(&tmp);
+        return STR_MR_ERROR_OOM;
+    }
+
+    for (i = 0; i < set->pair_cnt; i++) {
+        if (!set->removed[i]) {
+            tmp.own_pairs[tmp.pair_cnt]  = set->match_pairs[i];
+            tmp.key_hashes[tmp.pair_cnt] = set->key_hashes[i];
+            tmp.removed[tmp.pair_cnt]    = false;
+            tmp.pair_cnt++;
+        }
+    }
+
+    tmp.match_pairs = tmp.own_pairs;
+    if ((str_mr_set_build(&tmp) != STR_MR_ERROR_SUCCESS) ||
+        (str_mr_set_intern(&tmp) != STR_MR_ERROR_SUCCESS)) {
+        str_mr_set_fini(&tmp);
+        return STR_MR_ERROR_OOM;
+    }
+
+    /* mapped image stays with the set */
+    tmp.map     = set->map;
+    tmp.map_len = set->map_len;
+
+    str_mr_set_fini(set);
+    *set = tmp;
+
+    return STR_MR_ERROR_SUCCESS;
+}
+
+/**
+ * @brief Function to add match pair into compiled set.
+ *
+ * @see str_multireplace.h
+ */
+int32_t
+str_mr_set_add (str_mr_set *set, const str_mr_match_pair *pair)
+{
+    int32_t rc = STR_MR_ERROR_SUCCESS;
+    str_mr_bucket *bucket = NULL;
+    str_mr_match_pair copy;
+    size_t b = 0, w = 0;
+
+    if ((set == NULL) || (pair == NULL)) {
+        return STR_MR_ERROR_INVALID_ARG;
+    }
+
+    if ((pair->key == NULL) || (pair->key_length == 0)) {
+        return STR_MR_ERROR_INVALID_MATCH;
+    }
+
+    /* pair can be one of the set's own (from str_mr_set_pair()) */
+    copy = *pair;
+    rc   = str_mr_set_detach(set);
+    if (rc != STR_MR_ERROR_SUCCESS) {
+        return rc;
+    }
+
+    rc = str_mr_set_reserve(set);
+    if (rc != STR_MR_ERROR_SUCCESS) {
+        return rc;
+    }
+
+    rc = str_mr_arena_reserve(set, copy.key_length +
+                              (copy.value != NULL ? copy.value_length : 0),
+                              &copy);
+    if (rc != STR_MR_ERROR_SUCCESS) {
+        return rc;
+    }
+
+    rc = str_mr_bucket_get(set, copy.key_length, &b);
+    if (rc != STR_MR_ERROR_SUCCESS) {
+        return rc;
+    }
+
+    /* new bucket has room for first key, so it is never left empty */
+    bucket = &set->buckets[b];
+    if ((bucket->cnt + 1) * STR_MR_BUCKET_LOAD > ((size_t)1 << bucket->bits)) {
+        rc = str_mr_bucket_grow(set, bucket);
+        if (rc != STR_MR_ERROR_SUCCESS) {
+            return rc;
+        }
+    }
+
+    copy.key = str_mr_arena_put(set, copy.key, copy.key_length);
+    if (copy.value != NULL) {
+        copy.value = str_mr_arena_put(set, copy.value, copy.value_length);
+    }
+
+    w = set->pair_cnt++;
+    set->own_pairs[w]  = copy;
+    set->key_hashes[w] = str_mr_key_hash(&copy);
+    set->removed[w]    = false;
+    str_mr_bucket_link(set, bucket, w);
+
+    bucket->cnt++;
+    if (copy.value == NULL) {
+        set->no_value_cnt++;
+    }
+
+    set->max_key_len = set->key_lens[0];
+
+    /* rebuild filter that is too full or hashes longer prefix than key */
+    if ((set->filter == NULL) || (copy.key_length < set->filter_q) ||
+        ((set->pair_cnt - set->removed_cnt) * STR_MR_FILTER_LOAD >
+         ((size_t)1 << set->filter_bits) * 2)) {
+        /* set without filter works, just slower */
+        str_mr_filter_build(set);
+    } else {
+        str_mr_filter_add(set, &copy);
+    }
+
+    return STR_MR_ERROR_SUCCESS;
+}
+
+/**
+ * @brief Function to remove key from compiled set.
+ *
+ * @see str_multireplace.h
+ */
+int64_t
+str_mr_set_remove (str_mr_set *set, const char *key, size_t key_len)
+{
+    str_mr_match_pair key_pair;
+    str_mr_bucket *bucket = NULL;
+    uint64_t key_hash = 0;
+    size_t  *link = NULL;
+    size_t   b = 0, w = 0;
+    int64_t  removed = 0;
+
+    if ((set == NULL) || (key == NULL) || (key_len == 0)) {
+        return STR_MR_ERROR_INVALID_ARG;
+    }
+
+    if (!str_mr_bucket_find(set, key_len, &b)) {
+        return 0;
+    }
+
+    if (str_mr_set_detach(set) != STR_MR_ERROR_SUCCESS) {
+        return STR_MR_ERROR_OOM;
+    }
+
+    memset(&key_pair, 0, sizeof(key_pair));
+    key_pair.key        = key;
+    key_pair.key_length = key_len;
+    key_hash = str_mr_key_hash(&key_pair);
+
+    bucket = &set->buckets[b];
+    link   = &bucket->heads[STR_MR_CHAIN(key_hash, bucket->bits)];
+    while (*link != STR_MR_NO_PAIR) {
+        w = *link;
+        if ((set->key_hashes[w] != key_hash) ||
+            (memcmp(set->match_pairs[w].key, key, key_len) != 0)) {
+            link = &set->chain_next[w];
+            continue;
+        }
+
+        /* unlink from chain, pair stays in arrays until rebuild */
+        *link = set->chain_next[w];
+        set->removed[w] = true;
+        set->removed_cnt++;
+        bucket->cnt--;
+        if (set->match_pairs[w].value == NULL) {
+            set->no_value_cnt--;
+        }
+
+        removed++;
+    }
+
+    if (bucket->cnt == 0) {
+        free(bucket->heads);
+        memmove(&set->buckets[b], &set->buckets[b + 1],
+                (set->bucket_cnt - b - 1) * sizeof(str_mr_bucket));
+        memmove(&set->key_lens[b], &set->key_lens[b + 1],
+                (set->bucket_cnt - b - 1) * sizeof(size_t));
+        memmove(&set->rem_coefs[b], &set->rem_coefs[b + 1],
+                (set->bucket_cnt - b - 1) * sizeof(uint64_t));
+        set->bucket_cnt--;
+    }
+
+    set->max_key_len = (set->bucket_cnt > 0 ? set->key_lens[0] : 0);
+
+    if ((set->removed_cnt >= STR_MR_SET_REBUILD_MIN) &&
+        (set->removed_cnt * 2 > set->pair_cnt)) {
+        /* set stays valid with removed pairs when out of memory */
+        str_mr_set_compact(set);
+    }
+
+    return removed;
+}
+
+/**
+ * @brief Function to get match pair of compiled set by its index.
+ *
+ * @see str_multireplace.h
+ */
+const str_mr_match_pair *
+str_mr_set_pair (const str_mr_set *set, size_t pair_idx)
+{
+    if ((set == NULL) || (pair_idx >= set->pair_cnt) ||
+        set->removed[pair_idx]) {
+        return NULL;
+    }
+
+    return &set->match_pairs[pair_idx];
+}
+
+/**
+ * @brief Function to check whether any key of compiled set occurs in buffer.
+ *
+ * @see str_multireplace.h
+ */
+int32_t
+str_mr_set_contains_any (const str_mr_set *set, const char *str,
+                         size_t str_len)
+{
+    int32_t rc = 0;
+    bool found = false;
+
+    if ((set == NULL) || ((str == NULL) && (str_len > 0))) {
+        return STR_MR_ERROR_INVALID_ARG;
+    }
+
+    if (str_len == 0) {
+        return 0;
+    }
+
+    rc = str_mr_kr_search(str, str_len, set,
+                          str_mr_contains_callback, NULL, &found);
+    if (rc != STR_MR_ERROR_SUCCESS) {
+        return rc;
+    }
+
+    return (found ? 1 : 0);
+}
+
+/**
+ * @brief Function to replace all occurrences of compiled set into a sink.
+ *
+ * @see str_multireplace.h
+ */
+int64_t
+str_mr_set_replace_sink (const str_mr_set *set, const char *str,
+                         size_t str_len, str_mr_sink_cb sink, void *sink_ctx)
+{
+    int32_t rc = STR_MR_ERROR_SUCCESS;
+    str_mr_sink_state ss;
+
+    if ((set == NULL) || ((str == NULL) && (str_len > 0)) ||
+        (sink == NULL)) {
+        return STR_MR_ERROR_INVALID_ARG;
+    }
+
+    if (set->no_value_cnt > 0) {
+        return STR_MR_ERROR_INVALID_MATCH;
+    }
+
+    memset(&ss, 0, sizeof(ss));
+    ss.sink        = sink;
+    ss.sink_ctx    = sink_ctx;
+    ss.match_pairs = set->match_pairs;
+
+    /* whole buffer is decided at once, nothing is carried */
+    rc = str_mr_sink_scan(set, &ss, str, str_len, str_len);
+    if (rc != STR_MR_ERROR_SUCCESS) {
+        return rc;
+    }
+
+    return ss.mp_cnt;
+}
+
+/**
+ * @brief Function to start streaming replacement.
+ *
+ * @see str_multireplace.h
+ */
+int32_t
+str_mr_stream_init (const str_mr_set *set, str_mr_sink_cb sink,
+                    void *sink_ctx, str_mr_stream **stream)
+{
+    str_mr_stream *st = NULL;
+
+    if ((set == NULL) || (sink == NULL) || (stream == NULL)) {
+        return STR_MR_ERROR_INVALID_ARG;
+    }
+
+    if (set->no_value_cnt > 0) {
+        return STR_MR_ERROR_INVALID_MATCH;
+    }
+
+    st = (str_mr_stream *)calloc(1, sizeof(str_mr_stream));
+    if (st == NULL) {
+        return STR_MR_ERROR_OOM;
+    }
+
+    /* carried input + lookahead taken from next chunk */
+    st->lookahead = (set->max_key_len > 0 ? set->max_key_len - 1 : 0);
+    st->carry = (char *)malloc(2 * st->lookahead + 1);
+    if (st->carry == NULL) {
+        free(st);
+        return STR_MR_ERROR_OOM;
+    }
+
+    st->set            = set;
+    st->ss.sink        = sink;
+    st->ss.sink_ctx    = sink_ctx;
+    st->ss.match_pairs = set->match_pairs;
+
+    *stream = st;
+    return STR_MR_ERROR_SUCCESS;
+}
+
+/**
+ * @brief Scan part of the input passing decided result to sink
+ *
+ * Everything starting before decide_end is decided, the rest needs more
+ * input (all keys have to fit into data to decide a position).
+ *
+ * @param[out] consumed length of data passed to sink (>= decide_end)
+ *
+ * @return status code
+ */
+static
+int32_t
+str_mr_stream_scan (str_mr_stream *st, const char *data, size_t data_len,
+                    bool final, size_t *consumed)
+{
+    int32_t rc = STR_MR_ERROR_SUCCESS;
+    size_t  decide_end = data_len;
+
+    if (!final) {
+        decide_end = (data_len > st->lookahead ? data_len - st->lookahead : 0);
+    }
+
+    st->ss.str_pos = 0;
+    st->ss.mp_cnt  = 0;
+    st->ss.status  = STR_MR_ERROR_SUCCESS;
+
+    rc = str_mr_sink_scan(st->set, &st->ss, data, data_len, decide_end);
+    if (rc != STR_MR_ERROR_SUCCESS) {
+        st->status = rc;
+        return rc;
+    }
+
+    st->mp_cnt += st->ss.mp_cnt;
+    *consumed   = st->ss.str_pos;
+
+    return STR_MR_ERROR_SUCCESS;
+}
+
+/**
+ * @brief Function to feed next chunk of input into stream.
+ *
+ * @see str_multireplace.h
+ */
+int64_t
+str_mr_stream_feed (str_mr_stream *stream, const char *chunk,
+                    size_t chunk_len)
+{
+    int32_t rc = STR_MR_ERROR_SUCCESS;
+    size_t  take = 0, total = 0, consumed = 0, off = 0;
+
+    if ((stream == NULL) || ((chunk == NULL) && (chunk_len > 0))) {
+        return STR_MR_ERROR_INVALID_ARG;
+    }
+
+    if (stream->status != STR_MR_ERROR_SUCCESS) {
+        return stream->status;
+    }
+
+    if (chunk_len == 0) {
+        return stream->mp_cnt;
+    }
+
+    if (stream->carry_len > 0) {
+        /* decide carried input with just enough of the chunk behind it */
+        take  = MIN(chunk_len, stream->lookahead);
+        total = stream->carry_len + take;
+        memcpy(stream->carry + stream->carry_len, chunk, take);
+
+        rc = str_mr_stream_scan(stream, stream->carry, total, false, &consumed);
+        if (rc != STR_MR_ERROR_SUCCESS) {
+            return rc;
+        }
+
+        if (take == chunk_len) {
+            /* whole chunk went to carry */
+            memmove(stream->carry, stream->carry + consumed, total - consumed);
+            stream->carry_len = total - consumed;
+            return stream->mp_cnt;
+        }
+
+        /* all carried input decided, continue in the chunk itself */
+        off = consumed - stream->carry_len;
+        stream->carry_len = 0;
+    }
+
+    rc = str_mr_stream_scan(stream, chunk + off, chunk_len - off, false,
+                            &consumed);
+    if (rc != STR_MR_ERROR_SUCCESS) {
+        return rc;
+    }
+
+    off += consumed;
+    stream->carry_len = chunk_len - off;
+    memcpy(stream->carry, chunk + off, stream->carry_len);
+
+    return stream->mp_cnt;
+}
+
+/**
+ * @brief Function to end input of stream.
+ *
+ * @see str_multireplace.h
+ */
+int64_t
+str_mr_stream_finish (str_mr_stream *stream)
+{
+    int32_t rc = STR_MR_ERROR_SUCCESS;
+    int64_t mp_cnt = 0;
+    size_t  consumed = 0;
+
+    if (stream == NULL) {
+        return STR_MR_ERROR_INVALID_ARG;
+    }
+
+    if (stream->status != STR_MR_ERROR_SUCCESS) {
+        return stream->status;
+    }
+
+    if (stream->carry_len > 0) {
+        rc = str_mr_stream_scan(stream, stream->carry, stream->carry_len,
+                                true, &consumed);
+        if (rc != STR_MR_ERROR_SUCCESS) {
+            return rc;
+        }
+    }
+
+    /* ready for new input */
+    mp_cnt = stream->mp_cnt;
+    stream->carry_len = 0;
+    stream->mp_cnt    = 0;
+
+    return mp_cnt;
+}
+
+/**
+ * @brief Function to free stream.
+ *
+ * @see str_multireplace.h
+ */
+void
+str_mr_stream_free (str_mr_stream *stream)
+{
+    if (stream == NULL) {
+        return;
+    }
+
+    free(stream->carry);
+    free(stream);
+}
+
+/** @} */
+
+/**
+ * @name Match cursor
+ *
+ * This section contains pull-based non-overlapping search over compiled set
+ */
+/** @{ */
+
+/**
+ * @brief Resumable match cursor
+ *
+ * Keeps the state of str_mr_kr_scan() between calls.
+ */
+struct str_mr_cursor {
+    str_mr_kr_state st;         /* search state */
+    str_mr_match *match;        /* match found by last scan */
+    bool done;                  /* no more matches */
+};
+
+/**
+ * @brief Function to create match cursor over buffer.
+ *
+ * @see str_multireplace.h
+ */
+int32_t
+str_mr_cursor_init (const str_mr_set *set, const char *str, size_t str_len,
+                    str_mr_cursor **cursor)
+{
+    str_mr_cursor *c = NULL;
+
+    if ((set == NULL) || (cursor == NULL) ||
+        ((str == NULL) && (str_len > 0))) {
+        return STR_MR_ERROR_INVALID_ARG;
+    }
+
+    c = (str_mr_cursor *)calloc(1, sizeof(str_mr_cursor));
+    if (c == NULL) {
+        return STR_MR_ERROR_OOM;
+    }
+
+    if (str_mr_kr_init(&c->st, set) != STR_MR_ERROR_SUCCESS) {
+        free(c);
+        return STR_MR_ERROR_OOM;
+    }
+
+    str_mr_cursor_reset(c, str, str_len);
+
+    *cursor = c;
+    return STR_MR_ERROR_SUCCESS;
+}
+
+/**
+ * @brief Function to restart cursor on another buffer.
+ *
+ * @see str_multireplace.h
+ */
+int32_t
+str_mr_cursor_reset (str_mr_cursor *cursor, const char *str, size_t str_len)
+{
+    if ((cursor == NULL) || ((str == NULL) && (str_len > 0))) {
+        return STR_MR_ERROR_INVALID_ARG;
+    }
+
+    str_mr_kr_start(&cursor->st, str, str_len);
+    cursor->done = (cursor->st.end == 0);
+
+    return STR_MR_ERROR_SUCCESS;
+}
+
+/**
+ * @brief Callback taking the match and stopping the scan
  *
- * @return callback returns whether the searching should continue or not
- * @retval STR_MR_MATCH_CONTINUE continue with searching for rest of matches
- * @retval STR_MR_MATCH_STOP stop searching
+ * @return always STR_MR_MATCH_STOP
  */
+static
 int
-str_mr_match_callback (const char *str, const char *where,
-                       const str_mr_match_pair *pair, void *ctx)
+str_mr_cursor_callback (const char *str, const char *where,
+                        const str_mr_match_pair *pair, void *ctx)
 {
-    str_mr_mp_queue *mpq = (str_mr_mp_queue *)ctx;
+    str_mr_cursor *cursor = (str_mr_cursor *)ctx;
 
-    /* add to queue */
-    str_mr_mp_queue_add(mpq, (where - str), pair);
+    cursor->match->pos      = where - str;
+    cursor->match->pair_idx = pair - cursor->st.set->match_pairs;
 
-    return STR_MR_MATCH_CONTINUE;
+    return STR_MR_MATCH_STOP;
 }
 
 /**
- * @brief qsort compare function
+ * @brief Function to find next non-overlapping match.
+ *
+ * Scan stops at the match and the next call resumes at its position, which
+ * is then taken, so only hashes are rolled over it.
+ *
+ * @see str_multireplace.h
  */
-int
-str_mr_mp_compare (const void *x0, const void *x1)
+int32_t
+str_mr_cursor_next (str_mr_cursor *cursor, str_mr_match *match)
 {
-    str_mr_match_pair_wrap *p0 = (str_mr_match_pair_wrap *)x0;
-    str_mr_match_pair_wrap *p1 = (str_mr_match_pair_wrap *)x1;
+    if ((cursor == NULL) || (match == NULL)) {
+        return STR_MR_ERROR_INVALID_ARG;
+    }
 
-    if (p0->pair->key_length == p1->pair->key_length) {
+    if (cursor->done) {
         return 0;
     }
 
-    if (p0->pair->key_length > p1->pair->key_length) {
-        return -1;
+    cursor->match = match;
+    if (str_mr_kr_scan(&cursor->st, NULL, str_mr_cursor_callback,
+                       cursor) == STR_MR_MATCH_STOP) {
+        return 1;
     }
 
-    return 1;
+    cursor->done = true;
+    return 0;
 }
 
 /**
- * @brief Function to replace all occurrences of match pairs in buffer.
+ * @brief Function to duplicate cursor with its position.
  *
  * @see str_multireplace.h
  */
 int32_t
-str_multireplace (const char *str, size_t str_len,
-                  const str_mr_match_pair *match_pairs, size_t match_pair_cnt,
-                  char **result, size_t *result_len, bool terminate)
+str_mr_cursor_copy (const str_mr_cursor *cursor, str_mr_cursor **copy)
 {
-    int i = 0;
-    int32_t rc    = 0;
-    char   *r     = NULL;
-    size_t  r_len = 0;
-    size_t  alloc_len = 0;
-    size_t  str_pos   = 0;
-    size_t  offset    = 0;
-
-    str_mr_mp_queue *mpq = NULL;               /* matched pairs queue */
-    str_mr_match_pair_wrap *sorted_mps = NULL; /* sorted wrapped match pairs */
-    str_mr_matched_pair    *mp = NULL;         /* match pair helper pointer */
+    str_mr_cursor *c = NULL;
 
-    if ((str == NULL) || (str_len <= 0) || (match_pairs == NULL) ||
-        (match_pair_cnt <= 0) || (result == NULL) || (result_len == NULL)) {
+    if ((cursor == NULL) || (copy == NULL)) {
         return STR_MR_ERROR_INVALID_ARG;
     }
 
-    mpq = str_mr_mp_queue_init(STR_MR_PREALLOC_OCCURENCES);
-    if (mpq == NULL) {
+    c = (str_mr_cursor *)calloc(1, sizeof(str_mr_cursor));
+    if (c == NULL) {
         return STR_MR_ERROR_OOM;
     }
 
-    sorted_mps = (str_mr_match_pair_wrap *)calloc(match_pair_cnt,
-                                                  sizeof(str_mr_match_pair_wrap));
-    if (sorted_mps == NULL) {
-        str_mr_mp_queue_free(mpq);
+    if (str_mr_kr_copy(&cursor->st, &c->st) != STR_MR_ERROR_SUCCESS) {
+        free(c);
         return STR_MR_ERROR_OOM;
     }
 
-    for (i = 0; i < match_pair_cnt; i++) {
-        sorted_mps[i].pair = &match_pairs[i];
+    c->done = cursor->done;
+
+    *copy = c;
+    return STR_MR_ERROR_SUCCESS;
+}
+
+/**
+ * @brief Function to free cursor.
+ *
+ * @see str_multireplace.h
+ */
+void
+str_mr_cursor_free (str_mr_cursor *cursor)
+{
+    if (cursor == NULL) {
+        return;
     }
 
-    qsort(sorted_mps, match_pair_cnt, sizeof(str_mr_match_pair_wrap),
-          str_mr_mp_compare);
+    str_mr_kr_fini(&cursor->st);
+    free(cursor);
+}
 
-    str_mr_kr_search(str, str_len, sorted_mps, match_pair_cnt,
-                     NULL, str_mr_match_callback, mpq);
+/** @} */
 
-    if (mpq->mp_cnt <= 0) {
-        alloc_len = str_len;
-        if (terminate == true) {
-            alloc_len++;
+/**
+ * @name Compiled set image
+ *
+ * This section contains position independent serialization of compiled set
+ */
+/** @{ */
+
+#define STR_MR_IMAGE_MAGIC          "STRMRSET"
+#define STR_MR_IMAGE_VERSION        (3)
+#define STR_MR_IMAGE_BYTE_ORDER     (0x01020304)
+#define STR_MR_IMAGE_HAS_VALUES     (1 << 0)
+#define STR_MR_IMAGE_NO_VALUE       (UINT64_MAX)
+#define STR_MR_IMAGE_ALIGN(x)       (((x) + 7) & ~(uint64_t)7)
+
+/**
+ * Largest hash table or filter in image has 2^STR_MR_IMAGE_MAX_BITS entries
+ */
+#define STR_MR_IMAGE_MAX_BITS       (48)
+
+/**
+ * @brief Image header
+ *
+ * All offsets are from the start of the image, except key and value offsets
+ * that are from the start of data. Hash tables, chain links, key hashes and
+ * filter are stored as the set uses them, so loaded set points at them.
+ */
+typedef struct {
+    char     magic[8];          /* STR_MR_IMAGE_MAGIC */
+    uint32_t version;           /* STR_MR_IMAGE_VERSION */
+    uint32_t byte_order;        /* STR_MR_IMAGE_BYTE_ORDER as written */
+    uint32_t word_size;         /* sizeof(size_t) as written */
+    uint32_t filter_bits;       /* filter has 2^filter_bits entries (0 when
+                                   set has no filter) */
+    uint64_t filter_q;          /* length of prefix hashed by filter */
+    uint64_t pair_cnt;          /* number of match pairs */
+    uint64_t bucket_cnt;        /* number of buckets */
+    uint64_t max_key_len;       /* length of the longest key */
+    uint64_t flags;             /* STR_MR_IMAGE_HAS_VALUES */
+    uint64_t pairs_off;         /* str_mr_image_pair[pair_cnt] */
+    uint64_t key_hashes_off;    /* uint64_t[pair_cnt] */
+    uint64_t chain_next_off;    /* size_t[pair_cnt] */
+    uint64_t buckets_off;       /* str_mr_image_bucket[bucket_cnt] */
+    uint64_t filter_off;        /* uint8_t[2^filter_bits] */
+    uint64_t data_off;          /* keys and values */
+    uint64_t data_len;          /* length of keys and values */
+} str_mr_image_hdr;
+
+/**
+ * @brief Image match pair (removed pairs are left out)
+ */
+typedef struct {
+    uint64_t key_off;
+    uint64_t key_len;
+    uint64_t value_off;         /* STR_MR_IMAGE_NO_VALUE for NULL value */
+    uint64_t value_len;
+} str_mr_image_pair;
+
+/**
+ * @brief Image bucket
+ */
+typedef struct {
+    uint64_t key_len;           /* key length, SORTED (descending) */
+    uint64_t bits;              /* hash table has 2^bits chains */
+    uint64_t cnt;               /* number of keys in bucket */
+    uint64_t heads_off;         /* size_t[2^bits] */
+} str_mr_image_bucket;
+
+/**
+ * @brief Check that [off, off + len) lies within size
+ */
+static
+bool
+str_mr_image_fits (uint64_t off, uint64_t len, uint64_t size)
+{
+    return ((off <= size) && (len <= size - off));
+}
+
+/**
+ * @brief Function to serialize compiled set into image.
+ *
+ * Removed pairs are left out, so pairs are renumbered in chains.
+ *
+ * @see str_multireplace.h
+ */
+int32_t
+str_mr_set_serialize (const str_mr_set *set, void **image, size_t *image_len)
+{
+    str_mr_image_hdr    *hdr = NULL;
+    str_mr_image_pair   *ip  = NULL;
+    str_mr_image_bucket *ib  = NULL;
+    const str_mr_match_pair *pair = NULL;
+    uint64_t *key_hashes = NULL;
+    size_t   *chain_next = NULL, *heads = NULL;
+    size_t   *new_idx = NULL;   /* index of each pair in image */
+    char     *data = NULL;
+    uint64_t  data_len = 0, len = 0, pair_cnt = 0, heads_off = 0;
+    size_t    i = 0, b = 0, c = 0, chains = 0;
+
+    if ((set == NULL) || (image == NULL) || (image_len == NULL)) {
+        return STR_MR_ERROR_INVALID_ARG;
+    }
+
+    new_idx = (size_t *)malloc((set->pair_cnt > 0 ? set->pair_cnt : 1) *
+                               sizeof(size_t));
+    if (new_idx == NULL) {
+        return STR_MR_ERROR_OOM;
+    }
+
+    for (i = 0; i < set->pair_cnt; i++) {
+        if (set->removed[i]) {
+            new_idx[i] = STR_MR_NO_PAIR;
+            continue;
         }
 
-        *result = (char *)malloc(alloc_len * sizeof(char));
-        if (*result == NULL) {
-            rc = STR_MR_ERROR_OOM;
-        } else {
-            memcpy(*result, str, str_len * sizeof(char));
-            if (terminate == true) {
-                *result[str_len] = '\0';
-            }
+        new_idx[i] = pair_cnt++;
+        data_len  += set->match_pairs[i].key_length;
+        if (set->match_pairs[i].value != NULL) {
+            data_len += set->match_pairs[i].value_length;
+        }
+    }
 
-            *result_len = str_len;
+    /* header, pairs, key hashes, chain links, buckets, tables, filter */
+    len = STR_MR_IMAGE_ALIGN(sizeof(str_mr_image_hdr)) +
+          pair_cnt * (sizeof(str_mr_image_pair) + sizeof(uint64_t) +
+                      sizeof(size_t)) +
+          set->bucket_cnt * sizeof(str_mr_image_bucket);
+    heads_off = len;
+    for (b = 0; b < set->bucket_cnt; b++) {
+        len += ((size_t)1 << set->buckets[b].bits) * sizeof(size_t);
+    }
+
+    if (set->filter != NULL) {
+        len += (size_t)1 << set->filter_bits;
+    }
+
+    len = STR_MR_IMAGE_ALIGN(len);
+
+    hdr = (str_mr_image_hdr *)calloc(1, STR_MR_IMAGE_ALIGN(len + data_len));
+    if (hdr == NULL) {
+        free(new_idx);
+        return STR_MR_ERROR_OOM;
+    }
+
+    memcpy(hdr->magic, STR_MR_IMAGE_MAGIC, sizeof(hdr->magic));
+    hdr->version        = STR_MR_IMAGE_VERSION;
+    hdr->byte_order     = STR_MR_IMAGE_BYTE_ORDER;
+    hdr->word_size      = sizeof(size_t);
+    hdr->filter_bits    = (set->filter != NULL ? set->filter_bits : 0);
+    hdr->filter_q       = (set->filter != NULL ? set->filter_q : 0);
+    hdr->pair_cnt       = pair_cnt;
+    hdr->bucket_cnt     = set->bucket_cnt;
+    hdr->max_key_len    = set->max_key_len;
+    hdr->flags          = (set->no_value_cnt == 0 ?
+                           STR_MR_IMAGE_HAS_VALUES : 0);
+    hdr->pairs_off      = STR_MR_IMAGE_ALIGN(sizeof(str_mr_image_hdr));
+    hdr->key_hashes_off = hdr->pairs_off +
+                          pair_cnt * sizeof(str_mr_image_pair);
+    hdr->chain_next_off = hdr->key_hashes_off + pair_cnt * sizeof(uint64_t);
+    hdr->buckets_off    = hdr->chain_next_off + pair_cnt * sizeof(size_t);
+    hdr->filter_off     = len - ((set->filter != NULL) ?
+                                 STR_MR_IMAGE_ALIGN((size_t)1 <<
+                                                    set->filter_bits) : 0);
+    hdr->data_off       = len;
+    hdr->data_len       = data_len;
+
+    ip         = (str_mr_image_pair *)((char *)hdr + hdr->pairs_off);
+    key_hashes = (uint64_t *)((char *)hdr + hdr->key_hashes_off);
+    chain_next = (size_t *)((char *)hdr + hdr->chain_next_off);
+    ib         = (str_mr_image_bucket *)((char *)hdr + hdr->buckets_off);
+    data       = (char *)hdr + hdr->data_off;
+
+    for (i = 0, len = 0; i < set->pair_cnt; i++) {
+        if (set->removed[i]) {
+            continue;
         }
-    } else {
-        rc    = mpq->mp_cnt;
-        r_len = str_len + mpq->offset;
-        alloc_len = r_len;
-        if (terminate) {
-            alloc_len++;
+
+        pair = &set->match_pairs[i];
+
+        ip->key_off = len;
+        ip->key_len = pair->key_length;
+        memcpy(data + len, pair->key, pair->key_length);
+        len += pair->key_length;
+
+        ip->value_off = STR_MR_IMAGE_NO_VALUE;
+        if (pair->value != NULL) {
+            ip->value_off = len;
+            ip->value_len = pair->value_length;
+            memcpy(data + len, pair->value, pair->value_length);
+            len += pair->value_length;
         }
 
-        r = (char *)malloc(alloc_len * sizeof(char));
-        if (r == NULL) {
-            rc = STR_MR_ERROR_OOM;
+        /* removed pairs are unlinked, so chains contain live pairs only */
+        key_hashes[new_idx[i]] = set->key_hashes[i];
+        chain_next[new_idx[i]] = (set->chain_next[i] == STR_MR_NO_PAIR ?
+                                  STR_MR_NO_PAIR :
+                                  new_idx[set->chain_next[i]]);
+        ip++;
+    }
+
+    for (b = 0; b < set->bucket_cnt; b++, ib++) {
+        ib->key_len   = set->key_lens[b];
+        ib->bits      = set->buckets[b].bits;
+        ib->cnt       = set->buckets[b].cnt;
+        ib->heads_off = heads_off;
+
+        heads  = (size_t *)((char *)hdr + heads_off);
+        chains = (size_t)1 << set->buckets[b].bits;
+        for (c = 0; c < chains; c++) {
+            heads[c] = (set->buckets[b].heads[c] == STR_MR_NO_PAIR ?
+                        STR_MR_NO_PAIR : new_idx[set->buckets[b].heads[c]]);
         }
 
-        for (i = 0; i < mpq->mp_cnt; i++) {
-            mp = &mpq->mps[i];
+        heads_off += chains * sizeof(size_t);
+    }
 
-            memcpy(r + str_pos + offset, str + str_pos, mp->pos - str_pos);
-            str_pos = mp->pos + mp->pair->key_length;
-            memcpy(r + mp->pos + offset, mp->pair->value,
-                   mp->pair->value_length);
-            offset += mp->pair->value_length - mp->pair->key_length;
+    if (set->filter != NULL) {
+        memcpy((char *)hdr + hdr->filter_off, set->filter,
+               (size_t)1 << set->filter_bits);
+    }
+
+    free(new_idx);
+
+    *image     = hdr;
+    *image_len = STR_MR_IMAGE_ALIGN(hdr->data_off + data_len);
+
+    return STR_MR_ERROR_SUCCESS;
+}
+
+/**
+ * @brief Check hash tables of loaded set
+ *
+ * Each link is checked on its own, without walking chains: heads point at
+ * keys of bucket length and chain links at later pairs with key of the same
+ * length. So every chain ends and holds only keys of its bucket, which is
+ * all the search relies on.
+ *
+ * @return true when hash tables are valid
+ */
+static
+bool
+str_mr_image_check_chains (const str_mr_set *set)
+{
+    const str_mr_bucket *bucket = NULL;
+    size_t b = 0, c = 0, w = 0, next = 0, total = 0;
+
+    for (b = 0; b < set->bucket_cnt; b++) {
+        bucket = &set->buckets[b];
+        for (c = 0; c < ((size_t)1 << bucket->bits); c++) {
+            w = bucket->heads[c];
+            if ((w != STR_MR_NO_PAIR) &&
+                ((w >= set->pair_cnt) ||
+                 (set->match_pairs[w].key_length != set->key_lens[b]))) {
+                return false;
+            }
         }
 
-        memcpy(r + str_pos + offset, str + str_pos, str_len - str_pos);
-        if (terminate) {
-            r[r_len] = '\0';
+        total += bucket->cnt;
+    }
+
+    for (w = 0; w < set->pair_cnt; w++) {
+        next = set->chain_next[w];
+        if ((next != STR_MR_NO_PAIR) &&
+            ((next <= w) || (next >= set->pair_cnt) ||
+             (set->match_pairs[next].key_length !=
+              set->match_pairs[w].key_length))) {
+            return false;
         }
+    }
 
-        *result = r;
-        *result_len = r_len;
+    return (total == set->pair_cnt);
+}
+
+/**
+ * @brief Function to load compiled set from image.
+ *
+ * Nothing is rebuilt, set points at hash tables, chain links, key hashes
+ * and filter in the image after checking them.
+ *
+ * @see str_multireplace.h
+ */
+int32_t
+str_mr_set_load (const void *image, size_t image_len, str_mr_set **set)
+{
+    const str_mr_image_hdr    *hdr = (const str_mr_image_hdr *)image;
+    const str_mr_image_pair   *ips = NULL;
+    const str_mr_image_bucket *ibs = NULL;
+    const char *base = (const char *)image;
+    const char *data = NULL;
+    str_mr_set *s = NULL;
+    size_t i = 0, cnt = 0, b = 0, bucket_cnt = 0;
+
+    if ((image == NULL) || (set == NULL) || (((uintptr_t)image & 7) != 0)) {
+        return STR_MR_ERROR_INVALID_ARG;
     }
 
-    /* cleanup */
-    free(sorted_mps);
-    str_mr_mp_queue_free(mpq);
+    if ((image_len < sizeof(str_mr_image_hdr)) ||
+        (memcmp(hdr->magic, STR_MR_IMAGE_MAGIC, sizeof(hdr->magic)) != 0) ||
+        (hdr->version != STR_MR_IMAGE_VERSION) ||
+        (hdr->byte_order != STR_MR_IMAGE_BYTE_ORDER) ||
+        (hdr->word_size != sizeof(size_t)) ||
+        (hdr->pair_cnt > image_len / sizeof(str_mr_image_pair)) ||
+        (hdr->bucket_cnt > image_len / sizeof(str_mr_image_bucket)) ||
+        (hdr->bucket_cnt > hdr->pair_cnt) ||
+        ((hdr->pairs_off & 7) != 0) || ((hdr->key_hashes_off & 7) != 0) ||
+        ((hdr->chain_next_off & 7) != 0) || ((hdr->buckets_off & 7) != 0) ||
+        !str_mr_image_fits(hdr->pairs_off,
+                           hdr->pair_cnt * sizeof(str_mr_image_pair),
+                           image_len) ||
+        !str_mr_image_fits(hdr->key_hashes_off,
+                           hdr->pair_cnt * sizeof(uint64_t), image_len) ||
+        !str_mr_image_fits(hdr->chain_next_off,
+                           hdr->pair_cnt * sizeof(size_t), image_len) ||
+        !str_mr_image_fits(hdr->buckets_off,
+                           hdr->bucket_cnt * sizeof(str_mr_image_bucket),
+                           image_len) ||
+        !str_mr_image_fits(hdr->data_off, hdr->data_len, image_len)) {
+        return STR_MR_ERROR_FORMAT;
+    }
+
+    if ((hdr->filter_bits != 0) &&
+        ((hdr->filter_bits < STR_MR_BUCKET_MIN_BITS) ||
+         (hdr->filter_bits > STR_MR_IMAGE_MAX_BITS) ||
+         (hdr->filter_q == 0) || (hdr->filter_q > STR_MR_FILTER_Q) ||
+         !str_mr_image_fits(hdr->filter_off,
+                            (uint64_t)1 << hdr->filter_bits, image_len))) {
+        return STR_MR_ERROR_FORMAT;
+    }
+
+    cnt        = hdr->pair_cnt;
+    bucket_cnt = hdr->bucket_cnt;
+    ips  = (const str_mr_image_pair *)(base + hdr->pairs_off);
+    ibs  = (const str_mr_image_bucket *)(base + hdr->buckets_off);
+    data = base + hdr->data_off;
+
+    s = (str_mr_set *)calloc(1, sizeof(str_mr_set));
+    if (s == NULL) {
+        return STR_MR_ERROR_OOM;
+    }
+
+    /* tables in image are not freed by str_mr_set_fini() */
+    s->in_image = true;
+
+    s->own_pairs = (str_mr_match_pair *)malloc((cnt > 0 ? cnt : 1) *
+                                               sizeof(str_mr_match_pair));
+    s->removed   = (bool *)calloc((cnt > 0 ? cnt : 1), sizeof(bool));
+    s->buckets   = (str_mr_bucket *)calloc(bucket_cnt + 1,
+                                           sizeof(str_mr_bucket));
+    s->key_lens  = (size_t *)calloc(bucket_cnt + 1, sizeof(size_t));
+    s->rem_coefs = (uint64_t *)calloc(bucket_cnt + 1, sizeof(uint64_t));
+    if ((s->own_pairs == NULL) || (s->removed == NULL) ||
+        (s->buckets == NULL) || (s->key_lens == NULL) ||
+        (s->rem_coefs == NULL)) {
+        str_mr_set_free(s);
+        return STR_MR_ERROR_OOM;
+    }
+
+    for (i = 0; i < cnt; i++) {
+        if ((ips[i].key_len == 0) ||
+            !str_mr_image_fits(ips[i].key_off, ips[i].key_len,
+                               hdr->data_len) ||
+            ((ips[i].value_off != STR_MR_IMAGE_NO_VALUE) &&
+             !str_mr_image_fits(ips[i].value_off, ips[i].value_len,
+                                hdr->data_len))) {
+            str_mr_set_free(s);
+            return STR_MR_ERROR_FORMAT;
+        }
+
+        s->own_pairs[i].key          = data + ips[i].key_off;
+        s->own_pairs[i].key_length   = ips[i].key_len;
+        s->own_pairs[i].value        = NULL;
+        s->own_pairs[i].value_length = 0;
+        if (ips[i].value_off != STR_MR_IMAGE_NO_VALUE) {
+            s->own_pairs[i].value        = data + ips[i].value_off;
+            s->own_pairs[i].value_length = ips[i].value_len;
+        } else {
+            s->no_value_cnt++;
+        }
+    }
+
+    s->pair_cnt     = cnt;
+    s->pair_alloc   = cnt;
+    s->match_pairs  = s->own_pairs;
+    s->key_hashes   = (uint64_t *)(base + hdr->key_hashes_off);
+    s->chain_next   = (size_t *)(base + hdr->chain_next_off);
+    s->bucket_cnt   = bucket_cnt;
+    s->bucket_alloc = bucket_cnt + 1;
+
+    for (b = 0; b < bucket_cnt; b++) {
+        if ((ibs[b].key_len == 0) ||
+            ((b > 0) && (ibs[b].key_len >= ibs[b - 1].key_len)) ||
+            (ibs[b].bits < STR_MR_BUCKET_MIN_BITS) ||
+            (ibs[b].bits > STR_MR_IMAGE_MAX_BITS) ||
+            ((ibs[b].heads_off & 7) != 0) ||
+            !str_mr_image_fits(ibs[b].heads_off,
+                               ((uint64_t)1 << ibs[b].bits) * sizeof(size_t),
+                               image_len)) {
+            str_mr_set_free(s);
+            return STR_MR_ERROR_FORMAT;
+        }
+
+        s->buckets[b].heads = (size_t *)(base + ibs[b].heads_off);
+        s->buckets[b].bits  = ibs[b].bits;
+        s->buckets[b].cnt   = ibs[b].cnt;
+        s->key_lens[b]      = ibs[b].key_len;
+        s->rem_coefs[b]     = str_mr_rem_coef(ibs[b].key_len);
+    }
+
+    s->max_key_len = (bucket_cnt > 0 ? s->key_lens[0] : 0);
+    if (hdr->filter_bits != 0) {
+        s->filter      = (uint8_t *)(base + hdr->filter_off);
+        s->filter_bits = hdr->filter_bits;
+        s->filter_q    = hdr->filter_q;
+    }
+
+    /* filter prefix has to fit into the shortest key */
+    if (!str_mr_image_check_chains(s) ||
+        (s->max_key_len != hdr->max_key_len) ||
+        ((s->filter != NULL) &&
+         ((bucket_cnt == 0) || (s->filter_q > s->key_lens[bucket_cnt - 1]))) ||
+        ((s->no_value_cnt == 0) !=
+         ((hdr->flags & STR_MR_IMAGE_HAS_VALUES) != 0))) {
+        str_mr_set_free(s);
+        return STR_MR_ERROR_FORMAT;
+    }
+
+    *set = s;
+    return STR_MR_ERROR_SUCCESS;
+}
+
+#ifdef STR_MR_WITH_POSIX
+/**
+ * @brief Function to save compiled set image into file.
+ *
+ * @see str_multireplace.h
+ */
+int32_t
+str_mr_set_save (const str_mr_set *set, const char *path)
+{
+    int32_t rc = STR_MR_ERROR_SUCCESS;
+    void   *image = NULL;
+    size_t  image_len = 0;
+    char   *tmp_path = NULL;
+    FILE   *f = NULL;
+    int     err_no = 0;
+
+    if ((set == NULL) || (path == NULL)) {
+        return STR_MR_ERROR_INVALID_ARG;
+    }
+
+    rc = str_mr_set_serialize(set, &image, &image_len);
+    if (rc != STR_MR_ERROR_SUCCESS) {
+        return rc;
+    }
+
+    tmp_path = (char *)malloc(strlen(path) + 32);
+    if (tmp_path == NULL) {
+        free(image);
+        return STR_MR_ERROR_OOM;
+    }
+
+    sprintf(tmp_path, "%s.tmp.%ld", path, (long)getpid());
+
+    f = fopen(tmp_path, "wb");
+    if ((f == NULL) ||
+        (fwrite(image, 1, image_len, f) != image_len) ||
+        (fflush(f) != 0) || (fsync(fileno(f)) != 0)) {
+        err_no = errno;
+    }
+
+    if ((f != NULL) && (fclose(f) != 0) && (err_no == 0)) {
+        err_no = errno;
+    }
+
+    if ((err_no == 0) && (rename(tmp_path, path) != 0)) {
+        err_no = errno;
+    }
+
+    if (err_no != 0) {
+        unlink(tmp_path);
+        errno = err_no;
+        rc = STR_MR_ERROR_IO;
+    }
+
+    free(tmp_path);
+    free(image);
 
     return rc;
 }
 
-/** @} */
+/**
+ * @brief Function to map compiled set image file.
+ *
+ * @see str_multireplace.h
+ */
+int32_t
+str_mr_set_map (const char *path, str_mr_set **set)
+{
+    int32_t rc = STR_MR_ERROR_SUCCESS;
+    struct stat st;
+    void   *map = NULL;
+    int     fd = -1;
+
+    if ((path == NULL) || (set == NULL)) {
+        return STR_MR_ERROR_INVALID_ARG;
+    }
 
+    fd = open(path, O_RDONLY);
+    if ((fd < 0) || (fstat(fd, &st) != 0)) {
+        if (fd >= 0) {
+            close(fd);
+        }
+
+        return STR_MR_ERROR_IO;
+    }
+
+    if ((size_t)st.st_size < sizeof(str_mr_image_hdr)) {
+        close(fd);
+        return STR_MR_ERROR_FORMAT;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return STR_MR_ERROR_IO;
+    }
+
+    rc = str_mr_set_load(map, st.st_size, set);
+    if (rc != STR_MR_ERROR_SUCCESS) {
+        munmap(map, st.st_size);
+        return rc;
+    }
+
+    (*set)->map     = map;
+    (*set)->map_len = st.st_size;
+
+    return STR_MR_ERROR_SUCCESS;
+}
+
+#endif
+
+/** @} */
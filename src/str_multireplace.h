@@ -18,6 +18,25 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <uchar.h>
+#include <wchar.h>
+
+/*
+ * Functions using POSIX interfaces (iovec output, saving and mapping of set
+ * images) are built only for POSIX systems, define STR_MR_NO_POSIX to leave
+ * them out anyway. The rest is plain C11.
+ */
+#if !defined(STR_MR_NO_POSIX) && (defined(__unix__) || defined(__APPLE__))
+#define STR_MR_WITH_POSIX
+#endif
+
+#ifdef STR_MR_WITH_POSIX
+#include <sys/uio.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 /**
  * Success
@@ -41,6 +60,45 @@
  */
 #define STR_MR_ERROR_INVALID_MATCH  (-3)
 
+/**
+ * Output sink failed
+ * (sink or value callback returned non-zero)
+ */
+#define STR_MR_ERROR_SINK           (-4)
+
+/**
+ * Result doesn't fit into return type
+ * (more than INT32_MAX replacements, use the 64-bit variant)
+ */
+#define STR_MR_ERROR_OVERFLOW       (-5)
+
+/**
+ * Reading or writing failed
+ * (errno is set)
+ */
+#define STR_MR_ERROR_IO             (-6)
+
+/**
+ * Invalid compiled set image
+ * (wrong magic, version, byte order or corrupted content)
+ */
+#define STR_MR_ERROR_FORMAT         (-7)
+
+/**
+ * Continue searching (returned by find callback)
+ */
+#define STR_MR_MATCH_CONTINUE       (0)
+
+/**
+ * Stop searching (returned by find callback)
+ */
+#define STR_MR_MATCH_STOP           (1)
+
+/**
+ * No limit on number of replacements
+ */
+#define STR_MR_UNLIMITED            ((size_t)-1)
+
 /**
  * @brief Match key-value string pair
  */
@@ -51,6 +109,110 @@ typedef struct {
     size_t value_length;        /**< length of the value (w/o NULL termin.) */
 } str_mr_match_pair;
 
+/**
+ * @brief Match key-value pair of UTF-16 strings
+ */
+typedef struct {
+    const char16_t *key;        /**< key that should be replaced */
+    size_t key_length;          /**< length of the key in code units */
+    const char16_t *value;      /**< value put in place of key */
+    size_t value_length;        /**< length of the value in code units */
+} str_mr_match_pair16;
+
+/**
+ * @brief Match key-value pair of UTF-32 strings
+ */
+typedef struct {
+    const char32_t *key;        /**< key that should be replaced */
+    size_t key_length;          /**< length of the key in code units */
+    const char32_t *value;      /**< value put in place of key */
+    size_t value_length;        /**< length of the value in code units */
+} str_mr_match_pair32;
+
+/**
+ * @brief Match key-value pair of wide character strings
+ */
+typedef struct {
+    const wchar_t *key;         /**< key that should be replaced */
+    size_t key_length;          /**< length of the key in characters */
+    const wchar_t *value;       /**< value put in place of key */
+    size_t value_length;        /**< length of the value in characters */
+} str_mr_match_pair_w;
+
+/**
+ * @brief Compiled match pairs set
+ *
+ * Created by str_mr_set_compile(), changed only by str_mr_set_add() and
+ * str_mr_set_remove().
+ */
+typedef struct str_mr_set str_mr_set;
+
+/**
+ * @brief Streaming replacement state
+ *
+ * Created by str_mr_stream_init().
+ */
+typedef struct str_mr_stream str_mr_stream;
+
+/**
+ * @brief Resumable match cursor
+ *
+ * Created by str_mr_cursor_init().
+ */
+typedef struct str_mr_cursor str_mr_cursor;
+
+/**
+ * @brief Match found in source buffer
+ */
+typedef struct {
+    size_t pos;                 /**< position of the match in source buffer */
+    size_t pair_idx;            /**< index of matched pair in match pairs */
+} str_mr_match;
+
+/**
+ * @brief Find callback called for every match found
+ *
+ * @param[in] ctx callback context provided by caller
+ * @param[in] pos position of the match in source buffer
+ * @param[in] pair_idx index of matched pair in match pairs array
+ * @return callback returns whether the searching should continue or not
+ * @retval STR_MR_MATCH_CONTINUE continue with searching for rest of matches
+ * @retval STR_MR_MATCH_STOP stop searching
+ */
+typedef int (*str_mr_find_cb)(void *ctx, size_t pos, size_t pair_idx);
+
+/**
+ * @brief Output sink callback receiving result piece by piece
+ *
+ * Called in order with untouched parts of the source buffer and values of
+ * matched pairs. Pieces are never empty.
+ *
+ * @param[in] ctx sink context provided by caller
+ * @param[in] ptr piece of the result
+ * @param[in] len length of the piece
+ * @return 0 to continue, anything else aborts the replacement
+ */
+typedef int (*str_mr_sink_cb)(void *ctx, const char *ptr, size_t len);
+
+/**
+ * @brief Value callback producing replacement for a match
+ *
+ * Called in order for every replaced match instead of using value of the
+ * match pair. Writes the replacement by calling provided sink (any number
+ * of times, also zero times for empty replacement).
+ *
+ * @param[in] ctx value callback context provided by caller
+ * @param[in] pos position of the match in source buffer
+ * @param[in] pair_idx index of matched pair in match pairs array
+ * @param[in] pair matched pair
+ * @param[in] sink sink the replacement should be written to
+ * @param[in] sink_ctx context to be passed to sink
+ * @return 0 to continue, anything else aborts the replacement
+ */
+typedef int (*str_mr_value_cb)(void *ctx, size_t pos, size_t pair_idx,
+                               const str_mr_match_pair *pair,
+                               str_mr_sink_cb sink, void *sink_ctx);
+
 /**
  * @brief Function to replace all occurrences of match pairs in buffer.
  *
@@ -72,10 +234,767 @@ typedef struct {
  * @retval STR_MR_ERROR_OOM out of memory
  * @retval STR_MR_ERROR_INVALID_ARG invalid argument provided
  * @retval STR_MR_ERROR_INVALID_MATCH invalid match pair provided
+ * @retval STR_MR_ERROR_OVERFLOW more than INT32_MAX replacements (use
+ *         str_multireplace64())
  */
 int32_t
 str_multireplace(const char *str, size_t str_len,
                  const str_mr_match_pair *match_pairs, size_t match_pair_cnt,
                  char **result, size_t *result_len, bool terminate);
 
+/**
+ * @brief Function to replace all occurrences of match pairs in buffer.
+ *
+ * Same as str_multireplace(), but returns 64-bit number of replacements, so
+ * it can be used for inputs with more than INT32_MAX matches.
+ *
+ * Note: Caller is responsible for freeing the result.
+ *
+ * @param[in] str source buffer
+ * @param[in] str_len source buffer length
+ * @param[in] match_pairs match pairs array
+ * @param[in] match_pair_cnt number of match pairs in match_pair array
+ * @param[out] result newly allocated buffer containing all replacements
+ * @param[out] result_len length of result string
+ * @param[in] terminate true to get the result to be terminated
+ *
+ * @return number of replacements made or negative number on error
+ * @retval STR_MR_ERROR_OOM out of memory
+ * @retval STR_MR_ERROR_INVALID_ARG invalid argument provided
+ * @retval STR_MR_ERROR_INVALID_MATCH invalid match pair provided
+ */
+int64_t
+str_multireplace64(const char *str, size_t str_len,
+                   const str_mr_match_pair *match_pairs, size_t match_pair_cnt,
+                   char **result, size_t *result_len, bool terminate);
+
+/**
+ * @brief Function to replace all occurrences of match pairs in UTF-16
+ *        buffer.
+ *
+ * Same as str_multireplace64(), but buffer, keys and values are strings of
+ * 16-bit code units and all lengths are in code units. Matches start only
+ * at code unit boundaries (only those are probed), so no transcoding to
+ * UTF-8 is needed. Terminator is one zero code unit.
+ *
+ * Code units are matched as they are, surrogate pairs are not decoded: a
+ * key made of a lone surrogate also matches half of a surrogate pair.
+ *
+ * Note: Caller is responsible for freeing the result.
+ *
+ * @param[in] str source buffer
+ * @param[in] str_len source buffer length in code units
+ * @param[in] match_pairs match pairs array
+ * @param[in] match_pair_cnt number of match pairs in match_pair array
+ * @param[out] result newly allocated buffer containing all replacements
+ * @param[out] result_len length of result in code units
+ * @param[in] terminate true to get the result to be terminated
+ *
+ * @return number of replacements made or negative number on error
+ * @retval STR_MR_ERROR_OOM out of memory
+ * @retval STR_MR_ERROR_INVALID_ARG invalid argument provided
+ * @retval STR_MR_ERROR_INVALID_MATCH invalid match pair provided
+ */
+int64_t
+str_multireplace16(const char16_t *str, size_t str_len,
+                   const str_mr_match_pair16 *match_pairs,
+                   size_t match_pair_cnt,
+                   char16_t **result, size_t *result_len, bool terminate);
+
+/**
+ * @brief Function to replace all occurrences of match pairs in UTF-32
+ *        buffer.
+ *
+ * Same as str_multireplace16(), but for 32-bit code units.
+ *
+ * @see str_multireplace16()
+ */
+int64_t
+str_multireplace32(const char32_t *str, size_t str_len,
+                   const str_mr_match_pair32 *match_pairs,
+                   size_t match_pair_cnt,
+                   char32_t **result, size_t *result_len, bool terminate);
+
+/**
+ * @brief Function to replace all occurrences of match pairs in wide
+ *        character buffer.
+ *
+ * Same as str_multireplace16(), but for wchar_t (16-bit on Windows, 32-bit
+ * elsewhere).
+ *
+ * @see str_multireplace16()
+ */
+int64_t
+str_multireplace_w(const wchar_t *str, size_t str_len,
+                   const str_mr_match_pair_w *match_pairs,
+                   size_t match_pair_cnt,
+                   wchar_t **result, size_t *result_len, bool terminate);
+
+/**
+ * @brief Function to replace limited number of occurrences of match pairs.
+ *
+ * Same as str_multireplace(), but stops searching once max_replacements
+ * replacements were made and copies the rest of str as is.
+ * Matches of a pair that used up its quota are left alone (shorter keys
+ * matching at the same position can still be replaced).
+ *
+ * Note: Caller is responsible for freeing the result.
+ *
+ * @param[in] str source buffer
+ * @param[in] str_len source buffer length
+ * @param[in] match_pairs match pairs array
+ * @param[in] match_pair_cnt number of match pairs in match_pair array
+ * @param[in] max_replacements max. number of replacements
+ *            (STR_MR_UNLIMITED for no limit)
+ * @param[in] pair_quotas array of match_pair_cnt max. numbers of replacements
+ *            of each pair (STR_MR_UNLIMITED for no limit) or NULL
+ * @param[out] result newly allocated buffer containing all replacements
+ * @param[out] result_len length of result string
+ * @param[in] terminate true to get the result to be terminated
+ *
+ * @return number of replacements made or negative number on error
+ * @retval STR_MR_ERROR_OOM out of memory
+ * @retval STR_MR_ERROR_INVALID_ARG invalid argument provided
+ * @retval STR_MR_ERROR_INVALID_MATCH invalid match pair provided
+ */
+int64_t
+str_multireplace_limit(const char *str, size_t str_len,
+                       const str_mr_match_pair *match_pairs,
+                       size_t match_pair_cnt,
+                       size_t max_replacements, const size_t *pair_quotas,
+                       char **result, size_t *result_len, bool terminate);
+
+/**
+ * @brief Function to replace all occurrences of match pairs in place.
+ *
+ * Same as str_multireplace(), but rewrites provided buffer instead of
+ * allocating the result. Only usable when no value is longer than its key,
+ * so the result can never be longer than the source.
+ * Buffer is rewritten in one pass during the search, the only memory
+ * allocated is compiled match pairs (nothing depends on buffer length).
+ * Result is not NULL terminated.
+ *
+ * @param[in,out] str source buffer rewritten with the result
+ * @param[in] str_len source buffer length
+ * @param[in] match_pairs match pairs array
+ * @param[in] match_pair_cnt number of match pairs in match_pair array
+ * @param[out] result_len length of result in str
+ *
+ * @return number of replacements made or negative number on error
+ * @retval STR_MR_ERROR_OOM out of memory
+ * @retval STR_MR_ERROR_INVALID_ARG invalid argument provided
+ * @retval STR_MR_ERROR_INVALID_MATCH invalid match pair provided (or some
+ *         value is longer than its key)
+ */
+int64_t
+str_multireplace_inplace(char *str, size_t str_len,
+                         const str_mr_match_pair *match_pairs,
+                         size_t match_pair_cnt, size_t *result_len);
+
+#ifdef STR_MR_WITH_POSIX
+/**
+ * @brief Function to describe replaced buffer as scatter/gather list.
+ *
+ * Finds the same replacements as str_multireplace(), but doesn't build the
+ * result. Instead returns iovec array alternating between untouched slices
+ * of str and values of matched pairs, ready to be passed to writev() or
+ * sendmsg(). Empty slices are left out.
+ *
+ * Note: Caller is responsible for freeing the iov array. Entries point into
+ * str and match pair values, so those have to stay valid while iov is used.
+ *
+ * @param[in] str source buffer
+ * @param[in] str_len source buffer length
+ * @param[in] match_pairs match pairs array
+ * @param[in] match_pair_cnt number of match pairs in match_pair array
+ * @param[out] iov newly allocated iovec array describing the result
+ * @param[out] iov_cnt number of entries in iov array
+ *
+ * @return number of replacements made or negative number on error
+ * @retval STR_MR_ERROR_OOM out of memory
+ * @retval STR_MR_ERROR_INVALID_ARG invalid argument provided
+ * @retval STR_MR_ERROR_INVALID_MATCH invalid match pair provided
+ */
+int64_t
+str_multireplace_iov(const char *str, size_t str_len,
+                     const str_mr_match_pair *match_pairs,
+                     size_t match_pair_cnt,
+                     struct iovec **iov, size_t *iov_cnt);
+#endif
+
+/**
+ * @brief Function to replace all occurrences of match pairs into a sink.
+ *
+ * Finds the same replacements as str_multireplace(), but passes the result
+ * to provided sink callback as it is found instead of building it in memory.
+ *
+ * @param[in] str source buffer
+ * @param[in] str_len source buffer length
+ * @param[in] match_pairs match pairs array
+ * @param[in] match_pair_cnt number of match pairs in match_pair array
+ * @param[in] sink callback receiving the result
+ * @param[in] sink_ctx context passed to sink
+ *
+ * @return number of replacements made or negative number on error
+ * @retval STR_MR_ERROR_OOM out of memory
+ * @retval STR_MR_ERROR_INVALID_ARG invalid argument provided
+ * @retval STR_MR_ERROR_INVALID_MATCH invalid match pair provided
+ * @retval STR_MR_ERROR_SINK sink aborted the replacement
+ */
+int64_t
+str_multireplace_sink(const char *str, size_t str_len,
+                      const str_mr_match_pair *match_pairs,
+                      size_t match_pair_cnt,
+                      str_mr_sink_cb sink, void *sink_ctx);
+
+/**
+ * @brief Function to replace match pairs with values produced by callback.
+ *
+ * Same as str_multireplace_sink(), but replacement of every match is written
+ * to the sink by value_cb. Values of match pairs are not used and can be NULL.
+ *
+ * @param[in] str source buffer
+ * @param[in] str_len source buffer length
+ * @param[in] match_pairs match pairs array
+ * @param[in] match_pair_cnt number of match pairs in match_pair array
+ * @param[in] value_cb callback producing replacements
+ * @param[in] value_ctx context passed to value_cb
+ * @param[in] sink callback receiving the result
+ * @param[in] sink_ctx context passed to sink
+ *
+ * @return number of replacements made or negative number on error
+ * @retval STR_MR_ERROR_OOM out of memory
+ * @retval STR_MR_ERROR_INVALID_ARG invalid argument provided
+ * @retval STR_MR_ERROR_INVALID_MATCH invalid match pair provided
+ * @retval STR_MR_ERROR_SINK sink or value_cb aborted the replacement
+ */
+int64_t
+str_multireplace_dyn_sink(const char *str, size_t str_len,
+                          const str_mr_match_pair *match_pairs,
+                          size_t match_pair_cnt,
+                          str_mr_value_cb value_cb, void *value_ctx,
+                          str_mr_sink_cb sink, void *sink_ctx);
+
+/**
+ * @brief Function to replace match pairs with values produced by callback.
+ *
+ * Same as str_multireplace(), but replacement of every match is written by
+ * value_cb. Values of match pairs are not used and can be NULL.
+ *
+ * Note: Caller is responsible for freeing the result.
+ *
+ * @param[in] str source buffer
+ * @param[in] str_len source buffer length
+ * @param[in] match_pairs match pairs array
+ * @param[in] match_pair_cnt number of match pairs in match_pair array
+ * @param[in] value_cb callback producing replacements
+ * @param[in] value_ctx context passed to value_cb
+ * @param[out] result newly allocated buffer containing all replacements
+ * @param[out] result_len length of result string
+ * @param[in] terminate true to get the result to be terminated
+ *
+ * @return number of replacements made or negative number on error
+ * @retval STR_MR_ERROR_OOM out of memory
+ * @retval STR_MR_ERROR_INVALID_ARG invalid argument provided
+ * @retval STR_MR_ERROR_INVALID_MATCH invalid match pair provided
+ * @retval STR_MR_ERROR_SINK value_cb aborted the replacement
+ */
+int64_t
+str_multireplace_dyn(const char *str, size_t str_len,
+                     const str_mr_match_pair *match_pairs,
+                     size_t match_pair_cnt,
+                     str_mr_value_cb value_cb, void *value_ctx,
+                     char **result, size_t *result_len, bool terminate);
+
+/**
+ * @brief Function to find occurrences of match pairs calling callback.
+ *
+ * Searches for keys of match pairs without doing any replacement. In
+ * non-overlapping mode reports exactly the matches str_multireplace() would
+ * replace. In overlapping mode reports every occurrence of every key
+ * (longer keys first when more keys start at the same position).
+ * Values of match pairs are not used and can be NULL.
+ *
+ * @param[in] str source buffer
+ * @param[in] str_len source buffer length
+ * @param[in] match_pairs match pairs array
+ * @param[in] match_pair_cnt number of match pairs in match_pair array
+ * @param[in] overlapping true to report overlapping matches too
+ * @param[in] cb callback called for every match found (any other return
+ *            value than STR_MR_MATCH_CONTINUE stops the search)
+ * @param[in] cb_ctx context passed to cb
+ *
+ * @return number of matches reported or negative number on error
+ * @retval STR_MR_ERROR_OOM out of memory
+ * @retval STR_MR_ERROR_INVALID_ARG invalid argument provided
+ * @retval STR_MR_ERROR_INVALID_MATCH invalid match pair provided
+ */
+int64_t
+str_mr_find_each(const char *str, size_t str_len,
+                 const str_mr_match_pair *match_pairs, size_t match_pair_cnt,
+                 bool overlapping, str_mr_find_cb cb, void *cb_ctx);
+
+/**
+ * @brief Function to find occurrences of match pairs.
+ *
+ * Same as str_mr_find_each(), but returns array of matches in order they
+ * were found.
+ *
+ * Note: Caller is responsible for freeing the matches.
+ *
+ * @param[in] str source buffer
+ * @param[in] str_len source buffer length
+ * @param[in] match_pairs match pairs array
+ * @param[in] match_pair_cnt number of match pairs in match_pair array
+ * @param[in] overlapping true to report overlapping matches too
+ * @param[out] matches newly allocated array of matches found
+ * @param[out] match_cnt number of matches in matches array
+ *
+ * @return number of matches found or negative number on error
+ * @retval STR_MR_ERROR_OOM out of memory
+ * @retval STR_MR_ERROR_INVALID_ARG invalid argument provided
+ * @retval STR_MR_ERROR_INVALID_MATCH invalid match pair provided
+ */
+int64_t
+str_mr_find(const char *str, size_t str_len,
+            const str_mr_match_pair *match_pairs, size_t match_pair_cnt,
+            bool overlapping, str_mr_match **matches, size_t *match_cnt);
+
+/**
+ * @brief Function to check whether any key occurs in buffer.
+ *
+ * Stops searching at the first occurrence of any key. Values of match
+ * pairs are not used and can be NULL.
+ *
+ * Every call compiles match pairs (hash tables of all key lengths, plus
+ * prefix filter for a thousand keys or more) and releases them again.
+ * When the same keys are probed repeatedly, compile them once by
+ * str_mr_set_compile() and use str_mr_set_contains_any().
+ *
+ * @param[in] str source buffer
+ * @param[in] str_len source buffer length
+ * @param[in] match_pairs match pairs array
+ * @param[in] match_pair_cnt number of match pairs in match_pair array
+ *
+ * @return 1 when some key occurs in str, 0 when not or negative number on
+ *         error
+ * @retval STR_MR_ERROR_OOM out of memory
+ * @retval STR_MR_ERROR_INVALID_ARG invalid argument provided
+ * @retval STR_MR_ERROR_INVALID_MATCH invalid match pair provided
+ */
+int32_t
+str_mr_contains_any(const char *str, size_t str_len,
+                    const str_mr_match_pair *match_pairs,
+                    size_t match_pair_cnt);
+
+/**
+ * @brief Function to count occurrences of keys in buffer.
+ *
+ * Counts matches the same way str_mr_find_each() reports them, without
+ * storing them. Values of match pairs are not used and can be NULL.
+ *
+ * @param[in] str source buffer
+ * @param[in] str_len source buffer length
+ * @param[in] match_pairs match pairs array
+ * @param[in] match_pair_cnt number of match pairs in match_pair array
+ * @param[in] overlapping true to count overlapping matches too
+ * @param[out] counts array of match_pair_cnt counters receiving number of
+ *             matches of each pair (can be NULL)
+ *
+ * @return total number of matches or negative number on error
+ * @retval STR_MR_ERROR_OOM out of memory
+ * @retval STR_MR_ERROR_INVALID_ARG invalid argument provided
+ * @retval STR_MR_ERROR_INVALID_MATCH invalid match pair provided
+ */
+int64_t
+str_mr_count(const char *str, size_t str_len,
+             const str_mr_match_pair *match_pairs, size_t match_pair_cnt,
+             bool overlapping, size_t *counts);
+
+/**
+ * @brief Function to compile match pairs into reusable set.
+ *
+ * Checks and preprocesses match pairs once, so they can be used for many
+ * searches. Set is never modified by searching, so it can be shared by
+ * concurrent searches. Values can be NULL when set is only used for
+ * searching.
+ *
+ * Keys and values are copied into one cache-line-aligned arena owned by
+ * the set (keys probed together are next to each other), so match pairs
+ * array, keys and values can be released right after the call.
+ *
+ * Sets of a thousand keys or more also get a filter of key prefixes, so
+ * most positions of searched buffer are passed by one table lookup.
+ *
+ * Note: Caller is responsible for freeing the set (str_mr_set_free()).
+ *
+ * @param[in] match_pairs match pairs array
+ * @param[in] match_pair_cnt number of match pairs in match_pair array
+ * @param[out] set newly allocated compiled set
+ *
+ * @return status code
+ * @retval STR_MR_ERROR_SUCCESS successfuly compiled
+ * @retval STR_MR_ERROR_OOM out of memory
+ * @retval STR_MR_ERROR_INVALID_ARG invalid argument provided
+ * @retval STR_MR_ERROR_INVALID_MATCH invalid match pair provided
+ */
+int32_t
+str_mr_set_compile(const str_mr_match_pair *match_pairs,
+                   size_t match_pair_cnt, str_mr_set **set);
+
+/**
+ * @brief Function to free compiled set.
+ *
+ * @param[in] set set to be freed (can be NULL)
+ */
+void
+str_mr_set_free(str_mr_set *set);
+
+/**
+ * @brief Function to add match pair into compiled set.
+ *
+ * Only hash table of keys of the same length is updated (doubled when it
+ * gets half full). Duplicate keys are allowed, the first added wins.
+ *
+ * Note: Set must not be used by any search or stream while it is changed.
+ * Pair, key and value are copied into the set.
+ *
+ * @param[in] set compiled match pairs set
+ * @param[in] pair match pair to add
+ *
+ * @return status code
+ * @retval STR_MR_ERROR_SUCCESS success
+ * @retval STR_MR_ERROR_OOM out of memory (set is unchanged)
+ * @retval STR_MR_ERROR_INVALID_ARG invalid argument provided
+ * @retval STR_MR_ERROR_INVALID_MATCH invalid match pair provided
+ */
+int32_t
+str_mr_set_add(str_mr_set *set, const str_mr_match_pair *pair);
+
+/**
+ * @brief Function to remove key from compiled set.
+ *
+ * All pairs with the key are unlinked from hash table. Removed pairs are
+ * dropped and all hash tables rebuilt once they are more than half of
+ * the pairs in set.
+ *
+ * Note: Set must not be used by any search or stream while it is changed.
+ *
+ * @param[in] set compiled match pairs set
+ * @param[in] key key to remove
+ * @param[in] key_len length of the key
+ *
+ * @return number of removed pairs (0 when key isn't in set) or negative
+ *         number on error
+ * @retval STR_MR_ERROR_OOM out of memory (only when copying loaded set)
+ * @retval STR_MR_ERROR_INVALID_ARG invalid argument provided
+ */
+int64_t
+str_mr_set_remove(str_mr_set *set, const char *key, size_t key_len);
+
+/**
+ * @brief Function to get match pair of compiled set by its index.
+ *
+ * Index is the one reported in matches (pair_idx). It is the index in
+ * match pairs array given to str_mr_set_compile() until the set is
+ * modified or loaded, after that pairs can be renumbered.
+ *
+ * @param[in] set compiled match pairs set
+ * @param[in] pair_idx index of the pair
+ *
+ * @return match pair or NULL when index is out of range
+ */
+const str_mr_match_pair *
+str_mr_set_pair(const str_mr_set *set, size_t pair_idx);
+
+/**
+ * @brief Function to check whether any key of compiled set occurs in buffer.
+ *
+ * Same as str_mr_contains_any(), but keys are not compiled again, the only
+ * allocation is one rolling hash for each key length.
+ *
+ * @param[in] set compiled match pairs set
+ * @param[in] str source buffer (can be NULL when str_len is 0)
+ * @param[in] str_len source buffer length
+ *
+ * @return 1 when some key occurs in str, 0 when not or negative number on
+ *         error
+ * @retval STR_MR_ERROR_OOM out of memory
+ * @retval STR_MR_ERROR_INVALID_ARG invalid argument provided
+ */
+int32_t
+str_mr_set_contains_any(const str_mr_set *set, const char *str,
+                        size_t str_len);
+
+/**
+ * @brief Function to replace all occurrences of compiled set into a sink.
+ *
+ * Same as str_multireplace_sink(), but keys are not compiled again, the only
+ * allocation is one rolling hash for each key length. Unlike streaming the
+ * whole buffer, no input is carried (copied) between scans.
+ *
+ * @param[in] set compiled match pairs set (all pairs need values)
+ * @param[in] str source buffer (can be NULL when str_len is 0)
+ * @param[in] str_len source buffer length
+ * @param[in] sink callback receiving the result
+ * @param[in] sink_ctx context passed to sink
+ *
+ * @return number of replacements made or negative number on error
+ * @retval STR_MR_ERROR_OOM out of memory
+ * @retval STR_MR_ERROR_INVALID_ARG invalid argument provided
+ * @retval STR_MR_ERROR_INVALID_MATCH some pair in set has no value
+ * @retval STR_MR_ERROR_SINK sink aborted the replacement
+ */
+int64_t
+str_mr_set_replace_sink(const str_mr_set *set, const char *str,
+                        size_t str_len, str_mr_sink_cb sink, void *sink_ctx);
+
+/**
+ * @brief Function to serialize compiled set into image.
+ *
+ * Image contains keys, values and all precomputed search data (hash tables,
+ * chain links, key hashes and filter) in the form the search uses. It uses
+ * only offsets, so it can be stored and loaded at any address by
+ * str_mr_set_load() or str_mr_set_map(). It is versioned and only loadable
+ * on machines with the same byte order and size_t width. Removed pairs are
+ * left out.
+ *
+ * Note: Caller is responsible for freeing the image (free()).
+ *
+ * @param[in] set compiled match pairs set
+ * @param[out] image newly allocated image
+ * @param[out] image_len length of the image
+ *
+ * @return status code
+ * @retval STR_MR_ERROR_SUCCESS success
+ * @retval STR_MR_ERROR_OOM out of memory
+ * @retval STR_MR_ERROR_INVALID_ARG invalid argument provided
+ */
+int32_t
+str_mr_set_serialize(const str_mr_set *set, void **image, size_t *image_len);
+
+/**
+ * @brief Function to load compiled set from image.
+ *
+ * Nothing is rebuilt: keys, values, hash tables, chain links, key hashes
+ * and filter are used in place, only pairs pointing into the image are set
+ * up. Bounds of everything in the image and every chain link are checked.
+ * First str_mr_set_add() or str_mr_set_remove() copies the tables out of
+ * the image.
+ *
+ * Loading still takes time linear in the number of pairs: match pairs use
+ * pointers, so the pair array is allocated and filled from the records,
+ * and every pair and chain head is visited by the checks. Only hashing keys
+ * and building hash tables is saved.
+ *
+ * Note: Caller is responsible for freeing the set (str_mr_set_free()).
+ * Image is not copied, it has to be 8 bytes aligned and stay valid while
+ * the set is used.
+ *
+ * @param[in] image image created by str_mr_set_serialize()
+ * @param[in] image_len length of the image
+ * @param[out] set newly allocated compiled set
+ *
+ * @return status code
+ * @retval STR_MR_ERROR_SUCCESS success
+ * @retval STR_MR_ERROR_OOM out of memory
+ * @retval STR_MR_ERROR_INVALID_ARG invalid argument provided
+ * @retval STR_MR_ERROR_FORMAT invalid image
+ */
+int32_t
+str_mr_set_load(const void *image, size_t image_len, str_mr_set **set);
+
+#ifdef STR_MR_WITH_POSIX
+/**
+ * @brief Function to save compiled set image into file.
+ *
+ * Image is written into temporary file renamed over path at the end, so
+ * processes that have the old file mapped are not affected.
+ *
+ * @param[in] set compiled match pairs set
+ * @param[in] path file path
+ *
+ * @return status code
+ * @retval STR_MR_ERROR_SUCCESS success
+ * @retval STR_MR_ERROR_OOM out of memory
+ * @retval STR_MR_ERROR_INVALID_ARG invalid argument provided
+ * @retval STR_MR_ERROR_IO writing failed (errno is set)
+ */
+int32_t
+str_mr_set_save(const str_mr_set *set, const char *path);
+
+/**
+ * @brief Function to map compiled set image file.
+ *
+ * File is mapped read-only and shared, so its pages are shared by all
+ * processes using it. Mapping is released by str_mr_set_free().
+ *
+ * @param[in] path path to file saved by str_mr_set_save()
+ * @param[out] set newly allocated compiled set
+ *
+ * @return status code
+ * @retval STR_MR_ERROR_SUCCESS success
+ * @retval STR_MR_ERROR_OOM out of memory
+ * @retval STR_MR_ERROR_INVALID_ARG invalid argument provided
+ * @retval STR_MR_ERROR_IO opening or mapping failed (errno is set)
+ * @retval STR_MR_ERROR_FORMAT invalid image
+ */
+int32_t
+str_mr_set_map(const char *path, str_mr_set **set);
+#endif
+
+/**
+ * @brief Function to start streaming replacement.
+ *
+ * Input is fed in chunks of any size by str_mr_stream_feed() and the result
+ * is passed to sink as soon as it can't be changed by following input.
+ * Result is the same as str_multireplace() of all chunks concatenated.
+ * At most 2 * (longest key length) bytes are buffered between chunks.
+ *
+ * Note: Caller is responsible for freeing the stream (str_mr_stream_free()).
+ * Set has to stay valid while the stream is used.
+ *
+ * @param[in] set compiled match pairs set (all pairs need values)
+ * @param[in] sink callback receiving the result
+ * @param[in] sink_ctx context passed to sink
+ * @param[out] stream newly allocated stream
+ *
+ * @return status code
+ * @retval STR_MR_ERROR_SUCCESS success
+ * @retval STR_MR_ERROR_OOM out of memory
+ * @retval STR_MR_ERROR_INVALID_ARG invalid argument provided
+ * @retval STR_MR_ERROR_INVALID_MATCH some pair in set has no value
+ */
+int32_t
+str_mr_stream_init(const str_mr_set *set, str_mr_sink_cb sink,
+                   void *sink_ctx, str_mr_stream **stream);
+
+/**
+ * @brief Function to feed next chunk of input into stream.
+ *
+ * Errors are sticky, every following call fails with the same error.
+ *
+ * @param[in] stream stream
+ * @param[in] chunk next chunk of input
+ * @param[in] chunk_len length of the chunk
+ *
+ * @return number of replacements made so far or negative number on error
+ * @retval STR_MR_ERROR_OOM out of memory
+ * @retval STR_MR_ERROR_INVALID_ARG invalid argument provided
+ * @retval STR_MR_ERROR_SINK sink aborted the replacement
+ */
+int64_t
+str_mr_stream_feed(str_mr_stream *stream, const char *chunk,
+                   size_t chunk_len);
+
+/**
+ * @brief Function to end input of stream.
+ *
+ * Passes the rest of the result to sink. Stream can be fed again after
+ * finishing, as a new input.
+ *
+ * @param[in] stream stream
+ *
+ * @return total number of replacements made or negative number on error
+ * @retval STR_MR_ERROR_OOM out of memory
+ * @retval STR_MR_ERROR_INVALID_ARG invalid argument provided
+ * @retval STR_MR_ERROR_SINK sink aborted the replacement
+ */
+int64_t
+str_mr_stream_finish(str_mr_stream *stream);
+
+/**
+ * @brief Function to free stream.
+ *
+ * @param[in] stream stream to be freed (can be NULL)
+ */
+void
+str_mr_stream_free(str_mr_stream *stream);
+
+/**
+ * @brief Function to create match cursor over buffer.
+ *
+ * Cursor yields the same matches as str_mr_find_each() in non-overlapping
+ * mode, one per str_mr_cursor_next() call, so no callback is needed.
+ * Input is only scanned as far as the last returned match.
+ *
+ * Note: Caller is responsible for freeing the cursor (str_mr_cursor_free()).
+ * Set and buffer have to stay valid (and unchanged) while the cursor is
+ * used.
+ *
+ * @param[in] set compiled match pairs set (values are not used)
+ * @param[in] str source buffer
+ * @param[in] str_len source buffer length
+ * @param[out] cursor newly allocated cursor
+ *
+ * @return status code
+ * @retval STR_MR_ERROR_SUCCESS success
+ * @retval STR_MR_ERROR_OOM out of memory
+ * @retval STR_MR_ERROR_INVALID_ARG invalid argument provided
+ */
+int32_t
+str_mr_cursor_init(const str_mr_set *set, const char *str, size_t str_len,
+                   str_mr_cursor **cursor);
+
+/**
+ * @brief Function to restart cursor on another buffer.
+ *
+ * Reuses memory of the cursor, set stays the same.
+ *
+ * @param[in] cursor cursor
+ * @param[in] str source buffer
+ * @param[in] str_len source buffer length
+ *
+ * @return status code
+ * @retval STR_MR_ERROR_SUCCESS success
+ * @retval STR_MR_ERROR_INVALID_ARG invalid argument provided
+ */
+int32_t
+str_mr_cursor_reset(str_mr_cursor *cursor, const char *str, size_t str_len);
+
+/**
+ * @brief Function to find next non-overlapping match.
+ *
+ * Continues scanning where the previous call stopped.
+ *
+ * @param[in] cursor cursor
+ * @param[out] match next match (set only when 1 is returned)
+ *
+ * @return 1 when match was found, 0 at the end of buffer or negative number
+ *         on error
+ * @retval STR_MR_ERROR_INVALID_ARG invalid argument provided
+ */
+int32_t
+str_mr_cursor_next(str_mr_cursor *cursor, str_mr_match *match);
+
+/**
+ * @brief Function to duplicate cursor with its position.
+ *
+ * Both cursors continue independently from the same position.
+ *
+ * Note: Caller is responsible for freeing the copy (str_mr_cursor_free()).
+ *
+ * @param[in] cursor cursor to copy
+ * @param[out] copy newly allocated cursor
+ *
+ * @return status code
+ * @retval STR_MR_ERROR_SUCCESS success
+ * @retval STR_MR_ERROR_OOM out of memory
+ * @retval STR_MR_ERROR_INVALID_ARG invalid argument provided
+ */
+int32_t
+str_mr_cursor_copy(const str_mr_cursor *cursor, str_mr_cursor **copy);
+
+/**
+ * @brief Function to free cursor.
+ *
+ * @param[in] cursor cursor to be freed (can be NULL)
+ */
+void
+str_mr_cursor_free(str_mr_cursor *cursor);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif
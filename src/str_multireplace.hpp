@@ -0,0 +1,846 @@
+/**
+ * @file      str_multireplace.hpp
+ * @brief     Header-only C++20 wrapper of multiple key-value replacement.
+ * @author    MMaster
+ * @version   0.1
+ * @date      2013
+ * @copyright Apache License v2
+ *
+ * multireplacer owns a compiled set and writes the result straight into
+ * a caller supplied std::string, any output iterator or a malloc'd buffer
+ * adopted by move-only result, so no intermediate copy is made.
+ *
+ * Errors are reported by exceptions: std::bad_alloc when out of memory,
+ * str_mr::error with the STR_MR_ERROR_* code otherwise. Exceptions thrown
+ * by output iterators are carried across the C library and rethrown.
+ *
+ * views::multireplace() gives the result lazily as a range of pieces, so
+ * it can be consumed by other views without materializing it.
+ *
+ * Usage:
+ *    str_mr::multireplacer mr{{"cat", "dog"}, {"red", "blue"}};
+ *    std::string out;
+ *    mr.replace("red cat", out);
+ */
+
+#ifndef __STR_MULTIREPLACE_HPP__
+#define __STR_MULTIREPLACE_HPP__
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <initializer_list>
+#include <iterator>
+#include <new>
+#include <ranges>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "str_multireplace.h"
+
+namespace str_mr {
+
+/**
+ * @brief Error reported by the library (STR_MR_ERROR_* code)
+ */
+class error : public std::runtime_error {
+public:
+    explicit error (int64_t code)
+        : std::runtime_error("str_multireplace error " +
+                             std::to_string(code)),
+          code_(code)
+    {
+    }
+
+    /**
+     * @brief STR_MR_ERROR_* code
+     */
+    int64_t
+    code () const noexcept
+    {
+        return code_;
+    }
+
+private:
+    int64_t code_;
+};
+
+/**
+ * @brief Throw exception for negative return code, pass others through
+ */
+inline int64_t
+check (int64_t rc)
+{
+    if (rc == STR_MR_ERROR_OOM) {
+        throw std::bad_alloc();
+    }
+
+    if (rc < 0) {
+        throw error(rc);
+    }
+
+    return rc;
+}
+
+/**
+ * @brief Make match pair of views (they are not copied)
+ */
+inline str_mr_match_pair
+make_pair (std::string_view key, std::string_view value)
+{
+    return str_mr_match_pair{key.data(), key.size(), value.data(),
+                             value.size()};
+}
+
+/**
+ * @brief Move-only owner of malloc'd result buffer
+ *
+ * Adopts the buffer returned by the C library without copying it.
+ */
+class result {
+public:
+    result () noexcept = default;
+
+    /**
+     * @brief Adopt buffer allocated by malloc()
+     */
+    result (char *data, size_t size, int64_t replacements) noexcept
+        : data_(data), size_(size), replacements_(replacements)
+    {
+    }
+
+    result (result &&other) noexcept
+        : data_(std::exchange(other.data_, nullptr)),
+          size_(std::exchange(other.size_, 0)),
+          replacements_(std::exchange(other.replacements_, 0))
+    {
+    }
+
+    result &
+    operator= (result &&other) noexcept
+    {
+        if (this != &other) {
+            std::free(data_);
+            data_         = std::exchange(other.data_, nullptr);
+            size_         = std::exchange(other.size_, 0);
+            replacements_ = std::exchange(other.replacements_, 0);
+        }
+
+        return *this;
+    }
+
+    result (const result &) = delete;
+    result &operator= (const result &) = delete;
+
+    ~result ()
+    {
+        std::free(data_);
+    }
+
+    const char *
+    data () const noexcept
+    {
+        return data_;
+    }
+
+    size_t
+    size () const noexcept
+    {
+        return size_;
+    }
+
+    /**
+     * @brief Number of replacements made
+     */
+    int64_t
+    replacements () const noexcept
+    {
+        return replacements_;
+    }
+
+    std::string_view
+    view () const noexcept
+    {
+        return std::string_view(data_ != nullptr ? data_ : "", size_);
+    }
+
+    operator std::string_view () const noexcept
+    {
+        return view();
+    }
+
+    /**
+     * @brief Give up ownership, caller has to free() the buffer
+     */
+    char *
+    release () noexcept
+    {
+        size_         = 0;
+        replacements_ = 0;
+        return std::exchange(data_, nullptr);
+    }
+
+private:
+    char   *data_         = nullptr;
+    size_t  size_         = 0;
+    int64_t replacements_ = 0;
+};
+
+/**
+ * @brief Replace all occurrences of match pairs (without compiling a set)
+ *
+ * @return result adopting buffer of str_multireplace64()
+ */
+inline result
+replace (std::string_view str, std::span<const str_mr_match_pair> pairs)
+{
+    char   *out     = nullptr;
+    size_t  out_len = 0;
+    int64_t rc      = check(str_multireplace64(str.data(), str.size(),
+                                               pairs.data(), pairs.size(),
+                                               &out, &out_len, false));
+
+    return result(out, out_len, rc);
+}
+
+/**
+ * @brief Non-overlapping match found by match_iterator
+ */
+struct match {
+    size_t pos;                 /**< position of the match in source */
+    size_t pair_idx;            /**< index of matched pair in set */
+    std::string_view key;       /**< matched key */
+    std::string_view value;     /**< value of matched pair */
+};
+
+/**
+ * @brief Forward iterator over matches, pulled from str_mr_cursor
+ *
+ * Copying the iterator copies the cursor, so both continue independently.
+ * Dereferencing returns the match by value.
+ */
+class match_iterator {
+public:
+    using value_type        = match;
+    using reference         = match;
+    using difference_type   = std::ptrdiff_t;
+    using iterator_concept  = std::forward_iterator_tag;
+    using iterator_category = std::input_iterator_tag;
+
+    match_iterator () noexcept = default;
+
+    /**
+     * @brief Start at the first match in str
+     */
+    match_iterator (const str_mr_set *set, std::string_view str)
+        : set_(set)
+    {
+        check(str_mr_cursor_init(set, str.data(), str.size(), &cursor_));
+        next();
+    }
+
+    match_iterator (const match_iterator &other)
+        : set_(other.set_), cur_(other.cur_)
+    {
+        if (other.cursor_ != nullptr) {
+            check(str_mr_cursor_copy(other.cursor_, &cursor_));
+        }
+    }
+
+    match_iterator (match_iterator &&other) noexcept
+        : cursor_(std::exchange(other.cursor_, nullptr)),
+          set_(other.set_), cur_(other.cur_)
+    {
+    }
+
+    match_iterator &
+    operator= (match_iterator other) noexcept
+    {
+        std::swap(cursor_, other.cursor_);
+        set_ = other.set_;
+        cur_ = other.cur_;
+        return *this;
+    }
+
+    ~match_iterator ()
+    {
+        str_mr_cursor_free(cursor_);
+    }
+
+    match
+    operator* () const noexcept
+    {
+        return cur_;
+    }
+
+    match_iterator &
+    operator++ ()
+    {
+        next();
+        return *this;
+    }
+
+    match_iterator
+    operator++ (int)
+    {
+        match_iterator prev = *this;
+
+        next();
+        return prev;
+    }
+
+    friend bool
+    operator== (const match_iterator &a, const match_iterator &b) noexcept
+    {
+        if ((a.cursor_ == nullptr) || (b.cursor_ == nullptr)) {
+            return a.cursor_ == b.cursor_;
+        }
+
+        return a.cur_.pos == b.cur_.pos;
+    }
+
+    friend bool
+    operator== (const match_iterator &a, std::default_sentinel_t) noexcept
+    {
+        return a.cursor_ == nullptr;
+    }
+
+private:
+    /**
+     * @brief Pull next match, cursor is dropped at the end
+     */
+    void
+    next ()
+    {
+        str_mr_match m;
+        const str_mr_match_pair *pair = nullptr;
+
+        if (check(str_mr_cursor_next(cursor_, &m)) == 0) {
+            str_mr_cursor_free(cursor_);
+            cursor_ = nullptr;
+            return;
+        }
+
+        pair = str_mr_set_pair(set_, m.pair_idx);
+        cur_ = match{m.pos, m.pair_idx,
+                     std::string_view(pair->key, pair->key_length),
+                     std::string_view(pair->value, pair->value_length)};
+    }
+
+    str_mr_cursor    *cursor_ = nullptr;  /* nullptr at the end */
+    const str_mr_set *set_    = nullptr;
+    match             cur_{};
+};
+
+/**
+ * @brief Forward range of non-overlapping matches in a buffer
+ *
+ * Input is only scanned as far as the range is iterated.
+ */
+class match_range {
+public:
+    match_range (const str_mr_set *set, std::string_view str) noexcept
+        : set_(set), str_(str)
+    {
+    }
+
+    match_iterator
+    begin () const
+    {
+        return match_iterator(set_, str_);
+    }
+
+    std::default_sentinel_t
+    end () const noexcept
+    {
+        return std::default_sentinel;
+    }
+
+private:
+    const str_mr_set *set_;
+    std::string_view  str_;
+};
+
+/**
+ * @brief Multiple key-value replacer over compiled set
+ *
+ * Move-only. Replacing never modifies the set, so one replacer can be used
+ * by concurrent threads (add() and remove() can't run meanwhile).
+ * Keys and values are copied into the set.
+ */
+class multireplacer {
+public:
+    /**
+     * @brief Compile pairs
+     */
+    explicit multireplacer (std::span<const str_mr_match_pair> pairs)
+    {
+        compile(pairs);
+    }
+
+    /**
+     * @brief Compile pairs of views
+     */
+    multireplacer (std::initializer_list<std::pair<std::string_view,
+                                                   std::string_view>> pairs)
+    {
+        std::vector<str_mr_match_pair> mps;
+
+        mps.reserve(pairs.size());
+        for (const auto &p : pairs) {
+            mps.push_back(make_pair(p.first, p.second));
+        }
+
+        compile(mps);
+    }
+
+    /**
+     * @brief Adopt already compiled set (e.g. from str_mr_set_map())
+     */
+    explicit multireplacer (str_mr_set *set) noexcept : set_(set)
+    {
+    }
+
+    multireplacer (multireplacer &&other) noexcept
+        : set_(std::exchange(other.set_, nullptr))
+    {
+    }
+
+    multireplacer &
+    operator= (multireplacer &&other) noexcept
+    {
+        if (this != &other) {
+            str_mr_set_free(set_);
+            set_ = std::exchange(other.set_, nullptr);
+        }
+
+        return *this;
+    }
+
+    multireplacer (const multireplacer &) = delete;
+    multireplacer &operator= (const multireplacer &) = delete;
+
+    ~multireplacer ()
+    {
+        str_mr_set_free(set_);
+    }
+
+    const str_mr_set *
+    get () const noexcept
+    {
+        return set_;
+    }
+
+    /**
+     * @brief Add pair (see str_mr_set_add())
+     */
+    void
+    add (std::string_view key, std::string_view value)
+    {
+        str_mr_match_pair pair = make_pair(key, value);
+
+        check(str_mr_set_add(set_, &pair));
+    }
+
+    /**
+     * @brief Remove all pairs with key (see str_mr_set_remove())
+     *
+     * @return number of pairs removed
+     */
+    size_t
+    remove (std::string_view key)
+    {
+        return static_cast<size_t>(check(str_mr_set_remove(set_, key.data(),
+                                                           key.size())));
+    }
+
+    /**
+     * @brief Replace into output iterator
+     *
+     * @return iterator past the last written character
+     */
+    template <std::output_iterator<char> It>
+    It
+    replace (std::string_view str, It out, int64_t *replacements = nullptr)
+        const
+    {
+        auto write = [&out] (const char *ptr, size_t len) {
+            out = std::copy(ptr, ptr + len, out);
+        };
+        int64_t rc = run(str, write);
+
+        if (replacements != nullptr) {
+            *replacements = rc;
+        }
+
+        return out;
+    }
+
+    /**
+     * @brief Replace into out (overwritten, capacity is reused)
+     *
+     * @return number of replacements made
+     */
+    int64_t
+    replace (std::string_view str, std::string &out) const
+    {
+        auto write = [&out] (const char *ptr, size_t len) {
+            out.append(ptr, len);
+        };
+
+        out.clear();
+        out.reserve(str.size());
+        return run(str, write);
+    }
+
+    /**
+     * @brief Replace into newly allocated buffer
+     */
+    result
+    replace (std::string_view str) const
+    {
+        buffer buf;
+        auto write = [&buf] (const char *ptr, size_t len) {
+            buf.append(ptr, len);
+        };
+
+        buf.reserve(str.size());
+        int64_t rc = run(str, write);
+
+        return result(buf.release(), buf.len, rc);
+    }
+
+    /**
+     * @brief Lazy range of matches str_multireplace() would replace
+     *
+     * str and the replacer have to outlive the range and its iterators.
+     */
+    match_range
+    matches (std::string_view str) const noexcept
+    {
+        return match_range(set_, str);
+    }
+
+private:
+    /**
+     * @brief Growing malloc'd buffer adopted by result
+     */
+    struct buffer {
+        char  *data  = nullptr;
+        size_t len   = 0;
+        size_t alloc = 0;
+
+        ~buffer ()
+        {
+            std::free(data);
+        }
+
+        void
+        reserve (size_t size)
+        {
+            char *p = nullptr;
+
+            if (size <= alloc) {
+                return;
+            }
+
+            p = static_cast<char *>(std::realloc(data, size > 0 ? size : 1));
+            if (p == nullptr) {
+                throw std::bad_alloc();
+            }
+
+            data  = p;
+            alloc = size;
+        }
+
+        void
+        append (const char *ptr, size_t n)
+        {
+            if (alloc - len < n) {
+                reserve(len + n > 2 * alloc ? len + n : 2 * alloc);
+            }
+
+            std::memcpy(data + len, ptr, n);
+            len += n;
+        }
+
+        char *
+        release () noexcept
+        {
+            return std::exchange(data, nullptr);
+        }
+    };
+
+    /**
+     * @brief Sink context carrying writer and its exception
+     */
+    template <typename Write>
+    struct sink_ctx {
+        Write &write;
+        std::exception_ptr exc;
+    };
+
+    /**
+     * @brief Sink calling writer, exceptions must not cross C frames
+     */
+    template <typename Write>
+    static int
+    sink (void *ctx, const char *ptr, size_t len)
+    {
+        auto *s = static_cast<sink_ctx<Write> *>(ctx);
+
+        try {
+            s->write(ptr, len);
+        } catch (...) {
+            s->exc = std::current_exception();
+            return 1;
+        }
+
+        return 0;
+    }
+
+    /**
+     * @brief Replace whole str by the set into writer
+     *
+     * Pieces are slices of str and values of the set, written as found.
+     */
+    template <typename Write>
+    int64_t
+    run (std::string_view str, Write &write) const
+    {
+        sink_ctx<Write> ctx{write, nullptr};
+        int64_t rc = str_mr_set_replace_sink(set_, str.data(), str.size(),
+                                             sink<Write>, &ctx);
+
+        if (ctx.exc) {
+            std::rethrow_exception(ctx.exc);
+        }
+
+        return check(rc);
+    }
+
+    void
+    compile (std::span<const str_mr_match_pair> pairs)
+    {
+        check(str_mr_set_compile(pairs.data(), pairs.size(), &set_));
+    }
+
+    str_mr_set *set_ = nullptr;             /* compiled set */
+};
+
+/**
+ * @brief View of replaced output as sequence of contiguous pieces
+ *
+ * Pieces are untouched slices of the source and values of matched pairs,
+ * in order and never empty. They are computed lazily as the view is
+ * iterated, so nothing is allocated for the whole result. Pieces point
+ * into the source and set, which have to outlive them.
+ */
+template <std::ranges::view V>
+    requires std::ranges::contiguous_range<const V> &&
+             std::ranges::sized_range<const V> &&
+             std::same_as<std::ranges::range_value_t<V>, char>
+class multireplace_view
+    : public std::ranges::view_interface<multireplace_view<V>> {
+public:
+    /**
+     * @brief Forward iterator over pieces of the result
+     */
+    class iterator {
+    public:
+        using value_type        = std::string_view;
+        using reference         = std::string_view;
+        using difference_type   = std::ptrdiff_t;
+        using iterator_concept  = std::forward_iterator_tag;
+        using iterator_category = std::input_iterator_tag;
+
+        iterator () noexcept = default;
+
+        iterator (const str_mr_set *set, std::string_view str)
+            : str_(str), match_(set, str), done_(false)
+        {
+            next();
+        }
+
+        std::string_view
+        operator* () const noexcept
+        {
+            return piece_;
+        }
+
+        iterator &
+        operator++ ()
+        {
+            next();
+            return *this;
+        }
+
+        iterator
+        operator++ (int)
+        {
+            iterator prev = *this;
+
+            next();
+            return prev;
+        }
+
+        /* end of every piece is further than end of the previous one */
+        friend bool
+        operator== (const iterator &a, const iterator &b) noexcept
+        {
+            return (a.done_ == b.done_) && (a.done_ || (a.pos_ == b.pos_));
+        }
+
+        friend bool
+        operator== (const iterator &a, std::default_sentinel_t) noexcept
+        {
+            return a.done_;
+        }
+
+    private:
+        /**
+         * @brief Move to next non-empty piece
+         */
+        void
+        next ()
+        {
+            /* next match is searched for only when it's needed */
+            if (replaced_) {
+                replaced_ = false;
+                ++match_;
+            }
+
+            for (;;) {
+                if (match_ == std::default_sentinel) {
+                    done_  = (pos_ == str_.size());
+                    piece_ = str_.substr(pos_);
+                    pos_   = str_.size();
+                    return;
+                }
+
+                match m = *match_;
+                if (pos_ < m.pos) {
+                    piece_ = str_.substr(pos_, m.pos - pos_);
+                    pos_   = m.pos;
+                    return;
+                }
+
+                piece_ = m.value;
+                pos_   = m.pos + m.key.size();
+                if (!piece_.empty()) {
+                    replaced_ = true;
+                    return;
+                }
+
+                ++match_;
+            }
+        }
+
+        std::string_view str_;          /* whole source */
+        match_iterator   match_;        /* next match not yet replaced */
+        size_t           pos_  = 0;     /* end of current piece in source */
+        std::string_view piece_;        /* current piece */
+        bool             done_ = true;  /* past the last piece */
+        bool             replaced_ = false; /* piece_ is value of match_ */
+    };
+
+    multireplace_view () = default;
+
+    multireplace_view (V base, const str_mr_set *set)
+        : base_(std::move(base)), set_(set)
+    {
+    }
+
+    iterator
+    begin () const
+    {
+        return iterator(set_, std::string_view(std::ranges::data(base_),
+                                               std::ranges::size(base_)));
+    }
+
+    std::default_sentinel_t
+    end () const noexcept
+    {
+        return std::default_sentinel;
+    }
+
+    V
+    base () const &
+    {
+        return base_;
+    }
+
+private:
+    V base_ = V();
+    const str_mr_set *set_ = nullptr;
+};
+
+template <typename R>
+multireplace_view (R &&, const str_mr_set *)
+    -> multireplace_view<std::views::all_t<R>>;
+
+namespace views {
+
+/**
+ * @brief Adaptor closure of views::multireplace(set)
+ */
+struct multireplace_closure {
+    const str_mr_set *set;
+
+    template <std::ranges::viewable_range R>
+    friend auto
+    operator| (R &&r, const multireplace_closure &c)
+    {
+        return multireplace_view(std::forward<R>(r), c.set);
+    }
+};
+
+/**
+ * @brief Range adaptor producing replaced output as string_view pieces
+ *
+ * Usage:
+ *    for (std::string_view piece : src | str_mr::views::multireplace(mr))
+ *        hash.update(piece);
+ *
+ * Source is any contiguous range of char (pass string literals as
+ * std::string_view, otherwise the terminator is part of the source).
+ */
+struct multireplace_fn {
+    multireplace_closure
+    operator() (const str_mr_set *set) const noexcept
+    {
+        return multireplace_closure{set};
+    }
+
+    multireplace_closure
+    operator() (const multireplacer &mr) const noexcept
+    {
+        return multireplace_closure{mr.get()};
+    }
+
+    template <std::ranges::viewable_range R>
+    auto
+    operator() (R &&r, const str_mr_set *set) const
+    {
+        return multireplace_view(std::forward<R>(r), set);
+    }
+
+    template <std::ranges::viewable_range R>
+    auto
+    operator() (R &&r, const multireplacer &mr) const
+    {
+        return multireplace_view(std::forward<R>(r), mr.get());
+    }
+};
+
+inline constexpr multireplace_fn multireplace{};
+
+} /* namespace views */
+
+} /* namespace str_mr */
+
+#endif
@@ -1,36 +1,1016 @@
 /**
  * @file      test.c
- * @brief     Basic test of multiple key-value replacement in provided string.
+ * @brief     Tests of multiple key-value replacement in provided string.
  * @author    Matej Spanik <mmaster@bitbix.com>
  * @version   0.1
  * @date      2013
  * @copyright Apache License v2
  *
- * Very lame test.
+ * Results of specialised functions are compared against str_multireplace()
+ * (and str_multireplace() against expected strings).
  *
  * Compile with:
- *    $ gcc -o test test.c str_replace.c
+ *    $ gcc -o test test.c str_multireplace.c
+ *
+ * Build also with vector kernels used for any number of key lengths:
+ *    $ gcc -mavx2 -DSTR_MR_SIMD_MIN_LENS=1 -o test_avx2 test.c \
+ *          str_multireplace.c
+ *    $ gcc -mavx512f -mavx512dq -DSTR_MR_SIMD_MIN_LENS=1 -o test_avx512 \
+ *          test.c str_multireplace.c
+ *
+ * Add -DSTR_MR_INT32_MAX=1000 to check STR_MR_ERROR_OVERFLOW of
+ * str_multireplace() on a small input.
+ *
+ * Run with:
+ *    $ ./test
  */
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "str_multireplace.h"
+#include "test_util.h"
 
-int
-main ()
+/**
+ * @brief Check str_multireplace() result against expected string
+ */
+static void
+check_replace (const char *str, const str_mr_match_pair *mps, size_t mp_cnt,
+               const char *expected, int64_t expected_cnt)
+{
+    char  *result = NULL;
+    size_t result_len = 0;
+    int64_t cnt = 0;
+
+    cnt = str_multireplace(str, strlen(str), mps, mp_cnt, &result,
+                           &result_len, true);
+    CHECK(cnt == expected_cnt);
+    CHECK((result != NULL) && (result_len == strlen(expected)) &&
+          (strcmp(result, expected) == 0));
+    free(result);
+}
+
+static void
+test_replace (void)
 {
     str_mr_match_pair mps[] = {
         {"1",  1, "One", 3},         {"2",     1, "Two",  3},
         {"33", 2, "Threethree", 10}, {"abcde", 5, "A..e", 4},
     };
-    size_t mp_cnt = sizeof(mps) / sizeof(str_mr_match_pair);
-    const char *str   = "1233abcde2331122233333abcdeabcdeaaabcdefg";
-    size_t str_len    = strlen(str);
-    char  *result     = NULL;
-    size_t result_len = 0;
+    str_mr_match_pair overlap[] = {
+        {"ab", 2, "X", 1}, {"bc", 2, "Y", 1}, {"abc", 3, "Z", 1},
+    };
+
+    check_replace("1233abcde2331122233333abcdeabcdeaaabcdefg", mps, 4,
+                  "OneTwoThreethreeA..eTwoThreethreeOneOneTwoTwoTwo"
+                  "ThreethreeThreethree3A..eA..eaaA..efg", 16);
+    check_replace("no match here", mps, 4, "no match here", 0);
+    /* longest match wins, matches never overlap */
+    check_replace("abcbcab", overlap, 3, "ZYX", 3);
+}
+
+/**
+ * @brief Run str_multireplace_inplace() on copy of str and compare with
+ *        str_multireplace()
+ */
+static void
+check_inplace (const char *str, size_t str_len, const str_mr_match_pair *mps,
+               size_t mp_cnt)
+{
+    char  *buf = (char *)malloc(str_len);
+    char  *result = NULL;
+    size_t result_len = 0, inplace_len = 0;
+    int64_t cnt = 0, inplace_cnt = 0;
+
+    memcpy(buf, str, str_len);
+    cnt = str_multireplace(str, str_len, mps, mp_cnt, &result, &result_len,
+                           false);
+    inplace_cnt = str_multireplace_inplace(buf, str_len, mps, mp_cnt,
+                                           &inplace_len);
+    CHECK(cnt >= 0);
+    CHECK(inplace_cnt == cnt);
+    CHECK((inplace_len == result_len) &&
+          (memcmp(buf, result, result_len) == 0));
+
+    free(result);
+    free(buf);
+}
+
+static void
+test_inplace (void)
+{
+    str_mr_match_pair adjacent[] = {
+        {"aa", 2, "b", 1},
+    };
+    str_mr_match_pair overlap[] = {
+        {"ab", 2, "X", 1}, {"bc", 2, "", 0}, {"abc", 3, "ZZ", 2},
+        {"x", 1, "", 0},
+    };
+    str_mr_match_pair growing[] = {
+        {"a", 1, "", 0}, {"b", 1, "bb", 2},
+    };
+    str_mr_match_pair mps[8];
+    char   keys[8][4], values[8][4];
+    char   str[] = "abcab";
+    char   buf[512];
+    size_t len = 0, i = 0, k = 0;
+    int    round = 0;
+
+    check_inplace("aaaaa", 5, adjacent, 1);
+    check_inplace("aaaaaa", 6, adjacent, 1);
+    check_inplace("abcbcabxabcxx", 13, overlap, 4);
+    check_inplace("xxxxxxxx", 8, overlap, 4);
+    check_inplace("nothing", 7, overlap, 4);
+
+    /* values longer than keys are refused and buffer stays untouched */
+    CHECK(str_multireplace_inplace(str, 5, growing, 2, &len) ==
+          STR_MR_ERROR_INVALID_MATCH);
+    CHECK(memcmp(str, "abcab", 5) == 0);
+
+    /* random shrink-only pairs, many adjacent and overlapping matches */
+    for (round = 0; round < 500; round++) {
+        k = 1 + rnd() % 8;
+        for (i = 0; i < k; i++) {
+            mps[i].key          = keys[i];
+            mps[i].key_length   = 1 + rnd() % 4;
+            mps[i].value        = values[i];
+            mps[i].value_length = rnd() % (mps[i].key_length + 1);
+            rnd_fill(keys[i], mps[i].key_length, "abc");
+            rnd_fill(values[i], mps[i].value_length, "XYZ");
+        }
+
+        len = 1 + rnd() % sizeof(buf);
+        rnd_fill(buf, len, "abc");
+        check_inplace(buf, len, mps, k);
+    }
+}
+
+/**
+ * @brief Replace code units of unit bytes the simple way: at each code unit
+ *        take the longest key (the first of equal ones) found there
+ *
+ * Keys and values of mps are in bytes, out has to be large enough.
+ *
+ * @return number of replacements
+ */
+static int64_t
+naive_unit_replace (const char *str, size_t str_len,
+                    const str_mr_match_pair *mps, size_t mp_cnt, size_t unit,
+                    char *out, size_t *out_len)
+{
+    const str_mr_match_pair *best = NULL;
+    size_t  pos = 0, i = 0;
+    int64_t cnt = 0;
+
+    *out_len = 0;
+    while (pos < str_len) {
+        best = NULL;
+        for (i = 0; i < mp_cnt; i++) {
+            if ((mps[i].key_length <= str_len - pos) &&
+                (memcmp(str + pos, mps[i].key, mps[i].key_length) == 0) &&
+                ((best == NULL) || (mps[i].key_length > best->key_length))) {
+                best = &mps[i];
+            }
+        }
+
+        if (best == NULL) {
+            memcpy(out + *out_len, str + pos, unit);
+            *out_len += unit;
+            pos += unit;
+            continue;
+        }
+
+        memcpy(out + *out_len, best->value, best->value_length);
+        *out_len += best->value_length;
+        pos += best->key_length;
+        cnt++;
+    }
+
+    return cnt;
+}
+
+/**
+ * @brief Compare str_multireplace16() or str_multireplace32() (by unit)
+ *        with naive_unit_replace()
+ *
+ * Keys and values of mps (at most 16) are in bytes.
+ */
+static void
+check_units (const void *str, size_t str_len, const str_mr_match_pair *mps,
+             size_t mp_cnt, size_t unit)
+{
+    str_mr_match_pair16 mps16[16];
+    str_mr_match_pair32 mps32[16];
+    char   *expected = (char *)malloc(str_len * unit * 4 + 1);
+    void   *result = NULL;
+    size_t  expected_len = 0, result_len = 0, i = 0;
+    int64_t cnt = 0, expected_cnt = 0;
+
+    expected_cnt = naive_unit_replace((const char *)str, str_len * unit, mps,
+                                      mp_cnt, unit, expected, &expected_len);
+
+    for (i = 0; i < mp_cnt; i++) {
+        mps16[i].key          = (const char16_t *)mps[i].key;
+        mps16[i].key_length   = mps[i].key_length / unit;
+        mps16[i].value        = (const char16_t *)mps[i].value;
+        mps16[i].value_length = mps[i].value_length / unit;
+        mps32[i].key          = (const char32_t *)mps[i].key;
+        mps32[i].key_length   = mps[i].key_length / unit;
+        mps32[i].value        = (const char32_t *)mps[i].value;
+        mps32[i].value_length = mps[i].value_length / unit;
+    }
+
+    if (unit == sizeof(char16_t)) {
+        cnt = str_multireplace16((const char16_t *)str, str_len, mps16,
+                                 mp_cnt, (char16_t **)&result, &result_len,
+                                 false);
+    } else {
+        cnt = str_multireplace32((const char32_t *)str, str_len, mps32,
+                                 mp_cnt, (char32_t **)&result, &result_len,
+                                 false);
+    }
+
+    CHECK(cnt == expected_cnt);
+    CHECK((result != NULL) && (result_len * unit == expected_len) &&
+          (memcmp(result, expected, expected_len) == 0));
+
+    free(result);
+    free(expected);
+}
+
+static void
+test_units (void)
+{
+    /* U+1F600 and U+1F601 are surrogate pairs in UTF-16 */
+    static const char16_t str16[] = u"a\U0001F600b\U0001F601";
+    static const char16_t smiley[] = u"\U0001F600";
+    static const char16_t lone[] = { 0xDE01 };
+    static const char16_t expected16[] = u"aXb\xD83DY";
+    static const char16_t shifted16[] = { 0x1234, 0x5678, 0x9ABC, 0xDEF0 };
+    static const char32_t shifted32[] = { 0x01020304, 0x05060708,
+                                          0x090A0B0C, 0x0D0E0F10 };
+    static const char16_t alphabet16[] = { 0x0061, 0x6100, 0x6161, 0xD83D,
+                                           0xDE00, 0x0000 };
+    static const char32_t alphabet32[] = { 0x61, 0x61000000, 0x00610061,
+                                           0x6161, 0x1F600, 0 };
+    str_mr_match_pair16 pairs16[] = {
+        { smiley, 2, u"X", 1 }, { lone, 1, u"Y", 1 },
+    };
+    str_mr_match_pair mps[8];
+    char32_t keys[8][4], values[8][4], buf[200];
+    char16_t *result16 = NULL;
+    size_t  result_len = 0, len = 0, unit = 0, i = 0, k = 0, off = 0;
+    int64_t cnt = 0;
+    int     round = 0;
+
+    /* surrogate pair is a key of two code units, halves match alone */
+    cnt = str_multireplace16(str16, 6, pairs16, 2, &result16, &result_len,
+                             true);
+    CHECK(cnt == 2);
+    CHECK((result16 != NULL) && (result_len == 5) &&
+          (memcmp(result16, expected16, sizeof(expected16)) == 0));
+    free(result16);
+
+    /* keys made of bytes straddling code units never match */
+    for (unit = 2; unit <= 4; unit += 2) {
+        const char *str = (unit == 2 ? (const char *)shifted16 :
+                                       (const char *)shifted32);
+
+        for (off = 1; off < unit; off++) {
+            for (k = 1; k <= 2; k++) {
+                mps[0].key          = (const char *)keys[0];
+                mps[0].key_length   = k * unit;
+                mps[0].value        = (const char *)values[0];
+                mps[0].value_length = unit;
+                memcpy(keys[0], str + off, k * unit);
+                memset(values[0], 'v', unit);
+                check_units(str, 4, mps, 1, unit);
+            }
+        }
+    }
+
+    /* random code units mixing into each other, keys taken across units */
+    for (round = 0; round < 600; round++) {
+        unit = (round % 2 == 0 ? 2 : 4);
+        len  = 1 + rnd() % 48;
+        for (i = 0; i < len; i++) {
+            if (unit == 2) {
+                ((char16_t *)buf)[i] = alphabet16[rnd() % 6];
+            } else {
+                buf[i] = alphabet32[rnd() % 6];
+            }
+        }
+
+        k = 1 + rnd() % 8;
+        for (i = 0; i < k; i++) {
+            mps[i].key          = (const char *)keys[i];
+            mps[i].key_length   = (1 + rnd() % 3) * unit;
+            mps[i].value        = (const char *)values[i];
+            mps[i].value_length = (rnd() % 3) * unit;
+            memset(values[i], 'A' + (int)i, mps[i].value_length);
 
-    printf("str: %s\n", str);
-    str_multireplace(str, str_len, mps, mp_cnt, &result, &result_len, true);
-    printf("result: %s\n", result);
+            off = rnd() % (len * unit);
+            if ((rnd() % 2) && (off + mps[i].key_length <= len * unit)) {
+                memcpy(keys[i], (char *)buf + off, mps[i].key_length);
+            } else {
+                memcpy(keys[i], (char *)buf + (rnd() % len) * unit, unit);
+                mps[i].key_length = unit;
+            }
+        }
+
+        check_units(buf, len, mps, k, unit);
+    }
+}
+
+/**
+ * @brief Random pairs of up to 8 short keys (overlapping a lot in input of
+ *        "abc") with values of up to 3 characters, empty ones too
+ *
+ * @return number of pairs
+ */
+static size_t
+rnd_pairs (str_mr_match_pair *mps, char keys[][4], char values[][4])
+{
+    size_t i = 0, cnt = 1 + rnd() % 8;
+
+    for (i = 0; i < cnt; i++) {
+        mps[i].key          = keys[i];
+        mps[i].key_length   = 1 + rnd() % 4;
+        mps[i].value        = values[i];
+        mps[i].value_length = rnd() % 4;
+        rnd_fill(keys[i], mps[i].key_length, "ab");
+        rnd_fill(values[i], mps[i].value_length, "XYZ");
+    }
+
+    return cnt;
+}
+
+/**
+ * @brief Random input of "abc" (8 to max_len characters) starting and
+ *        ending with a key of mps
+ *
+ * @return input length
+ */
+static size_t
+rnd_input (char *buf, size_t max_len, const str_mr_match_pair *mps,
+           size_t mp_cnt)
+{
+    const str_mr_match_pair *first = &mps[rnd() % mp_cnt];
+    const str_mr_match_pair *last  = &mps[rnd() % mp_cnt];
+    size_t len = 8 + rnd() % (max_len - 7);
+
+    rnd_fill(buf, len, "abc");
+    memcpy(buf, first->key, first->key_length);
+    memcpy(buf + len - last->key_length, last->key, last->key_length);
+    return len;
+}
+
+#ifdef STR_MR_WITH_POSIX
+/**
+ * @brief Compare concatenated str_multireplace_iov() entries with
+ *        str_multireplace64()
+ */
+static void
+check_iov (const char *str, size_t str_len, const str_mr_match_pair *mps,
+           size_t mp_cnt)
+{
+    struct iovec *iov = NULL;
+    char   *result = NULL, *joined = NULL;
+    size_t  result_len = 0, iov_cnt = 0, len = 0, i = 0;
+    int64_t cnt = 0;
+
+    cnt = str_multireplace64(str, str_len, mps, mp_cnt, &result, &result_len,
+                             false);
+    CHECK(cnt >= 0);
+    CHECK(str_multireplace_iov(str, str_len, mps, mp_cnt, &iov, &iov_cnt) ==
+          cnt);
+
+    joined = (char *)malloc(result_len + 1);
+    for (i = 0; (iov != NULL) && (i < iov_cnt); i++) {
+        /* empty entries are left out */
+        CHECK(iov[i].iov_len > 0);
+        CHECK(len + iov[i].iov_len <= result_len);
+        if (len + iov[i].iov_len > result_len) {
+            break;
+        }
+
+        memcpy(joined + len, iov[i].iov_base, iov[i].iov_len);
+        len += iov[i].iov_len;
+    }
+
+    CHECK((len == result_len) && (memcmp(joined, result, len) == 0));
+
+    free(joined);
+    free(iov);
+    free(result);
+}
+
+static void
+test_iov (void)
+{
+    str_mr_match_pair ends[] = {
+        {"key", 3, "", 0}, {"X", 1, "value", 5},
+    };
+    str_mr_match_pair mps[8];
+    struct iovec *iov = NULL;
+    char   keys[8][4], values[8][4];
+    char   buf[256];
+    size_t iov_cnt = 0, len = 0, k = 0;
+    int    round = 0;
+
+    /* empty values at both ends leave only the middle */
+    CHECK(str_multireplace_iov("keyXkey", 7, ends, 2, &iov, &iov_cnt) == 3);
+    CHECK((iov_cnt == 1) && (iov[0].iov_len == 5) &&
+          (memcmp(iov[0].iov_base, "value", 5) == 0));
+    free(iov);
+
+    /* nothing left at all */
+    CHECK(str_multireplace_iov("keykey", 6, ends, 1, &iov, &iov_cnt) == 2);
+    CHECK(iov_cnt == 0);
+    free(iov);
+
+    for (round = 0; round < 500; round++) {
+        k   = rnd_pairs(mps, keys, values);
+        len = rnd_input(buf, sizeof(buf), mps, k);
+        check_iov(buf, len, mps, k);
+    }
+}
+#endif
+
+/**
+ * @brief Find matches the simple way: at each position keys from the
+ *        longest one, equal keys in order of pairs; non-overlapping search
+ *        takes the first of them and continues behind it
+ *
+ * @return number of matches stored in matches (has to be large enough)
+ */
+static size_t
+naive_find (const char *str, size_t str_len, const str_mr_match_pair *mps,
+            size_t mp_cnt, bool overlapping, str_mr_match *matches)
+{
+    size_t pos = 0, len = 0, max_len = 0, i = 0, cnt = 0;
+    bool   found = false;
+
+    for (i = 0; i < mp_cnt; i++) {
+        if (mps[i].key_length > max_len) {
+            max_len = mps[i].key_length;
+        }
+    }
+
+    for (pos = 0; pos < str_len; pos++) {
+        found = false;
+        for (len = max_len; (len > 0) && !found; len--) {
+            for (i = 0; (i < mp_cnt) && !found; i++) {
+                if ((mps[i].key_length != len) || (len > str_len - pos) ||
+                    (memcmp(str + pos, mps[i].key, len) != 0)) {
+                    continue;
+                }
+
+                matches[cnt].pos      = pos;
+                matches[cnt].pair_idx = i;
+                cnt++;
+
+                if (!overlapping) {
+                    found = true;
+                    pos  += len - 1;
+                }
+            }
+        }
+    }
+
+    return cnt;
+}
+
+/**
+ * Most pieces and matches in random tests (inputs of rnd_input() are
+ * shorter)
+ */
+#define MAX_PIECES      (1024)
+
+/**
+ * @brief Sink collecting pieces, aborting at call number fail_at
+ */
+typedef struct {
+    char data[4 * MAX_PIECES];
+    size_t len;
+    size_t ends[MAX_PIECES];    /* end of each piece in data */
+    size_t piece_cnt;
+    size_t calls;               /* number of calls */
+    size_t fail_at;             /* call returning non-zero (0 for none) */
+} piece_sink;
+
+static int
+piece_sink_cb (void *ctx, const char *ptr, size_t len)
+{
+    piece_sink *ps = (piece_sink *)ctx;
+
+    ps->calls++;
+    if (ps->calls == ps->fail_at) {
+        return -1;
+    }
+
+    if ((ps->piece_cnt >= MAX_PIECES) || (len > sizeof(ps->data) - ps->len)) {
+        return 1;
+    }
+
+    memcpy(ps->data + ps->len, ptr, len);
+    ps->len += len;
+    ps->ends[ps->piece_cnt++] = ps->len;
     return 0;
 }
 
+/**
+ * @brief Compare pieces (their boundaries too) of two sinks
+ */
+static void
+check_pieces (const piece_sink *ps, const piece_sink *expected)
+{
+    CHECK((ps->piece_cnt == expected->piece_cnt) &&
+          (memcmp(ps->ends, expected->ends,
+                  ps->piece_cnt * sizeof(size_t)) == 0));
+    CHECK((ps->len == expected->len) &&
+          (memcmp(ps->data, expected->data, ps->len) == 0));
+}
+
+/**
+ * @brief Check str_multireplace_sink() passes untouched slices and values
+ *        in order (never empty ones) and stops right after aborting sink
+ */
+static void
+check_sink (const char *str, size_t str_len, const str_mr_match_pair *mps,
+            size_t mp_cnt)
+{
+    static str_mr_match matches[MAX_PIECES];
+    static piece_sink   ps, expected;
+    size_t  match_cnt = 0, pos = 0, i = 0;
+
+    memset(&expected, 0, sizeof(expected));
+    match_cnt = naive_find(str, str_len, mps, mp_cnt, false, matches);
+    for (i = 0; i < match_cnt; i++) {
+        if (matches[i].pos > pos) {
+            piece_sink_cb(&expected, str + pos, matches[i].pos - pos);
+        }
+
+        if (mps[matches[i].pair_idx].value_length > 0) {
+            piece_sink_cb(&expected, mps[matches[i].pair_idx].value,
+                          mps[matches[i].pair_idx].value_length);
+        }
+
+        pos = matches[i].pos + mps[matches[i].pair_idx].key_length;
+    }
+
+    if (str_len > pos) {
+        piece_sink_cb(&expected, str + pos, str_len - pos);
+    }
+
+    memset(&ps, 0, sizeof(ps));
+    CHECK(str_multireplace_sink(str, str_len, mps, mp_cnt, piece_sink_cb,
+                                &ps) == (int64_t)match_cnt);
+    check_pieces(&ps, &expected);
+
+    /* no more calls after the sink aborted */
+    if (expected.piece_cnt > 0) {
+        memset(&ps, 0, sizeof(ps));
+        ps.fail_at = 1 + rnd() % expected.piece_cnt;
+        CHECK(str_multireplace_sink(str, str_len, mps, mp_cnt, piece_sink_cb,
+                                    &ps) == STR_MR_ERROR_SINK);
+        CHECK(ps.calls == ps.fail_at);
+    }
+}
+
+static void
+test_sink (void)
+{
+    str_mr_match_pair mps[8];
+    char   keys[8][4], values[8][4];
+    char   buf[256];
+    size_t len = 0, k = 0;
+    int    round = 0;
+
+    for (round = 0; round < 500; round++) {
+        k   = rnd_pairs(mps, keys, values);
+        len = rnd_input(buf, sizeof(buf), mps, k);
+        check_sink(buf, len, mps, k);
+    }
+
+    CHECK(str_multireplace_sink("abc", 3, mps, k, NULL, NULL) ==
+          STR_MR_ERROR_INVALID_ARG);
+}
+
+/**
+ * @brief Value callback state
+ */
+typedef struct {
+    const char *str;            /* searched buffer */
+    const str_mr_match_pair *mps; /* match pairs */
+    size_t calls;               /* number of calls */
+    size_t fail_at;             /* call returning non-zero (0 for none) */
+    bool bad_args;              /* called with match not in str */
+} value_state;
+
+/**
+ * @brief Write "<pos:pair_idx>" in two pieces, nothing for every third pair
+ *
+ * @return 0 or non-zero of sink, non-zero at call number fail_at
+ */
+static int
+value_cb (void *ctx, size_t pos, size_t pair_idx,
+          const str_mr_match_pair *pair, str_mr_sink_cb sink,
+          void *sink_ctx)
+{
+    value_state *vs = (value_state *)ctx;
+    char buf[32];
+    int  rc = 0;
+
+    vs->calls++;
+    if (vs->calls == vs->fail_at) {
+        return 3;
+    }
+
+    if ((pair != &vs->mps[pair_idx]) ||
+        (memcmp(vs->str + pos, pair->key, pair->key_length) != 0)) {
+        vs->bad_args = true;
+    }
+
+    if (pair_idx % 3 == 2) {
+        return 0;
+    }
+
+    rc = sink(sink_ctx, buf, sprintf(buf, "<%zu:", pos));
+    if (rc != 0) {
+        return rc;
+    }
+
+    return sink(sink_ctx, buf, sprintf(buf, "%zu>", pair_idx));
+}
+
+/**
+ * @brief Check str_multireplace_dyn() and str_multireplace_dyn_sink() put
+ *        what value_cb() writes for each match in place of the match and
+ *        handle aborting value callback and sink
+ */
+static void
+check_dyn (const char *str, size_t str_len, const str_mr_match_pair *mps,
+           size_t mp_cnt)
+{
+    static str_mr_match matches[MAX_PIECES];
+    static piece_sink   ps, expected;
+    value_state vs;
+    char   *result = NULL;
+    size_t  result_len = 0, match_cnt = 0, pos = 0, i = 0;
+
+    memset(&vs, 0, sizeof(vs));
+    vs.str = str;
+    vs.mps = mps;
+
+    /* expected result built by calling value_cb() for naive matches */
+    memset(&expected, 0, sizeof(expected));
+    match_cnt = naive_find(str, str_len, mps, mp_cnt, false, matches);
+    for (i = 0; i < match_cnt; i++) {
+        if (matches[i].pos > pos) {
+            piece_sink_cb(&expected, str + pos, matches[i].pos - pos);
+        }
+
+        value_cb(&vs, matches[i].pos, matches[i].pair_idx,
+                 &mps[matches[i].pair_idx], piece_sink_cb, &expected);
+        pos = matches[i].pos + mps[matches[i].pair_idx].key_length;
+    }
+
+    if (str_len > pos) {
+        piece_sink_cb(&expected, str + pos, str_len - pos);
+    }
+
+    memset(&ps, 0, sizeof(ps));
+    vs.calls = 0;
+    CHECK(str_multireplace_dyn_sink(str, str_len, mps, mp_cnt, value_cb, &vs,
+                                    piece_sink_cb, &ps) ==
+          (int64_t)match_cnt);
+    CHECK(vs.calls == match_cnt);
+    CHECK(!vs.bad_args);
+    check_pieces(&ps, &expected);
+
+    vs.calls = 0;
+    CHECK(str_multireplace_dyn(str, str_len, mps, mp_cnt, value_cb, &vs,
+                               &result, &result_len, true) ==
+          (int64_t)match_cnt);
+    CHECK((result != NULL) && (result_len == expected.len) &&
+          (memcmp(result, expected.data, result_len) == 0) &&
+          (result[result_len] == '\0'));
+    free(result);
+
+    if (match_cnt == 0) {
+        return;
+    }
+
+    /* aborting value callback is called no more, result is not set */
+    result   = NULL;
+    vs.calls = 0;
+    vs.fail_at = 1 + rnd() % match_cnt;
+    CHECK(str_multireplace_dyn(str, str_len, mps, mp_cnt, value_cb, &vs,
+                               &result, &result_len, false) ==
+          STR_MR_ERROR_SINK);
+    CHECK((vs.calls == vs.fail_at) && (result == NULL));
+
+    memset(&ps, 0, sizeof(ps));
+    vs.calls = 0;
+    CHECK(str_multireplace_dyn_sink(str, str_len, mps, mp_cnt, value_cb, &vs,
+                                    piece_sink_cb, &ps) ==
+          STR_MR_ERROR_SINK);
+    CHECK(vs.calls == vs.fail_at);
+
+    /* sink aborting inside value callback stops the same way */
+    if (expected.piece_cnt > 0) {
+        memset(&ps, 0, sizeof(ps));
+        vs.calls   = 0;
+        vs.fail_at = 0;
+        ps.fail_at = 1 + rnd() % expected.piece_cnt;
+        CHECK(str_multireplace_dyn_sink(str, str_len, mps, mp_cnt, value_cb,
+                                        &vs, piece_sink_cb, &ps) ==
+              STR_MR_ERROR_SINK);
+        CHECK(ps.calls == ps.fail_at);
+    }
+}
+
+static void
+test_dyn (void)
+{
+    str_mr_match_pair mps[8];
+    char   keys[8][4], values[8][4];
+    char   buf[256];
+    size_t len = 0, k = 0, i = 0;
+    int    round = 0;
+
+    for (round = 0; round < 500; round++) {
+        k   = rnd_pairs(mps, keys, values);
+        len = rnd_input(buf, sizeof(buf), mps, k);
+
+        /* values are not used */
+        for (i = 0; i < k; i++) {
+            mps[i].value = NULL;
+        }
+
+        check_dyn(buf, len, mps, k);
+    }
+}
+
+/**
+ * @brief Compare str_mr_find() array with naive scan, both modes
+ */
+static void
+check_find (const char *str, size_t str_len, const str_mr_match_pair *mps,
+            size_t mp_cnt)
+{
+    static str_mr_match expected[8 * 256];
+    str_mr_match *matches = NULL;
+    size_t match_cnt = 0, expected_cnt = 0;
+    int    overlapping = 0;
+
+    for (overlapping = 0; overlapping < 2; overlapping++) {
+        expected_cnt = naive_find(str, str_len, mps, mp_cnt, overlapping,
+                                  expected);
+
+        matches = NULL;
+        CHECK(str_mr_find(str, str_len, mps, mp_cnt, overlapping, &matches,
+                          &match_cnt) == (int64_t)expected_cnt);
+        CHECK((match_cnt == expected_cnt) &&
+              (memcmp(matches, expected,
+                      match_cnt * sizeof(str_mr_match)) == 0));
+        free(matches);
+    }
+}
+
+static void
+test_find (void)
+{
+    str_mr_match_pair mps[8];
+    char   keys[8][4], values[8][4];
+    char   buf[256];
+    size_t len = 0, k = 0;
+    int    round = 0;
+
+    for (round = 0; round < 500; round++) {
+        k = rnd_pairs(mps, keys, values);
+
+        /* duplicate key, every copy reported only when overlapping */
+        if ((k > 1) && (round % 2 == 0)) {
+            mps[k - 1].key_length = mps[0].key_length;
+            memcpy(keys[k - 1], keys[0], mps[0].key_length);
+        }
+
+        len = rnd_input(buf, sizeof(buf), mps, k);
+        check_find(buf, len, mps, k);
+    }
+}
+
+/**
+ * @brief Compare str_mr_count() histogram with naive count, both modes
+ */
+static void
+check_count (const char *str, size_t str_len, const str_mr_match_pair *mps,
+             size_t mp_cnt)
+{
+    static str_mr_match matches[8 * 256];
+    size_t counts[8], expected[8];
+    size_t match_cnt = 0, i = 0;
+    int    overlapping = 0;
+
+    for (overlapping = 0; overlapping < 2; overlapping++) {
+        match_cnt = naive_find(str, str_len, mps, mp_cnt, overlapping,
+                               matches);
+        memset(expected, 0, sizeof(expected));
+        for (i = 0; i < match_cnt; i++) {
+            expected[matches[i].pair_idx]++;
+        }
+
+        /* counters are reset by the call */
+        memset(counts, 0xff, sizeof(counts));
+        CHECK(str_mr_count(str, str_len, mps, mp_cnt, overlapping, counts) ==
+              (int64_t)match_cnt);
+        CHECK(memcmp(counts, expected, mp_cnt * sizeof(size_t)) == 0);
+        CHECK(str_mr_count(str, str_len, mps, mp_cnt, overlapping, NULL) ==
+              (int64_t)match_cnt);
+    }
+}
+
+static void
+test_count (void)
+{
+    str_mr_match_pair mps[8];
+    char   keys[8][4], values[8][4];
+    char   buf[256];
+    size_t len = 0, k = 0;
+    int    round = 0;
+
+    for (round = 0; round < 500; round++) {
+        k = rnd_pairs(mps, keys, values);
+
+        /* duplicate key, later copies counted only when overlapping */
+        if ((k > 1) && (round % 2 == 0)) {
+            mps[k - 1].key_length = mps[0].key_length;
+            memcpy(keys[k - 1], keys[0], mps[0].key_length);
+        }
+
+        len = rnd_input(buf, sizeof(buf), mps, k);
+        check_count(buf, len, mps, k);
+    }
+}
+
+#ifdef STR_MR_INT32_MAX
+/**
+ * @brief Check str_multireplace() refuses more than STR_MR_INT32_MAX
+ *        replacements, while str_multireplace64() reports them all
+ */
+static void
+test_overflow (void)
+{
+    str_mr_match_pair mps[] = {
+        {"ab", 2, "X", 1},
+    };
+    char  *str = (char *)malloc(2 * (STR_MR_INT32_MAX + 1));
+    char  *result = NULL;
+    size_t result_len = 0, i = 0;
+
+    for (i = 0; i < STR_MR_INT32_MAX + 1; i++) {
+        memcpy(str + 2 * i, "ab", 2);
+    }
+
+    CHECK(str_multireplace(str, 2 * STR_MR_INT32_MAX, mps, 1, &result,
+                           &result_len, false) == STR_MR_INT32_MAX);
+    free(result);
+
+    /* result is cleared, not left pointing to freed memory */
+    result = str;
+    CHECK(str_multireplace(str, 2 * (STR_MR_INT32_MAX + 1), mps, 1, &result,
+                           &result_len, false) == STR_MR_ERROR_OVERFLOW);
+    CHECK(result == NULL);
+
+    CHECK(str_multireplace64(str, 2 * (STR_MR_INT32_MAX + 1), mps, 1,
+                             &result, &result_len, false) ==
+          STR_MR_INT32_MAX + 1);
+    CHECK((result != NULL) && (result_len == STR_MR_INT32_MAX + 1));
+    free(result);
+    free(str);
+}
+#endif
+
+/**
+ * @brief Find callback stopping the search by non-standard return value
+ */
+static int
+find_stop_cb (void *ctx, size_t pos, size_t pair_idx)
+{
+    (void)pos;
+    (void)pair_idx;
+    (*(int *)ctx)++;
+    return 2;
+}
+
+static void
+test_find_stop (void)
+{
+    str_mr_match_pair mps[] = {
+        {"abc", 3, NULL, 0}, {"ab", 2, NULL, 0}, {"a", 1, NULL, 0},
+    };
+    int calls = 0;
+
+    /* any value but STR_MR_MATCH_CONTINUE stops, shorter keys not tried */
+    CHECK(str_mr_find_each("abcabc", 6, mps, 3, false, find_stop_cb,
+                           &calls) == 1);
+    CHECK(calls == 1);
+
+    calls = 0;
+    CHECK(str_mr_find_each("abcabc", 6, mps, 3, true, find_stop_cb,
+                           &calls) == 1);
+    CHECK(calls == 1);
+}
+
+/**
+ * @brief Check str_multireplace_limit() result against expected string
+ */
+static void
+check_limit (const char *str, const str_mr_match_pair *mps, size_t mp_cnt,
+             size_t max_cnt, const size_t *quotas, const char *expected,
+             int64_t expected_cnt)
+{
+    char  *result = NULL;
+    size_t result_len = 0;
+    int64_t cnt = 0;
+
+    cnt = str_multireplace_limit(str, strlen(str), mps, mp_cnt, max_cnt,
+                                 quotas, &result, &result_len, true);
+    CHECK(cnt == expected_cnt);
+    CHECK((result != NULL) && (strcmp(result, expected) == 0));
+    free(result);
+}
+
+static void
+test_limit (void)
+{
+    str_mr_match_pair nested[] = {
+        {"abc", 3, "X", 1}, {"ab", 2, "Y", 1}, {"a", 1, "Z", 1},
+    };
+    str_mr_match_pair dups[] = {
+        {"a", 1, "1", 1}, {"a", 1, "2", 1}, {"b", 1, "3", 1},
+    };
+    size_t longest_once[] = { 1, STR_MR_UNLIMITED, STR_MR_UNLIMITED };
+    size_t two_shortest[] = { 1, 0, 2 };
+    size_t dup_quotas[]   = { 2, 1, 0 };
+
+    /* limit only */
+    check_limit("abcabcabc", nested, 3, 2, NULL, "XXabc", 2);
+    check_limit("abcabcabc", nested, 3, 0, NULL, "abcabcabc", 0);
+    check_limit("abcabcabc", nested, 3, STR_MR_UNLIMITED, NULL, "XXX", 3);
+
+    /* used up longer key lets shorter key match at the same position */
+    check_limit("abcabcabc", nested, 3, STR_MR_UNLIMITED, longest_once,
+                "XYcYc", 3);
+    /* quota 0 never matches, then shortest until its quota is used up */
+    check_limit("abcabcabcabc", nested, 3, STR_MR_UNLIMITED, two_shortest,
+                "XZbcZbcabc", 3);
+    /* used up duplicate key lets later pair with the same key match */
+    check_limit("aaaab", dups, 3, STR_MR_UNLIMITED, dup_quotas, "112ab", 3);
+    /* limit and quotas together */
+    check_limit("abcabcabc", nested, 3, 2, longest_once, "XYcabc", 2);
+}
+
+static void
+test_contains (void)
+{
+    str_mr_match_pair mps[] = {
+        {"needle", 6, NULL, 0}, {"pin", 3, NULL, 0},
+    };
+    str_mr_set *set = NULL;
+
+    CHECK(str_mr_contains_any("haystack with pin", 17, mps, 2) == 1);
+    CHECK(str_mr_contains_any("haystack", 8, mps, 2) == 0);
+
+    CHECK(str_mr_set_compile(mps, 2, &set) == STR_MR_ERROR_SUCCESS);
+    CHECK(str_mr_set_contains_any(set, "a needle", 8) == 1);
+    CHECK(str_mr_set_contains_any(set, "a needl", 7) == 0);
+    CHECK(str_mr_set_contains_any(set, NULL, 0) == 0);
+    CHECK(str_mr_set_contains_any(NULL, "pin", 3) ==
+          STR_MR_ERROR_INVALID_ARG);
+    str_mr_set_free(set);
+}
+
+int
+main ()
+{
+    test_replace();
+    test_inplace();
+    test_units();
+#ifdef STR_MR_WITH_POSIX
+    test_iov();
+#endif
+    test_sink();
+    test_dyn();
+    test_find();
+    test_count();
+    test_find_stop();
+    test_contains();
+    test_limit();
+#ifdef STR_MR_INT32_MAX
+    test_overflow();
+#endif
+
+    return test_result();
+}
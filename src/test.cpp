@@ -0,0 +1,350 @@
+/**
+ * @file      test.cpp
+ * @brief     Tests of C++ wrapper of multiple key-value replacement.
+ * @author    MMaster <mmaster@bitbix.com>
+ * @version   0.1
+ * @date      2013
+ * @copyright Apache License v2
+ *
+ * Results of multireplacer written into std::string, output iterator and
+ * adopted buffer are compared against str_multireplace64() of the same
+ * pairs, including errors carried out of the C library as exceptions.
+ * Pieces of views::multireplace() have to add up to the same result, and
+ * taking the first pieces must not read the source beyond them.
+ *
+ * Compile with:
+ *    $ gcc -c str_multireplace.c
+ *    $ g++ -std=c++20 -o test_cpp test.cpp str_multireplace.o
+ *
+ * Run with:
+ *    $ ./test_cpp
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "str_multireplace.h"
+#include "test_util.h"
+#include "str_multireplace.hpp"
+#ifdef STR_MR_WITH_POSIX
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+/**
+ * @brief Random pairs with keys and values kept alive by the caller
+ */
+struct rnd_set {
+    std::vector<std::string>       keys, values;
+    std::vector<str_mr_match_pair> mps;
+
+    /**
+     * @brief 1 to 8 pairs of "ab" keys (1 to 4 long, duplicates and
+     *        prefixes of each other are common) and "XYZ" values
+     */
+    rnd_set ()
+    {
+        size_t cnt = 1 + rnd() % 8;
+
+        keys.resize(cnt);
+        values.resize(cnt);
+        for (size_t i = 0; i < cnt; i++) {
+            keys[i].resize(1 + rnd() % 4);
+            values[i].resize(rnd() % 4);
+            rnd_fill(keys[i].data(), keys[i].size(), "ab");
+            rnd_fill(values[i].data(), values[i].size(), "XYZ");
+        }
+
+        for (size_t i = 0; i < cnt; i++) {
+            mps.push_back(str_mr::make_pair(keys[i], values[i]));
+        }
+    }
+
+    /**
+     * @brief Result of str_multireplace64() (empty input stays empty)
+     */
+    std::string
+    expected (const std::string &str, int64_t *cnt) const
+    {
+        char   *result = nullptr;
+        size_t  result_len = 0;
+
+        *cnt = 0;
+        if (str.empty()) {
+            return str;
+        }
+
+        *cnt = str_multireplace64(str.data(), str.size(), mps.data(),
+                                  mps.size(), &result, &result_len, false);
+        CHECK(*cnt >= 0);
+
+        std::string out(result, result_len);
+
+        std::free(result);
+        return out;
+    }
+};
+
+/**
+ * @brief Random input of "abc" up to max_len characters
+ */
+static std::string
+rnd_input (size_t max_len)
+{
+    std::string str(rnd() % (max_len + 1), '\0');
+
+    rnd_fill(str.data(), str.size(), "abc");
+    return str;
+}
+
+static void
+test_replace (void)
+{
+    std::string out = "previous content is overwritten";
+
+    for (int round = 0; round < 500; round++) {
+        rnd_set  s;
+        str_mr::multireplacer mr(s.mps);
+        std::string str = rnd_input(300);
+        int64_t     cnt = 0, it_cnt = -1;
+        std::string expected = s.expected(str, &cnt);
+        std::string it_out;
+
+        /* the same string reused by every round */
+        CHECK(mr.replace(str, out) == cnt);
+        CHECK(out == expected);
+
+        mr.replace(str, std::back_inserter(it_out), &it_cnt);
+        CHECK((it_cnt == cnt) && (it_out == expected));
+
+        str_mr::result r = mr.replace(str);
+        CHECK((r.replacements() == cnt) && (r.view() == expected));
+
+        /* free function compiles pairs on every call */
+        if (!str.empty()) {
+            str_mr::result f = str_mr::replace(str, s.mps);
+            CHECK((f.replacements() == cnt) && (f.view() == expected));
+        }
+    }
+}
+
+static void
+test_replacer (void)
+{
+    str_mr::multireplacer mr{{"cat", "dog"}, {"red", "blue"}};
+    std::string out;
+
+    CHECK(mr.replace("red cat", out) == 2);
+    CHECK(out == "blue dog");
+
+    /* views are copied, keys are gone from the set after remove() */
+    {
+        std::string key = "dog", value = "wolf";
+
+        mr.add(key, value);
+    }
+
+    CHECK(mr.replace("red cat dog", out) == 3);
+    CHECK(out == "blue dog wolf");
+    CHECK(mr.remove("red") == 1);
+    CHECK(mr.replace("red cat", out) == 1);
+    CHECK(out == "red dog");
+
+    /* moved-from replacer hands the set over */
+    str_mr::multireplacer moved = std::move(mr);
+
+    CHECK(moved.replace("cat", out) == 1);
+    CHECK(out == "dog");
+}
+
+/**
+ * @brief Output iterator throwing after limit characters
+ */
+struct throwing_iterator {
+    using difference_type = std::ptrdiff_t;
+
+    size_t *limit;
+
+    throwing_iterator &
+    operator* ()
+    {
+        return *this;
+    }
+
+    throwing_iterator &
+    operator= (char)
+    {
+        if (*limit == 0) {
+            throw std::length_error("limit");
+        }
+
+        (*limit)--;
+        return *this;
+    }
+
+    throwing_iterator &
+    operator++ ()
+    {
+        return *this;
+    }
+
+    throwing_iterator
+    operator++ (int)
+    {
+        return *this;
+    }
+};
+
+static void
+test_errors (void)
+{
+    str_mr_match_pair mps[] = {
+        {"key", 3, "value", 5}, {"nokey", 5, nullptr, 0},
+    };
+    str_mr::multireplacer mr(std::span<const str_mr_match_pair>(mps, 1));
+    str_mr::multireplacer no_value(mps);
+    std::string out;
+    size_t limit = 7;
+    bool   thrown = false;
+
+    /* pairs without value can't be used for replacing */
+    try {
+        no_value.replace("key", out);
+    } catch (const str_mr::error &e) {
+        thrown = (e.code() == STR_MR_ERROR_INVALID_MATCH);
+    }
+
+    CHECK(thrown);
+
+    /* exception of output iterator is rethrown, not turned into error */
+    thrown = false;
+    try {
+        mr.replace("key key", throwing_iterator{&limit});
+    } catch (const std::length_error &) {
+        thrown = true;
+    }
+
+    CHECK(thrown && (limit == 0));
+
+    /* replacer is still usable after an exception */
+    CHECK(mr.replace("key key", out) == 2);
+    CHECK(out == "value value");
+}
+
+/**
+ * @brief Concatenate pieces of view, no piece may be empty
+ */
+template <typename View>
+static std::string
+join_pieces (View &&view)
+{
+    std::string out;
+
+    for (std::string_view piece : view) {
+        CHECK(!piece.empty());
+        out.append(piece);
+    }
+
+    return out;
+}
+
+static void
+test_view (void)
+{
+    for (int round = 0; round < 500; round++) {
+        rnd_set  s;
+        str_mr::multireplacer mr(s.mps);
+        std::string str = rnd_input(300);
+        int64_t     cnt = 0;
+        std::string expected = s.expected(str, &cnt);
+
+        CHECK(join_pieces(str | str_mr::views::multireplace(mr)) == expected);
+        CHECK(join_pieces(str_mr::views::multireplace(std::string_view(str),
+                                                      mr.get())) ==
+              expected);
+
+        /* copied iterator continues on its own */
+        auto view = str_mr::views::multireplace(str, mr);
+        auto it   = view.begin();
+        std::string out;
+
+        for (size_t k = rnd() % 4; (k > 0) && (it != view.end()); k--) {
+            out.append(*it++);
+        }
+
+        auto copy = it;
+        std::string rest, copy_rest;
+
+        for (; it != view.end(); ++it) {
+            rest.append(*it);
+        }
+
+        CHECK((out + rest) == expected);
+        for (; copy != view.end(); ++copy) {
+            copy_rest.append(*copy);
+        }
+
+        CHECK(copy_rest == rest);
+    }
+}
+
+#ifdef STR_MR_WITH_POSIX
+/**
+ * @brief Pieces taken from view must not need source behind them
+ *
+ * Source ends in a page without access, reading it would crash the test.
+ */
+static void
+test_view_lazy (void)
+{
+    str_mr::multireplacer mr{{"abab", "X"}, {"ba", "YY"}, {"b", ""}};
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    char  *mem = static_cast<char *>(mmap(nullptr, 2 * page,
+                                          PROT_READ | PROT_WRITE,
+                                          MAP_PRIVATE | MAP_ANONYMOUS, -1,
+                                          0));
+
+    CHECK(mem != MAP_FAILED);
+    if (mem == MAP_FAILED) {
+        return;
+    }
+
+    /*
+     * "ba" at 10 and close to the end of the readable page, "c" elsewhere,
+     * its value is the last piece that can be taken: longer keys and vector
+     * loads look a few bytes ahead of a match, the next piece would need the
+     * rest of the source.
+     */
+    std::memset(mem, 'c', page);
+    std::memcpy(mem + 10, "ba", 2);
+    std::memcpy(mem + page - 64, "ba", 2);
+    CHECK(mprotect(mem + page, page, PROT_NONE) == 0);
+
+    std::string_view str(mem, 2 * page);
+    auto view = str | str_mr::views::multireplace(mr);
+    auto it   = view.begin();
+
+    CHECK(*it == str.substr(0, 10));
+    CHECK(*++it == "YY");
+    CHECK(*++it == str.substr(12, page - 64 - 12));
+    CHECK(*++it == "YY");
+
+    munmap(mem, 2 * page);
+}
+#endif
+
+int
+main ()
+{
+    test_replace();
+    test_replacer();
+    test_errors();
+    test_view();
+#ifdef STR_MR_WITH_POSIX
+    test_view_lazy();
+#endif
+
+    return test_result();
+}
@@ -0,0 +1,298 @@
+/**
+ * @file      test_dict.c
+ * @brief     Tests of dictionary loading.
+ * @author    MMaster <mmaster@bitbix.com>
+ * @version   0.1
+ * @date      2013
+ * @copyright Apache License v2
+ *
+ * Writes TSV and length-prefixed (STRMRKV1) dictionaries into a temporary
+ * file, maps them and checks the pairs. Malformed and truncated files have
+ * to be refused with the number of the bad line or record.
+ *
+ * Compile with:
+ *    $ gcc -o test_dict test_dict.c str_mr_dict.c str_multireplace.c
+ *
+ * Run with:
+ *    $ ./test_dict
+ */
+
+/* mkstemp() also with strict -std=c11 */
+#if !defined(_POSIX_C_SOURCE) && !defined(_GNU_SOURCE)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "str_multireplace.h"
+#include "test_util.h"
+#include "str_mr_dict.h"
+
+/**
+ * Line number err_line is left at when it is not set
+ */
+#define NO_LINE         ((size_t)-1)
+
+/**
+ * Temporary dictionary file
+ */
+static char dict_path[] = "/tmp/test_dict_XXXXXX";
+
+/**
+ * @brief Expected pair (key and value with their lengths, may contain NUL)
+ */
+typedef struct {
+    const char *key;
+    size_t key_length;
+    const char *value;
+    size_t value_length;
+} expected_pair;
+
+#define PAIR(k, v)      { k, sizeof(k) - 1, v, sizeof(v) - 1 }
+
+/**
+ * @brief Replace temporary file content
+ */
+static void
+write_dict (const char *data, size_t len)
+{
+    FILE *f = fopen(dict_path, "wb");
+
+    CHECK(f != NULL);
+    if (f != NULL) {
+        CHECK(fwrite(data, 1, len, f) == len);
+        fclose(f);
+    }
+}
+
+/**
+ * @brief Map data as dictionary and compare its pairs with expected ones
+ */
+static void
+check_dict (const char *data, size_t len, const expected_pair *expected,
+            size_t expected_cnt)
+{
+    const str_mr_match_pair *mps = NULL;
+    str_mr_dict *dict = NULL;
+    size_t cnt = 0, i = 0, err_line = NO_LINE;
+
+    write_dict(data, len);
+    CHECK(str_mr_dict_map(dict_path, &dict, &err_line) ==
+          STR_MR_ERROR_SUCCESS);
+    CHECK(err_line == NO_LINE);
+    if (dict == NULL) {
+        return;
+    }
+
+    mps = str_mr_dict_pairs(dict, &cnt);
+    CHECK(cnt == expected_cnt);
+    for (i = 0; (i < cnt) && (i < expected_cnt); i++) {
+        CHECK((mps[i].key_length == expected[i].key_length) &&
+              (memcmp(mps[i].key, expected[i].key,
+                      expected[i].key_length) == 0));
+        CHECK((mps[i].value_length == expected[i].value_length) &&
+              (memcmp(mps[i].value, expected[i].value,
+                      expected[i].value_length) == 0));
+    }
+
+    str_mr_dict_free(dict);
+}
+
+/**
+ * @brief Map data as dictionary, it has to be refused at line (or record)
+ */
+static void
+check_refused (const char *data, size_t len, size_t line)
+{
+    str_mr_dict *dict = NULL;
+    size_t err_line = NO_LINE;
+
+    write_dict(data, len);
+    CHECK(str_mr_dict_map(dict_path, &dict, &err_line) ==
+          STR_MR_ERROR_FORMAT);
+    CHECK(dict == NULL);
+    CHECK(err_line == line);
+
+    /* line number is optional */
+    CHECK(str_mr_dict_map(dict_path, &dict, NULL) == STR_MR_ERROR_FORMAT);
+}
+
+static void
+test_tsv (void)
+{
+    static const char plain[] = "one\t1\ntwo\t2\r\n\nthree\t\n\r\nfour\t4";
+    static const expected_pair plain_pairs[] = {
+        PAIR("one", "1"), PAIR("two", "2"), PAIR("three", ""),
+        PAIR("four", "4"),
+    };
+    static const char escaped[] =
+        "a\\tb\tx\\ny\n"        /* tab in key, newline in value */
+        "\\0\\r\\\\\t\\0\n"     /* NUL, CR and backslash */
+        "k\tv\tw\n"             /* value can contain tab as is */
+        "\\q\\\tz\\\n";         /* unknown escape, trailing backslash */
+    static const expected_pair escaped_pairs[] = {
+        PAIR("a\tb", "x\ny"), PAIR("\0\r\\", "\0"), PAIR("k", "v\tw"),
+        PAIR("q\\", "z\\"),
+    };
+
+    check_dict(plain, sizeof(plain) - 1, plain_pairs, 4);
+    check_dict(escaped, sizeof(escaped) - 1, escaped_pairs, 4);
+    check_dict("", 0, NULL, 0);
+    check_dict("\n\r\n\n", 4, NULL, 0);
+}
+
+static void
+test_tsv_malformed (void)
+{
+    static const char no_tab[]    = "a\tb\n\nno tab\nc\td\n";
+    static const char empty_key[] = "a\tb\r\n\tvalue\r\n";
+    static const char last[]      = "a\tb\nc\td\nlast";
+
+    /* empty lines are counted */
+    check_refused(no_tab, sizeof(no_tab) - 1, 3);
+    check_refused(empty_key, sizeof(empty_key) - 1, 2);
+    check_refused(last, sizeof(last) - 1, 3);
+    check_refused("x", 1, 1);
+
+    /* too short to be length-prefixed, parsed as TSV */
+    check_refused("STRMRKV", 7, 1);
+}
+
+/**
+ * @brief Append length-prefixed record to buf
+ */
+static size_t
+lp_record (char *buf, size_t pos, const char *key, size_t key_len,
+           const char *value, size_t value_len)
+{
+    size_t i = 0;
+
+    for (i = 0; i < 4; i++) {
+        buf[pos++] = (char)((key_len >> (8 * i)) & 0xFF);
+    }
+
+    memcpy(buf + pos, key, key_len);
+    pos += key_len;
+    for (i = 0; i < 4; i++) {
+        buf[pos++] = (char)((value_len >> (8 * i)) & 0xFF);
+    }
+
+    memcpy(buf + pos, value, value_len);
+    return pos + value_len;
+}
+
+static void
+test_lp (void)
+{
+    static char long_key[300];
+    expected_pair pairs[] = {
+        PAIR("key", "value"), PAIR("\t\n\\0\0", "\r\n"), PAIR("empty", ""),
+        { long_key, sizeof(long_key), "long", 4 },
+    };
+    size_t ends[4];
+    char   buf[512];
+    size_t len = 0, i = 0, cut = 0, rec = 0;
+
+    memset(long_key, 'L', sizeof(long_key));
+
+    /* magic only */
+    check_dict(STR_MR_DICT_LP_MAGIC, sizeof(STR_MR_DICT_LP_MAGIC) - 1, NULL,
+               0);
+
+    memcpy(buf, STR_MR_DICT_LP_MAGIC, sizeof(STR_MR_DICT_LP_MAGIC) - 1);
+    len = sizeof(STR_MR_DICT_LP_MAGIC) - 1;
+    for (i = 0; i < 4; i++) {
+        len = lp_record(buf, len, pairs[i].key, pairs[i].key_length,
+                        pairs[i].value, pairs[i].value_length);
+        ends[i] = len;
+    }
+
+    check_dict(buf, len, pairs, 4);
+
+    /* truncated input is refused at the cut record, unless cut between */
+    for (cut = sizeof(STR_MR_DICT_LP_MAGIC); cut < len; cut++) {
+        for (rec = 0; ends[rec] < cut; rec++) {
+        }
+
+        if (ends[rec] == cut) {
+            check_dict(buf, cut, pairs, rec + 1);
+        } else {
+            check_refused(buf, cut, rec + 1);
+        }
+    }
+
+    /* empty key, lengths beyond the end */
+    len = sizeof(STR_MR_DICT_LP_MAGIC) - 1;
+    len = lp_record(buf, len, "k", 1, "v", 1);
+    check_refused(buf, lp_record(buf, len, "", 0, "v", 1), 2);
+    i = lp_record(buf, len, "k", 1, "", 0);
+    memset(buf + len, 0xFF, 4);
+    check_refused(buf, i, 2);
+    i = lp_record(buf, len, "k", 1, "", 0);
+    memset(buf + i - 4, 0xFF, 4);
+    check_refused(buf, i, 2);
+}
+
+static void
+test_dict_args (void)
+{
+    str_mr_dict *dict = NULL;
+    size_t cnt = 1;
+
+    CHECK(str_mr_dict_map(NULL, &dict, NULL) == STR_MR_ERROR_INVALID_ARG);
+    CHECK(str_mr_dict_map(dict_path, NULL, NULL) == STR_MR_ERROR_INVALID_ARG);
+    CHECK(str_mr_dict_pairs(NULL, &cnt) == NULL);
+    CHECK(cnt == 0);
+    str_mr_dict_free(NULL);
+
+    unlink(dict_path);
+    CHECK(str_mr_dict_map(dict_path, &dict, NULL) == STR_MR_ERROR_IO);
+}
+
+/**
+ * @brief Loaded pairs can be used for replacement
+ */
+static void
+test_dict_replace (void)
+{
+    static const char tsv[] = "cat\tdog\nhello\\tworld\tbye\n";
+    static const char str[] = "hello\tworld, cat!";
+    const str_mr_match_pair *mps = NULL;
+    str_mr_dict *dict = NULL;
+    char  *result = NULL;
+    size_t cnt = 0, result_len = 0;
+
+    write_dict(tsv, sizeof(tsv) - 1);
+    CHECK(str_mr_dict_map(dict_path, &dict, NULL) == STR_MR_ERROR_SUCCESS);
+    mps = str_mr_dict_pairs(dict, &cnt);
+    CHECK(str_multireplace(str, sizeof(str) - 1, mps, cnt, &result,
+                           &result_len, true) == 2);
+    CHECK((result != NULL) && (strcmp(result, "bye, dog!") == 0));
+    free(result);
+    str_mr_dict_free(dict);
+}
+
+int
+main ()
+{
+    int fd = mkstemp(dict_path);
+
+    if (fd < 0) {
+        perror("mkstemp");
+        return 1;
+    }
+
+    close(fd);
+
+    test_tsv();
+    test_tsv_malformed();
+    test_lp();
+    test_dict_replace();
+    test_dict_args();
+
+    unlink(dict_path);
+
+    return test_result();
+}
@@ -0,0 +1,120 @@
+#!/bin/sh
+#
+# Tests of file to file replacement tool (str_mr_file.c).
+#
+# Every mode (mapped input with writev(), pipe, -u and compiled image) has
+# to write the same output, to a file as well as to stdout shared with
+# other writers or opened in append mode. Output of mapped input is
+# checked by test.c against str_multireplace64(), here the other modes are
+# compared with it.
+#
+# Compile and run with:
+#    $ gcc -O2 -pthread -o str_mr_file str_mr_file.c str_mr_dict.c \
+#          str_mr_pipe.c str_mr_uring.c str_multireplace.c
+#    $ ./test_file.sh ./str_mr_file
+#
+
+tool=${1:-./str_mr_file}
+dir=$(mktemp -d) || exit 1
+failures=0
+
+trap 'rm -rf "$dir"' EXIT
+
+# check <name> <file> <expected file>
+check () {
+    if ! cmp -s "$2" "$3"; then
+        echo "$1: output differs"
+        failures=$((failures + 1))
+    fi
+}
+
+# run <name> <command...>
+run () {
+    name=$1
+    shift
+    if ! "$@"; then
+        echo "$name: failed"
+        failures=$((failures + 1))
+    fi
+}
+
+# small dictionary with known result
+printf 'small\tbig\nab\tX\nabab\t\n' > "$dir/small.tsv"
+printf 'small ab abab aab\n' > "$dir/small.in"
+printf 'big X  aX\n' > "$dir/small.expected"
+run "small" "$tool" "$dir/small.tsv" "$dir/small.in" "$dir/small.out"
+check "small" "$dir/small.out" "$dir/small.expected"
+
+# random dictionary of overlapping keys and input full of their matches
+awk 'BEGIN {
+    srand(1);
+    for (i = 0; i < 64; i++) {
+        key = ""; len = 1 + int(rand() * 6);
+        for (j = 0; j < len; j++) key = key substr("ab", 1 + int(rand() * 2), 1);
+        val = ""; len = int(rand() * 4);
+        for (j = 0; j < len; j++) val = val substr("XYZ", 1 + int(rand() * 3), 1);
+        print key "\t" val;
+    }
+}' > "$dir/dict.tsv"
+awk 'BEGIN {
+    srand(2);
+    for (i = 0; i < 20000; i++) {
+        line = "";
+        for (j = 0; j < 40; j++) line = line substr("aab c", 1 + int(rand() * 5), 1);
+        print line;
+    }
+}' > "$dir/in"
+
+run "mapped" "$tool" "$dir/dict.tsv" "$dir/in" "$dir/expected"
+run "compile" "$tool" -c "$dir/dict.tsv" "$dir/dict.img"
+
+# existing longer output is truncated
+head -c 2000000 /dev/zero > "$dir/out"
+run "uring" "$tool" -u "$dir/dict.tsv" "$dir/in" "$dir/out"
+check "uring" "$dir/out" "$dir/expected"
+
+run "image" "$tool" "$dir/dict.img" "$dir/in" "$dir/out"
+check "image" "$dir/out" "$dir/expected"
+
+run "pipe" sh -c 'cat "$2" | "$1" "$3" - "$4"' sh "$tool" "$dir/in" \
+    "$dir/dict.tsv" "$dir/out"
+check "pipe" "$dir/out" "$dir/expected"
+
+run "image pipe" sh -c 'cat "$2" | "$1" "$3" - "$4"' sh "$tool" "$dir/in" \
+    "$dir/dict.img" "$dir/out"
+check "image pipe" "$dir/out" "$dir/expected"
+
+# stdout shared with other writers, then appended to
+for mode in "" "-u" "image"; do
+    case $mode in
+        image) set -- "$dir/dict.img" ;;
+        -u)    set -- -u "$dir/dict.tsv" ;;
+        *)     set -- "$dir/dict.tsv" ;;
+    esac
+
+    { echo header; "$tool" "$@" "$dir/in" -; echo footer; } > "$dir/out"
+    { echo header; cat "$dir/expected"; echo footer; } > "$dir/shared"
+    check "stdout $mode" "$dir/out" "$dir/shared"
+
+    "$tool" "$@" "$dir/in" - >> "$dir/out"
+    cat "$dir/expected" >> "$dir/shared"
+    check "append $mode" "$dir/out" "$dir/shared"
+
+    cat "$dir/in" | "$tool" "$@" - - >> "$dir/out"
+    cat "$dir/expected" >> "$dir/shared"
+    check "pipe append $mode" "$dir/out" "$dir/shared"
+done
+
+# empty input gives empty output
+: > "$dir/empty"
+run "empty" "$tool" "$dir/dict.tsv" "$dir/empty" "$dir/out"
+check "empty" "$dir/out" "$dir/empty"
+run "empty uring" "$tool" -u "$dir/dict.tsv" "$dir/empty" "$dir/out"
+check "empty uring" "$dir/out" "$dir/empty"
+
+if [ "$failures" -ne 0 ]; then
+    echo "$failures checks failed"
+    exit 1
+fi
+
+echo "all tests passed"
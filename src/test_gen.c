@@ -0,0 +1,137 @@
+/**
+ * @file      test_gen.c
+ * @brief     Tests of matchers generated by str_mr_gen.
+ * @author    MMaster <mmaster@bitbix.com>
+ * @version   0.1
+ * @date      2013
+ * @copyright Apache License v2
+ *
+ * Linked with source generated from a dictionary as function gen_replace(),
+ * compares its results with str_multireplace64() of the same dictionary.
+ * Inputs are random runs of keys, key prefixes and bytes of the keys, so
+ * nearly every position starts some key. test_gen.sh generates the
+ * dictionaries, builds and runs this test for each of them.
+ *
+ * Compile with:
+ *    $ ./str_mr_gen dict.tsv gen_replace gen.c
+ *    $ gcc -I. -o test_gen test_gen.c gen.c str_mr_dict.c str_multireplace.c
+ *
+ * Run with:
+ *    $ ./test_gen dict.tsv
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "str_multireplace.h"
+#include "test_util.h"
+#include "str_mr_dict.h"
+
+#define MAX_INPUT       (2048)
+
+/**
+ * @brief Generated matcher of the dictionary
+ */
+int64_t
+gen_replace(const char *str, size_t str_len,
+            char **result, size_t *result_len, bool terminate);
+
+/**
+ * @brief Random input made of whole keys, key prefixes and single bytes
+ *
+ * @return length of input
+ */
+static size_t
+rnd_input (char *buf, size_t max, const str_mr_match_pair *mps,
+           size_t mp_cnt)
+{
+    size_t len = 0, target = rnd() % max, n = 0;
+    const str_mr_match_pair *mp = NULL;
+
+    while (len < target) {
+        mp = &mps[rnd() % mp_cnt];
+        n  = mp->key_length;
+        switch (rnd() % 3) {
+        case 0:
+            break;
+        case 1:
+            n = rnd() % n;
+            break;
+        default:
+            n = 1;
+            buf[len] = mp->key[rnd() % mp->key_length];
+            len++;
+            continue;
+        }
+
+        if (n > target - len) {
+            n = target - len;
+        }
+
+        memcpy(buf + len, mp->key, n);
+        len += n;
+    }
+
+    return len;
+}
+
+static void
+check_gen (const char *str, size_t len, const str_mr_match_pair *mps,
+           size_t mp_cnt, bool terminate)
+{
+    char   *exp = NULL, *got = NULL;
+    size_t  exp_len = 0, got_len = 0;
+    int64_t exp_cnt = 0, got_cnt = 0;
+
+    exp_cnt = str_multireplace64(str, len, mps, mp_cnt, &exp, &exp_len,
+                                 terminate);
+    got_cnt = gen_replace(str, len, &got, &got_len, terminate);
+
+    CHECK(exp_cnt >= 0);
+    CHECK(got_cnt == exp_cnt);
+    if ((exp_cnt >= 0) && (got_cnt >= 0)) {
+        CHECK((got_len == exp_len) && (memcmp(got, exp, exp_len) == 0));
+        CHECK(!terminate || (got[got_len] == '\0'));
+    }
+
+    free(exp);
+    free(got);
+}
+
+int
+main (int argc, char *argv[])
+{
+    str_mr_dict *d = NULL;
+    const str_mr_match_pair *mps = NULL;
+    size_t mp_cnt = 0, len = 0;
+    char   buf[MAX_INPUT];
+    char  *out = NULL;
+    size_t out_len = 0;
+    int    round = 0;
+
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s dict.tsv\n", argv[0]);
+        return 2;
+    }
+
+    CHECK(str_mr_dict_map(argv[1], &d, NULL) == STR_MR_ERROR_SUCCESS);
+    if (d == NULL) {
+        return test_result();
+    }
+
+    mps = str_mr_dict_pairs(d, &mp_cnt);
+    CHECK(mp_cnt > 0);
+
+    for (round = 0; (mp_cnt > 0) && (round < 2000); round++) {
+        len = rnd_input(buf, sizeof(buf), mps, mp_cnt);
+        if (len > 0) {
+            check_gen(buf, len, mps, mp_cnt, (rnd() % 2 == 0));
+        }
+    }
+
+    /* empty input is refused the same way */
+    CHECK(gen_replace(buf, 0, &out, &out_len, false) ==
+          str_multireplace64(buf, 0, mps, mp_cnt, &out, &out_len, false));
+
+    str_mr_dict_free(d);
+    return test_result();
+}
@@ -0,0 +1,93 @@
+#!/bin/sh
+#
+# Tests of matcher generator (str_mr_gen.c).
+#
+# For every dictionary a matcher is generated, built together with
+# test_gen.c and compared with str_multireplace64() of the same dictionary.
+# Dictionaries cover bytes that need escaping in C literals, duplicate
+# keys, keys that are prefixes of other keys and a trie too big for one
+# generated function.
+#
+# Compile and run with:
+#    $ gcc -O2 -o str_mr_gen str_mr_gen.c str_mr_dict.c
+#    $ ./test_gen.sh ./str_mr_gen
+#
+# Set CC and CFLAGS to build the generated matchers differently.
+#
+
+gen=${1:-./str_mr_gen}
+src=$(dirname "$0")
+cc=${CC:-cc}
+dir=$(mktemp -d) || exit 1
+failures=0
+
+trap 'rm -rf "$dir"' EXIT
+
+# check <name> <dictionary>
+check () {
+    if ! "$gen" "$2" gen_replace "$dir/gen.c"; then
+        echo "$1: generating failed"
+        failures=$((failures + 1))
+        return
+    fi
+
+    # shellcheck disable=SC2086
+    if ! $cc $CFLAGS -I"$src" -o "$dir/test_gen" "$src/test_gen.c" \
+            "$dir/gen.c" "$src/str_mr_dict.c" "$src/str_multireplace.c"; then
+        echo "$1: build failed"
+        failures=$((failures + 1))
+        return
+    fi
+
+    if ! "$dir/test_gen" "$2"; then
+        echo "$1: results differ"
+        failures=$((failures + 1))
+    fi
+}
+
+# quotes, backslashes, trigraphs, control and high bytes in keys and values
+{
+    printf 'a\\tb\tTAB\n'
+    printf '\\\\\tback\\\\slash\n'
+    printf '"\t&quot;\n'
+    printf '??=\t#\n'
+    printf '?\t\\0?\n'
+    printf '\\0x\tNUL\\n\n'
+    printf '\303\251\te\n'
+    printf '\303\tbroken\n'
+    printf 'ab\t1\n'
+    printf 'ab\t2\n'
+    printf 'abc\t\n'
+} > "$dir/special.tsv"
+check "special" "$dir/special.tsv"
+
+# random keys full of duplicates and prefixes of each other
+awk 'BEGIN {
+    srand(1);
+    for (i = 0; i < 64; i++) {
+        key = ""; len = 1 + int(rand() * 6);
+        for (j = 0; j < len; j++) key = key substr("ab", 1 + int(rand() * 2), 1);
+        val = ""; len = int(rand() * 4);
+        for (j = 0; j < len; j++) val = val substr("XYZ", 1 + int(rand() * 3), 1);
+        print key "\t" val;
+    }
+}' > "$dir/dup.tsv"
+check "duplicates" "$dir/dup.tsv"
+
+# thousands of trie nodes, split into many functions
+awk 'BEGIN {
+    srand(2);
+    for (i = 0; i < 2000; i++) {
+        key = ""; len = 1 + int(rand() * 12);
+        for (j = 0; j < len; j++) key = key substr("abcd", 1 + int(rand() * 4), 1);
+        print key "\t<" i ">";
+    }
+}' > "$dir/big.tsv"
+check "big" "$dir/big.tsv"
+
+if [ "$failures" -ne 0 ]; then
+    echo "$failures checks failed"
+    exit 1
+fi
+
+echo "all tests passed"
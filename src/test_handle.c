@@ -0,0 +1,205 @@
+/**
+ * @file      test_handle.c
+ * @brief     Tests of swappable compiled set handle.
+ * @author    MMaster <mmaster@bitbix.com>
+ * @version   0.1
+ * @date      2013
+ * @copyright Apache License v2
+ *
+ * Reader threads search sets acquired from the handle while other threads
+ * swap new sets in. Each set holds a key whose value is the number of the
+ * set, readers check it does not change while they hold the set and that
+ * sets are never seen out of order. Set freed too early shows up as
+ * changed value, or as use after free when built with sanitizer.
+ *
+ * Compile with:
+ *    $ gcc -pthread -o test_handle test_handle.c str_mr_handle.c \
+ *          str_multireplace.c
+ *    $ gcc -pthread -fsanitize=thread -o test_handle test_handle.c \
+ *          str_mr_handle.c str_multireplace.c
+ *
+ * Run with:
+ *    $ ./test_handle
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "str_multireplace.h"
+#include "test_util.h"
+#include "str_mr_handle.h"
+
+/**
+ * Number of reader threads
+ */
+#define READER_CNT      (4)
+
+/**
+ * Number of swaps done by each swapper thread
+ */
+#define SWAP_CNT        (200)
+
+/**
+ * Key of every set, searched text contains it
+ */
+#define KEY             "generation"
+
+/**
+ * @brief Shared state of test threads
+ */
+typedef struct {
+    str_mr_handle *handle;
+    _Atomic unsigned next_gen;  /* number of the next compiled set */
+    _Atomic bool stop;          /* swappers are done */
+    bool ordered;               /* only one swapper, numbers only grow */
+} handle_test;
+
+/**
+ * @brief Compile set whose only pair has value gen
+ */
+static str_mr_set *
+gen_set (unsigned gen)
+{
+    str_mr_match_pair pair = { KEY, sizeof(KEY) - 1, NULL, 0 };
+    str_mr_set *set = NULL;
+    char value[16];
+
+    pair.value        = value;
+    pair.value_length = sprintf(value, "%u", gen);
+    CHECK(str_mr_set_compile(&pair, 1, &set) == STR_MR_ERROR_SUCCESS);
+    return set;
+}
+
+/**
+ * @brief Number of the set (value of its pair)
+ */
+static unsigned
+set_gen (const str_mr_set *set)
+{
+    const str_mr_match_pair *pair = str_mr_set_pair(set, 0);
+    char value[16];
+
+    if ((pair == NULL) || (pair->value_length >= sizeof(value))) {
+        return (unsigned)-1;
+    }
+
+    memcpy(value, pair->value, pair->value_length);
+    value[pair->value_length] = '\0';
+    return (unsigned)strtoul(value, NULL, 10);
+}
+
+static void *
+reader_thread (void *arg)
+{
+    handle_test *ht = (handle_test *)arg;
+    static const char text[] = "text with " KEY " somewhere";
+    const str_mr_set *set = NULL;
+    uint32_t ticket = 0;
+    unsigned gen = 0, last_gen = 0, reads = 0;
+    bool     done = false;
+
+    while (!done) {
+        /* last round after swappers finished sees the final set */
+        done = atomic_load(&ht->stop);
+
+        set = str_mr_handle_acquire(ht->handle, &ticket);
+        gen = set_gen(set);
+        CHECK(gen < atomic_load(&ht->next_gen));
+        CHECK(!ht->ordered || (gen >= last_gen));
+        last_gen = gen;
+
+        /* set stays the same while held */
+        CHECK(str_mr_set_contains_any(set, text, sizeof(text) - 1) == 1);
+        CHECK(set_gen(set) == gen);
+        str_mr_handle_release(ht->handle, ticket);
+        reads++;
+    }
+
+    CHECK(reads > 0);
+    CHECK(!ht->ordered || (last_gen == atomic_load(&ht->next_gen) - 1));
+    return NULL;
+}
+
+static void *
+swapper_thread (void *arg)
+{
+    handle_test *ht = (handle_test *)arg;
+    str_mr_set *set = NULL;
+    unsigned i = 0;
+
+    for (i = 0; i < SWAP_CNT; i++) {
+        set = gen_set(atomic_fetch_add(&ht->next_gen, 1));
+        CHECK(str_mr_handle_swap(ht->handle, set) == STR_MR_ERROR_SUCCESS);
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Run readers against swapper_cnt concurrent swappers
+ */
+static void
+check_swaps (unsigned swapper_cnt)
+{
+    handle_test ht;
+    pthread_t   readers[READER_CNT], swappers[2];
+    unsigned    i = 0;
+
+    memset(&ht, 0, sizeof(ht));
+    atomic_init(&ht.next_gen, 1);
+    atomic_init(&ht.stop, false);
+    ht.ordered = (swapper_cnt == 1);
+    CHECK(str_mr_handle_init(gen_set(0), &ht.handle) ==
+          STR_MR_ERROR_SUCCESS);
+
+    for (i = 0; i < READER_CNT; i++) {
+        pthread_create(&readers[i], NULL, reader_thread, &ht);
+    }
+
+    for (i = 0; i < swapper_cnt; i++) {
+        pthread_create(&swappers[i], NULL, swapper_thread, &ht);
+    }
+
+    for (i = 0; i < swapper_cnt; i++) {
+        pthread_join(swappers[i], NULL);
+    }
+
+    atomic_store(&ht.stop, true);
+    for (i = 0; i < READER_CNT; i++) {
+        pthread_join(readers[i], NULL);
+    }
+
+    str_mr_handle_free(ht.handle);
+}
+
+static void
+test_handle_args (void)
+{
+    str_mr_handle *handle = NULL;
+    str_mr_set *set = gen_set(7);
+    uint32_t ticket = 0;
+
+    CHECK(str_mr_handle_init(NULL, &handle) == STR_MR_ERROR_INVALID_ARG);
+    CHECK(str_mr_handle_init(set, NULL) == STR_MR_ERROR_INVALID_ARG);
+    CHECK(str_mr_handle_init(set, &handle) == STR_MR_ERROR_SUCCESS);
+    CHECK(str_mr_handle_swap(handle, NULL) == STR_MR_ERROR_INVALID_ARG);
+
+    /* swapping in the current set keeps it */
+    CHECK(str_mr_handle_swap(handle, set) == STR_MR_ERROR_SUCCESS);
+    CHECK(set_gen(str_mr_handle_acquire(handle, &ticket)) == 7);
+    str_mr_handle_release(handle, ticket);
+
+    str_mr_handle_free(handle);
+    str_mr_handle_free(NULL);
+}
+
+int
+main ()
+{
+    test_handle_args();
+    check_swaps(1);
+    check_swaps(2);
+
+    return test_result();
+}
@@ -0,0 +1,1010 @@
+/**
+ * @file      test_set.c
+ * @brief     Tests of compiled set changes and images.
+ * @author    MMaster <mmaster@bitbix.com>
+ * @version   0.1
+ * @date      2013
+ * @copyright Apache License v2
+ *
+ * Adds and removes pairs of compiled sets and compares matches with sets
+ * compiled from the remaining pairs. Matches of sets large enough to get
+ * key prefix filter are compared with simple search, so are matches of
+ * copied and reset cursors. Serializes compiled sets, loads and maps the
+ * images and compares matches of the loaded set with the compiled one.
+ * Corrupted images have to be refused.
+ *
+ * Compile with:
+ *    $ gcc -o test_set test_set.c str_multireplace.c
+ *
+ * Build also with vector kernels used for any number of key lengths:
+ *    $ gcc -mavx2 -DSTR_MR_SIMD_MIN_LENS=1 -o test_set_avx2 \
+ *          test_set.c str_multireplace.c
+ *    $ gcc -mavx512f -mavx512dq -DSTR_MR_SIMD_MIN_LENS=1 \
+ *          -o test_set_avx512 test_set.c str_multireplace.c
+ *
+ * Run with:
+ *    $ ./test_set
+ */
+
+/* mkstemp() also with strict -std=c11 */
+#if !defined(_POSIX_C_SOURCE) && !defined(_GNU_SOURCE)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "str_multireplace.h"
+#include "test_util.h"
+#ifdef STR_MR_WITH_POSIX
+#include <unistd.h>
+#endif
+
+/**
+ * Longest key of random sets
+ */
+#define KEY_MAX         (16)
+
+/**
+ * Length of searched text
+ */
+#define TEXT_LEN        (20000)
+
+/**
+ * Offsets of image header fields (str_mr_image_hdr in str_multireplace.c)
+ */
+#define IMAGE_VERSION_OFF       (8)
+#define IMAGE_BYTE_ORDER_OFF    (12)
+#define IMAGE_WORD_SIZE_OFF     (16)
+#define IMAGE_PAIR_CNT_OFF      (32)
+#define IMAGE_BUCKET_CNT_OFF    (40)
+#define IMAGE_MAX_KEY_LEN_OFF   (48)
+#define IMAGE_FLAGS_OFF         (56)
+
+static const struct {
+    size_t off;
+    bool aligned;
+} image_sections[] = {
+    { 64,  true  },     /* pairs */
+    { 72,  true  },     /* key hashes */
+    { 80,  true  },     /* chain links */
+    { 88,  true  },     /* buckets */
+    { 96,  false },     /* filter */
+    { 104, false },     /* data */
+};
+
+/**
+ * @brief Random pairs with keys stored in one buffer
+ */
+typedef struct {
+    str_mr_match_pair *pairs;
+    size_t cnt;
+    char *data;
+} rnd_set;
+
+/**
+ * @brief Generate cnt pairs of mixed key lengths (without values when
+ *        with_values is false)
+ */
+static void
+rnd_set_init (rnd_set *rs, size_t cnt, bool with_values)
+{
+    size_t i = 0;
+
+    rs->cnt   = cnt;
+    rs->pairs = (str_mr_match_pair *)malloc(cnt * sizeof(str_mr_match_pair));
+    rs->data  = (char *)malloc(cnt * 2 * KEY_MAX);
+
+    for (i = 0; i < cnt; i++) {
+        char *key = rs->data + i * 2 * KEY_MAX;
+
+        rs->pairs[i].key          = key;
+        rs->pairs[i].key_length   = 1 + rnd() % KEY_MAX;
+        rs->pairs[i].value        = NULL;
+        rs->pairs[i].value_length = 0;
+        rnd_fill(key, rs->pairs[i].key_length, "abcd");
+        if (with_values) {
+            rs->pairs[i].value        = key + KEY_MAX;
+            rs->pairs[i].value_length = rnd() % KEY_MAX;
+            rnd_fill(key + KEY_MAX, rs->pairs[i].value_length, "XYZ");
+        }
+    }
+}
+
+static void
+rnd_set_fini (rnd_set *rs)
+{
+    free(rs->pairs);
+    free(rs->data);
+}
+
+/**
+ * @brief Check both sets find the same pairs at the same positions
+ *
+ * Pairs are compared by content, loaded set renumbers pairs of modified
+ * set.
+ */
+static void
+check_same_matches (const str_mr_set *expected, const str_mr_set *set,
+                    const char *str, size_t str_len)
+{
+    str_mr_cursor *ec = NULL, *c = NULL;
+    str_mr_match em, m;
+    const str_mr_match_pair *ep = NULL, *p = NULL;
+    int32_t erc = 0, rc = 0;
+
+    CHECK(str_mr_cursor_init(expected, str, str_len, &ec) ==
+          STR_MR_ERROR_SUCCESS);
+    CHECK(str_mr_cursor_init(set, str, str_len, &c) == STR_MR_ERROR_SUCCESS);
+    if ((ec == NULL) || (c == NULL)) {
+        str_mr_cursor_free(ec);
+        str_mr_cursor_free(c);
+        return;
+    }
+
+    do {
+        erc = str_mr_cursor_next(ec, &em);
+        rc  = str_mr_cursor_next(c, &m);
+        CHECK(rc == erc);
+        if ((rc != 1) || (erc != 1)) {
+            break;
+        }
+
+        ep = str_mr_set_pair(expected, em.pair_idx);
+        p  = str_mr_set_pair(set, m.pair_idx);
+        CHECK((m.pos == em.pos) && (ep != NULL) && (p != NULL));
+        if ((m.pos != em.pos) || (ep == NULL) || (p == NULL)) {
+            break;
+        }
+
+        CHECK((p->key_length == ep->key_length) &&
+              (memcmp(p->key, ep->key, ep->key_length) == 0));
+        CHECK((p->value == NULL) == (ep->value == NULL));
+        CHECK((p->value == NULL) ||
+              ((p->value_length == ep->value_length) &&
+               (memcmp(p->value, ep->value, ep->value_length) == 0)));
+    } while (true);
+
+    str_mr_cursor_free(ec);
+    str_mr_cursor_free(c);
+}
+
+/**
+ * @brief Check value of the pair matched first in str
+ */
+static void
+check_first_value (const str_mr_set *set, const char *str,
+                   const char *expected)
+{
+    str_mr_cursor *cursor = NULL;
+    str_mr_match m;
+    const str_mr_match_pair *pair = NULL;
+
+    CHECK(str_mr_cursor_init(set, str, strlen(str), &cursor) ==
+          STR_MR_ERROR_SUCCESS);
+    CHECK(str_mr_cursor_next(cursor, &m) == 1);
+    pair = str_mr_set_pair(set, m.pair_idx);
+    CHECK((pair != NULL) && (pair->value_length == strlen(expected)) &&
+          (memcmp(pair->value, expected, pair->value_length) == 0));
+    str_mr_cursor_free(cursor);
+}
+
+static void
+test_duplicates (void)
+{
+    str_mr_match_pair mps[] = {
+        {"ab", 2, "1", 1}, {"ab", 2, "2", 1}, {"abc", 3, "3", 1},
+    };
+    str_mr_match_pair readd[] = {
+        {"ab", 2, "4", 1}, {"ab", 2, "5", 1}, {"abc", 3, "6", 1},
+    };
+    str_mr_set *set = NULL;
+
+    CHECK(str_mr_set_compile(mps, 3, &set) == STR_MR_ERROR_SUCCESS);
+    check_first_value(set, "xab", "1");
+    check_first_value(set, "xabc", "3");
+
+    /* all pairs with the key are removed, shorter key matches again */
+    CHECK(str_mr_set_remove(set, "ab", 2) == 2);
+    CHECK(str_mr_set_remove(set, "ab", 2) == 0);
+    CHECK(str_mr_set_remove(set, "abc", 3) == 1);
+    CHECK(str_mr_set_contains_any(set, "xabc", 4) == 0);
+
+    /* the first added of re-added duplicates wins */
+    CHECK(str_mr_set_add(set, &readd[0]) == STR_MR_ERROR_SUCCESS);
+    CHECK(str_mr_set_add(set, &readd[1]) == STR_MR_ERROR_SUCCESS);
+    check_first_value(set, "xab", "4");
+    check_first_value(set, "xabc", "4");
+    CHECK(str_mr_set_add(set, &readd[2]) == STR_MR_ERROR_SUCCESS);
+    check_first_value(set, "xabc", "6");
+
+    /* duplicate added to existing key loses */
+    CHECK(str_mr_set_add(set, &mps[0]) == STR_MR_ERROR_SUCCESS);
+    check_first_value(set, "xab", "4");
+    CHECK(str_mr_set_remove(set, "ab", 2) == 3);
+    CHECK(str_mr_set_add(set, &mps[1]) == STR_MR_ERROR_SUCCESS);
+    check_first_value(set, "xab", "2");
+
+    str_mr_set_free(set);
+}
+
+/**
+ * @brief Check matches and pair indexes of set are the same as of set
+ *        compiled from remaining pairs
+ */
+static void
+check_compacted (const str_mr_set *set, const str_mr_match_pair *pairs,
+                 size_t cnt, const char *str, size_t str_len)
+{
+    str_mr_set *expected = NULL;
+    str_mr_cursor *ec = NULL, *c = NULL;
+    str_mr_match em, m;
+    int32_t rc = 0;
+
+    CHECK(str_mr_set_compile(pairs, cnt, &expected) == STR_MR_ERROR_SUCCESS);
+    CHECK(str_mr_cursor_init(expected, str, str_len, &ec) ==
+          STR_MR_ERROR_SUCCESS);
+    CHECK(str_mr_cursor_init(set, str, str_len, &c) == STR_MR_ERROR_SUCCESS);
+
+    while ((rc = str_mr_cursor_next(ec, &em)) == 1) {
+        CHECK(str_mr_cursor_next(c, &m) == 1);
+        CHECK((m.pos == em.pos) && (m.pair_idx == em.pair_idx));
+    }
+
+    CHECK(rc == 0);
+    CHECK(str_mr_cursor_next(c, &m) == 0);
+
+    str_mr_cursor_free(ec);
+    str_mr_cursor_free(c);
+    str_mr_set_free(expected);
+}
+
+/**
+ * @brief Remove first keys of cnt distinct keys one by one, pairs have to
+ *        be renumbered exactly when at least 64 pairs and more than half
+ *        of them are removed
+ */
+static void
+check_compaction (size_t cnt, const char *text, size_t text_len)
+{
+    str_mr_match_pair *pairs = NULL;
+    str_mr_set *set = NULL;
+    char   *keys = NULL;
+    size_t  i = 0, removed = 0;
+    bool    compacted = false;
+
+    pairs = (str_mr_match_pair *)calloc(cnt, sizeof(str_mr_match_pair));
+    keys  = (char *)malloc(cnt * 8);
+    for (i = 0; i < cnt; i++) {
+        pairs[i].key          = keys + i * 8;
+        pairs[i].key_length   = sprintf(keys + i * 8, "k%zu", i);
+        pairs[i].value        = "v";
+        pairs[i].value_length = 1;
+    }
+
+    CHECK(str_mr_set_compile(pairs, cnt, &set) == STR_MR_ERROR_SUCCESS);
+
+    while (!compacted && (removed < cnt)) {
+        removed++;
+        CHECK(str_mr_set_remove(set, pairs[removed - 1].key,
+                                pairs[removed - 1].key_length) == 1);
+        compacted = (removed >= 64) && (removed * 2 > cnt);
+
+        if (compacted) {
+            /* the rest is renumbered from 0 in the original order */
+            CHECK(str_mr_set_pair(set, cnt - removed) == NULL);
+            CHECK(str_mr_set_pair(set, 0) != NULL);
+            CHECK(str_mr_set_pair(set, 0)->key_length ==
+                  pairs[removed].key_length);
+            CHECK(memcmp(str_mr_set_pair(set, 0)->key, pairs[removed].key,
+                         pairs[removed].key_length) == 0);
+            check_compacted(set, pairs + removed, cnt - removed, text,
+                            text_len);
+        } else {
+            /* removed pairs keep their indexes */
+            CHECK(str_mr_set_pair(set, removed - 1) == NULL);
+            CHECK(str_mr_set_pair(set, cnt - 1) != NULL);
+            CHECK(str_mr_set_pair(set, cnt - 1)->key_length ==
+                  pairs[cnt - 1].key_length);
+        }
+    }
+
+    CHECK(compacted);
+
+    /* added pairs go after the compacted ones */
+    CHECK(str_mr_set_add(set, &pairs[0]) == STR_MR_ERROR_SUCCESS);
+    CHECK(str_mr_set_pair(set, cnt - removed) != NULL);
+    CHECK(memcmp(str_mr_set_pair(set, cnt - removed)->key, "k0", 2) == 0);
+
+    str_mr_set_free(set);
+    free(keys);
+    free(pairs);
+}
+
+static void
+test_compaction (void)
+{
+    char  *text = (char *)malloc(TEXT_LEN);
+    size_t i = 0;
+
+    /* keys of all pairs and of some more, each padded to 5 characters */
+    memset(text, ' ', TEXT_LEN);
+    for (i = 0; i + 5 <= TEXT_LEN; i += 5) {
+        sprintf(text + i, "k%-3u", rnd() % 400);
+        text[i + 4] = ' ';
+    }
+
+    /* more than half removed before 64 */
+    check_compaction(100, text, TEXT_LEN);
+    /* 64 removed before more than half */
+    check_compaction(300, text, TEXT_LEN);
+    free(text);
+}
+
+/**
+ * Number of keys of sets searched with key prefix filter (it is built from
+ * 1024 keys)
+ */
+#define FILTER_KEY_CNT  (1500)
+
+/**
+ * Number of pairs and length of text of cursor test
+ */
+#define CURSOR_KEY_CNT  (48)
+#define CURSOR_TEXT_LEN (4000)
+
+/**
+ * @brief Find first match at or after pos the simple way: leftmost, longest
+ *        key, first of equal keys, pairs not live are skipped
+ *
+ * @return index of matched pair, cnt when there is none
+ */
+static size_t
+naive_next (const str_mr_match_pair *pairs, const bool *live, size_t cnt,
+            const char *str, size_t str_len, size_t *pos)
+{
+    size_t best = cnt, i = 0;
+
+    for (; *pos < str_len; (*pos)++) {
+        for (i = 0; i < cnt; i++) {
+            if (live[i] && (pairs[i].key_length <= str_len - *pos) &&
+                (memcmp(str + *pos, pairs[i].key, pairs[i].key_length) == 0)
+                && ((best == cnt) ||
+                    (pairs[i].key_length > pairs[best].key_length))) {
+                best = i;
+            }
+        }
+
+        if (best < cnt) {
+            return best;
+        }
+    }
+
+    return cnt;
+}
+
+/**
+ * @brief Compare matches of set with the simple search over live pairs
+ */
+static void
+check_naive_matches (const str_mr_set *set, const str_mr_match_pair *pairs,
+                     const bool *live, size_t cnt, const char *str,
+                     size_t str_len)
+{
+    const str_mr_match_pair *p = NULL;
+    str_mr_cursor *c = NULL;
+    str_mr_match m;
+    size_t  pos = 0, best = 0;
+    int32_t rc = 0;
+
+    best = naive_next(pairs, live, cnt, str, str_len, &pos);
+    CHECK(str_mr_set_contains_any(set, str, str_len) == (best < cnt));
+
+    CHECK(str_mr_cursor_init(set, str, str_len, &c) == STR_MR_ERROR_SUCCESS);
+    if (c == NULL) {
+        return;
+    }
+
+    do {
+        rc = str_mr_cursor_next(c, &m);
+        CHECK(rc == (best < cnt ? 1 : 0));
+        if ((rc != 1) || (best == cnt)) {
+            break;
+        }
+
+        p = str_mr_set_pair(set, m.pair_idx);
+        CHECK((m.pos == pos) && (p != NULL));
+        if ((m.pos != pos) || (p == NULL)) {
+            break;
+        }
+
+        CHECK((p->key_length == pairs[best].key_length) &&
+              (memcmp(p->key, pairs[best].key, p->key_length) == 0));
+        CHECK((p->value_length == pairs[best].value_length) &&
+              (memcmp(p->value, pairs[best].value, p->value_length) == 0));
+
+        pos += pairs[best].key_length;
+        best = naive_next(pairs, live, cnt, str, str_len, &pos);
+    } while (true);
+
+    str_mr_cursor_free(c);
+}
+
+/**
+ * @brief Remove key of pair from set, also from its duplicates in live
+ */
+static void
+filter_remove (str_mr_set *set, const str_mr_match_pair *pairs, bool *live,
+               size_t cnt, size_t idx)
+{
+    size_t i = 0, dup_cnt = 0;
+
+    for (i = 0; i < cnt; i++) {
+        if (live[i] && (pairs[i].key_length == pairs[idx].key_length) &&
+            (memcmp(pairs[i].key, pairs[idx].key,
+                    pairs[idx].key_length) == 0)) {
+            live[i] = false;
+            dup_cnt++;
+        }
+    }
+
+    CHECK(str_mr_set_remove(set, pairs[idx].key, pairs[idx].key_length) ==
+          (int64_t)dup_cnt);
+}
+
+/**
+ * @brief Sets large enough to be filtered find the same matches as
+ *        the simple search without filter, also after keys are removed
+ *        (stale filter bits) and added (filter updated or rebuilt)
+ */
+static void
+test_filter (void)
+{
+    static const char alphabet[] = "abcdefghij";
+    size_t total = FILTER_KEY_CNT + 200;     /* 3 short keys added later */
+    str_mr_match_pair *pairs = NULL;
+    str_mr_set *set = NULL;
+    char   *data = NULL, *text = NULL;
+    bool   *live = NULL;
+    size_t  i = 0, pos = 0, min_len = 0;
+
+    pairs = (str_mr_match_pair *)calloc(total + 3,
+                                        sizeof(str_mr_match_pair));
+    live  = (bool *)calloc(total + 3, sizeof(bool));
+    data  = (char *)malloc(total * 2 * KEY_MAX);
+    text  = (char *)malloc(TEXT_LEN);
+
+    /* prefixes of 4 characters hashed, keys of 4 to 16 */
+    for (i = 0; i < total; i++) {
+        char *key = data + i * 2 * KEY_MAX;
+
+        pairs[i].key          = key;
+        pairs[i].key_length   = 4 + rnd() % (KEY_MAX - 3);
+        pairs[i].value        = key + KEY_MAX;
+        pairs[i].value_length = rnd() % KEY_MAX;
+        rnd_fill(key, pairs[i].key_length, alphabet);
+        rnd_fill(key + KEY_MAX, pairs[i].value_length, "XYZ");
+    }
+
+    /* random text with keys and their parts spread in it */
+    rnd_fill(text, TEXT_LEN, alphabet);
+    for (pos = 0; pos + KEY_MAX < TEXT_LEN; pos += 1 + rnd() % 40) {
+        i = rnd() % total;
+        memcpy(text + pos, pairs[i].key, 1 + rnd() % pairs[i].key_length);
+    }
+
+    CHECK(str_mr_set_compile(pairs, FILTER_KEY_CNT, &set) ==
+          STR_MR_ERROR_SUCCESS);
+    if (set == NULL) {
+        goto out;
+    }
+
+    for (i = 0; i < FILTER_KEY_CNT; i++) {
+        live[i] = true;
+    }
+
+    check_naive_matches(set, pairs, live, total, text, TEXT_LEN);
+
+    /* removed keys leave their filter bits set */
+    for (i = 0; i < 300; i++) {
+        filter_remove(set, pairs, live, total, rnd() % FILTER_KEY_CNT);
+    }
+
+    check_naive_matches(set, pairs, live, total, text, TEXT_LEN);
+
+    /* added keys set filter bits, or rebuild filter when it gets full */
+    for (i = FILTER_KEY_CNT; i < total; i++) {
+        CHECK(str_mr_set_add(set, &pairs[i]) == STR_MR_ERROR_SUCCESS);
+        live[i] = true;
+    }
+
+    check_naive_matches(set, pairs, live, total, text, TEXT_LEN);
+
+    /* keys shorter than hashed prefix rebuild filter with shorter one */
+    for (min_len = 3; min_len >= 1; min_len--) {
+        i = total++;
+        pairs[i] = pairs[rnd() % i];
+        pairs[i].key_length = min_len;
+        filter_remove(set, pairs, live, total, i);
+        CHECK(str_mr_set_add(set, &pairs[i]) == STR_MR_ERROR_SUCCESS);
+        live[i] = true;
+        check_naive_matches(set, pairs, live, total, text, TEXT_LEN);
+    }
+
+    str_mr_set_free(set);
+
+out:
+    free(text);
+    free(data);
+    free(live);
+    free(pairs);
+}
+
+/**
+ * @brief Cursor from its position gives the rest of expected matches
+ *
+ * @return number of matches compared
+ */
+static size_t
+check_cursor_rest (str_mr_cursor *c, const str_mr_match *expected,
+                   size_t expected_cnt, size_t from)
+{
+    str_mr_match m;
+    size_t i = from;
+
+    while ((i < expected_cnt) && (str_mr_cursor_next(c, &m) == 1)) {
+        CHECK((m.pos == expected[i].pos) &&
+              (m.pair_idx == expected[i].pair_idx));
+        i++;
+    }
+
+    CHECK(i == expected_cnt);
+    CHECK(str_mr_cursor_next(c, &m) == 0);
+    CHECK(str_mr_cursor_next(c, &m) == 0);
+
+    return i - from;
+}
+
+/**
+ * @brief Matches of the simple search, all pairs live
+ *
+ * @return number of matches
+ */
+static size_t
+naive_matches (const rnd_set *rs, const bool *live, const char *str,
+               size_t str_len, str_mr_match *matches)
+{
+    size_t pos = 0, best = 0, cnt = 0;
+
+    while ((best = naive_next(rs->pairs, live, rs->cnt, str, str_len,
+                              &pos)) < rs->cnt) {
+        matches[cnt].pos      = pos;
+        matches[cnt].pair_idx = best;
+        cnt++;
+        pos += rs->pairs[best].key_length;
+    }
+
+    return cnt;
+}
+
+/**
+ * @brief Copied cursor continues from the same position independently of
+ *        the original, reset cursor starts over on another buffer
+ */
+static void
+test_cursor (void)
+{
+    static str_mr_match expected[CURSOR_TEXT_LEN], expected2[CURSOR_TEXT_LEN];
+    static char text[CURSOR_TEXT_LEN], text2[CURSOR_TEXT_LEN];
+    static bool live[CURSOR_KEY_CNT];
+    rnd_set rs;
+    str_mr_set *set = NULL;
+    str_mr_cursor *c = NULL, *d = NULL;
+    str_mr_match m, md;
+    size_t cnt = 0, cnt2 = 0, i = 0, k = 0, pos = 0;
+    int    round = 0;
+
+    for (round = 0; round < 20; round++) {
+        /* all key lengths, so vector kernels are used when built in */
+        rnd_set_init(&rs, CURSOR_KEY_CNT, true);
+        for (i = 0; i < CURSOR_KEY_CNT; i++) {
+            live[i] = true;
+        }
+
+        rnd_fill(text, CURSOR_TEXT_LEN, "abcd");
+        rnd_fill(text2, CURSOR_TEXT_LEN, "abcd");
+        for (pos = 0; pos + KEY_MAX < CURSOR_TEXT_LEN; pos += rnd() % 24) {
+            i = rnd() % CURSOR_KEY_CNT;
+            memcpy(text + pos, rs.pairs[i].key, rs.pairs[i].key_length);
+            i = rnd() % CURSOR_KEY_CNT;
+            memcpy(text2 + pos, rs.pairs[i].key, rs.pairs[i].key_length);
+        }
+
+        cnt  = naive_matches(&rs, live, text, CURSOR_TEXT_LEN, expected);
+        cnt2 = naive_matches(&rs, live, text2, CURSOR_TEXT_LEN, expected2);
+
+        CHECK(str_mr_set_compile(rs.pairs, rs.cnt, &set) ==
+              STR_MR_ERROR_SUCCESS);
+        CHECK(str_mr_cursor_init(set, text, CURSOR_TEXT_LEN, &c) ==
+              STR_MR_ERROR_SUCCESS);
+        if (c == NULL) {
+            str_mr_set_free(set);
+            rnd_set_fini(&rs);
+            continue;
+        }
+
+        /* copy in the middle, both continue in lock step */
+        k = rnd() % (cnt + 1);
+        for (i = 0; (i < k) && (str_mr_cursor_next(c, &m) == 1); i++) {
+            CHECK((m.pos == expected[i].pos) &&
+                  (m.pair_idx == expected[i].pair_idx));
+        }
+
+        CHECK(str_mr_cursor_copy(c, &d) == STR_MR_ERROR_SUCCESS);
+        for (i = k; i < cnt; i++) {
+            CHECK(str_mr_cursor_next(c, &m) == 1);
+            CHECK(str_mr_cursor_next(d, &md) == 1);
+            CHECK((m.pos == expected[i].pos) && (md.pos == m.pos) &&
+                  (m.pair_idx == expected[i].pair_idx) &&
+                  (md.pair_idx == m.pair_idx));
+        }
+
+        CHECK(str_mr_cursor_next(c, &m) == 0);
+        CHECK(str_mr_cursor_next(d, &md) == 0);
+        str_mr_cursor_free(d);
+        d = NULL;
+
+        /* copy taken before the original is walked to the end */
+        CHECK(str_mr_cursor_reset(c, text, CURSOR_TEXT_LEN) ==
+              STR_MR_ERROR_SUCCESS);
+        for (i = 0; (i < k) && (str_mr_cursor_next(c, &m) == 1); i++) {
+        }
+
+        CHECK(str_mr_cursor_copy(c, &d) == STR_MR_ERROR_SUCCESS);
+        check_cursor_rest(c, expected, cnt, k);
+        check_cursor_rest(d, expected, cnt, k);
+
+        /* finished cursor copies finished */
+        str_mr_cursor_free(d);
+        d = NULL;
+        CHECK(str_mr_cursor_copy(c, &d) == STR_MR_ERROR_SUCCESS);
+        CHECK(str_mr_cursor_next(d, &md) == 0);
+        str_mr_cursor_free(d);
+        d = NULL;
+
+        /* reset in the middle of walk to another buffer and back */
+        CHECK(str_mr_cursor_reset(c, text, CURSOR_TEXT_LEN) ==
+              STR_MR_ERROR_SUCCESS);
+        for (i = 0; (i < k) && (str_mr_cursor_next(c, &m) == 1); i++) {
+        }
+
+        CHECK(str_mr_cursor_reset(c, text2, CURSOR_TEXT_LEN) ==
+              STR_MR_ERROR_SUCCESS);
+        check_cursor_rest(c, expected2, cnt2, 0);
+        CHECK(str_mr_cursor_reset(c, text, CURSOR_TEXT_LEN) ==
+              STR_MR_ERROR_SUCCESS);
+        check_cursor_rest(c, expected, cnt, 0);
+
+        /* buffers where nothing fits */
+        CHECK(str_mr_cursor_reset(c, NULL, 0) == STR_MR_ERROR_SUCCESS);
+        CHECK(str_mr_cursor_next(c, &m) == 0);
+        CHECK(str_mr_cursor_reset(c, NULL, 5) == STR_MR_ERROR_INVALID_ARG);
+
+        str_mr_cursor_free(c);
+        c = NULL;
+        str_mr_set_free(set);
+        set = NULL;
+        rnd_set_fini(&rs);
+    }
+}
+
+/**
+ * @brief Serialize set, load it and compare with the original, image of
+ *        loaded set has to be the same
+ */
+static void
+check_roundtrip (const str_mr_set *set, const char *str, size_t str_len)
+{
+    str_mr_set *loaded = NULL;
+    void  *image = NULL, *image2 = NULL;
+    size_t image_len = 0, image2_len = 0;
+
+    CHECK(str_mr_set_serialize(set, &image, &image_len) ==
+          STR_MR_ERROR_SUCCESS);
+    CHECK(str_mr_set_load(image, image_len, &loaded) ==
+          STR_MR_ERROR_SUCCESS);
+    if (loaded == NULL) {
+        free(image);
+        return;
+    }
+
+    check_same_matches(set, loaded, str, str_len);
+
+    CHECK(str_mr_set_serialize(loaded, &image2, &image2_len) ==
+          STR_MR_ERROR_SUCCESS);
+    CHECK((image2_len == image_len) &&
+          (memcmp(image2, image, image_len) == 0));
+
+    str_mr_set_free(loaded);
+    free(image2);
+    free(image);
+}
+
+static void
+test_image_roundtrip (void)
+{
+    /* small sets, set of one key, sets large enough for key prefix filter */
+    size_t   sizes[] = { 1, 3, 40, 1500, 5000 };
+    char    *text = (char *)malloc(TEXT_LEN);
+    rnd_set  rs;
+    str_mr_set *set = NULL;
+    size_t   i = 0, k = 0;
+
+    rnd_fill(text, TEXT_LEN, "abcde");
+
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        rnd_set_init(&rs, sizes[i], (i % 2) == 0);
+        CHECK(str_mr_set_compile(rs.pairs, rs.cnt, &set) ==
+              STR_MR_ERROR_SUCCESS);
+        check_roundtrip(set, text, TEXT_LEN);
+
+        /* removed pairs are left out of image */
+        for (k = 0; k < rs.cnt; k += 3) {
+            CHECK(str_mr_set_remove(set, rs.pairs[k].key,
+                                    rs.pairs[k].key_length) >= 0);
+        }
+
+        check_roundtrip(set, text, TEXT_LEN);
+        str_mr_set_free(set);
+        rnd_set_fini(&rs);
+    }
+
+    /* set with all keys removed */
+    rnd_set_init(&rs, 1, true);
+    CHECK(str_mr_set_compile(rs.pairs, rs.cnt, &set) == STR_MR_ERROR_SUCCESS);
+    CHECK(str_mr_set_remove(set, rs.pairs[0].key, rs.pairs[0].key_length) ==
+          1);
+    check_roundtrip(set, text, TEXT_LEN);
+    str_mr_set_free(set);
+    rnd_set_fini(&rs);
+
+    free(text);
+}
+
+/**
+ * @brief Modify one field of image header
+ */
+static void
+image_set_u32 (char *image, size_t off, uint32_t value)
+{
+    memcpy(image + off, &value, sizeof(value));
+}
+
+static void
+image_set_u64 (char *image, size_t off, uint64_t value)
+{
+    memcpy(image + off, &value, sizeof(value));
+}
+
+/**
+ * @brief Load corrupted copy of image, it has to be refused with status
+ */
+static void
+check_refused (const char *image, size_t image_len, int32_t status)
+{
+    str_mr_set *set = NULL;
+
+    CHECK(str_mr_set_load(image, image_len, &set) == status);
+    CHECK(set == NULL);
+    str_mr_set_free(set);
+}
+
+static void
+test_image_corrupt (void)
+{
+    rnd_set  rs;
+    str_mr_set *set = NULL, *loaded = NULL;
+    char    *text = (char *)malloc(TEXT_LEN);
+    void    *image = NULL;
+    char    *copy = NULL;
+    uint64_t *aligned = NULL;
+    size_t   image_len = 0, i = 0, len = 0, k = 0;
+    int32_t  rc = 0;
+    int      loaded_cnt = 0;
+
+    rnd_fill(text, TEXT_LEN, "abcde");
+
+    /* large enough to have filter, so all sections are present */
+    rnd_set_init(&rs, 2000, true);
+    CHECK(str_mr_set_compile(rs.pairs, rs.cnt, &set) == STR_MR_ERROR_SUCCESS);
+    CHECK(str_mr_set_serialize(set, &image, &image_len) ==
+          STR_MR_ERROR_SUCCESS);
+
+    /* malloc() memory is 8 bytes aligned, one more byte misaligns it */
+    aligned = (uint64_t *)malloc(image_len + 8);
+    copy    = (char *)aligned;
+
+#define RESET_COPY() memcpy(copy, image, image_len)
+
+    RESET_COPY();
+    CHECK(str_mr_set_load(copy, image_len, &loaded) == STR_MR_ERROR_SUCCESS);
+    str_mr_set_free(loaded);
+    loaded = NULL;
+
+    check_refused(NULL, image_len, STR_MR_ERROR_INVALID_ARG);
+    memcpy(copy + 1, image, image_len);
+    check_refused(copy + 1, image_len, STR_MR_ERROR_INVALID_ARG);
+
+    /* bad magic, version, byte order and word size */
+    RESET_COPY();
+    copy[0] ^= 1;
+    check_refused(copy, image_len, STR_MR_ERROR_FORMAT);
+
+    RESET_COPY();
+    image_set_u32(copy, IMAGE_VERSION_OFF, 2);
+    check_refused(copy, image_len, STR_MR_ERROR_FORMAT);
+
+    RESET_COPY();
+    image_set_u32(copy, IMAGE_BYTE_ORDER_OFF, 0x04030201);
+    check_refused(copy, image_len, STR_MR_ERROR_FORMAT);
+
+    RESET_COPY();
+    image_set_u32(copy, IMAGE_WORD_SIZE_OFF, sizeof(size_t) == 8 ? 4 : 8);
+    check_refused(copy, image_len, STR_MR_ERROR_FORMAT);
+
+    /* counts not matching the image */
+    RESET_COPY();
+    image_set_u64(copy, IMAGE_PAIR_CNT_OFF, UINT64_MAX / 2);
+    check_refused(copy, image_len, STR_MR_ERROR_FORMAT);
+
+    RESET_COPY();
+    image_set_u64(copy, IMAGE_PAIR_CNT_OFF, rs.cnt - 1);
+    check_refused(copy, image_len, STR_MR_ERROR_FORMAT);
+
+    RESET_COPY();
+    image_set_u64(copy, IMAGE_BUCKET_CNT_OFF, UINT64_MAX);
+    check_refused(copy, image_len, STR_MR_ERROR_FORMAT);
+
+    RESET_COPY();
+    image_set_u64(copy, IMAGE_MAX_KEY_LEN_OFF, KEY_MAX + 1);
+    check_refused(copy, image_len, STR_MR_ERROR_FORMAT);
+
+    RESET_COPY();
+    image_set_u64(copy, IMAGE_FLAGS_OFF, 0);
+    check_refused(copy, image_len, STR_MR_ERROR_FORMAT);
+
+    /* sections out of bounds (also by overflow) or misaligned */
+    for (i = 0; i < sizeof(image_sections) / sizeof(image_sections[0]);
+         i++) {
+        RESET_COPY();
+        image_set_u64(copy, image_sections[i].off, image_len);
+        check_refused(copy, image_len, STR_MR_ERROR_FORMAT);
+
+        RESET_COPY();
+        image_set_u64(copy, image_sections[i].off, UINT64_MAX - 7);
+        check_refused(copy, image_len, STR_MR_ERROR_FORMAT);
+
+        if (image_sections[i].aligned) {
+            RESET_COPY();
+            image_set_u64(copy, image_sections[i].off, 4);
+            check_refused(copy, image_len, STR_MR_ERROR_FORMAT);
+        }
+    }
+
+    /* truncated image */
+    for (len = 0; len < image_len; len += 1 + len / 2) {
+        RESET_COPY();
+        check_refused(copy, len, STR_MR_ERROR_FORMAT);
+    }
+
+    /*
+     * Random damage anywhere: image is refused or loaded set can be
+     * searched and modified.
+     */
+    for (i = 0; i < 3000; i++) {
+        RESET_COPY();
+        for (k = 1 + rnd() % 3; k > 0; k--) {
+            len = (i % 2 == 0 ? rnd() % 128 :
+                   ((size_t)rnd() << 15 | rnd()) % image_len);
+            copy[len] ^= (char)(1 << (rnd() % 8));
+        }
+
+        rc = str_mr_set_load(copy, image_len, &loaded);
+        CHECK((rc == STR_MR_ERROR_SUCCESS) || (rc == STR_MR_ERROR_FORMAT));
+        if (rc == STR_MR_ERROR_SUCCESS) {
+            loaded_cnt++;
+            CHECK(str_mr_set_contains_any(loaded, text, TEXT_LEN) >= 0);
+            CHECK(str_mr_set_remove(loaded, rs.pairs[0].key,
+                                    rs.pairs[0].key_length) >= 0);
+            CHECK(str_mr_set_add(loaded, &rs.pairs[1]) ==
+                  STR_MR_ERROR_SUCCESS);
+            CHECK(str_mr_set_contains_any(loaded, text, TEXT_LEN) >= 0);
+            str_mr_set_free(loaded);
+            loaded = NULL;
+        }
+    }
+
+#undef RESET_COPY
+
+    /* damage of keys, values and key hashes cannot be detected */
+    CHECK(loaded_cnt > 0);
+
+    free(aligned);
+    free(image);
+    free(text);
+    str_mr_set_free(set);
+    rnd_set_fini(&rs);
+}
+
+#ifdef STR_MR_WITH_POSIX
+static void
+test_image_map (void)
+{
+    rnd_set  rs;
+    str_mr_set *set = NULL, *mapped = NULL;
+    char     path[] = "/tmp/test_set_XXXXXX";
+    char    *text = (char *)malloc(TEXT_LEN);
+    FILE    *f = NULL;
+    int      fd = 0;
+
+    rnd_fill(text, TEXT_LEN, "abcde");
+    rnd_set_init(&rs, 1500, true);
+    CHECK(str_mr_set_compile(rs.pairs, rs.cnt, &set) == STR_MR_ERROR_SUCCESS);
+
+    fd = mkstemp(path);
+    CHECK(fd >= 0);
+    close(fd);
+
+    CHECK(str_mr_set_save(set, path) == STR_MR_ERROR_SUCCESS);
+    CHECK(str_mr_set_map(path, &mapped) == STR_MR_ERROR_SUCCESS);
+    if (mapped != NULL) {
+        check_same_matches(set, mapped, text, TEXT_LEN);
+
+        /* mapped image is read-only, modification copies it */
+        CHECK(str_mr_set_remove(mapped, rs.pairs[0].key,
+                                rs.pairs[0].key_length) >= 1);
+        CHECK(str_mr_set_remove(set, rs.pairs[0].key,
+                                rs.pairs[0].key_length) >= 1);
+        CHECK(str_mr_set_add(mapped, &rs.pairs[0]) == STR_MR_ERROR_SUCCESS);
+        CHECK(str_mr_set_add(set, &rs.pairs[0]) == STR_MR_ERROR_SUCCESS);
+        check_same_matches(set, mapped, text, TEXT_LEN);
+        str_mr_set_free(mapped);
+        mapped = NULL;
+    }
+
+    /* file that is not an image */
+    f = fopen(path, "wb");
+    CHECK(f != NULL);
+    if (f != NULL) {
+        fwrite(text, 1, 4096, f);
+        fclose(f);
+    }
+
+    CHECK(str_mr_set_map(path, &mapped) == STR_MR_ERROR_FORMAT);
+    CHECK(mapped == NULL);
+
+    unlink(path);
+    CHECK(str_mr_set_map(path, &mapped) == STR_MR_ERROR_IO);
+
+    str_mr_set_free(set);
+    rnd_set_fini(&rs);
+    free(text);
+}
+#endif
+
+int
+main ()
+{
+    test_duplicates();
+    test_compaction();
+    test_filter();
+    test_cursor();
+    test_image_roundtrip();
+    test_image_corrupt();
+#ifdef STR_MR_WITH_POSIX
+    test_image_map();
+#endif
+
+    return test_result();
+}
@@ -0,0 +1,146 @@
+/**
+ * @file      test_static.cpp
+ * @brief     Tests of compile-time match pairs sets.
+ * @author    MMaster <mmaster@bitbix.com>
+ * @version   0.1
+ * @date      2013
+ * @copyright Apache License v2
+ *
+ * Results and counts of str_mr::static_set are compared against
+ * str_multireplace64() of the same pairs. Random sets of short "ab" keys
+ * are full of duplicates and keys that are prefixes of other keys, the
+ * cases where leftmost-longest and first-duplicate-wins matter.
+ *
+ * Compile with:
+ *    $ gcc -c str_multireplace.c
+ *    $ g++ -std=c++20 -o test_static test_static.cpp str_multireplace.o
+ *
+ * Run with:
+ *    $ ./test_static
+ */
+#include <cstdlib>
+#include <iterator>
+#include <string>
+#include <vector>
+#include "str_multireplace.h"
+#include "test_util.h"
+#include "str_mr_static.hpp"
+#include "str_multireplace.hpp"
+
+#define PAIR_CNT    (6)
+#define KEY_MAX     (4)
+
+static constexpr str_mr::static_pair fixed_pairs[] = {
+    {"ab", "1"}, {"abab", "2"}, {"ab", "3"}, {"b", ""}, {"bba", "4"},
+};
+
+static constexpr auto fixed_set = str_mr::make_static_set<fixed_pairs>();
+
+/* usable in constant expressions, duplicate "ab" takes no node */
+static_assert(fixed_set.node_cnt() == 1 + 4 + 3);
+static_assert(fixed_set.count("ababab bbab") == 4);
+
+/**
+ * @brief Result of str_multireplace64() (empty input stays empty)
+ */
+static std::string
+expected (const std::string &str, const std::vector<str_mr_match_pair> &mps,
+          int64_t *cnt)
+{
+    char   *result = nullptr;
+    size_t  result_len = 0;
+
+    *cnt = 0;
+    if (str.empty()) {
+        return str;
+    }
+
+    *cnt = str_multireplace64(str.data(), str.size(), mps.data(), mps.size(),
+                              &result, &result_len, false);
+    CHECK(*cnt >= 0);
+
+    std::string out(result, result_len);
+
+    std::free(result);
+    return out;
+}
+
+/**
+ * @brief Compare all results of set with str_multireplace64()
+ */
+template <size_t P, size_t N>
+static void
+check_static (const str_mr::static_set<P, N> &set,
+              const str_mr::static_pair (&pairs)[P], const std::string &str)
+{
+    std::vector<str_mr_match_pair> mps;
+    std::string out, it_out, joined;
+    int64_t     cnt = 0;
+    size_t      piece_cnt = 0;
+
+    for (const auto &p : pairs) {
+        mps.push_back(str_mr::make_pair(p.key, p.value));
+    }
+
+    std::string exp = expected(str, mps, &cnt);
+
+    CHECK(set.replace(str, out) == (size_t)cnt);
+    CHECK(out == exp);
+    set.replace(str, std::back_inserter(it_out));
+    CHECK(it_out == exp);
+    CHECK(set.count(str) == (size_t)cnt);
+
+    set.for_each_piece(str, [&] (std::string_view piece) {
+        CHECK(!piece.empty());
+        joined.append(piece);
+        piece_cnt++;
+    });
+
+    CHECK((joined == exp) && (piece_cnt <= 2 * (size_t)cnt + 1));
+}
+
+static void
+test_fixed (void)
+{
+    std::string out;
+
+    /* longest key wins, the first of duplicates gives the value */
+    CHECK(fixed_set.replace("ababab bbab", out) == 4);
+    CHECK(out == "21 4");
+
+    check_static(fixed_set, fixed_pairs, "");
+    check_static(fixed_set, fixed_pairs, "bbbababbaabab");
+}
+
+static void
+test_random (void)
+{
+    /* every key gets its own nodes at most */
+    using set_t = str_mr::static_set<PAIR_CNT, 1 + PAIR_CNT * KEY_MAX>;
+
+    for (int round = 0; round < 2000; round++) {
+        std::string keys[PAIR_CNT], values[PAIR_CNT];
+        str_mr::static_pair pairs[PAIR_CNT];
+        std::string str(rnd() % 300, '\0');
+
+        for (size_t i = 0; i < PAIR_CNT; i++) {
+            keys[i].resize(1 + rnd() % KEY_MAX);
+            values[i].resize(rnd() % 4);
+            rnd_fill(keys[i].data(), keys[i].size(), "ab");
+            rnd_fill(values[i].data(), values[i].size(), "XYZ");
+            pairs[i] = {keys[i], values[i]};
+        }
+
+        rnd_fill(str.data(), str.size(), "abc");
+        check_static(set_t(pairs), pairs, str);
+    }
+}
+
+int
+main ()
+{
+    test_fixed();
+    test_random();
+
+    return test_result();
+}
@@ -0,0 +1,372 @@
+/**
+ * @file      test_stream.c
+ * @brief     Tests of streaming and pipelined replacement.
+ * @author    MMaster <mmaster@bitbix.com>
+ * @version   0.1
+ * @date      2013
+ * @copyright Apache License v2
+ *
+ * Feeds input in chunks of random sizes (down to single bytes, so matches
+ * of the longest keys straddle many chunks) into str_mr_stream_feed() and
+ * through str_mr_pipe() over pipes and compares the result with
+ * str_multireplace64() of the whole input. str_mr_set_replace_sink() of the
+ * whole input has to give the same.
+ *
+ * Compile with:
+ *    $ gcc -pthread -o test_stream test_stream.c str_mr_pipe.c \
+ *          str_multireplace.c
+ *
+ * Run with:
+ *    $ ./test_stream
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "str_multireplace.h"
+#include "test_util.h"
+#include "str_mr_pipe.h"
+
+/**
+ * Longest key of random sets
+ */
+#define KEY_MAX         (32)
+
+/**
+ * Number of pairs in random sets
+ */
+#define PAIR_CNT        (24)
+
+/**
+ * @brief Growable output buffer
+ */
+typedef struct {
+    char *data;
+    size_t len;
+    size_t alloc_len;
+} out_buf;
+
+/**
+ * @brief Append to output buffer (sink of stream)
+ */
+static int
+out_sink (void *ctx, const char *ptr, size_t len)
+{
+    out_buf *out = (out_buf *)ctx;
+
+    if (out->len + len > out->alloc_len) {
+        out->alloc_len = 2 * (out->len + len);
+        out->data = (char *)realloc(out->data, out->alloc_len);
+        if (out->data == NULL) {
+            return 1;
+        }
+    }
+
+    memcpy(out->data + out->len, ptr, len);
+    out->len += len;
+    return 0;
+}
+
+/**
+ * @brief Sink failing after limit bytes
+ */
+static int
+failing_sink (void *ctx, const char *ptr, size_t len)
+{
+    size_t *limit = (size_t *)ctx;
+
+    (void)ptr;
+    if (len > *limit) {
+        return 1;
+    }
+
+    *limit -= len;
+    return 0;
+}
+
+/**
+ * @brief Random set: short keys, keys of KEY_MAX length sharing prefixes
+ *        with short ones and keys repeated in the input
+ */
+static void
+rnd_pairs (str_mr_match_pair *mps, char keys[][KEY_MAX], char values[][8])
+{
+    size_t i = 0;
+
+    for (i = 0; i < PAIR_CNT; i++) {
+        mps[i].key          = keys[i];
+        mps[i].key_length   = ((i % 4) == 0 ? KEY_MAX : 1 + rnd() % 6);
+        mps[i].value        = values[i];
+        mps[i].value_length = rnd() % 8;
+        rnd_fill(keys[i], mps[i].key_length, "ab");
+        rnd_fill(values[i], mps[i].value_length, "XYZ");
+    }
+}
+
+/**
+ * @brief Random input made of keys of mps and random characters
+ */
+static char *
+rnd_input (const str_mr_match_pair *mps, size_t len)
+{
+    char  *str = (char *)malloc(len);
+    size_t pos = 0, n = 0;
+
+    while (pos < len) {
+        const str_mr_match_pair *mp = &mps[rnd() % PAIR_CNT];
+
+        if (rnd() % 2) {
+            n = (mp->key_length < len - pos ? mp->key_length : len - pos);
+            memcpy(str + pos, mp->key, n);
+        } else {
+            n = 1;
+            rnd_fill(str + pos, n, "abc");
+        }
+
+        pos += n;
+    }
+
+    return str;
+}
+
+/**
+ * @brief Feed str in chunks of random size up to max_chunk (several inputs
+ *        into one stream, each compared with str_multireplace64())
+ */
+static void
+check_stream (const str_mr_set *set, const str_mr_match_pair *mps,
+              const char *str, size_t len, size_t max_chunk)
+{
+    str_mr_stream *stream = NULL;
+    out_buf out = { NULL, 0, 0 };
+    char   *result = NULL;
+    size_t  result_len = 0, pos = 0, n = 0;
+    int64_t cnt = 0, stream_cnt = 0;
+    int     input = 0;
+
+    cnt = str_multireplace64(str, len, mps, PAIR_CNT, &result, &result_len,
+                             false);
+    CHECK(cnt >= 0);
+
+    CHECK(str_mr_stream_init(set, out_sink, &out, &stream) ==
+          STR_MR_ERROR_SUCCESS);
+
+    /* stream is reused after finish, previous input must not leak in */
+    for (input = 0; input < 2; input++) {
+        out.len = 0;
+        for (pos = 0; pos < len; pos += n) {
+            n = 1 + rnd() % max_chunk;
+            n = (n < len - pos ? n : len - pos);
+            CHECK(str_mr_stream_feed(stream, str + pos, n) >= 0);
+
+            /* empty chunks change nothing */
+            if (rnd() % 8 == 0) {
+                CHECK(str_mr_stream_feed(stream, str + pos, 0) >= 0);
+            }
+        }
+
+        stream_cnt = str_mr_stream_finish(stream);
+        CHECK(stream_cnt == cnt);
+        CHECK((out.len == result_len) &&
+              (memcmp(out.data, result, result_len) == 0));
+    }
+
+    str_mr_stream_free(stream);
+
+    /* the whole input at once, without stream */
+    out.len = 0;
+    CHECK(str_mr_set_replace_sink(set, str, len, out_sink, &out) == cnt);
+    CHECK((out.len == result_len) &&
+          (memcmp(out.data, result, result_len) == 0));
+
+    free(out.data);
+    free(result);
+}
+
+static void
+test_stream (void)
+{
+    str_mr_match_pair mps[PAIR_CNT];
+    char   keys[PAIR_CNT][KEY_MAX], values[PAIR_CNT][8];
+    str_mr_set *set = NULL;
+    char  *str = NULL;
+    size_t len = 0;
+    int    round = 0;
+
+    for (round = 0; round < 40; round++) {
+        rnd_pairs(mps, keys, values);
+        CHECK(str_mr_set_compile(mps, PAIR_CNT, &set) ==
+              STR_MR_ERROR_SUCCESS);
+
+        len = 1 + rnd() % 4096;
+        str = rnd_input(mps, len);
+
+        check_stream(set, mps, str, len, 1);
+        check_stream(set, mps, str, len, 3);
+        check_stream(set, mps, str, len, KEY_MAX - 1);
+        check_stream(set, mps, str, len, 2 * KEY_MAX + 1);
+        check_stream(set, mps, str, len, 4096);
+
+        free(str);
+        str_mr_set_free(set);
+    }
+}
+
+static void
+test_stream_errors (void)
+{
+    str_mr_match_pair mps[] = {
+        {"key", 3, "value", 5}, {"nokey", 5, NULL, 0},
+    };
+    str_mr_stream *stream = NULL;
+    str_mr_set *set = NULL;
+    size_t limit = 4;
+
+    /* pairs without value cannot be streamed */
+    CHECK(str_mr_set_compile(mps, 2, &set) == STR_MR_ERROR_SUCCESS);
+    CHECK(str_mr_stream_init(set, failing_sink, &limit, &stream) ==
+          STR_MR_ERROR_INVALID_MATCH);
+    CHECK(str_mr_set_replace_sink(set, "key", 3, failing_sink, &limit) ==
+          STR_MR_ERROR_INVALID_MATCH);
+    str_mr_set_free(set);
+
+    /* sink failure is sticky */
+    CHECK(str_mr_set_compile(mps, 1, &set) == STR_MR_ERROR_SUCCESS);
+    CHECK(str_mr_stream_init(set, failing_sink, &limit, &stream) ==
+          STR_MR_ERROR_SUCCESS);
+    CHECK(str_mr_stream_feed(stream, "key key key key ", 16) ==
+          STR_MR_ERROR_SINK);
+    CHECK(str_mr_stream_feed(stream, "key", 3) == STR_MR_ERROR_SINK);
+    CHECK(str_mr_stream_finish(stream) == STR_MR_ERROR_SINK);
+    str_mr_stream_free(stream);
+
+    limit = 4;
+    CHECK(str_mr_set_replace_sink(set, "key key ", 8, failing_sink,
+                                  &limit) == STR_MR_ERROR_SINK);
+    CHECK(str_mr_set_replace_sink(set, NULL, 0, failing_sink, &limit) == 0);
+    CHECK(str_mr_set_replace_sink(set, "key", 3, NULL, NULL) ==
+          STR_MR_ERROR_INVALID_ARG);
+    str_mr_set_free(set);
+}
+
+/**
+ * @brief Input writer of pipe test
+ */
+typedef struct {
+    int fd;
+    const char *str;
+    size_t len;
+} pipe_writer;
+
+/**
+ * @brief Write input into pipe in small writes, then close it
+ */
+static void *
+pipe_writer_thread (void *arg)
+{
+    pipe_writer *pw = (pipe_writer *)arg;
+    size_t pos = 0, n = 0;
+    ssize_t w = 0;
+
+    for (pos = 0; pos < pw->len; pos += w) {
+        n = 1 + (pos * 7919) % 97;
+        n = (n < pw->len - pos ? n : pw->len - pos);
+        w = write(pw->fd, pw->str + pos, n);
+        if (w <= 0) {
+            break;
+        }
+    }
+
+    close(pw->fd);
+    return NULL;
+}
+
+/**
+ * @brief Output reader of pipe test
+ */
+typedef struct {
+    int fd;
+    out_buf out;
+} pipe_reader;
+
+/**
+ * @brief Read pipe until end of file
+ */
+static void *
+pipe_reader_thread (void *arg)
+{
+    pipe_reader *pr = (pipe_reader *)arg;
+    char    buf[509];
+    ssize_t r = 0;
+
+    while ((r = read(pr->fd, buf, sizeof(buf))) > 0) {
+        out_sink(&pr->out, buf, r);
+    }
+
+    return NULL;
+}
+
+static void
+test_pipe (void)
+{
+    str_mr_match_pair mps[PAIR_CNT];
+    char   keys[PAIR_CNT][KEY_MAX], values[PAIR_CNT][8];
+    str_mr_set *set = NULL;
+    pipe_writer pw;
+    pipe_reader pr;
+    pthread_t   writer, reader;
+    int     in_fds[2], out_fds[2];
+    char   *str = NULL, *result = NULL;
+    size_t  len = 200000, result_len = 0;
+    size_t  buf_sizes[] = { 1, 7, KEY_MAX, 4096, 0 };
+    size_t  i = 0;
+    int64_t cnt = 0;
+
+    rnd_pairs(mps, keys, values);
+    CHECK(str_mr_set_compile(mps, PAIR_CNT, &set) == STR_MR_ERROR_SUCCESS);
+    str = rnd_input(mps, len);
+    cnt = str_multireplace64(str, len, mps, PAIR_CNT, &result, &result_len,
+                             false);
+
+    for (i = 0; i < sizeof(buf_sizes) / sizeof(buf_sizes[0]); i++) {
+        if ((pipe(in_fds) != 0) || (pipe(out_fds) != 0)) {
+            CHECK(!"pipe() failed");
+            break;
+        }
+
+        memset(&pr, 0, sizeof(pr));
+        pw.fd  = in_fds[1];
+        pw.str = str;
+        pw.len = len;
+        pr.fd  = out_fds[0];
+        pthread_create(&writer, NULL, pipe_writer_thread, &pw);
+        pthread_create(&reader, NULL, pipe_reader_thread, &pr);
+
+        CHECK(str_mr_pipe(set, in_fds[0], out_fds[1], buf_sizes[i]) == cnt);
+
+        close(in_fds[0]);
+        close(out_fds[1]);
+        pthread_join(writer, NULL);
+        pthread_join(reader, NULL);
+        close(out_fds[0]);
+
+        CHECK((pr.out.len == result_len) &&
+              (memcmp(pr.out.data, result, result_len) == 0));
+        free(pr.out.data);
+    }
+
+    free(result);
+    free(str);
+    str_mr_set_free(set);
+}
+
+int
+main ()
+{
+    test_stream();
+    test_stream_errors();
+    test_pipe();
+
+    return test_result();
+}
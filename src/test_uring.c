@@ -0,0 +1,265 @@
+/**
+ * @file      test_uring.c
+ * @brief     Tests of asynchronous file to file replacement.
+ * @author    MMaster <mmaster@bitbix.com>
+ * @version   0.1
+ * @date      2013
+ * @copyright Apache License v2
+ *
+ * Replaces temporary files by str_mr_uring_file() with various buffer sizes
+ * and depths and compares them with str_multireplace64(). Input and output
+ * start at current offsets of the descriptors, content before them has to
+ * stay and output in append mode has to be refused untouched.
+ *
+ * Compile with:
+ *    $ gcc -o test_uring test_uring.c str_mr_uring.c str_multireplace.c
+ *    $ gcc -DSTR_MR_WITH_IO_URING -o test_uring test_uring.c \
+ *          str_mr_uring.c str_multireplace.c
+ *
+ * Run with:
+ *    $ ./test_uring
+ */
+
+/* mkstemp() also with strict -std=c11 */
+#if !defined(_POSIX_C_SOURCE) && !defined(_GNU_SOURCE)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "str_multireplace.h"
+#include "test_util.h"
+#include "str_mr_uring.h"
+
+/**
+ * Number of pairs in random sets
+ */
+#define PAIR_CNT        (16)
+
+/**
+ * Length of random input
+ */
+#define INPUT_LEN       (100000)
+
+/**
+ * Content of output file before replacement
+ */
+#define EXISTING        "EXISTING LINE\n"
+
+/**
+ * Temporary input and output files
+ */
+static char in_path[]  = "/tmp/test_uring_in_XXXXXX";
+static char out_path[] = "/tmp/test_uring_out_XXXXXX";
+
+/**
+ * @brief Replace file content
+ */
+static void
+write_file (const char *path, const char *data, size_t len)
+{
+    FILE *f = fopen(path, "wb");
+
+    CHECK(f != NULL);
+    if (f != NULL) {
+        CHECK(fwrite(data, 1, len, f) == len);
+        fclose(f);
+    }
+}
+
+/**
+ * @brief Compare file content with expected data
+ */
+static void
+check_file (const char *path, const char *expected, size_t expected_len)
+{
+    FILE  *f = fopen(path, "rb");
+    char  *data = (char *)malloc(expected_len + 1);
+    size_t len = 0;
+
+    CHECK(f != NULL);
+    if (f != NULL) {
+        len = fread(data, 1, expected_len + 1, f);
+        CHECK((len == expected_len) &&
+              (memcmp(data, expected, expected_len) == 0));
+        fclose(f);
+    }
+
+    free(data);
+}
+
+/**
+ * @brief Random set with keys made of few characters, so input is full of
+ *        matches
+ */
+static void
+rnd_pairs (str_mr_match_pair *mps, char keys[][8], char values[][8])
+{
+    size_t i = 0;
+
+    for (i = 0; i < PAIR_CNT; i++) {
+        mps[i].key          = keys[i];
+        mps[i].key_length   = 1 + rnd() % 8;
+        mps[i].value        = values[i];
+        mps[i].value_length = rnd() % 8;
+        rnd_fill(keys[i], mps[i].key_length, "ab");
+        rnd_fill(values[i], mps[i].value_length, "XYZ");
+    }
+}
+
+/**
+ * @brief Replace input from in_skip into output from out_skip (keeping what
+ *        is before) and compare with expected
+ */
+static void
+check_uring (const str_mr_set *set, const char *str, size_t len,
+             const char *result, size_t result_len, int64_t cnt,
+             size_t in_skip, size_t out_skip, size_t buf_size,
+             unsigned depth)
+{
+    char  *expected = (char *)malloc(out_skip + result_len + 100);
+    int    in_fd = -1, out_fd = -1;
+    size_t i = 0;
+
+    write_file(in_path, str, len);
+
+    /* output is longer than the result, the rest is cut off */
+    for (i = 0; i < out_skip; i++) {
+        expected[i] = EXISTING[i % (sizeof(EXISTING) - 1)];
+    }
+
+    memset(expected + out_skip, 'T', result_len + 100);
+    write_file(out_path, expected, out_skip + result_len + 100);
+    memcpy(expected + out_skip, result, result_len);
+
+    in_fd  = open(in_path, O_RDONLY);
+    out_fd = open(out_path, O_WRONLY);
+    CHECK((in_fd >= 0) && (out_fd >= 0));
+    CHECK(lseek(in_fd, in_skip, SEEK_SET) == (off_t)in_skip);
+    CHECK(lseek(out_fd, out_skip, SEEK_SET) == (off_t)out_skip);
+
+    CHECK(str_mr_uring_file(set, in_fd, out_fd, buf_size, depth) == cnt);
+
+    /* offsets are left at the ends */
+    CHECK(lseek(in_fd, 0, SEEK_CUR) == (off_t)len);
+    CHECK(lseek(out_fd, 0, SEEK_CUR) == (off_t)(out_skip + result_len));
+    close(in_fd);
+    close(out_fd);
+
+    check_file(out_path, expected, out_skip + result_len);
+    free(expected);
+}
+
+static void
+test_uring (void)
+{
+    str_mr_match_pair mps[PAIR_CNT];
+    char   keys[PAIR_CNT][8], values[PAIR_CNT][8];
+    str_mr_set *set = NULL;
+    char  *str = (char *)malloc(INPUT_LEN);
+    char  *result = NULL;
+    size_t result_len = 0, buf_sizes[] = { 7, 4096, 0 };
+    size_t i = 0, skip = 0;
+    unsigned depths[] = { 1, 3, 0 }, d = 0;
+    int64_t cnt = 0;
+
+    rnd_pairs(mps, keys, values);
+    rnd_fill(str, INPUT_LEN, "abc");
+    CHECK(str_mr_set_compile(mps, PAIR_CNT, &set) == STR_MR_ERROR_SUCCESS);
+
+    cnt = str_multireplace64(str, INPUT_LEN, mps, PAIR_CNT, &result,
+                             &result_len, false);
+    for (i = 0; i < sizeof(buf_sizes) / sizeof(buf_sizes[0]); i++) {
+        for (d = 0; d < sizeof(depths) / sizeof(depths[0]); d++) {
+            check_uring(set, str, INPUT_LEN, result, result_len, cnt, 0, 0,
+                        buf_sizes[i], depths[d]);
+        }
+    }
+
+    free(result);
+
+    /* input from its offset into output after existing content (single
+     * byte buffers are slow, so the input is short) */
+    for (skip = 0; skip < 40; skip += 13) {
+        cnt = str_multireplace64(str + skip, 3000 - skip, mps, PAIR_CNT,
+                                 &result, &result_len, false);
+        check_uring(set, str, 3000, result, result_len, cnt, skip,
+                    sizeof(EXISTING) - 1, 1, 2);
+        check_uring(set, str, 3000, result, result_len, cnt, skip, skip + 1,
+                    64, 0);
+        free(result);
+    }
+
+    /* empty input (or nothing after its offset) */
+    check_uring(set, str, 0, "", 0, 0, 0, 5, 0, 0);
+    check_uring(set, str, 10, "", 0, 0, 10, 5, 0, 0);
+
+    str_mr_set_free(set);
+    free(str);
+}
+
+static void
+test_uring_append (void)
+{
+    str_mr_match_pair mps[] = {
+        {"small", 5, "big", 3},
+    };
+    str_mr_set *set = NULL;
+    int in_fd = -1, out_fd = -1;
+
+    write_file(in_path, "small input\n", 12);
+    write_file(out_path, EXISTING, sizeof(EXISTING) - 1);
+    CHECK(str_mr_set_compile(mps, 1, &set) == STR_MR_ERROR_SUCCESS);
+
+    /* writes at offsets are ignored in append mode, output stays intact */
+    in_fd  = open(in_path, O_RDONLY);
+    out_fd = open(out_path, O_WRONLY | O_APPEND);
+    CHECK((in_fd >= 0) && (out_fd >= 0));
+    CHECK(str_mr_uring_file(set, in_fd, out_fd, 0, 0) ==
+          STR_MR_ERROR_INVALID_ARG);
+    close(out_fd);
+    check_file(out_path, EXISTING, sizeof(EXISTING) - 1);
+
+    /* the same output appended to at its end */
+    out_fd = open(out_path, O_WRONLY);
+    CHECK(out_fd >= 0);
+    CHECK(lseek(out_fd, 0, SEEK_END) == sizeof(EXISTING) - 1);
+    CHECK(str_mr_uring_file(set, in_fd, out_fd, 0, 0) == 1);
+    close(out_fd);
+    check_file(out_path, EXISTING "big input\n",
+               sizeof(EXISTING) - 1 + 10);
+
+    CHECK(str_mr_uring_file(NULL, in_fd, 1, 0, 0) ==
+          STR_MR_ERROR_INVALID_ARG);
+    CHECK(str_mr_uring_file(set, -1, 1, 0, 0) == STR_MR_ERROR_INVALID_ARG);
+    close(in_fd);
+    str_mr_set_free(set);
+}
+
+int
+main ()
+{
+    int in_fd  = mkstemp(in_path);
+    int out_fd = mkstemp(out_path);
+
+    if ((in_fd < 0) || (out_fd < 0)) {
+        perror("mkstemp");
+        return 1;
+    }
+
+    close(in_fd);
+    close(out_fd);
+
+    printf("io_uring %s\n", (str_mr_uring_available() ? "used" :
+                             "not available, pread()/pwrite() used"));
+    test_uring();
+    test_uring_append();
+
+    unlink(in_path);
+    unlink(out_path);
+
+    return test_result();
+}
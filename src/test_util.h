@@ -0,0 +1,87 @@
+/**
+ * @file      test_util.h
+ * @brief     Checks and pseudo random data shared by tests.
+ * @author    MMaster <mmaster@bitbix.com>
+ * @version   0.1
+ * @date      2013
+ * @copyright Apache License v2
+ *
+ * Included once by every test program (C and C++), so everything in here is
+ * static. Failed checks are counted atomically, checks can fail in threads.
+ */
+
+#ifndef __TEST_UTIL_H__
+#define __TEST_UTIL_H__
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef __cplusplus
+#include <atomic>
+#else
+#include <stdatomic.h>
+#endif
+
+/**
+ * Number of failed checks
+ */
+#ifdef __cplusplus
+static std::atomic<int> failures(0);
+#else
+static _Atomic int failures = 0;
+#endif
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, \
+                    __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+/**
+ * @brief Pseudo random number generator (same sequence everywhere)
+ */
+static inline unsigned
+rnd (void)
+{
+    static unsigned seed = 1;
+
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 16) & 0x7FFF;
+}
+
+/**
+ * @brief Fill buf with len random characters of alphabet
+ */
+static inline void
+rnd_fill (char *buf, size_t len, const char *alphabet)
+{
+    size_t i = 0, cnt = strlen(alphabet);
+
+    for (i = 0; i < len; i++) {
+        buf[i] = alphabet[rnd() % cnt];
+    }
+}
+
+/**
+ * @brief Report result of all checks
+ *
+ * @return exit status of test program
+ */
+static inline int
+test_result (void)
+{
+    int cnt = failures;
+
+    if (cnt > 0) {
+        printf("%d checks failed\n", cnt);
+        return 1;
+    }
+
+    printf("all tests passed\n");
+    return 0;
+}
+
+#endif